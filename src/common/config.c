@@ -1,5 +1,7 @@
 #include "common/config.h"
 
+#include "common/histogram.h"
+
 #ifndef __KERNEL__
 #include <errno.h>
 #endif
@@ -69,6 +71,41 @@ struct nla_policy joolnl_bib_entry_policy[JNLAB_COUNT] = {
 	[JNLAB_STATIC] = { .type = NLA_U8 },
 };
 
+struct nla_policy joolnl_histogram_entry_policy[JNLAH_COUNT] = {
+	[JNLAH_STAGE] = { .type = NLA_U8 },
+	[JNLAH_L3_PROTO] = { .type = NLA_U8 },
+	[JNLAH_L4_PROTO] = { .type = NLA_U8 },
+#ifdef __KERNEL__
+	[JNLAH_BUCKETS] = {
+		.type = NLA_BINARY,
+		.len = JHIST_BUCKETS * sizeof(__u64),
+	},
+#else
+	[JNLAH_BUCKETS] = {
+		.type = NLA_UNSPEC,
+		.minlen = JHIST_BUCKETS * sizeof(__u64),
+		.maxlen = JHIST_BUCKETS * sizeof(__u64),
+	},
+#endif
+};
+
+struct nla_policy joolnl_lock_stats_entry_policy[JNLALS_COUNT] = {
+	[JNLALS_LOCK] = { .type = NLA_U8 },
+	[JNLALS_SITE] = { .type = NLA_U8 },
+	[JNLALS_ACQUISITIONS] = { .type = NLA_U64 },
+	[JNLALS_CONTENDED] = { .type = NLA_U64 },
+	[JNLALS_HOLD_TOTAL] = { .type = NLA_U64 },
+	[JNLALS_HOLD_MAX] = { .type = NLA_U64 },
+};
+
+struct nla_policy joolnl_joold_transport_policy[JNLAJT_COUNT] = {
+	[JNLAJT_ADDR6] = JOOLNL_ADDR6_POLICY,
+	[JNLAJT_ADDR4] = JOOLNL_ADDR4_POLICY,
+	[JNLAJT_PORT] = { .type = NLA_U16 },
+	[JNLAJT_IFINDEX] = { .type = NLA_U32 },
+	[JNLAJT_TTL] = { .type = NLA_U8 },
+};
+
 struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT] = {
 	[JNLASE_SRC6] = { .type = NLA_NESTED },
 	[JNLASE_DST6] = { .type = NLA_NESTED },
@@ -89,6 +126,14 @@ struct nla_policy siit_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_RESET_TOS] = { .type = NLA_U8 },
 	[JNLAG_TOS] = { .type = NLA_U8 },
 	[JNLAG_PLATEAUS] = { .type = NLA_NESTED },
+	[JNLAG_XLAT_IN_PLACE] = { .type = NLA_U8 },
+	[JNLAG_DEBUG_PREFIX6] = { .type = NLA_NESTED },
+	[JNLAG_DEBUG_PREFIX4] = { .type = NLA_NESTED },
+	[JNLAG_DEBUG_PROTO] = { .type = NLA_U8 },
+	[JNLAG_DEBUG_PORT] = { .type = NLA_U32 },
+	[JNLAG_DEBUG_MARK] = { .type = NLA_U32 },
+	[JNLAG_DEBUG_RATE] = { .type = NLA_U32 },
+	[JNLAG_LATENCY_HISTOGRAMS] = { .type = NLA_U8 },
 	[JNLAG_COMPUTE_CSUM_ZERO] = { .type = NLA_U8 },
 	[JNLAG_HAIRPIN_MODE] = { .type = NLA_U8 },
 	[JNLAG_RANDOMIZE_ERROR_ADDR] = { .type = NLA_U8 },
@@ -105,6 +150,14 @@ struct nla_policy nat64_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_RESET_TOS] = { .type = NLA_U8 },
 	[JNLAG_TOS] = { .type = NLA_U8 },
 	[JNLAG_PLATEAUS] = { .type = NLA_NESTED },
+	[JNLAG_XLAT_IN_PLACE] = { .type = NLA_U8 },
+	[JNLAG_DEBUG_PREFIX6] = { .type = NLA_NESTED },
+	[JNLAG_DEBUG_PREFIX4] = { .type = NLA_NESTED },
+	[JNLAG_DEBUG_PROTO] = { .type = NLA_U8 },
+	[JNLAG_DEBUG_PORT] = { .type = NLA_U32 },
+	[JNLAG_DEBUG_MARK] = { .type = NLA_U32 },
+	[JNLAG_DEBUG_RATE] = { .type = NLA_U32 },
+	[JNLAG_LATENCY_HISTOGRAMS] = { .type = NLA_U8 },
 	[JNLAG_DROP_ICMP6_INFO] = { .type = NLA_U8 },
 	[JNLAG_SRC_ICMP6_BETTER] = { .type = NLA_U8 },
 	[JNLAG_F_ARGS] = { .type = NLA_U8 },
@@ -118,12 +171,24 @@ struct nla_policy nat64_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_DROP_BY_ADDR] = { .type = NLA_U8 },
 	[JNLAG_DROP_EXTERNAL_TCP] = { .type = NLA_U8 },
 	[JNLAG_MAX_STORED_PKTS] = { .type = NLA_U32 },
+	[JNLAG_LOCK_STATS] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_ENABLED] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_ASAP] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_DEADLINE] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_CAPACITY] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_MAX_PAYLOAD] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_MAX_SESSIONS_PER_PACKET] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_WINDOW] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_COMPACT] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_LZ4] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_MIN_READVERTISE_INTERVAL] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_MIN_AGE] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_MIN_PACKETS] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_TCP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_UDP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_ICMP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_INCLUDE_PORTS] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_EXCLUDE_PORTS] = { .type = NLA_U32 },
 };
 
 int iname_validate(const char *iname, bool allow_null)
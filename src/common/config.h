@@ -61,6 +61,11 @@ enum joolnl_operation {
 	JNLOP_JOOLD_ADD,
 	JNLOP_JOOLD_ADVERTISE,
 	JNLOP_JOOLD_ACK,
+
+	JNLOP_STATS_HISTOGRAM,
+	JNLOP_STATS_LOCKS,
+
+	JNLOP_JOOLD_TRANSPORT,
 };
 
 enum joolnl_attr_root {
@@ -77,6 +82,8 @@ enum joolnl_attr_root {
 	JNLAR_PROTO,
 	JNLAR_ATOMIC_INIT,
 	JNLAR_ATOMIC_END,
+	JNLAR_JOOLD_SEQ,
+	JNLAR_JOOLD_TRANSPORT,
 	JNLAR_COUNT,
 #define JNLAR_MAX (JNLAR_COUNT - 1)
 };
@@ -90,6 +97,21 @@ enum joolnl_attr_list {
 extern struct nla_policy joolnl_struct_list_policy[JNLAL_COUNT];
 extern struct nla_policy joolnl_plateau_list_policy[JNLAL_COUNT];
 
+/* Contents of a joold packet (JNLAR_SESSION_ENTRIES). */
+enum joolnl_attr_joold {
+	/* One session; legacy format */
+	JNLAJ_SESSION = JNLAL_ENTRY,
+	/* Several sessions; compact format (see common/joold_compact.h) */
+	JNLAJ_BATCH,
+	/*
+	 * In-kernel transport control (see mod/common/joold_udp.c).
+	 * The instances skip them.
+	 */
+	JNLAJ_SEQ,
+	JNLAJ_NACK,
+	JNLAJ_RESYNC,
+};
+
 #ifdef __KERNEL__
 #define JOOLNL_ADDR6_POLICY { \
 	.type = NLA_BINARY, \
@@ -189,6 +211,46 @@ enum joolnl_attr_bib {
 
 extern struct nla_policy joolnl_bib_entry_policy[JNLAB_COUNT];
 
+enum joolnl_attr_histogram {
+	JNLAH_STAGE = 1,
+	JNLAH_L3_PROTO,
+	JNLAH_L4_PROTO,
+	/* Array of JHIST_BUCKETS __u64s. */
+	JNLAH_BUCKETS,
+	JNLAH_COUNT,
+#define JNLAH_MAX (JNLAH_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_histogram_entry_policy[JNLAH_COUNT];
+
+enum joolnl_attr_lock_stats {
+	JNLALS_LOCK = 1,
+	JNLALS_SITE,
+	JNLALS_ACQUISITIONS,
+	JNLALS_CONTENDED,
+	/* Nanoseconds */
+	JNLALS_HOLD_TOTAL,
+	JNLALS_HOLD_MAX,
+	JNLALS_PAD,
+	JNLALS_COUNT,
+#define JNLALS_MAX (JNLALS_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_lock_stats_entry_policy[JNLALS_COUNT];
+
+/* In-kernel joold transport. Either ADDR6 or ADDR4 is required. */
+enum joolnl_attr_joold_transport {
+	JNLAJT_ADDR6 = 1,
+	JNLAJT_ADDR4,
+	JNLAJT_PORT,
+	JNLAJT_IFINDEX,
+	JNLAJT_TTL,
+	JNLAJT_COUNT,
+#define JNLAJT_MAX (JNLAJT_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_joold_transport_policy[JNLAJT_COUNT];
+
 /* TODO (fine) Most of these fields are obsolete; rm them in a minor release. */
 enum joolnl_attr_session {
 	JNLASE_SRC6 = 1,
@@ -224,6 +286,14 @@ enum joolnl_attr_global {
 	JNLAG_RESET_TOS,
 	JNLAG_TOS,
 	JNLAG_PLATEAUS,
+	JNLAG_XLAT_IN_PLACE,
+	JNLAG_DEBUG_PREFIX6,
+	JNLAG_DEBUG_PREFIX4,
+	JNLAG_DEBUG_PROTO,
+	JNLAG_DEBUG_PORT,
+	JNLAG_DEBUG_MARK,
+	JNLAG_DEBUG_RATE,
+	JNLAG_LATENCY_HISTOGRAMS,
 
 	/* SIIT */
 	JNLAG_COMPUTE_CSUM_ZERO,
@@ -246,6 +316,7 @@ enum joolnl_attr_global {
 	JNLAG_BIB_LOGGING,
 	JNLAG_SESSION_LOGGING,
 	JNLAG_MAX_STORED_PKTS,
+	JNLAG_LOCK_STATS,
 
 	/* joold */
 	JNLAG_JOOLD_ENABLED,
@@ -254,6 +325,17 @@ enum joolnl_attr_global {
 	JNLAG_JOOLD_CAPACITY,
 	JNLAG_JOOLD_MAX_PAYLOAD,
 	JNLAG_JOOLD_MAX_SESSIONS_PER_PACKET,
+	JNLAG_JOOLD_WINDOW,
+	JNLAG_JOOLD_COMPACT,
+	JNLAG_JOOLD_LZ4,
+	JNLAG_JOOLD_MIN_READVERTISE_INTERVAL,
+	JNLAG_JOOLD_MIN_AGE,
+	JNLAG_JOOLD_MIN_PACKETS,
+	JNLAG_JOOLD_TCP,
+	JNLAG_JOOLD_UDP,
+	JNLAG_JOOLD_ICMP,
+	JNLAG_JOOLD_INCLUDE_PORTS,
+	JNLAG_JOOLD_EXCLUDE_PORTS,
 
 	/* Needs to be last */
 	JNLAG_COUNT,
@@ -325,6 +407,26 @@ struct config_prefix4 {
 	struct ipv4_prefix prefix;
 };
 
+/**
+ * If jool_globals.debug is enabled, only the packets that match all of these
+ * are debugged. Unset prefixes and zeroes match everything.
+ */
+struct debug_filter_config {
+	/**
+	 * If either prefix is set, the source or destination address of
+	 * every debugged packet needs to belong to the prefix of its family.
+	 */
+	struct config_prefix6 prefix6;
+	struct config_prefix4 prefix4;
+	/** Layer 4 protocol number. (ICMP matches both 1 and 58.) */
+	__u8 proto;
+	/** Source or destination port, or ICMP identifier. */
+	__u32 port;
+	__u32 mark;
+	/** Maximum number of debugged packets per second. */
+	__u32 rate;
+};
+
 /**
  * Issued during atomic configuration initialization.
  */
@@ -443,7 +545,11 @@ struct joold_config {
 	 */
 	__u32 capacity;
 
-	/** Deprecated as of 4.1.11, does nothing. */
+	/**
+	 * Maximum size of a joold packet's payload, in bytes.
+	 * Only used by the compact format; the legacy format relies on
+	 * @max_sessions_per_pkt instead.
+	 */
 	__u32 max_payload;
 
 	/**
@@ -460,6 +566,48 @@ struct joold_config {
 	 * code. (I guess I'm missing something.)
 	 */
 	__u32 max_sessions_per_pkt;
+
+	/**
+	 * Maximum number of packets that can be waiting for the daemon's ACK
+	 * at the same time.
+	 */
+	__u32 window;
+
+	/**
+	 * Send the sessions in the compact format? (All the nodes need to
+	 * understand it.)
+	 */
+	bool compact;
+	/** LZ4-compress the compact batches? */
+	bool lz4;
+
+	/**
+	 * Milliseconds that need to elapse before a session whose state did
+	 * not change is replicated again. Zero disables the limit.
+	 */
+	__u32 min_readvertise_interval;
+
+	/*
+	 * Replication policy. A session is only synchronized once it's
+	 * @min_age milliseconds old and has translated @min_packets packets.
+	 * (Zero disables the corresponding limit.) Until then, it's assumed to
+	 * be a short-lived exchange (such as DNS), not worth the bandwidth.
+	 */
+	__u32 min_age;
+	__u32 min_packets;
+
+	/* Synchronize the sessions of each protocol? */
+	bool tcp;
+	bool udp;
+	bool icmp;
+
+	/*
+	 * TCP/UDP sessions are only synchronized if the port of their IPv6 or
+	 * IPv4 node belongs to @include_ports, and neither belongs to
+	 * @exclude_ports. (min > max means the range is empty.)
+	 */
+	struct port_range include_ports;
+	struct port_range exclude_ports;
 };
 
 /**
@@ -471,6 +619,10 @@ struct jool_globals {
 	bool enabled;
 	/** Print debug messages? */
 	bool debug;
+	/** Which packets should get debug messages? */
+	struct debug_filter_config debug_filter;
+	/** Record how long each translation stage takes? */
+	bool latency_histograms;
 
 	/**
 	 * BTW: NAT64 Jool can't do anything without pool6, so it validates that
@@ -517,6 +669,14 @@ struct jool_globals {
 	 */
 	struct mtu_plateaus plateaus;
 
+	/**
+	 * Translate eligible packets by rewriting their headers, instead of
+	 * building a new packet out of them?
+	 * Ineligible packets (ICMP errors, fragments, cloned packets, etc.)
+	 * are always copied.
+	 */
+	bool xlat_in_place;
+
 	union {
 		struct {
 			/**
@@ -572,6 +732,11 @@ struct jool_globals {
 			 * https://github.com/NICMx/Jool/issues/212
 			 */
 			bool handle_rst_during_fin_rcv;
+			/**
+			 * Count the acquisitions and hold times of the BIB,
+			 * pool4 and joold locks?
+			 */
+			bool lock_stats;
 
 			struct bib_config bib;
 			struct joold_config joold;
@@ -62,6 +62,24 @@
  */
 #define MIN_TIMER_SLEEP (255)
 
+/* -- Fragment cache (NAT64 inserted with defrag=0) -- */
+
+/**
+ * Lifetime of a fragment cache entry, in seconds. Also the amount of time a
+ * subsequent fragment will wait for its first fragment.
+ * (Much shorter than the kernel's reassembly timeouts, on purpose. We're not
+ * reassembling anything, and the fragments of a healthy packet arrive within
+ * milliseconds of each other.)
+ */
+#define FRAGCACHE_TIMEOUT (5)
+/** Maximum number of fragmented packets an instance can remember at once. */
+#define FRAGCACHE_MAX_ENTRIES (4096)
+/**
+ * Maximum number of subsequent fragments an instance can hold while it waits
+ * for their first fragments.
+ */
+#define FRAGCACHE_MAX_PENDING (256)
+
 /* -- Config defaults -- */
 #define DEFAULT_ADDR_DEPENDENT_FILTERING false
 #define DEFAULT_FILTER_ICMPV6_INFO false
@@ -78,6 +96,10 @@
 #define DEFAULT_RESET_TOS false
 #define DEFAULT_NEW_TOS 0
 #define DEFAULT_LOWEST_IPV6_MTU 1280
+#define DEFAULT_XLAT_IN_PLACE false
+#define DEFAULT_DEBUG_RATE 0
+#define DEFAULT_LATENCY_HISTOGRAMS false
+#define DEFAULT_LOCK_STATS false
 #define DEFAULT_COMPUTE_UDP_CSUM0 false
 #define DEFAULT_EAM_HAIRPIN_MODE EHM_INTRINSIC
 #define DEFAULT_RANDOMIZE_RFC6791 true
@@ -88,8 +110,7 @@
 #define DEFAULT_JOOLD_CAPACITY 512
 /**
  * typical MTU minus max(20, 40) minus the UDP header. (1500 - 40 - 8)
- * There's a 16-bytes joold header and each session spans 64 bytes currently.
- * This means we can fit 22 sessions per packet. (Regardless of IPv4/IPv6)
+ * Only used by the compact format, which packs as many sessions as fit.
  */
 #define DEFAULT_JOOLD_MAX_PAYLOAD 1452
 
@@ -111,6 +132,12 @@
  * computed the hard way. Run the joold unit test to find them in dmesg.
  */
 #define DEFAULT_JOOLD_MAX_SESSIONS_PER_PKT ((1500 - 40 - 8 - 4) / 40)
+#define DEFAULT_JOOLD_WINDOW 8
+#define DEFAULT_JOOLD_COMPACT false
+#define DEFAULT_JOOLD_LZ4 false
+#define DEFAULT_JOOLD_MIN_READVERTISE_INTERVAL 0
+#define DEFAULT_JOOLD_MIN_AGE 0
+#define DEFAULT_JOOLD_MIN_PACKETS 0
 
 /* -- IPv6 Pool -- */
 
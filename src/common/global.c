@@ -77,6 +77,21 @@ struct joolnl_global_meta {
 #endif
 };
 
+/*
+ * Port ranges travel as a single u32; min is the upper half, max is the lower
+ * one. (min > max means "empty.")
+ */
+static __u32 port_range2u32(struct port_range const *range)
+{
+	return (((__u32)range->min) << 16) | range->max;
+}
+
+static void u322port_range(__u32 value, struct port_range *range)
+{
+	range->min = value >> 16;
+	range->max = value & 0xFFFFu;
+}
+
 #ifdef __KERNEL__
 
 static int raw2nl_bool(struct joolnl_global_meta const *meta, void *raw,
@@ -97,6 +112,12 @@ static int raw2nl_u32(struct joolnl_global_meta const *meta, void *raw,
 	return nla_put_u32(skb, meta->id, *((__u32 *)raw));
 }
 
+static int raw2nl_port_range(struct joolnl_global_meta const *meta, void *raw,
+		struct sk_buff *skb)
+{
+	return nla_put_u32(skb, meta->id, port_range2u32(raw));
+}
+
 static int raw2nl_plateaus(struct joolnl_global_meta const *meta, void *raw,
 		struct sk_buff *skb)
 {
@@ -137,6 +158,12 @@ static int nl2raw_u32(struct nlattr *attr, void *raw, bool force)
 	return 0;
 }
 
+static int nl2raw_port_range(struct nlattr *attr, void *raw, bool force)
+{
+	u322port_range(nla_get_u32(attr), raw);
+	return 0;
+}
+
 static int nl2raw_plateaus(struct nlattr *attr, void *raw, bool force)
 {
 	return jnla_get_plateaus(attr, raw);
@@ -192,6 +219,44 @@ static int nl2raw_pool6791v4(struct nlattr *attr, void *raw, bool force)
 	return validate_prefix6791v4(prefix, force);
 }
 
+static int nl2raw_debug_prefix6(struct nlattr *attr, void *raw, bool force)
+{
+	struct config_prefix6 *prefix = raw;
+	int error;
+
+	error = jnla_get_prefix6_optional(attr, "debug prefix v6", prefix);
+	if (error)
+		return error;
+
+	return prefix->set ? prefix6_validate(&prefix->prefix) : 0;
+}
+
+static int nl2raw_debug_prefix4(struct nlattr *attr, void *raw, bool force)
+{
+	struct config_prefix4 *prefix = raw;
+	int error;
+
+	error = jnla_get_prefix4_optional(attr, "debug prefix v4", prefix);
+	if (error)
+		return error;
+
+	return prefix->set ? prefix4_validate(&prefix->prefix) : 0;
+}
+
+static int nl2raw_debug_port(struct nlattr *attr, void *raw, bool force)
+{
+	__u32 port;
+
+	port = nla_get_u32(attr);
+	if (port > 65535) {
+		log_err("logging-debug-port (%u) is too big (max: 65535).", port);
+		return -EINVAL;
+	}
+
+	*((__u32 *)raw) = port;
+	return 0;
+}
+
 static int nl2raw_lowest_ipv6_mtu(struct nlattr *attr, void *raw, bool force)
 {
 	__u32 lim;
@@ -319,6 +384,18 @@ static void print_timeout(void *value, bool csv)
 		printf(" (HH:MM:SS)");
 }
 
+static void print_port_range(void *value, bool csv)
+{
+	struct port_range *range = value;
+
+	if (range->min > range->max)
+		printf("%s", csv ? "" : "(unset)");
+	else if (range->min == range->max)
+		printf("%u", range->min);
+	else
+		printf("%u-%u", range->min, range->max);
+}
+
 static void print_plateaus(void *value, bool csv)
 {
 	struct mtu_plateaus *plateaus = value;
@@ -423,6 +500,12 @@ static struct jool_result nl2raw_u32(struct nlattr *attr, void *raw)
 	return result_success();
 }
 
+static struct jool_result nl2raw_port_range(struct nlattr *attr, void *raw)
+{
+	u322port_range(nla_get_u32(attr), raw);
+	return result_success();
+}
+
 static struct jool_result nl2raw_plateaus(struct nlattr *attr, void *raw)
 {
 	return nla_get_plateaus(attr, raw);
@@ -524,6 +607,30 @@ static struct jool_result str2nl_timeout(enum joolnl_attr_global id,
 			: result_success();
 }
 
+static struct jool_result str2nl_port_range(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct port_range range;
+	struct jool_result result;
+
+	if (strcmp(str, "null") == 0) {
+		range.min = 65535;
+		range.max = 0;
+	} else {
+		result = str_to_port_range((char *)str, &range);
+		if (result.error)
+			return result;
+		if (range.min > range.max) {
+			return result_from_error(-EINVAL,
+					"Port range '%s' is backwards.", str);
+		}
+	}
+
+	return (nla_put_u32(msg, id, port_range2u32(&range)) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
 static struct jool_result str2nl_plateaus(enum joolnl_attr_global id,
 		char const *str, struct nl_msg *msg)
 {
@@ -727,6 +834,12 @@ static struct joolnl_global_type gt_timeout = {
 	USERSPACE_FUNCTIONS(print_timeout, str2nl_timeout, json2nl_string, nl2raw_u32)
 };
 
+static struct joolnl_global_type gt_port_range = {
+	.name = "Port range (eg. 1024-65535, or null)",
+	KERNEL_FUNCTIONS(raw2nl_port_range, nl2raw_port_range)
+	USERSPACE_FUNCTIONS(print_port_range, str2nl_port_range, json2nl_string, nl2raw_port_range)
+};
+
 static struct joolnl_global_type gt_plateaus = {
 	.name = "List of 16-bit unsigned integers separated by commas",
 	KERNEL_FUNCTIONS(raw2nl_plateaus, nl2raw_plateaus)
@@ -816,6 +929,71 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Set the list of plateaus for ICMPv4 Fragmentation Neededs with MTU unset.",
 		.offset = offsetof(struct jool_globals, plateaus),
 		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_XLAT_IN_PLACE,
+		.name = "xlat-in-place",
+		.type = &gt_bool,
+		.doc = "Translate simple packets by rewriting their headers? Otherwise always build a new packet.",
+		.offset = offsetof(struct jool_globals, xlat_in_place),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_DEBUG_PREFIX6,
+		.name = "logging-debug-prefix6",
+		.type = &gt_prefix6,
+		.doc = "Only debug the IPv6 packets whose source or destination address belongs to this prefix.",
+		.offset = offsetof(struct jool_globals, debug_filter.prefix6),
+		.xt = XT_ANY,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_debug_prefix6,
+#endif
+	}, {
+		.id = JNLAG_DEBUG_PREFIX4,
+		.name = "logging-debug-prefix4",
+		.type = &gt_prefix4,
+		.doc = "Only debug the IPv4 packets whose source or destination address belongs to this prefix.",
+		.offset = offsetof(struct jool_globals, debug_filter.prefix4),
+		.xt = XT_ANY,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_debug_prefix4,
+#endif
+	}, {
+		.id = JNLAG_DEBUG_PROTO,
+		.name = "logging-debug-protocol",
+		.type = &gt_uint8,
+		.doc = "Only debug the packets of this layer 4 protocol number. (0 = any)",
+		.offset = offsetof(struct jool_globals, debug_filter.proto),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_DEBUG_PORT,
+		.name = "logging-debug-port",
+		.type = &gt_uint32,
+		.doc = "Only debug the packets that have this source or destination port, or ICMP identifier. (0 = any)",
+		.offset = offsetof(struct jool_globals, debug_filter.port),
+		.xt = XT_ANY,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_debug_port,
+#endif
+	}, {
+		.id = JNLAG_DEBUG_MARK,
+		.name = "logging-debug-mark",
+		.type = &gt_uint32,
+		.doc = "Only debug the packets that have this mark. (0 = any)",
+		.offset = offsetof(struct jool_globals, debug_filter.mark),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_DEBUG_RATE,
+		.name = "logging-debug-rate",
+		.type = &gt_uint32,
+		.doc = "Maximum number of packets to debug per second. (0 = unlimited)",
+		.offset = offsetof(struct jool_globals, debug_filter.rate),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_LATENCY_HISTOGRAMS,
+		.name = "latency-histograms",
+		.type = &gt_bool,
+		.doc = "Record how long each translation stage takes? (See `stats histogram`.)",
+		.offset = offsetof(struct jool_globals, latency_histograms),
+		.xt = XT_ANY,
 	}, {
 		.id = JNLAG_COMPUTE_CSUM_ZERO,
 		.name = "amend-udp-checksum-zero",
@@ -968,6 +1146,13 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Set the maximum allowable 'simultaneous' Simultaneos Opens of TCP connections.",
 		.offset = offsetof(struct jool_globals, nat64.bib.max_stored_pkts),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_LOCK_STATS,
+		.name = "lock-stats",
+		.type = &gt_bool,
+		.doc = "Count the acquisitions and hold times of the BIB, pool4 and joold locks? (See `stats locks`.)",
+		.offset = offsetof(struct jool_globals, nat64.lock_stats),
+		.xt = XT_NAT64,
 	}, {
 		.id = JNLAG_JOOLD_ENABLED,
 		.name = "ss-enabled",
@@ -1000,7 +1185,7 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.id = JNLAG_JOOLD_MAX_PAYLOAD,
 		.name = "ss-max-payload",
 		.type = &gt_uint32,
-		.doc = "Deprecated; does nothing as of Jool 4.1.11.",
+		.doc = "Maximum payload size of a compact joold packet, in bytes.",
 		.offset = offsetof(struct jool_globals, nat64.joold.max_payload),
 		.xt = XT_NAT64,
 	}, {
@@ -1010,6 +1195,83 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Maximum number of sessions to send, per joold packet.",
 		.offset = offsetof(struct jool_globals, nat64.joold.max_sessions_per_pkt),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_WINDOW,
+		.name = "ss-window",
+		.type = &gt_uint32,
+		.doc = "Maximum number of joold packets waiting for their ACK at the same time.",
+		.offset = offsetof(struct jool_globals, nat64.joold.window),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_COMPACT,
+		.name = "ss-compact",
+		.type = &gt_bool,
+		.doc = "Send the joold sessions in the compact format?",
+		.offset = offsetof(struct jool_globals, nat64.joold.compact),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_LZ4,
+		.name = "ss-lz4",
+		.type = &gt_bool,
+		.doc = "LZ4-compress the compact joold packets?",
+		.offset = offsetof(struct jool_globals, nat64.joold.lz4),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_MIN_READVERTISE_INTERVAL,
+		.name = "ss-min-readvertise-interval",
+		.type = &gt_uint32,
+		.doc = "Milliseconds before an unchanged session is synchronized again. (0 = every update)",
+		.offset = offsetof(struct jool_globals, nat64.joold.min_readvertise_interval),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_MIN_AGE,
+		.name = "ss-min-age",
+		.type = &gt_uint32,
+		.doc = "Do not synchronize sessions younger than this many milliseconds.",
+		.offset = offsetof(struct jool_globals, nat64.joold.min_age),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_MIN_PACKETS,
+		.name = "ss-min-packets",
+		.type = &gt_uint32,
+		.doc = "Do not synchronize sessions that have translated less packets than this.",
+		.offset = offsetof(struct jool_globals, nat64.joold.min_packets),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_TCP,
+		.name = "ss-tcp",
+		.type = &gt_bool,
+		.doc = "Synchronize TCP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.tcp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_UDP,
+		.name = "ss-udp",
+		.type = &gt_bool,
+		.doc = "Synchronize UDP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.udp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_ICMP,
+		.name = "ss-icmp",
+		.type = &gt_bool,
+		.doc = "Synchronize ICMP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.icmp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_INCLUDE_PORTS,
+		.name = "ss-include-ports",
+		.type = &gt_port_range,
+		.doc = "Only synchronize the TCP/UDP sessions whose IPv6 or IPv4 node uses a port from this range.",
+		.offset = offsetof(struct jool_globals, nat64.joold.include_ports),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_EXCLUDE_PORTS,
+		.name = "ss-exclude-ports",
+		.type = &gt_port_range,
+		.doc = "Do not synchronize the TCP/UDP sessions whose IPv6 or IPv4 node uses a port from this range.",
+		.offset = offsetof(struct jool_globals, nat64.joold.exclude_ports),
+		.xt = XT_NAT64,
 	},
 };
 
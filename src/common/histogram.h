@@ -0,0 +1,38 @@
+#ifndef SRC_COMMON_HISTOGRAM_H_
+#define SRC_COMMON_HISTOGRAM_H_
+
+/**
+ * @file
+ * Latency histograms. (See the latency-histograms global.)
+ *
+ * Every instance keeps one histogram per stage, direction and layer 4
+ * protocol. Each histogram counts the durations of its stage in log2
+ * nanosecond buckets.
+ *
+ * NOTE THAT ANY MODIFICATIONS MADE TO jool_hist_stage NEED TO BE CASCADED TO
+ * jhist_stage_names.
+ */
+
+enum jool_hist_stage {
+	/* The entire translation. */
+	JHIST_TOTAL,
+	/* Waiting for the BIB table's lock. (NAT64 only.) */
+	JHIST_BIB_LOCK,
+	/* Routing the translated packet. */
+	JHIST_ROUTE,
+	/* Allocating the translated packet. (Once per allocated skb.) */
+	JHIST_SKB_ALLOC,
+	/* Translating the layer 4 header; mostly updating its checksum. */
+	JHIST_CSUM,
+
+	JHIST_STAGE_COUNT,
+};
+
+/*
+ * Bucket 0 counts the durations that were rounded down to zero nanoseconds.
+ * Bucket n counts the durations in [2^(n - 1), 2^n) nanoseconds.
+ * The last bucket also counts everything longer than that.
+ */
+#define JHIST_BUCKETS 32
+
+#endif /* SRC_COMMON_HISTOGRAM_H_ */
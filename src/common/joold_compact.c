@@ -0,0 +1,173 @@
+#include "common/joold_compact.h"
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <asm/byteorder.h>
+#else
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#endif
+
+/* The addresses that are omitted because they equal the previous record's */
+#define SAME_SRC6_PREFIX (1 << 0) /* First 64 bits */
+#define SAME_SRC6_IID (1 << 1) /* Last 64 bits */
+#define SAME_SRC4 (1 << 2)
+#define SAME_DST4 (1 << 3)
+#define SAME_ALL (SAME_SRC6_PREFIX | SAME_SRC6_IID | SAME_SRC4 | SAME_DST4)
+
+static __u8 compute_flags(struct joold_record const *prev,
+		struct joold_record const *cur)
+{
+	__u8 flags = 0;
+
+	if (!prev)
+		return 0;
+
+	if (memcmp(&prev->src6.s6_addr[0], &cur->src6.s6_addr[0], 8) == 0)
+		flags |= SAME_SRC6_PREFIX;
+	if (memcmp(&prev->src6.s6_addr[8], &cur->src6.s6_addr[8], 8) == 0)
+		flags |= SAME_SRC6_IID;
+	if (prev->src4.s_addr == cur->src4.s_addr)
+		flags |= SAME_SRC4;
+	if (prev->dst4.s_addr == cur->dst4.s_addr)
+		flags |= SAME_DST4;
+
+	return flags;
+}
+
+static size_t flags_len(__u8 flags)
+{
+	size_t result = JOOLD_RECORD_MIN_LEN;
+
+	if (!(flags & SAME_SRC6_PREFIX))
+		result += 8;
+	if (!(flags & SAME_SRC6_IID))
+		result += 8;
+	if (!(flags & SAME_SRC4))
+		result += 4;
+	if (!(flags & SAME_DST4))
+		result += 4;
+
+	return result;
+}
+
+size_t joold_record_len(struct joold_record const *prev,
+		struct joold_record const *cur)
+{
+	return flags_len(compute_flags(prev, cur));
+}
+
+#define WRITE_RAW(buffer, content)					\
+	memcpy(buffer, &content, sizeof(content));			\
+	buffer += sizeof(content)
+
+#define READ_RAW(buffer, field)						\
+	memcpy(&field, buffer, sizeof(field));				\
+	buffer += sizeof(field)
+
+size_t joold_record_write(void *dst, struct joold_record const *prev,
+		struct joold_record const *cur)
+{
+	__u8 *buffer = dst;
+	__u8 flags;
+	__u8 tmp8;
+	__be16 tmp16;
+	__be32 tmp32;
+
+	flags = compute_flags(prev, cur);
+
+	/* Fixed part */
+	WRITE_RAW(buffer, flags);
+	tmp8 = (cur->proto << 5) /* 2 bits */
+			| (cur->state << 2) /* 3 bits */
+			| cur->timer_type; /* 2 bits */
+	WRITE_RAW(buffer, tmp8);
+	tmp16 = htons(cur->src6_port);
+	WRITE_RAW(buffer, tmp16);
+	tmp16 = htons(cur->src4_port);
+	WRITE_RAW(buffer, tmp16);
+	tmp16 = htons(cur->dst4_port);
+	WRITE_RAW(buffer, tmp16);
+	tmp32 = htonl(cur->expiration);
+	WRITE_RAW(buffer, tmp32);
+
+	/* Addresses */
+	if (!(flags & SAME_SRC6_PREFIX)) {
+		memcpy(buffer, &cur->src6.s6_addr[0], 8);
+		buffer += 8;
+	}
+	if (!(flags & SAME_SRC6_IID)) {
+		memcpy(buffer, &cur->src6.s6_addr[8], 8);
+		buffer += 8;
+	}
+	if (!(flags & SAME_SRC4)) {
+		WRITE_RAW(buffer, cur->src4);
+	}
+	if (!(flags & SAME_DST4)) {
+		WRITE_RAW(buffer, cur->dst4);
+	}
+
+	return buffer - (__u8 *)dst;
+}
+
+int joold_record_read(void const *src, size_t len,
+		struct joold_record const *prev, struct joold_record *cur)
+{
+	__u8 const *buffer = src;
+	__u8 flags;
+	__u8 tmp8;
+	__be16 tmp16;
+	__be32 tmp32;
+
+	if (len < JOOLD_RECORD_MIN_LEN)
+		return -EINVAL;
+
+	READ_RAW(buffer, flags);
+	if (flags & ~SAME_ALL)
+		return -EINVAL;
+	/* The first record of the batch cannot refer to a previous one. */
+	if (!prev && flags)
+		return -EINVAL;
+	if (len < flags_len(flags))
+		return -EINVAL;
+
+	READ_RAW(buffer, tmp8);
+	cur->proto = (tmp8 >> 5) & 3;
+	cur->state = (tmp8 >> 2) & 7;
+	cur->timer_type = tmp8 & 3;
+	READ_RAW(buffer, tmp16);
+	cur->src6_port = ntohs(tmp16);
+	READ_RAW(buffer, tmp16);
+	cur->src4_port = ntohs(tmp16);
+	READ_RAW(buffer, tmp16);
+	cur->dst4_port = ntohs(tmp16);
+	READ_RAW(buffer, tmp32);
+	cur->expiration = ntohl(tmp32);
+
+	if (flags & SAME_SRC6_PREFIX) {
+		memcpy(&cur->src6.s6_addr[0], &prev->src6.s6_addr[0], 8);
+	} else {
+		memcpy(&cur->src6.s6_addr[0], buffer, 8);
+		buffer += 8;
+	}
+	if (flags & SAME_SRC6_IID) {
+		memcpy(&cur->src6.s6_addr[8], &prev->src6.s6_addr[8], 8);
+	} else {
+		memcpy(&cur->src6.s6_addr[8], buffer, 8);
+		buffer += 8;
+	}
+	if (flags & SAME_SRC4) {
+		cur->src4 = prev->src4;
+	} else {
+		READ_RAW(buffer, cur->src4);
+	}
+	if (flags & SAME_DST4) {
+		cur->dst4 = prev->dst4;
+	} else {
+		READ_RAW(buffer, cur->dst4);
+	}
+
+	return buffer - (__u8 const *)src;
+}
@@ -0,0 +1,87 @@
+#ifndef SRC_COMMON_JOOLD_COMPACT_H_
+#define SRC_COMMON_JOOLD_COMPACT_H_
+
+/**
+ * @file
+ * Compact joold wire format. (See the ss-compact global.)
+ *
+ * The legacy format spends one Netlink attribute (4 bytes of header, 36 bytes
+ * of payload) per session. In the compact format, a single attribute (type
+ * JNLAJ_BATCH) contains a joold_compact_hdr, followed by a sequence of
+ * variable-length records.
+ *
+ * Each record is a 12-byte fixed part, followed by the addresses that differ
+ * from the previous record of the same batch. (The first record of each batch
+ * always carries all of them.) Because consecutive sessions tend to share the
+ * pool6 prefix and the pool4 address, records are usually 16-28 bytes long.
+ *
+ * The sequence of records can also be LZ4-compressed, in which case
+ * joold_compact_hdr.len is the uncompressed length.
+ *
+ * All fields are big endian.
+ */
+
+#ifdef __KERNEL__
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/types.h>
+#else
+#include <netinet/in.h>
+#include <stddef.h>
+#include <linux/types.h>
+#endif
+
+#define JOOLD_COMPACT_VERSION 1
+
+/* The records are LZ4-compressed. */
+#define JOOLD_COMPACT_LZ4 (1 << 0)
+
+struct joold_compact_hdr {
+	/* JOOLD_COMPACT_VERSION */
+	__u8 version;
+	/* JOOLD_COMPACT_* */
+	__u8 flags;
+	/* Number of records */
+	__be16 count;
+	/* Length of the (uncompressed) records, in bytes */
+	__be16 len;
+};
+
+/* One session, as it travels between Jool instances. */
+struct joold_record {
+	struct in6_addr src6;
+	struct in_addr src4;
+	struct in_addr dst4;
+	__u16 src6_port;
+	__u16 src4_port;
+	__u16 dst4_port;
+	/* l4_protocol */
+	__u8 proto;
+	/* tcp_state */
+	__u8 state;
+	/* session_timer_type */
+	__u8 timer_type;
+	/* Milliseconds until the session expires */
+	__u32 expiration;
+};
+
+#define JOOLD_RECORD_MIN_LEN 12
+#define JOOLD_RECORD_MAX_LEN 36
+
+/* @prev is the previous record of the batch. (NULL if @cur is the first one.) */
+size_t joold_record_len(struct joold_record const *prev,
+		struct joold_record const *cur);
+/*
+ * Serializes @cur into @dst, which needs to have room for at least
+ * joold_record_len(@prev, @cur) bytes. Returns the number of bytes written.
+ */
+size_t joold_record_write(void *dst, struct joold_record const *prev,
+		struct joold_record const *cur);
+/*
+ * Parses the record at the beginning of @src (which is @len bytes long) into
+ * @cur. Returns the number of bytes consumed, or -EINVAL if @src is truncated.
+ */
+int joold_record_read(void const *src, size_t len,
+		struct joold_record const *prev, struct joold_record *cur);
+
+#endif /* SRC_COMMON_JOOLD_COMPACT_H_ */
@@ -0,0 +1,64 @@
+#ifndef SRC_COMMON_LOCK_STATS_H_
+#define SRC_COMMON_LOCK_STATS_H_
+
+/**
+ * @file
+ * Lock instrumentation. (See the lock-stats global.)
+ *
+ * Every instrumented lock counts its acquisitions, contended acquisitions and
+ * hold times, separately for each call site.
+ *
+ * NOTE THAT ANY MODIFICATIONS MADE TO THESE ENUMS NEED TO BE CASCADED TO
+ * jlock_names and jlock_site_names.
+ */
+
+enum jool_lock {
+	JLOCK_BIB_TCP,
+	JLOCK_BIB_UDP,
+	JLOCK_BIB_ICMP,
+	JLOCK_POOL4,
+	JLOCK_JOOLD,
+
+	JLOCK_COUNT,
+};
+
+enum jool_lock_site {
+	/* BIB: IPv6 packet looking up or creating its session */
+	JLS_BIB_ADD6,
+	/* BIB: IPv4 packet looking up or creating its session */
+	JLS_BIB_ADD4,
+	/* BIB: Session received from joold */
+	JLS_BIB_SYNC,
+	/* BIB: Session expiration */
+	JLS_BIB_CLEAN,
+	/* BIB: Iterations (userspace queries and joold advertisements) */
+	JLS_BIB_FOREACH,
+	/* BIB: Lookups that do not create anything */
+	JLS_BIB_FIND,
+	/* BIB: Static entry management */
+	JLS_BIB_CONFIG,
+
+	/* pool4: Computation of the IPv6 packet's mask domain */
+	JLS_POOL4_MASK,
+	/* pool4: Membership tests */
+	JLS_POOL4_CONTAINS,
+	/* pool4: Userspace queries */
+	JLS_POOL4_FOREACH,
+	/* pool4: Entry management */
+	JLS_POOL4_CONFIG,
+
+	/* joold: Flushes triggered by new sessions */
+	JLS_JOOLD_ADD,
+	/* joold: Advertisements */
+	JLS_JOOLD_ADVERTISE,
+	/* joold: ACKs from the daemon */
+	JLS_JOOLD_ACK,
+	/* joold: Deadline-triggered flushes */
+	JLS_JOOLD_CLEAN,
+	/* joold: Transport changes */
+	JLS_JOOLD_TRANSPORT,
+
+	JLS_COUNT,
+};
+
+#endif /* SRC_COMMON_LOCK_STATS_H_ */
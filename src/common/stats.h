@@ -58,6 +58,11 @@ enum jool_stat_id {
 	JSTAT_SO_EXISTS,
 	JSTAT_SO_FULL,
 
+	JSTAT_FRAGCACHE_HIT,
+	JSTAT_FRAGCACHE_QUEUED,
+	JSTAT_FRAGCACHE_FULL,
+	JSTAT_FRAGCACHE_MISS,
+
 	JSTAT64_SRC,
 	JSTAT64_DST,
 	JSTAT64_PSKB_COPY,
@@ -86,6 +91,12 @@ enum jool_stat_id {
 	JSTAT_PKT_TOO_BIG,
 	JSTAT_DST_OUTPUT,
 
+	JSTAT_XLAT_IN_PLACE,
+	JSTAT_XLAT_COPY,
+	JSTAT_GSO_SEGMENTED,
+	JSTAT_GSO_SEGMENT_FAILED,
+	JSTAT_HAIRPIN_DIRECT,
+
 	JSTAT_ICMP6ERR_SUCCESS,
 	JSTAT_ICMP6ERR_FAILURE,
 	JSTAT_ICMP4ERR_SUCCESS,
@@ -108,6 +119,16 @@ enum jool_stat_id {
 	JSTAT_JOOLD_PKT_RCVD,
 	JSTAT_JOOLD_ADS,
 	JSTAT_JOOLD_ACKS,
+	JSTAT_JOOLD_STALE_ACKS,
+	JSTAT_JOOLD_SSS_COALESCED,
+	JSTAT_JOOLD_SSS_UNCHANGED,
+	JSTAT_JOOLD_SSS_EXCLUDED,
+	JSTAT_JOOLD_SSS_YOUNG,
+	JSTAT_JOOLD_GAPS,
+	JSTAT_JOOLD_DUPLICATES,
+	JSTAT_JOOLD_RETRANSMITS,
+	JSTAT_JOOLD_RESYNCS,
+	JSTAT_JOOLD_TX_OVERFLOW,
 
 	/* These 3 need to be last, and in this order. */
 	JSTAT_UNKNOWN, /* "WTF was that" errors only. */
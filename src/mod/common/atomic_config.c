@@ -229,7 +229,8 @@ static int handle_denylist4(struct config_candidate *new, struct nlattr *root,
 		error = jnla_get_prefix4(attr, "IPv4 denylist4 entry", &entry);
 		if (error)
 			return error;
-		error = denylist4_add(new->xlator.siit.denylist4, &entry, force);
+		error = denylist4_add(new->xlator.siit.denylist4, &entry, force,
+				false);
 		if (error)
 			return error;
 	}
@@ -1,16 +1,27 @@
 #include "mod/common/core.h"
 
+#include <linux/netdevice.h>
 #include "common/config.h"
+#include "mod/common/debug_filter.h"
+#include "mod/common/histogram.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/trace.h"
+#include "mod/common/tracepoints.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/xlator.h"
+#include "mod/common/db/fragcache.h"
 #include "mod/common/rfc7915/core.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 #include "mod/common/steps/determine_incoming_tuple.h"
 #include "mod/common/steps/filtering_and_updating.h"
+#include "mod/common/steps/handling_hairpinning_nat64.h"
 #include "mod/common/steps/send_packet.h"
 
+#if LINUX_VERSION_AT_LEAST(6, 4, 0, 9999, 9)
+#include <net/gso.h>
+#endif
+
 static verdict validate_xlator(struct xlation *state)
 {
 	struct jool_globals *cfg = &state->jool.globals;
@@ -25,35 +36,84 @@ static verdict validate_xlator(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-static verdict core_common(struct xlation *state)
+static verdict nat64_steps(struct xlation *state, struct sk_buff_head *pending)
+{
+	verdict result;
+
+	/*
+	 * Only happens if the module was inserted with defrag=0; otherwise
+	 * the kernel reassembles before us.
+	 */
+	if (pkt_is_subsequent_frag(&state->in))
+		return fragcache_find(state);
+
+	trace_jool_step_begin(state, JOOL_STEP_DETERMINE_IN_TUPLE);
+	result = determine_in_tuple(state);
+	trace_jool_step_end(state, JOOL_STEP_DETERMINE_IN_TUPLE, result);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	trace_jool_step_begin(state, JOOL_STEP_FILTERING);
+	result = filtering_and_updating(state);
+	trace_jool_step_end(state, JOOL_STEP_FILTERING, result);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	trace_jool_step_begin(state, JOOL_STEP_COMPUTE_OUT_TUPLE);
+	result = compute_out_tuple(state);
+	trace_jool_step_end(state, JOOL_STEP_COMPUTE_OUT_TUPLE, result);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	if (pkt_is_fragment(&state->in))
+		fragcache_add(state, pending);
+	return VERDICT_CONTINUE;
+}
+
+static verdict __core_common(struct xlation *state,
+		struct sk_buff_head *pending)
 {
 	verdict result;
 
 	if (xlation_is_nat64(state)) {
-		result = determine_in_tuple(state);
-		if (result != VERDICT_CONTINUE)
-			return result;
-		result = filtering_and_updating(state);
-		if (result != VERDICT_CONTINUE)
-			return result;
-		result = compute_out_tuple(state);
+		result = nat64_steps(state, pending);
 		if (result != VERDICT_CONTINUE)
 			return result;
+		if (hairpin_nat64_direct_viable(state)) {
+			trace_jool_step_begin(state, JOOL_STEP_HAIRPIN);
+			result = handling_hairpinning_nat64_direct(state);
+			trace_jool_step_end(state, JOOL_STEP_HAIRPIN, result);
+			goto sent;
+		}
 	}
+
+	trace_jool_step_begin(state, JOOL_STEP_TRANSLATE);
 	result = translating_the_packet(state);
+	trace_jool_step_end(state, JOOL_STEP_TRANSLATE, result);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
 	if (state->jool.is_hairpin(state)) {
 		skb_dst_drop(state->out.skb);
+		trace_jool_step_begin(state, JOOL_STEP_HAIRPIN);
 		result = state->jool.handling_hairpinning(state);
+		trace_jool_step_end(state, JOOL_STEP_HAIRPIN, result);
 		kfree_skb(state->out.skb); /* Put this inside of hh()? */
 	} else {
+		trace_jool_step_begin(state, JOOL_STEP_SEND);
 		result = sendpkt_send(state);
+		trace_jool_step_end(state, JOOL_STEP_SEND, result);
 		/* sendpkt_send() releases out's skb regardless of verdict. */
 	}
-	if (result != VERDICT_CONTINUE)
-		return result;
+
+sent:
+	if (result != VERDICT_CONTINUE) {
+		/*
+		 * If out was in, then in is gone too, so it can be neither
+		 * returned to the kernel nor dropped by it.
+		 */
+		return xlation_in_place(state) ? VERDICT_STOLEN : result;
+	}
 
 	log_debug(state, "Success.");
 	/*
@@ -64,8 +124,173 @@ static verdict core_common(struct xlation *state)
 	 * count as an error, so we free the incoming packet ourselves and
 	 * return NF_STOLEN on success.
 	 */
+	if (!xlation_in_place(state))
+		kfree_skb(state->in.skb);
+	/* If the packet is only queued, sendpkt_flush() will count it. */
+	return state->batch ? VERDICT_STOLEN : stolen(state, JSTAT_SUCCESS);
+}
+
+/*
+ * Returns the batch the packets spawned by @state should be queued to.
+ * (@state's own, if it has one, so everything is sent together.)
+ */
+static struct sendpkt_batch *get_batch(struct xlation *state,
+		struct sendpkt_batch *local)
+{
+	if (state->batch)
+		return state->batch;
+	sendpkt_batch_init(local);
+	return local;
+}
+
+/* Sends @batch, unless it belongs to @state's creator. */
+static void put_batch(struct xlation *state, struct sendpkt_batch *batch)
+{
+	if (batch != state->batch)
+		sendpkt_flush(&state->jool, batch);
+}
+
+static verdict core_4to6_skb(struct sk_buff *skb, struct xlation *state);
+static verdict core_6to4_skb(struct sk_buff *skb, struct xlation *state);
+static void send_icmp4_error(struct xlation *state, verdict result);
+static void send_icmp6_error(struct xlation *state, verdict result);
+
+/*
+ * Translates the subsequent fragments which were waiting for @state->in, the
+ * first fragment. (See fragcache.h.)
+ *
+ * The kernel already gave these up (they were NF_STOLEN when they were held),
+ * so they cannot be returned to it. Untranslatable fragments are therefore
+ * dropped here, with whatever ICMP error the translation requested.
+ */
+static void translate_pending(struct xlation *state,
+		struct sk_buff_head *pending)
+{
+	struct sendpkt_batch local;
+	struct sendpkt_batch *batch;
+	struct sk_buff *skb;
+	struct xlation *new;
+	bool ipv4;
+	verdict result;
+
+	if (skb_queue_empty(pending))
+		return;
+
+	ipv4 = pkt_l3_proto(&state->in) == L3PROTO_IPV4;
+	batch = get_batch(state, &local);
+
+	while ((skb = __skb_dequeue(pending)) != NULL) {
+		new = xlation_create(&state->jool);
+		if (!new) {
+			log_debug(state, "Cannot allocate the state of a held fragment; dropping it.");
+			jstat_inc(state->jool.stats, JSTAT_ENOMEM);
+			kfree_skb(skb);
+			continue;
+		}
+		new->debug = state->debug;
+		new->batch = batch;
+
+		trace_jool_xlat_start(new, skb);
+		log_debug(new, "Translating a fragment that was waiting for its first fragment.");
+
+		result = ipv4 ? core_4to6_skb(skb, new) : core_6to4_skb(skb, new);
+		if (result == VERDICT_UNTRANSLATABLE) {
+			log_debug(new, "The held fragment is untranslatable; dropping it.");
+			result = VERDICT_DROP;
+			if (ipv4)
+				send_icmp4_error(new, result);
+			else
+				send_icmp6_error(new, result);
+		}
+
+		trace_jool_xlat_end(new, result);
+		xlation_destroy(new);
+
+		if (result != VERDICT_STOLEN)
+			kfree_skb(skb);
+	}
+
+	put_batch(state, batch);
+}
+
+static verdict core_common(struct xlation *state)
+{
+	struct sk_buff_head pending;
+	verdict result;
+
+	__skb_queue_head_init(&pending);
+	result = __core_common(state, &pending);
+	translate_pending(state, &pending);
+
+	return result;
+}
+
+typedef verdict (*core_segment_fn)(struct sk_buff *, struct xlation *);
+
+/*
+ * Segments @state->in in software, and translates every segment as an
+ * independent packet. (See xlat_needs_segmentation().)
+ *
+ * The segments share the headers that decide translatability, so if the first
+ * one is untranslatable, so is the original packet, and it is returned to the
+ * kernel intact. Otherwise the original packet is consumed.
+ */
+static verdict translate_segments(struct xlation *state, core_segment_fn fn)
+{
+	struct sendpkt_batch local;
+	struct sendpkt_batch *batch;
+	struct sk_buff *segs;
+	struct sk_buff *seg;
+	struct sk_buff *next;
+	struct xlation *new;
+	bool first;
+	verdict result;
+
+	log_debug(state, "Segmenting the packet in software.");
+
+	segs = skb_gso_segment(state->in.skb, 0);
+	if (IS_ERR_OR_NULL(segs))
+		return drop(state, JSTAT_GSO_SEGMENT_FAILED);
+	jstat_inc(state->jool.stats, JSTAT_GSO_SEGMENTED);
+
+	batch = get_batch(state, &local);
+	first = true;
+	for (seg = segs; seg; seg = next) {
+		next = seg->next;
+		seg->next = NULL;
+
+		new = xlation_create(&state->jool);
+		if (!new) {
+			log_debug(state, "Cannot allocate the state of a segment; dropping it.");
+			jstat_inc(state->jool.stats, JSTAT_ENOMEM);
+			kfree_skb(seg);
+			first = false;
+			continue;
+		}
+		new->debug = state->debug;
+		new->batch = batch;
+
+		trace_jool_xlat_start(new, seg);
+		result = fn(seg, new);
+		trace_jool_xlat_end(new, result);
+		xlation_destroy(new);
+
+		if (result != VERDICT_STOLEN) {
+			kfree_skb(seg);
+			if (first && result == VERDICT_UNTRANSLATABLE) {
+				kfree_skb_list(next);
+				put_batch(state, batch);
+				return result;
+			}
+			log_debug(state, "A segment could not be translated; dropping it.");
+		}
+
+		first = false;
+	}
+
+	put_batch(state, batch);
 	kfree_skb(state->in.skb);
-	return stolen(state, JSTAT_SUCCESS);
+	return VERDICT_STOLEN;
 }
 
 static void send_icmp4_error(struct xlation *state, verdict result)
@@ -78,17 +303,37 @@ static void send_icmp4_error(struct xlation *state, verdict result)
 		return; /* Linux will decide what to do. */
 
 	success = icmp64_send4(&state->jool, state->in.skb,
-			state->result.icmp, state->result.info);
+			state->result.icmp, state->result.info,
+			state_debug(state));
 	jstat_inc(state->jool.stats, success
 			? JSTAT_ICMP4ERR_SUCCESS
 			: JSTAT_ICMP4ERR_FAILURE);
 }
 
+/*
+ * Translates a packet which was not received directly from the kernel. (One of
+ * the segments created by translate_segments(), or a held fragment.)
+ */
+static verdict core_4to6_skb(struct sk_buff *skb, struct xlation *state)
+{
+	verdict result;
+
+	result = pkt_init_ipv4(state, skb);
+	if (result == VERDICT_CONTINUE)
+		result = core_common(state);
+
+	send_icmp4_error(state, result);
+	return result;
+}
+
 verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 {
+	u64 start;
 	verdict result;
 
+	start = jhist_start();
 	jstat_inc(state->jool.stats, JSTAT_RECEIVED4);
+	trace_jool_xlat_start(state, skb);
 
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
@@ -99,6 +344,7 @@ verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
+	debug_filter_start(state);
 	log_debug(state, "===============================================");
 
 	/* Reminder: This function might change pointers. */
@@ -106,14 +352,19 @@ verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	debug_filter_apply(state);
+	if (state_debug(state))
 		pkt_trace4(state);
 
-	result = core_common(state);
+	result = xlat_needs_segmentation(state)
+			? translate_segments(state, core_4to6_skb)
+			: core_common(state);
+	jhist_end(state, JHIST_TOTAL, start);
 	/* Fall through */
 
 end:
 	send_icmp4_error(state, result);
+	trace_jool_xlat_end(state, result);
 	return result;
 }
 
@@ -127,17 +378,34 @@ static void send_icmp6_error(struct xlation *state, verdict result)
 		return; /* Linux will decide what to do. */
 
 	success = icmp64_send6(&state->jool, state->in.skb,
-			state->result.icmp, state->result.info);
+			state->result.icmp, state->result.info,
+			state_debug(state));
 	jstat_inc(state->jool.stats, success
 			? JSTAT_ICMP6ERR_SUCCESS
 			: JSTAT_ICMP6ERR_FAILURE);
 }
 
+/* Same as core_4to6_skb(), reversed. */
+static verdict core_6to4_skb(struct sk_buff *skb, struct xlation *state)
+{
+	verdict result;
+
+	result = pkt_init_ipv6(state, skb);
+	if (result == VERDICT_CONTINUE)
+		result = core_common(state);
+
+	send_icmp6_error(state, result);
+	return result;
+}
+
 verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 {
+	u64 start;
 	verdict result;
 
+	start = jhist_start();
 	jstat_inc(state->jool.stats, JSTAT_RECEIVED6);
+	trace_jool_xlat_start(state, skb);
 
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
@@ -148,6 +416,7 @@ verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
+	debug_filter_start(state);
 	log_debug(state, "===============================================");
 
 	/* Reminder: This function might change pointers. */
@@ -155,13 +424,18 @@ verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	debug_filter_apply(state);
+	if (state_debug(state))
 		pkt_trace6(state);
 
-	result = core_common(state);
+	result = xlat_needs_segmentation(state)
+			? translate_segments(state, core_6to4_skb)
+			: core_common(state);
+	jhist_end(state, JHIST_TOTAL, start);
 	/* Fall through */
 
 end:
 	send_icmp6_error(state, result);
+	trace_jool_xlat_end(state, result);
 	return result;
 }
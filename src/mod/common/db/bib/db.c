@@ -1,11 +1,16 @@
 #include "mod/common/db/bib/db.h"
 
 #include <linux/ktime.h>
+#include <linux/sort.h>
 #include <net/ip6_checksum.h>
 
 #include "common/constants.h"
+#include "mod/common/histogram.h"
 #include "mod/common/icmp_wrapper.h"
+#include "mod/common/joold.h"
 #include "mod/common/log.h"
+#include "mod/common/route.h"
+#include "mod/common/tracepoints.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/rbtree.h"
 #include "mod/common/db/bib/pkt_queue.h"
@@ -92,6 +97,22 @@ struct tabled_session {
 
 	/** See pke_queue.h for some thoughts on stored packets. */
 	struct sk_buff *stored;
+
+	/*
+	 * joold: Jiffy at which this session was last queued for replication,
+	 * and the state it had then. Only meaningful if @synced.
+	 * (See ss-min-readvertise-interval.)
+	 */
+	unsigned long sync_time;
+	tcp_state sync_state;
+	bool synced;
+	/*
+	 * joold: Jiffy at which this session was created, and number of
+	 * packets it has translated (saturates).
+	 * (See ss-min-age and ss-min-packets.)
+	 */
+	unsigned long creation_time;
+	unsigned int packets;
 };
 
 struct bib_session_tuple {
@@ -128,6 +149,8 @@ struct bib_table {
 	struct rb_root tree4;
 
 	spinlock_t lock;
+	/** Contention and hold time of @lock. (See the lock-stats global.) */
+	struct jlock_stats lstats;
 
 	/** Expires this table's established sessions. */
 	struct expire_timer est_timer;
@@ -271,6 +294,69 @@ static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
 	bs->session.proto = tabled->proto;
 }
 
+/*
+ * Has @ts lived long enough to be worth replicating?
+ * (See ss-min-age and ss-min-packets.)
+ */
+static bool sync_old_enough(struct joold_config const *cfg,
+		struct tabled_session *ts)
+{
+	if (cfg->min_packets && ts->packets < cfg->min_packets)
+		return false;
+	if (cfg->min_age && time_before(jiffies,
+			ts->creation_time + msecs_to_jiffies(cfg->min_age)))
+		return false;
+	return true;
+}
+
+/*
+ * Does joold need to replicate @ts (which was just updated by a packet)?
+ *
+ * Not if the replication policy excludes it, or it hasn't lived long enough
+ * yet. (In the latter case, it will be replicated by the first packet that
+ * finds it old enough.)
+ *
+ * Also not if the peers already have its current state, and it was replicated
+ * less than ss-min-readvertise-interval ago. The interval is capped at half the
+ * session's timeout, so the peers' copy never gets close to expiring.
+ */
+static bool sync_needed(struct xlation *state, struct tabled_session *ts)
+{
+	struct joold_config const *cfg;
+	unsigned long interval;
+
+	cfg = &state->jool.globals.nat64.joold;
+	if (ts->packets < UINT_MAX)
+		ts->packets++;
+
+	if (!joold_policy_allows(cfg, &state->entries.session)) {
+		jstat_inc(state->jool.stats, JSTAT_JOOLD_SSS_EXCLUDED);
+		return false;
+	}
+	if (!sync_old_enough(cfg, ts)) {
+		jstat_inc(state->jool.stats, JSTAT_JOOLD_SSS_YOUNG);
+		return false;
+	}
+
+	interval = cfg->min_readvertise_interval;
+	if (interval == 0)
+		return true;
+
+	if (ts->synced && ts->sync_state == ts->state) {
+		interval = min(msecs_to_jiffies(interval),
+				state->entries.session.timeout / 2);
+		if (time_before(jiffies, ts->sync_time + interval)) {
+			jstat_inc(state->jool.stats, JSTAT_JOOLD_SSS_UNCHANGED);
+			return false;
+		}
+	}
+
+	ts->sync_time = jiffies;
+	ts->sync_state = ts->state;
+	ts->synced = true;
+	return true;
+}
+
 /**
  * [Convert] tabled session to bib_session"
  */
@@ -279,6 +365,7 @@ static void tstobs(struct xlation *state, struct tabled_session *ts)
 	state->entries.bib_set = true;
 	state->entries.session_set = true;
 	tstose(&state->jool, ts, &state->entries.session);
+	state->entries.sync = sync_needed(state, ts);
 }
 
 /**
@@ -301,6 +388,24 @@ static struct bib_table *get_table(struct bib *db, l4_protocol proto)
 	return NULL;
 }
 
+struct jlock_stats *bib_lock_stats(struct bib *db, l4_protocol proto)
+{
+	struct bib_table *table;
+	table = get_table(db, proto);
+	return table ? &table->lstats : NULL;
+}
+
+/* Locks @table on behalf of @state's translation. */
+static void lock_table(struct xlation *state, struct bib_table *table,
+		enum jool_lock_site site)
+{
+	u64 start;
+
+	start = jhist_start();
+	jlock(&table->lock, &table->lstats, site);
+	jhist_end(state, JHIST_BIB_LOCK, start);
+}
+
 static void kill_stored_pkt(struct xlator *jool, struct bib_table *table,
 		struct tabled_session *session)
 {
@@ -367,6 +472,7 @@ static void init_table(struct bib_table *table,
 	table->tree6 = RB_ROOT;
 	table->tree4 = RB_ROOT;
 	spin_lock_init(&table->lock);
+	jlock_stats_init(&table->lstats);
 	init_expirer(&table->est_timer, est_timeout, SESSION_TIMER_EST, est_cb);
 
 	init_expirer(&table->trans_timer, trans_timeout, SESSION_TIMER_TRANS,
@@ -487,9 +593,16 @@ static void log_bib(struct xlator *jool, struct tabled_bib *bib, char *action)
 
 static void log_new_bib(struct xlator *jool, struct tabled_bib *bib)
 {
+	trace_jool_bib_add(jool->iname, &bib->src6, &bib->src4, bib->proto);
 	return log_bib(jool, bib, "Mapped");
 }
 
+static void log_rm_bib(struct xlator *jool, struct tabled_bib *bib)
+{
+	trace_jool_bib_rm(jool->iname, &bib->src6, &bib->src4, bib->proto);
+	return log_bib(jool, bib, "Forgot");
+}
+
 static void log_session(struct xlator *jool,
 		struct tabled_session *session,
 		char *action)
@@ -513,9 +626,20 @@ static void log_session(struct xlator *jool,
 
 static void log_new_session(struct xlator *jool, struct tabled_session *session)
 {
+	trace_jool_session_add(jool->iname, &session->bib->src6,
+			&session->dst6, &session->bib->src4, &session->dst4,
+			session->bib->proto);
 	return log_session(jool, session, "Added session");
 }
 
+static void log_rm_session(struct xlator *jool, struct tabled_session *session)
+{
+	trace_jool_session_rm(jool->iname, &session->bib->src6,
+			&session->dst6, &session->bib->src4, &session->dst4,
+			session->bib->proto);
+	return log_session(jool, session, "Forgot session");
+}
+
 /**
  * This function does not return a result because whatever needs to happen later
  * needs to happen regardless of probe status.
@@ -581,14 +705,14 @@ static void rm(struct xlator *jool,
 
 	rb_erase(&session->tree_hook, &bib->sessions);
 	list_del(&session->list_hook);
-	log_session(jool, session, "Forgot session");
+	log_rm_session(jool, session);
 	free_session(session);
 	jstat_dec(jool->stats, JSTAT_SESSIONS);
 
 	if (!bib->is_static && RB_EMPTY_ROOT(&bib->sessions)) {
 		rb_erase(&bib->hook6, &table->tree6);
 		rb_erase(&bib->hook4, &table->tree4);
-		log_bib(jool, bib, "Forgot");
+		log_rm_bib(jool, bib);
 		free_bib(bib);
 		jstat_dec(jool->stats, JSTAT_BIB_ENTRIES);
 	}
@@ -729,6 +853,7 @@ static void send_probe_packet(struct xlator *jool, struct session_entry *session
 	struct tcphdr *th;
 	struct flowi6 flow;
 	struct dst_entry *dst;
+	bool noref;
 	int error;
 
 	unsigned int l3_hdr_len = sizeof(*iph);
@@ -790,14 +915,18 @@ static void send_probe_packet(struct xlator *jool, struct session_entry *session
 	flow.fl6_sport = th->source;
 	flow.fl6_dport = th->dest;
 
-	dst = route6(jool, &flow);
-	if (!dst)
+	rcu_read_lock();
+	dst = route6(jool, &flow, &noref, xlator_debug(jool));
+	if (!dst) {
+		rcu_read_unlock();
 		goto revert;
+	}
 
-	skb_dst_set(skb, dst);
+	route_skb_set(skb, dst, noref);
 
 	/* Implicit kfree_skb(skb) here. */
 	error = dst_output(jool->ns, NULL, skb);
+	rcu_read_unlock();
 	if (error) {
 		__log_debug(jool, "dst_output() returned errcode %d.", error);
 		goto fail;
@@ -1020,6 +1149,9 @@ static int create_bib_session6(struct bib_session_tuple *tuple,
 	tuple->session->dst4 = *dst4;
 	tuple->session->state = state;
 	tuple->session->stored = NULL;
+	tuple->session->synced = false;
+	tuple->session->creation_time = jiffies;
+	tuple->session->packets = 0;
 	return 0;
 }
 
@@ -1041,6 +1173,9 @@ static struct tabled_session *create_session4(struct tuple *tuple4,
 	session->dst4 = tuple4->src.addr4;
 	session->state = state;
 	session->stored = NULL;
+	session->synced = false;
+	session->creation_time = jiffies;
+	session->packets = 0;
 	return session;
 }
 
@@ -1067,6 +1202,9 @@ static int create_bib_session(struct session_entry *session,
 	tuple->session->state = session->state;
 	tuple->session->update_time = session->update_time;
 	tuple->session->stored = NULL;
+	tuple->session->synced = false;
+	tuple->session->creation_time = jiffies;
+	tuple->session->packets = 0;
 	return 0;
 }
 
@@ -1601,7 +1739,7 @@ int bib_add6(struct xlation *state,
 	if (error)
 		return error;
 
-	spin_lock_bh(&table->lock); /* Here goes... */
+	lock_table(state, table, JLS_BIB_ADD6); /* Here goes... */
 
 	error = find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl);
 	if (error)
@@ -1618,7 +1756,7 @@ int bib_add6(struct xlation *state,
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_ADD6);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1666,7 +1804,7 @@ int bib_add4(struct xlation *state,
 	if (!new)
 		return -ENOMEM;
 
-	spin_lock_bh(&table->lock);
+	lock_table(state, table, JLS_BIB_ADD4);
 
 	find_bib_session4(table, tuple4, new, &old, &allow, &session_slot);
 
@@ -1692,7 +1830,7 @@ int bib_add4(struct xlation *state,
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_ADD4);
 	if (new)
 		free_session(new);
 	return error;
@@ -1723,7 +1861,7 @@ verdict bib_add_tcp6(struct xlation *state,
 		return drop(state, JSTAT_ENOMEM);
 
 	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
+	lock_table(state, table, JLS_BIB_ADD6);
 
 	if (find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl)) {
 		result = drop(state, JSTAT_UNKNOWN);
@@ -1762,7 +1900,7 @@ verdict bib_add_tcp6(struct xlation *state,
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_ADD6);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1798,7 +1936,7 @@ verdict bib_add_tcp4(struct xlation *state,
 		return drop(state, JSTAT_ENOMEM);
 
 	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
+	lock_table(state, table, JLS_BIB_ADD4);
 
 	find_bib_session4(table, &pkt->tuple, new, &old, NULL, &session_slot);
 
@@ -1882,7 +2020,7 @@ verdict bib_add_tcp4(struct xlation *state,
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_ADD4);
 
 	if (new)
 		free_session(new);
@@ -1890,7 +2028,7 @@ end:
 	return result;
 
 too_many_pkts:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_ADD4);
 	free_session(new);
 	log_debug(state, "Too many Simultaneous Opens.");
 	/* Fall back to assume there's no SO. */
@@ -1943,7 +2081,7 @@ int bib_add_session(struct xlator *jool,
 	if (error)
 		return error;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_SYNC);
 
 	error = find_bib_session6(jool, table, NULL, &new, &old, &slots, &bdl);
 	if (error)
@@ -1959,7 +2097,7 @@ int bib_add_session(struct xlator *jool,
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_SYNC);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1970,6 +2108,134 @@ end:
 	return error;
 }
 
+/*
+ * Maximum number of sessions bib_add_sessions() adds during a single hold of
+ * a table's lock.
+ */
+#define BIB_ADD_CHUNK 32
+
+/*
+ * Sorts by table, and then by the order in which the trees are searched.
+ * sort() is not stable, so updates of the same session are kept in arrival
+ * order explicitly. (The last one has to win.)
+ */
+static int compare_add_request(const void *a, const void *b)
+{
+	struct bib_add_request const *r1 = a;
+	struct bib_add_request const *r2 = b;
+	struct session_entry const *s1 = &r1->session;
+	struct session_entry const *s2 = &r2->session;
+	int gap;
+
+	gap = (int)s1->proto - (int)s2->proto;
+	if (gap)
+		return gap;
+	gap = taddr6_compare(&s1->src6, &s2->src6);
+	if (gap)
+		return gap;
+	gap = taddr4_compare(&s1->dst4, &s2->dst4);
+	if (gap)
+		return gap;
+	return (r1->order < r2->order) ? -1 : (r1->order > r2->order);
+}
+
+/*
+ * Adds @reqs (at most BIB_ADD_CHUNK, all of them @table's) during a single hold
+ * of @table's lock.
+ */
+static void add_session_chunk(struct xlator *jool, struct bib_table *table,
+		struct bib_add_request *reqs, unsigned int count, fate_cb cb)
+{
+	struct bib_session_tuple new[BIB_ADD_CHUNK];
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	struct bib_delete_list bdl = { NULL };
+	struct collision_cb collision;
+	unsigned int i;
+
+	/* Allocate everything before locking. */
+	for (i = 0; i < count; i++) {
+		reqs[i].error = create_bib_session(&reqs[i].session, &new[i]);
+		if (reqs[i].error) {
+			new[i].bib = NULL;
+			new[i].session = NULL;
+		}
+	}
+
+	collision.cb = cb;
+
+	jlock(&table->lock, &table->lstats, JLS_BIB_SYNC);
+
+	for (i = 0; i < count; i++) {
+		if (reqs[i].error)
+			continue;
+
+		reqs[i].error = find_bib_session6(jool, table, NULL, &new[i],
+				&old, &slots, &bdl);
+		if (reqs[i].error)
+			continue;
+
+		if (old.session) {
+			/* There's no packet; ignore the verdict. */
+			collision.arg = &reqs[i];
+			decide_fate(jool, &collision, table, old.session, NULL);
+			continue;
+		}
+
+		reqs[i].error = commit_add(jool, table, &old, &new[i], &slots,
+				reqs[i].session.timer_type);
+	}
+
+	junlock(&table->lock, &table->lstats, JLS_BIB_SYNC);
+
+	for (i = 0; i < count; i++) {
+		if (new[i].bib)
+			free_bib(new[i].bib);
+		if (new[i].session)
+			free_session(new[i].session);
+	}
+	commit_delete_list(&bdl);
+}
+
+/**
+ * bib_add_sessions - Same as bib_add_session(), except for @count sessions at
+ * once. (Meant for joold, which receives them in bulk.)
+ *
+ * Sorts @reqs, and then adds them in chunks; each chunk only takes its table's
+ * lock once.
+ * If a session already exists, @cb is called with its request as argument.
+ * The result of each request is left in its @error field.
+ */
+void bib_add_sessions(struct xlator *jool, struct bib_add_request *reqs,
+		unsigned int count, fate_cb cb)
+{
+	struct bib_table *table;
+	unsigned int start;
+	unsigned int end;
+
+	for (start = 0; start < count; start++)
+		reqs[start].order = start;
+	sort(reqs, count, sizeof(*reqs), compare_add_request, NULL);
+
+	for (start = 0; start < count; start = end) {
+		table = get_table(jool->nat64.bib, reqs[start].session.proto);
+		for (end = start + 1; end < count; end++) {
+			if (end - start >= BIB_ADD_CHUNK)
+				break;
+			if (reqs[end].session.proto != reqs[start].session.proto)
+				break;
+		}
+
+		if (table) {
+			add_session_chunk(jool, table, &reqs[start],
+					end - start, cb);
+		} else {
+			for (; start < end; start++)
+				reqs[start].error = -EINVAL;
+		}
+	}
+}
+
 static void __clean(struct xlator *jool,
 		struct expire_timer *expirer,
 		struct bib_table *table,
@@ -2000,7 +2266,7 @@ static void clean_table(struct xlator *jool, struct bib_table *table)
 	LIST_HEAD(probes);
 	LIST_HEAD(icmps);
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_CLEAN);
 	__clean(jool, &table->est_timer, table, &probes);
 	__clean(jool, &table->trans_timer, table, &probes);
 	__clean(jool, &table->syn4_timer, table, &probes);
@@ -2008,7 +2274,7 @@ static void clean_table(struct xlator *jool, struct bib_table *table)
 		table->pkt_count -= pktqueue_prepare_clean(table->pkt_queue,
 				&icmps);
 	}
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CLEAN);
 
 	post_fate(jool, &probes);
 	pktqueue_clean(&icmps);
@@ -2069,7 +2335,7 @@ int bib_foreach(struct bib *db, l4_protocol proto,
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_FOREACH);
 
 	node = find_starting_point(table, offset, false);
 	for (; node && !error; node = rb_next(node)) {
@@ -2078,7 +2344,7 @@ int bib_foreach(struct bib *db, l4_protocol proto,
 		error = cb(&bib, cb_arg);
 	}
 
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_FOREACH);
 	return error;
 }
 
@@ -2172,7 +2438,7 @@ int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_FOREACH);
 
 	if (offset) {
 		find_session_offset(table, offset, &pos);
@@ -2194,7 +2460,7 @@ goto_session:		tstose(jool, pos.session, &tmp);
 	}
 
 end:
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_FOREACH);
 	return error;
 }
 
@@ -2212,11 +2478,11 @@ int bib_find6(struct bib *db, l4_protocol proto,
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_FIND);
 	bib = find_bib6(table, addr);
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_FIND);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2232,11 +2498,11 @@ int bib_find4(struct bib *db, l4_protocol proto,
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_FIND);
 	bib = find_bib4(table, addr);
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_FIND);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2270,7 +2536,7 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 		return -ENOMEM;
 	bib2tabled(new, bib);
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	collision = find_bibtree6_slot(table, bib, &slot6);
 	if (collision) {
@@ -2296,18 +2562,18 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 	if (new->l4_proto == L4PROTO_TCP)
 		pktqueue_rm(jool->nat64.bib->tcp.pkt_queue, &new->addr4);
 
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 	return 0;
 
 upgrade:
 	collision->is_static = true;
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 	free_bib(bib);
 	return 0;
 
 eexist:
 	tbtobe(collision, old);
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 	free_bib(bib);
 	return -EEXIST;
 }
@@ -2347,7 +2613,7 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 
 	bib2tabled(entry, &key);
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	bib = find_bib6(table, &key.src6);
 	if (bib && taddr4_equals(&key.src4, &bib->src4)) {
@@ -2355,7 +2621,7 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 		error = 0;
 	}
 
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	if (!error)
 		release_bib_entry(bib);
@@ -2380,7 +2646,7 @@ void bib_rm_range(struct xlator *jool, l4_protocol proto,
 	offset.l3 = range->prefix.addr;
 	offset.l4 = range->ports.min;
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	node = find_starting_point(table, &offset, true);
 	for (; node; node = next) {
@@ -2395,7 +2661,7 @@ void bib_rm_range(struct xlator *jool, l4_protocol proto,
 		}
 	}
 
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	commit_delete_list(&delete_list);
 }
@@ -2406,7 +2672,7 @@ static void flush_table(struct xlator *jool, struct bib_table *table)
 	struct rb_node *next;
 	struct bib_delete_list delete_list = { NULL };
 
-	spin_lock_bh(&table->lock);
+	jlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	for (node = rb_first(&table->tree4); node; node = next) {
 		next = rb_next(node);
@@ -2414,7 +2680,7 @@ static void flush_table(struct xlator *jool, struct bib_table *table)
 		add_to_delete_list(&delete_list, node);
 	}
 
-	spin_unlock_bh(&table->lock);
+	junlock(&table->lock, &table->lstats, JLS_BIB_CONFIG);
 
 	commit_delete_list(&delete_list);
 }
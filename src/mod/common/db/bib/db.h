@@ -8,6 +8,7 @@
  */
 
 #include "common/config.h"
+#include "mod/common/lock_stats.h"
 #include "mod/common/packet.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/db/pool4/db.h"
@@ -63,6 +64,8 @@ struct bib *bib_alloc(void);
 void bib_get(struct bib *db);
 void bib_put(struct bib *db);
 
+struct jlock_stats *bib_lock_stats(struct bib *db, l4_protocol proto);
+
 typedef enum session_fate (*fate_cb)(struct session_entry *, void *);
 
 struct collision_cb {
@@ -98,6 +101,21 @@ int bib_find(struct bib *db, struct tuple *tuple,
 		struct bib_session *result);
 int bib_add_session(struct xlator *jool, struct session_entry *new,
 		struct collision_cb *cb);
+
+/* One of the sessions bib_add_sessions() is supposed to add. */
+struct bib_add_request {
+	struct session_entry session;
+	/*
+	 * Output: bib_add_session()'s result for @session. The collision
+	 * callback can also use it to report failure.
+	 */
+	int error;
+	/* Private; keeps the requests in arrival order while they're sorted. */
+	unsigned int order;
+};
+
+void bib_add_sessions(struct xlator *jool, struct bib_add_request *reqs,
+		unsigned int count, fate_cb cb);
 void bib_clean(struct xlator *jool);
 
 /* These are used by userspace request handling. */
@@ -79,6 +79,11 @@ struct bib_session {
 	 */
 	bool session_set;
 	struct session_entry session;
+	/**
+	 * Does joold need to replicate @session? (Only meaningful if
+	 * @session_set.)
+	 */
+	bool sync;
 };
 
 bool session_equals(const struct session_entry *s1,
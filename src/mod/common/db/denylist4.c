@@ -4,6 +4,7 @@
 #include "mod/common/address.h"
 #include "mod/common/log.h"
 #include "mod/common/rcu.h"
+#include "mod/common/rtrie.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 
@@ -12,8 +13,25 @@ struct pool_entry {
 	struct list_head list_hook;
 };
 
+#define INIT_KEY(ptr, length)	{ .bytes = (__u8 *)(ptr), .len = length }
+#define ADDR_TO_KEY(addr)	INIT_KEY(addr, 8 * sizeof(*addr))
+
+/*
+ * The same prefixes are stored twice:
+ *
+ * - @list keeps them in insertion order, which is what the user sees when
+ *   foreaching.
+ * - @trie indexes them by prefix, so the packet path can find out whether an
+ *   address is denylisted with a longest prefix match rather than a linear
+ *   walk.
+ *
+ * Both are updated under @lock, and both are RCU-friendly. As in the EAMT,
+ * there might be small windows in which a prefix shows up in one of them but
+ * not in the other; this is fine.
+ */
 struct addr4_pool {
 	struct list_head __rcu *list;
+	struct rtrie trie;
 	struct kref refcounter;
 };
 
@@ -53,6 +71,7 @@ struct addr4_pool *denylist4_alloc(void)
 	}
 
 	RCU_INIT_POINTER(result->list, list);
+	rtrie_init(&result->trie, sizeof(struct ipv4_prefix), &lock);
 	kref_init(&result->refcounter);
 
 	return result;
@@ -81,6 +100,7 @@ static void pool_release(struct kref *refcounter)
 	struct addr4_pool *pool;
 	pool = container_of(refcounter, struct addr4_pool, refcounter);
 	__destroy(rcu_dereference_raw(pool->list));
+	rtrie_clean(&pool->trie);
 	wkfree(struct addr4_pool, pool);
 }
 
@@ -90,7 +110,7 @@ void denylist4_put(struct addr4_pool *pool)
 }
 
 int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
-		bool force)
+		bool force, bool synchronize)
 {
 	struct list_head *list;
 	struct pool_entry *entry;
@@ -103,21 +123,36 @@ int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
 	if (error)
 		return error;
 
+	entry = wkmalloc(struct pool_entry, GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
+	entry->prefix = *prefix;
+
 	mutex_lock(&lock);
 
-	entry = wkmalloc(struct pool_entry, GFP_KERNEL);
-	if (!entry) {
-		error = -ENOMEM;
-		goto end;
+	error = rtrie_add(&pool->trie, &entry->prefix,
+			offsetof(struct ipv4_prefix, addr), prefix->len,
+			synchronize);
+	if (error) {
+		mutex_unlock(&lock);
+		wkfree(struct pool_entry, entry);
+		/*
+		 * The list used to accept duplicates, and configuration files
+		 * out there might contain them. Don't break them.
+		 */
+		if (error == -EEXIST) {
+			log_info("%pI4/%u is already denylisted; ignoring.",
+					&prefix->addr, prefix->len);
+			return 0;
+		}
+		return error;
 	}
-	entry->prefix = *prefix;
 
 	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
 	list_add_tail_rcu(&entry->list_hook, list);
 
-end:
 	mutex_unlock(&lock);
-	return error;
+	return 0;
 }
 
 int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix)
@@ -125,6 +160,8 @@ int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix)
 	struct list_head *list;
 	struct list_head *node;
 	struct pool_entry *entry;
+	struct rtrie_key key;
+	int error;
 
 	mutex_lock(&lock);
 
@@ -132,6 +169,13 @@ int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix)
 	list_for_each(node, list) {
 		entry = get_entry(node);
 		if (prefix4_equals(prefix, &entry->prefix)) {
+			key.bytes = (__u8 *)&entry->prefix.addr;
+			key.len = entry->prefix.len;
+			error = rtrie_rm(&pool->trie, &key, true);
+			if (error) {
+				mutex_unlock(&lock);
+				return error;
+			}
 			list_del_rcu(&entry->list_hook);
 			mutex_unlock(&lock);
 			synchronize_rcu_bh();
@@ -157,6 +201,7 @@ int denylist4_flush(struct addr4_pool *pool)
 	mutex_lock(&lock);
 	old = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
 	rcu_assign_pointer(pool->list, new);
+	rtrie_flush(&pool->trie);
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
@@ -165,36 +210,6 @@ int denylist4_flush(struct addr4_pool *pool)
 	return 0;
 }
 
-#define ALLOW_ADDRESS false
-#define DENY_ADDRESS true
-
-/* "Check interface address" */
-static int check_ifa(struct in_ifaddr *ifa, void const *arg)
-{
-	struct in_addr const *query = arg;
-	struct in_addr ifaddr;
-
-	/* Broadcast */
-	/* (RFC3021: /31 and /32 networks lack broadcast) */
-	if (ifa->ifa_prefixlen < 31) {
-		ifaddr.s_addr = ifa->ifa_local | ~ifa->ifa_mask;
-		if (ipv4_addr_cmp(&ifaddr, query) == 0)
-			return DENY_ADDRESS;
-	}
-
-	/* /32 (https://github.com/NICMx/Jool/issues/342) */
-	if (ifa->ifa_prefixlen == 32)
-		return ALLOW_ADDRESS;
-
-	/* Address belongs to this node */
-	ifaddr.s_addr = ifa->ifa_local;
-	if (ipv4_addr_cmp(&ifaddr, query) == 0)
-		return DENY_ADDRESS;
-
-	/* Anything else */
-	return ALLOW_ADDRESS;
-}
-
 /**
  * Is @addr *NOT* translatable, according to the interfaces?
  *
@@ -205,28 +220,13 @@ static int check_ifa(struct in_ifaddr *ifa, void const *arg)
  */
 bool interface_contains(struct net *ns, struct in_addr *addr)
 {
-	return foreach_ifa(ns, check_ifa, addr);
+	return ifa4_lookup(ns, addr) & (IFA4_LOCAL | IFA4_BROADCAST);
 }
 
 bool denylist4_contains(struct addr4_pool *pool, struct in_addr *addr)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
-
-	rcu_read_lock_bh();
-
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
-		if (prefix4_contains(&entry->prefix, addr)) {
-			rcu_read_unlock_bh();
-			return true;
-		}
-	}
-
-	rcu_read_unlock_bh();
-	return false;
+	struct rtrie_key key = ADDR_TO_KEY(addr);
+	return rtrie_contains(&pool->trie, &key);
 }
 
 int denylist4_foreach(struct addr4_pool *pool,
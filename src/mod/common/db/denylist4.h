@@ -14,7 +14,7 @@ void denylist4_get(struct addr4_pool *pool);
 void denylist4_put(struct addr4_pool *pool);
 
 int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
-		bool force);
+		bool force, bool synchronize);
 int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix);
 int denylist4_flush(struct addr4_pool *pool);
 
@@ -0,0 +1,403 @@
+#include "mod/common/db/fragcache.h"
+
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/random.h>
+
+#include "common/constants.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+
+/*
+ * Identifies a fragmented packet. (RFC 791 section 3.2 and RFC 8200 section
+ * 4.5.)
+ *
+ * Has to be zeroed before it's filled, because it is hashed and compared as a
+ * blob.
+ */
+struct fragcache_key {
+	union {
+		struct {
+			struct in_addr src;
+			struct in_addr dst;
+		} v4;
+		struct {
+			struct in6_addr src;
+			struct in6_addr dst;
+		} v6;
+	} addrs;
+	__u32 id;
+	__u8 l3_proto;
+	__u8 l4_proto;
+};
+
+struct fragcache_entry {
+	struct fragcache_key key;
+
+	/* Have the following tuples been computed yet? */
+	bool ready;
+	struct tuple in;
+	struct tuple out;
+
+	/* Subsequent fragments that arrived before the first one. */
+	struct sk_buff_head pending;
+
+	unsigned long expires;
+	struct hlist_node hash_hook;
+	/* Links this entry to fragcache.list. */
+	struct list_head list_hook;
+};
+
+#define FRAGCACHE_HASH_BITS 10
+
+struct fragcache {
+	DECLARE_HASHTABLE(table, FRAGCACHE_HASH_BITS);
+	/*
+	 * The same entries, sorted by expiration date. (oldest to newest)
+	 * Every entry lives the same amount of time, so adding to the tail
+	 * keeps this sorted.
+	 */
+	struct list_head list;
+	unsigned int count;
+	/* Sum of the lengths of every entry's pending queue. */
+	unsigned int pending;
+	u32 seed;
+
+	spinlock_t lock;
+	struct kref refcounter;
+};
+
+static unsigned long get_timeout(void)
+{
+	return msecs_to_jiffies(1000 * FRAGCACHE_TIMEOUT);
+}
+
+struct fragcache *fragcache_alloc(void)
+{
+	struct fragcache *result;
+
+	result = wkmalloc(struct fragcache, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	hash_init(result->table);
+	INIT_LIST_HEAD(&result->list);
+	result->count = 0;
+	result->pending = 0;
+	result->seed = get_random_u32();
+	spin_lock_init(&result->lock);
+	kref_init(&result->refcounter);
+
+	return result;
+}
+
+void fragcache_get(struct fragcache *cache)
+{
+	kref_get(&cache->refcounter);
+}
+
+/* Moves @entry's pending fragments to @garbage, and forgets @entry. */
+static void rm(struct fragcache *cache, struct fragcache_entry *entry,
+		struct sk_buff_head *garbage)
+{
+	cache->pending -= skb_queue_len(&entry->pending);
+	skb_queue_splice_tail_init(&entry->pending, garbage);
+	hash_del(&entry->hash_hook);
+	list_del(&entry->list_hook);
+	cache->count--;
+	wkfree(struct fragcache_entry, entry);
+}
+
+static void cache_release(struct kref *refcounter)
+{
+	struct fragcache *cache;
+	struct fragcache_entry *entry, *tmp;
+	struct sk_buff_head garbage;
+
+	cache = container_of(refcounter, struct fragcache, refcounter);
+
+	__skb_queue_head_init(&garbage);
+	list_for_each_entry_safe(entry, tmp, &cache->list, list_hook)
+		rm(cache, entry, &garbage);
+	__skb_queue_purge(&garbage);
+
+	wkfree(struct fragcache, cache);
+}
+
+void fragcache_put(struct fragcache *cache)
+{
+	kref_put(&cache->refcounter, cache_release);
+}
+
+static void build_key(struct packet const *pkt, struct fragcache_key *key)
+{
+	struct iphdr *hdr4;
+	struct ipv6hdr *hdr6;
+
+	memset(key, 0, sizeof(*key));
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		hdr6 = pkt_ip6_hdr(pkt);
+		key->addrs.v6.src = hdr6->saddr;
+		key->addrs.v6.dst = hdr6->daddr;
+		key->id = be32_to_cpu(pkt_frag_hdr(pkt)->identification);
+		break;
+	case L3PROTO_IPV4:
+		hdr4 = pkt_ip4_hdr(pkt);
+		key->addrs.v4.src.s_addr = hdr4->saddr;
+		key->addrs.v4.dst.s_addr = hdr4->daddr;
+		key->id = be16_to_cpu(hdr4->id);
+		break;
+	}
+
+	key->l3_proto = pkt_l3_proto(pkt);
+	key->l4_proto = pkt_l4_proto(pkt);
+}
+
+static u32 hash_key(struct fragcache *cache, struct fragcache_key const *key)
+{
+	BUILD_BUG_ON(sizeof(*key) % sizeof(u32));
+	return jhash2((u32 const *)key, sizeof(*key) / sizeof(u32), cache->seed);
+}
+
+static struct fragcache_entry *find(struct fragcache *cache,
+		struct fragcache_key const *key, u32 hash)
+{
+	struct fragcache_entry *entry;
+
+	hash_for_each_possible(cache->table, entry, hash_hook, hash)
+		if (memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+
+	return NULL;
+}
+
+/* Forgets the expired entries. */
+static void expire(struct fragcache *cache, struct sk_buff_head *garbage)
+{
+	struct fragcache_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, &cache->list, list_hook) {
+		if (time_before(jiffies, entry->expires))
+			return;
+		rm(cache, entry, garbage);
+	}
+}
+
+static struct fragcache_entry *create(struct fragcache *cache,
+		struct fragcache_key const *key, u32 hash,
+		struct sk_buff_head *garbage)
+{
+	struct fragcache_entry *entry;
+
+	/* Make room by forgetting the oldest one. */
+	if (cache->count >= FRAGCACHE_MAX_ENTRIES) {
+		rm(cache, list_first_entry(&cache->list,
+				struct fragcache_entry, list_hook), garbage);
+	}
+
+	entry = wkmalloc(struct fragcache_entry, GFP_ATOMIC);
+	if (!entry)
+		return NULL;
+
+	entry->key = *key;
+	entry->ready = false;
+	__skb_queue_head_init(&entry->pending);
+	entry->expires = jiffies + get_timeout();
+	hash_add(cache->table, &entry->hash_hook, hash);
+	list_add_tail(&entry->list_hook, &cache->list);
+	cache->count++;
+
+	return entry;
+}
+
+/*
+ * Fragments that had to be discarded are supposed to be released outside of
+ * the spinlock.
+ */
+static void purge(struct xlator *jool, struct sk_buff_head *garbage)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(garbage)) != NULL) {
+		jstat_inc(jool->stats, JSTAT_FRAGCACHE_FULL);
+		kfree_skb(skb);
+	}
+}
+
+/*
+ * 0: Found; @in and @out were initialized.
+ * 1: Not found; @skb was held.
+ * -ENOSPC: Not found, and @skb could not be held. (Also if @skb is NULL.)
+ */
+static int fetch_or_hold(struct fragcache *cache,
+		struct fragcache_key const *key, struct sk_buff *skb,
+		struct tuple *in, struct tuple *out,
+		struct sk_buff_head *garbage)
+{
+	struct fragcache_entry *entry;
+	u32 hash;
+	int result;
+
+	hash = hash_key(cache, key);
+
+	spin_lock_bh(&cache->lock);
+	expire(cache, garbage);
+
+	entry = find(cache, key, hash);
+	if (entry && entry->ready) {
+		*in = entry->in;
+		*out = entry->out;
+		result = 0;
+		goto end;
+	}
+
+	if (!skb || cache->pending >= FRAGCACHE_MAX_PENDING) {
+		result = -ENOSPC;
+		goto end;
+	}
+	if (!entry) {
+		entry = create(cache, key, hash, garbage);
+		if (!entry) {
+			result = -ENOSPC;
+			goto end;
+		}
+	}
+
+	/*
+	 * The fragment does not hold a reference to its device, which might
+	 * unregister while the fragment waits. So, like the kernel's defrag,
+	 * remember the index instead. (See restore_devs().)
+	 */
+	skb->skb_iif = skb->dev ? skb->dev->ifindex : 0;
+	skb->dev = NULL;
+
+	__skb_queue_tail(&entry->pending, skb);
+	cache->pending++;
+	result = 1;
+	/* Fall through */
+
+end:
+	spin_unlock_bh(&cache->lock);
+	return result;
+}
+
+static void store(struct fragcache *cache, struct fragcache_key const *key,
+		struct tuple const *in, struct tuple const *out,
+		struct sk_buff_head *pending, struct sk_buff_head *garbage)
+{
+	struct fragcache_entry *entry;
+	u32 hash;
+
+	hash = hash_key(cache, key);
+
+	spin_lock_bh(&cache->lock);
+	expire(cache, garbage);
+
+	entry = find(cache, key, hash);
+	if (entry) {
+		entry->expires = jiffies + get_timeout();
+		list_move_tail(&entry->list_hook, &cache->list);
+	} else {
+		entry = create(cache, key, hash, garbage);
+		if (!entry)
+			goto end;
+	}
+
+	entry->ready = true;
+	entry->in = *in;
+	entry->out = *out;
+
+	cache->pending -= skb_queue_len(&entry->pending);
+	skb_queue_splice_tail_init(&entry->pending, pending ? pending : garbage);
+	/* Fall through */
+
+end:
+	spin_unlock_bh(&cache->lock);
+}
+
+/*
+ * Gives the released fragments their devices back. The ones whose device is
+ * gone are moved to @garbage.
+ *
+ * Has to be called in an RCU read-side critical section. (The packet path.)
+ */
+static void restore_devs(struct net *ns, struct sk_buff_head *pending,
+		struct sk_buff_head *garbage)
+{
+	struct sk_buff *skb, *tmp;
+
+	skb_queue_walk_safe(pending, skb, tmp) {
+		if (!skb->skb_iif)
+			continue;
+		skb->dev = dev_get_by_index_rcu(ns, skb->skb_iif);
+		if (!skb->dev) {
+			__skb_unlink(skb, pending);
+			__skb_queue_tail(garbage, skb);
+		}
+	}
+}
+
+verdict fragcache_find(struct xlation *state)
+{
+	struct fragcache_key key;
+	struct sk_buff_head garbage;
+	int error;
+
+	build_key(&state->in, &key);
+	__skb_queue_head_init(&garbage);
+
+	/*
+	 * Hairpinned fragments cannot be held, because the caller owns them.
+	 * (Their first fragment is always translated first anyway.)
+	 */
+	error = fetch_or_hold(state->jool.nat64.fragcache, &key,
+			state->is_hairpin ? NULL : state->in.skb,
+			&state->in.tuple, &state->out.tuple, &garbage);
+	purge(&state->jool, &garbage);
+
+	switch (error) {
+	case 0:
+		log_debug(state, "Fragment cache hit.");
+		jstat_inc(state->jool.stats, JSTAT_FRAGCACHE_HIT);
+		return VERDICT_CONTINUE;
+	case 1:
+		log_debug(state, "The first fragment hasn't arrived yet; holding the packet.");
+		return stolen(state, JSTAT_FRAGCACHE_QUEUED);
+	}
+
+	log_debug(state, "Fragment cache miss, and cannot hold the packet.");
+	return drop(state, JSTAT_FRAGCACHE_MISS);
+}
+
+void fragcache_add(struct xlation *state, struct sk_buff_head *pending)
+{
+	struct fragcache_key key;
+	struct sk_buff_head garbage;
+
+	build_key(&state->in, &key);
+	__skb_queue_head_init(&garbage);
+
+	store(state->jool.nat64.fragcache, &key, &state->in.tuple,
+			&state->out.tuple, pending, &garbage);
+	if (pending)
+		restore_devs(state->jool.ns, pending, &garbage);
+	purge(&state->jool, &garbage);
+}
+
+void fragcache_clean(struct xlator *jool)
+{
+	struct fragcache *cache = jool->nat64.fragcache;
+	struct sk_buff_head garbage;
+
+	__skb_queue_head_init(&garbage);
+
+	spin_lock_bh(&cache->lock);
+	expire(cache, &garbage);
+	spin_unlock_bh(&cache->lock);
+
+	purge(jool, &garbage);
+}
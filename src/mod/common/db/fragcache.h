@@ -0,0 +1,57 @@
+#ifndef SRC_MOD_COMMON_DB_FRAGCACHE_H_
+#define SRC_MOD_COMMON_DB_FRAGCACHE_H_
+
+/**
+ * @file
+ * Fragment cache. Only used by NAT64 instances, and only when the module was
+ * inserted with defrag=0.
+ *
+ * Normally, nf_defrag_ipv4 and nf_defrag_ipv6 reassemble every fragmented
+ * packet before it reaches Jool, so the ports (which NAT64 needs to find the
+ * session) are always available. Without them, only the first fragment of each
+ * packet contains the layer 4 header.
+ *
+ * So, when a first fragment is translated, this module remembers its tuples,
+ * indexed by (src address, dst address, protocol, fragment ID). Subsequent
+ * fragments are then translated using those tuples, without going through the
+ * BIB/session steps.
+ *
+ * Subsequent fragments that arrive before their first fragment are held until
+ * it arrives, or until their entry expires. (Which is the only case in which
+ * anything resembling reassembly still happens.)
+ *
+ * Entries are short-lived (FRAGCACHE_TIMEOUT) and bounded
+ * (FRAGCACHE_MAX_ENTRIES, FRAGCACHE_MAX_PENDING).
+ */
+
+#include <linux/skbuff.h>
+#include "mod/common/translation_state.h"
+
+struct fragcache;
+
+struct fragcache *fragcache_alloc(void);
+void fragcache_get(struct fragcache *cache);
+void fragcache_put(struct fragcache *cache);
+
+/**
+ * Assumes @state->in is a subsequent fragment.
+ *
+ * VERDICT_CONTINUE: @state's tuples were recovered from the first fragment.
+ * VERDICT_STOLEN: The first fragment hasn't arrived yet; the packet was held.
+ * VERDICT_DROP: The first fragment hasn't arrived yet, and the packet could
+ *	not be held. (Cache is full, or the packet is hairpinned.)
+ */
+verdict fragcache_find(struct xlation *state);
+/**
+ * Assumes @state->in is a first fragment, and its tuples have already been
+ * computed. Remembers them.
+ *
+ * The subsequent fragments which were held waiting for this packet are moved
+ * to @pending; the caller should translate them now. (If @pending is NULL,
+ * they are dropped.)
+ */
+void fragcache_add(struct xlation *state, struct sk_buff_head *pending);
+
+void fragcache_clean(struct xlator *jool);
+
+#endif /* SRC_MOD_COMMON_DB_FRAGCACHE_H_ */
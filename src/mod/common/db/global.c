@@ -79,6 +79,14 @@ int globals_init(struct jool_globals *config, xlator_type type,
 	config->lowest_ipv6_mtu = DEFAULT_LOWEST_IPV6_MTU;
 	memcpy(config->plateaus.values, &PLATEAUS, sizeof(PLATEAUS));
 	config->plateaus.count = ARRAY_SIZE(PLATEAUS);
+	config->xlat_in_place = DEFAULT_XLAT_IN_PLACE;
+	config->debug_filter.prefix6.set = false;
+	config->debug_filter.prefix4.set = false;
+	config->debug_filter.proto = 0;
+	config->debug_filter.port = 0;
+	config->debug_filter.mark = 0;
+	config->debug_filter.rate = DEFAULT_DEBUG_RATE;
+	config->latency_histograms = DEFAULT_LATENCY_HISTOGRAMS;
 
 	switch (type) {
 	case XT_SIIT:
@@ -94,6 +102,7 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.src_icmp6errs_better = DEFAULT_SRC_ICMP6ERRS_BETTER;
 		config->nat64.f_args = DEFAULT_F_ARGS;
 		config->nat64.handle_rst_during_fin_rcv = DEFAULT_HANDLE_FIN_RCV_RST;
+		config->nat64.lock_stats = DEFAULT_LOCK_STATS;
 
 		config->nat64.bib.ttl.tcp_est = 1000 * TCP_EST;
 		config->nat64.bib.ttl.tcp_trans = 1000 * TCP_TRANS;
@@ -111,6 +120,20 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.joold.capacity = DEFAULT_JOOLD_CAPACITY;
 		config->nat64.joold.max_payload = DEFAULT_JOOLD_MAX_PAYLOAD;
 		config->nat64.joold.max_sessions_per_pkt = DEFAULT_JOOLD_MAX_SESSIONS_PER_PKT;
+		config->nat64.joold.window = DEFAULT_JOOLD_WINDOW;
+		config->nat64.joold.compact = DEFAULT_JOOLD_COMPACT;
+		config->nat64.joold.lz4 = DEFAULT_JOOLD_LZ4;
+		config->nat64.joold.min_readvertise_interval = DEFAULT_JOOLD_MIN_READVERTISE_INTERVAL;
+		config->nat64.joold.min_age = DEFAULT_JOOLD_MIN_AGE;
+		config->nat64.joold.min_packets = DEFAULT_JOOLD_MIN_PACKETS;
+		config->nat64.joold.tcp = true;
+		config->nat64.joold.udp = true;
+		config->nat64.joold.icmp = true;
+		config->nat64.joold.include_ports.min = 0;
+		config->nat64.joold.include_ports.max = 65535;
+		/* Empty */
+		config->nat64.joold.exclude_ports.min = 65535;
+		config->nat64.joold.exclude_ports.max = 0;
 		break;
 
 	default:
@@ -94,6 +94,7 @@ struct pool4 {
 	struct pool4_trees tree_addr;
 
 	spinlock_t lock;
+	struct jlock_stats lstats;
 	struct kref refcounter;
 };
 
@@ -276,6 +277,7 @@ struct pool4 *pool4db_alloc(void)
 	result->tree_addr.udp = RB_ROOT;
 	result->tree_addr.icmp = RB_ROOT;
 	spin_lock_init(&result->lock);
+	jlock_stats_init(&result->lstats);
 	kref_init(&result->refcounter);
 
 	return result;
@@ -322,6 +324,11 @@ void pool4db_put(struct pool4 *pool)
 	kref_put(&pool->refcounter, pool4db_release);
 }
 
+struct jlock_stats *pool4db_lock_stats(struct pool4 *pool)
+{
+	return &pool->lstats;
+}
+
 static int max_iterations_validate(__u8 flags, __u32 iterations)
 {
 	bool automatic = flags & ITERATIONS_AUTO;
@@ -590,14 +597,14 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry,
 
 	addend.prefix.len = 32;
 	foreach_addr4(addend.prefix.addr, tmp, &entry->range.prefix) {
-		spin_lock_bh(&pool->lock);
+		jlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 		error = add_to_mark_tree(pool, entry, &addend);
 		if (!error) {
 			error = add_to_addr_tree(pool, entry, &addend);
 			if (error)
 				goto trainwreck;
 		}
-		spin_unlock_bh(&pool->lock);
+		junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 		if (error)
 			return error;
 	}
@@ -605,7 +612,7 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry,
 	return 0;
 
 trainwreck:
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 	/*
 	 * We're in a serious conundrum.
 	 * We cannot revert the add_to_mark_tree() because of port range fusing;
@@ -630,17 +637,17 @@ int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 	if (error)
 		return error;
 
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 
 	tree = get_tree(&pool->tree_mark, update->l4_proto);
 	if (!tree) {
-		spin_unlock_bh(&pool->lock);
+		junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 		return -EINVAL;
 	}
 
 	table = find_by_mark(tree, update->mark);
 	if (!table) {
-		spin_unlock_bh(&pool->lock);
+		junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 		log_err("No entries match mark %u (protocol %s).", update->mark,
 				l4proto_to_string(update->l4_proto));
 		return -ESRCH;
@@ -651,7 +658,7 @@ int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 		table->max_iterations_allowed = update->iterations;
 	}
 
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 	return 0;
 }
 
@@ -801,13 +808,13 @@ int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 	if (range->ports.min > range->ports.max)
 		swap(range->ports.min, range->ports.max);
 
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 
 	error = rm_from_mark_tree(pool, mark, proto, range);
 	if (!error)
 		error = rm_from_addr_tree(pool, proto, range);
 
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 	return error;
 }
 
@@ -818,9 +825,9 @@ int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry *entry)
 
 void pool4db_flush(struct pool4 *pool)
 {
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 	clear_trees(pool);
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONFIG);
 }
 
 static struct ipv4_range *find_port_range(struct pool4_table *entry, __u16 port)
@@ -856,10 +863,10 @@ bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
 	struct pool4_table *table;
 	bool found = false;
 
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_CONTAINS);
 
 	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
+		junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONTAINS);
 		return pool4empty_contains(ns, addr);
 	}
 
@@ -867,7 +874,7 @@ bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
 	if (table)
 		found = find_port_range(table, addr->l4) != NULL;
 
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_CONTAINS);
 	return found;
 }
 
@@ -986,7 +993,7 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 	struct pool4_entry sample = { .proto = proto };
 	int error = 0;
 
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_FOREACH);
 
 	tree = get_tree(&pool->tree_mark, proto);
 	if (!tree) {
@@ -1022,11 +1029,11 @@ offset_start:; /* <- The semicolon prevents a compiler error. */
 	}
 
 end:
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_FOREACH);
 	return error;
 
 eagain:
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_FOREACH);
 	log_err("Oops. Pool4 changed while I was iterating so I lost track of where I was. Try again.");
 	return -EAGAIN;
 }
@@ -1126,10 +1133,10 @@ verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
 	offset += atomic_read(&next_ephemeral);
 
 	pool = state->jool.nat64.pool4;
-	spin_lock_bh(&pool->lock);
+	jlock(&pool->lock, &pool->lstats, JLS_POOL4_MASK);
 
 	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
+		junlock(&pool->lock, &pool->lstats, JLS_POOL4_MASK);
 		return find_empty(state, offset, out);
 	}
 
@@ -1151,7 +1158,7 @@ verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
 	masks->max_iterations = compute_max_iterations(table);
 	masks->range_count = table->sample_count;
 
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_MASK);
 
 	masks->pool_mark = state->in.skb->mark;
 	masks->taddr_counter = 0;
@@ -1173,7 +1180,7 @@ verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
 	return drop(state, JSTAT_UNKNOWN);
 
 fail:
-	spin_unlock_bh(&pool->lock);
+	junlock(&pool->lock, &pool->lstats, JLS_POOL4_MASK);
 	return drop(state, JSTAT_MASK_DOMAIN_NOT_FOUND);
 }
 
@@ -9,6 +9,7 @@
 
 #include <linux/net.h>
 #include "common/config.h"
+#include "mod/common/lock_stats.h"
 #include "mod/common/route.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/types.h"
@@ -23,6 +24,8 @@ struct pool4 *pool4db_alloc(void);
 void pool4db_get(struct pool4 *pool);
 void pool4db_put(struct pool4 *pool);
 
+struct jlock_stats *pool4db_lock_stats(struct pool4 *pool);
+
 int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry,
 		struct net *ns, bool force);
 int pool4db_update(struct pool4 *pool, const struct pool4_update *update);
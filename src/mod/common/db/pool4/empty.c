@@ -1,37 +1,93 @@
 #include "empty.h"
 
+#include <net/net_namespace.h>
 #include "common/constants.h"
 #include "mod/common/dev.h"
 #include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/log.h"
 #include "mod/common/rfc6052.h"
+#include "mod/common/route.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/xlator.h"
 #include "mod/common/rfc7915/6to4.h"
 
-static int check_ifa(struct in_ifaddr *ifa, void const *arg)
+bool pool4empty_contains(struct net *ns, const struct ipv4_transport_addr *addr)
 {
-	struct in_addr const *addr = arg;
+	if (addr->l4 < DEFAULT_POOL4_MIN_PORT)
+		return false;
+
+	return ifa4_lookup(ns, &addr->l3) & IFA4_UNIVERSE;
+}
+
+/*
+ * Cache of the source addresses the kernel chose for recent destinations.
+ *
+ * Finding out the source address requires a route lookup, and the answer only
+ * depends on the destination, the mark, the TOS and the state of the FIB. So
+ * remember it per CPU, and forget it whenever the namespace's IPv4 route
+ * generation ID changes. (Which happens on every route and address change.)
+ *
+ * The ports are not part of the key, so namespaces whose policy routing rules
+ * match them bypass the cache.
+ */
+
+#define SADDR_CACHE_BITS 6
+#define SADDR_CACHE_SIZE (1 << SADDR_CACHE_BITS)
+
+struct saddr_slot {
+	struct net *ns;
+	__be32 daddr;
+	__u32 mark;
+	__u8 tos;
+	int genid;
+	__be32 saddr;
+};
 
-	if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
-		return 0;
-	if (ifa->ifa_local == addr->s_addr)
-		return 1;
+static DEFINE_PER_CPU(struct saddr_slot[SADDR_CACHE_SIZE], saddr_cache);
 
-	return 0;
+static struct saddr_slot *get_slot(struct xlation *state)
+{
+	u32 hash;
+
+	hash = hash_ptr(state->jool.ns, 32)
+			^ (__force u32)state->out.tuple.dst.addr4.l3.s_addr
+			^ state->in.skb->mark;
+	return &this_cpu_ptr(saddr_cache)[hash_32(hash, SADDR_CACHE_BITS)];
 }
 
-static bool contains_addr(struct net *ns, const struct in_addr *addr)
+static bool saddr_cache_find(struct xlation *state, __u8 tos, __be32 *result)
 {
-	return foreach_ifa(ns, check_ifa, addr);
+	struct saddr_slot *slot;
+	bool found;
+
+	local_bh_disable();
+	slot = get_slot(state);
+	found = slot->ns == state->jool.ns
+			&& slot->daddr == state->out.tuple.dst.addr4.l3.s_addr
+			&& slot->mark == state->in.skb->mark
+			&& slot->tos == tos
+			&& slot->genid == rt_genid_ipv4(state->jool.ns);
+	if (found)
+		*result = slot->saddr;
+	local_bh_enable();
+
+	return found;
 }
 
-bool pool4empty_contains(struct net *ns, const struct ipv4_transport_addr *addr)
+static void saddr_cache_add(struct xlation *state, __u8 tos, int genid,
+		__be32 saddr)
 {
-	if (addr->l4 < DEFAULT_POOL4_MIN_PORT)
-		return false;
+	struct saddr_slot *slot;
 
-	return contains_addr(ns, &addr->l3);
+	local_bh_disable();
+	slot = get_slot(state);
+	slot->ns = state->jool.ns;
+	slot->daddr = state->out.tuple.dst.addr4.l3.s_addr;
+	slot->mark = state->in.skb->mark;
+	slot->tos = tos;
+	slot->genid = genid;
+	slot->saddr = saddr;
+	local_bh_enable();
 }
 
 /**
@@ -40,6 +96,9 @@ bool pool4empty_contains(struct net *ns, const struct ipv4_transport_addr *addr)
  */
 verdict pool4empty_find(struct xlation *state, struct ipv4_range *range)
 {
+	__be32 saddr;
+	__u8 tos;
+	int genid;
 	verdict result;
 
 	if (__rfc6052_6to4(&state->jool.globals.pool6.prefix,
@@ -48,11 +107,30 @@ verdict pool4empty_find(struct xlation *state, struct ipv4_range *range)
 		return untranslatable(state, JSTAT_UNTRANSLATABLE_DST6);
 	state->out.tuple.dst.addr4.l4 = state->in.tuple.dst.addr6.l4;
 
+	if (fib4_needs_l4(state->jool.ns)) {
+		result = predict_route64(state);
+		if (result != VERDICT_CONTINUE)
+			return result;
+		saddr = state->flowx.v4.flowi.saddr;
+		goto success;
+	}
+
+	tos = ttp64_xlat_tos(&state->jool.globals, pkt_ip6_hdr(&state->in));
+	if (saddr_cache_find(state, tos, &saddr)) {
+		log_debug(state, "Source address %pI4 was cached.", &saddr);
+		goto success;
+	}
+
+	/* Read before routing so a concurrent FIB change can't be missed. */
+	genid = rt_genid_ipv4(state->jool.ns);
 	result = predict_route64(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
+	saddr = state->flowx.v4.flowi.saddr;
+	saddr_cache_add(state, tos, genid, saddr);
 
-	range->prefix.addr.s_addr = state->flowx.v4.flowi.saddr;
+success:
+	range->prefix.addr.s_addr = saddr;
 	range->prefix.len = 0;
 	range->ports.min = DEFAULT_POOL4_MIN_PORT;
 	range->ports.max = DEFAULT_POOL4_MAX_PORT;
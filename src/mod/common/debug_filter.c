@@ -0,0 +1,198 @@
+#include "mod/common/debug_filter.h"
+
+#include <linux/kref.h>
+#include "mod/common/address.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+
+struct debug_limit {
+	/* Start of the current one-second window, in jiffies. */
+	unsigned long window;
+	/* Packets debugged during the current window. */
+	unsigned int count;
+
+	spinlock_t lock;
+	struct kref refcounter;
+};
+
+struct debug_limit *dbgl_alloc(void)
+{
+	struct debug_limit *result;
+
+	result = wkmalloc(struct debug_limit, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	result->window = jiffies;
+	result->count = 0;
+	spin_lock_init(&result->lock);
+	kref_init(&result->refcounter);
+
+	return result;
+}
+
+void dbgl_get(struct debug_limit *limit)
+{
+	kref_get(&limit->refcounter);
+}
+
+static void dbgl_release(struct kref *refcounter)
+{
+	struct debug_limit *limit;
+	limit = container_of(refcounter, struct debug_limit, refcounter);
+	wkfree(struct debug_limit, limit);
+}
+
+void dbgl_put(struct debug_limit *limit)
+{
+	kref_put(&limit->refcounter, dbgl_release);
+}
+
+/* Can another packet be debugged during the current second? */
+static bool limit_allows(struct xlation *state)
+{
+	struct debug_limit *limit = state->jool.debug_limit;
+	__u32 rate = state->jool.globals.debug_filter.rate;
+	bool result;
+
+	if (rate == 0)
+		return true;
+
+	spin_lock_bh(&limit->lock);
+	if (time_after_eq(jiffies, limit->window + HZ)) {
+		limit->window = jiffies;
+		limit->count = 0;
+	}
+	result = limit->count < rate;
+	if (result)
+		limit->count++;
+	spin_unlock_bh(&limit->lock);
+
+	return result;
+}
+
+/*
+ * If either prefix is set, the packet's source or destination address needs to
+ * belong to the prefix of its own family.
+ */
+static bool match_addrs(struct debug_filter_config const *filter,
+		struct packet const *pkt)
+{
+	struct iphdr *hdr4;
+	struct ipv6hdr *hdr6;
+
+	if (!filter->prefix6.set && !filter->prefix4.set)
+		return true;
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		if (!filter->prefix6.set)
+			return false;
+		hdr6 = pkt_ip6_hdr(pkt);
+		return prefix6_contains(&filter->prefix6.prefix, &hdr6->saddr)
+				|| prefix6_contains(&filter->prefix6.prefix,
+						&hdr6->daddr);
+	case L3PROTO_IPV4:
+		if (!filter->prefix4.set)
+			return false;
+		hdr4 = pkt_ip4_hdr(pkt);
+		return prefix4_contains(&filter->prefix4.prefix,
+				(struct in_addr *)&hdr4->saddr)
+				|| prefix4_contains(&filter->prefix4.prefix,
+						(struct in_addr *)&hdr4->daddr);
+	}
+
+	return false;
+}
+
+/* ICMP matches both 1 and 58, so the same filter works on both sides. */
+static bool match_proto(struct debug_filter_config const *filter,
+		struct packet const *pkt)
+{
+	if (!filter->proto)
+		return true;
+
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+		return filter->proto == IPPROTO_TCP;
+	case L4PROTO_UDP:
+		return filter->proto == IPPROTO_UDP;
+	case L4PROTO_ICMP:
+		return filter->proto == IPPROTO_ICMP
+				|| filter->proto == IPPROTO_ICMPV6;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
+static bool match_icmp_id(struct packet const *pkt, __be16 id)
+{
+	struct icmp6hdr *icmp6;
+	struct icmphdr *icmp4;
+
+	if (pkt_l3_proto(pkt) == L3PROTO_IPV6) {
+		icmp6 = pkt_icmp6_hdr(pkt);
+		return is_icmp6_info(icmp6->icmp6_type)
+				&& icmp6->icmp6_identifier == id;
+	}
+
+	icmp4 = pkt_icmp4_hdr(pkt);
+	return is_icmp4_info(icmp4->type) && icmp4->un.echo.id == id;
+}
+
+/* Source port, destination port or ICMP identifier. */
+static bool match_port(struct debug_filter_config const *filter,
+		struct packet const *pkt)
+{
+	__be16 port;
+
+	if (!filter->port)
+		return true;
+	/* Ports unavailable */
+	if (pkt_is_subsequent_frag(pkt))
+		return false;
+
+	port = cpu_to_be16(filter->port);
+
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+		return pkt_tcp_hdr(pkt)->source == port
+				|| pkt_tcp_hdr(pkt)->dest == port;
+	case L4PROTO_UDP:
+		return pkt_udp_hdr(pkt)->source == port
+				|| pkt_udp_hdr(pkt)->dest == port;
+	case L4PROTO_ICMP:
+		return match_icmp_id(pkt, port);
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
+void debug_filter_start(struct xlation *state)
+{
+	struct jool_globals const *cfg = &state->jool.globals;
+
+	state->debug = jool_debug_active()
+			&& cfg->debug
+			&& !debug_filter_set(&cfg->debug_filter)
+			&& limit_allows(state);
+}
+
+void debug_filter_apply(struct xlation *state)
+{
+	struct jool_globals const *cfg = &state->jool.globals;
+	struct debug_filter_config const *filter = &cfg->debug_filter;
+
+	if (!jool_debug_active() || !cfg->debug || !debug_filter_set(filter))
+		return;
+
+	state->debug = match_addrs(filter, &state->in)
+			&& match_proto(filter, &state->in)
+			&& match_port(filter, &state->in)
+			&& (!filter->mark || filter->mark == state->in.skb->mark)
+			&& limit_allows(state);
+}
@@ -0,0 +1,45 @@
+#ifndef SRC_MOD_COMMON_DEBUG_FILTER_H_
+#define SRC_MOD_COMMON_DEBUG_FILTER_H_
+
+/**
+ * @file
+ * Decides which packets get debug messages.
+ *
+ * logging-debug used to mean "debug every packet," which is not viable in
+ * production. The logging-debug-* globals narrow it down to the packets that
+ * match a prefix, protocol, port and mark, and limit the amount of debugged
+ * packets per second. The decision is made once per packet, and stored in
+ * xlation.debug. (Which is what log_debug() checks.)
+ */
+
+#include "mod/common/translation_state.h"
+
+/* Does @filter only match some packets? (Rate limit aside.) */
+static inline bool debug_filter_set(struct debug_filter_config const *filter)
+{
+	return filter->prefix6.set
+			|| filter->prefix4.set
+			|| filter->proto
+			|| filter->port
+			|| filter->mark;
+}
+
+/* The instance's mutable part of the filter. (The rate limiter.) */
+struct debug_limit;
+
+struct debug_limit *dbgl_alloc(void);
+void dbgl_get(struct debug_limit *limit);
+void dbgl_put(struct debug_limit *limit);
+
+/*
+ * To be called before @state's packet is parsed. Enables debugging if the
+ * instance debugs every packet.
+ */
+void debug_filter_start(struct xlation *state);
+/*
+ * To be called after @state's packet is parsed. Enables debugging if the
+ * packet matches the instance's filter.
+ */
+void debug_filter_apply(struct xlation *state);
+
+#endif /* SRC_MOD_COMMON_DEBUG_FILTER_H_ */
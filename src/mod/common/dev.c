@@ -1,6 +1,12 @@
 #include "mod/common/dev.h"
 
+#include <linux/hashtable.h>
+#include <linux/rtnetlink.h>
+#include <net/net_namespace.h>
+
 #include "mod/common/linux_version.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 
 /* "for each interface address" */
 int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
@@ -39,3 +45,245 @@ end:
 	rcu_read_unlock();
 	return result;
 }
+
+/*
+ * One node per (namespace, address) pair. Several interface addresses can map
+ * to the same node (eg. the same address on two interfaces, or a broadcast
+ * address that happens to also be somebody's local address), so the flags are
+ * the union of the contributions of every interface address.
+ *
+ * The inetaddr events are not idempotent (eg. promote_secondaries announces the
+ * promoted address again), so they cannot be applied as deltas. Instead, every
+ * event recomputes the affected namespace's nodes from its in_devices.
+ */
+struct ifa4_node {
+	struct net *ns;
+	__be32 addr;
+	/* What the packet path reads. */
+	unsigned int flags;
+	/* Flags found during the ongoing ifa4_rebuild(). */
+	unsigned int pending;
+
+	struct hlist_node hook;
+	struct rcu_head rcu;
+};
+
+/*
+ * Readers: RCU.
+ * Writers: RTNL. (The inetaddr notifier chain is always called with RTNL held,
+ * and the pernet callbacks take it explicitly.)
+ */
+static DEFINE_HASHTABLE(ifa4_table, 8);
+
+static u32 ifa4_hash(struct net *ns, __be32 addr)
+{
+	return hash_ptr(ns, 32) ^ (__force u32)addr;
+}
+
+static void ifa4_node_free(struct rcu_head *rcu)
+{
+	wkfree(struct ifa4_node, container_of(rcu, struct ifa4_node, rcu));
+}
+
+static void ifa4_node_rm(struct ifa4_node *node)
+{
+	hash_del_rcu(&node->hook);
+	call_rcu(&node->rcu, ifa4_node_free);
+}
+
+/* Assumes RTNL is held. */
+static struct ifa4_node *ifa4_find_locked(struct net *ns, __be32 addr)
+{
+	struct ifa4_node *node;
+
+	hash_for_each_possible(ifa4_table, node, hook, ifa4_hash(ns, addr))
+		if (node->ns == ns && node->addr == addr)
+			return node;
+
+	return NULL;
+}
+
+/* Assumes RTNL is held. */
+static void ifa4_mark(struct net *ns, __be32 addr, unsigned int flags)
+{
+	struct ifa4_node *node;
+
+	if (!flags)
+		return;
+
+	node = ifa4_find_locked(ns, addr);
+	if (!node) {
+		/* Called from the RCU iteration in foreach_ifa(). */
+		node = wkmalloc(struct ifa4_node, GFP_ATOMIC);
+		if (!node) {
+			log_warn_once("Out of memory; cannot index interface address %pI4.",
+					&addr);
+			return;
+		}
+		memset(node, 0, sizeof(*node));
+		node->ns = ns;
+		node->addr = addr;
+		/* flags = 0, so readers ignore it until the commit. */
+		hash_add_rcu(ifa4_table, &node->hook, ifa4_hash(ns, addr));
+	}
+
+	node->pending |= flags;
+}
+
+/* Assumes RTNL is held. */
+static int mark_ifa(struct in_ifaddr *ifa, void const *arg)
+{
+	struct net *ns;
+	unsigned int flags;
+
+	ns = dev_net(ifa->ifa_dev->dev);
+
+	/* (RFC3021: /31 and /32 networks lack broadcast) */
+	if (ifa->ifa_prefixlen < 31)
+		ifa4_mark(ns, ifa->ifa_local | ~ifa->ifa_mask, IFA4_BROADCAST);
+
+	flags = 0;
+	/* /32 (https://github.com/NICMx/Jool/issues/342) */
+	if (ifa->ifa_prefixlen != 32)
+		flags |= IFA4_LOCAL;
+	if (ifa->ifa_scope == RT_SCOPE_UNIVERSE)
+		flags |= IFA4_UNIVERSE;
+	ifa4_mark(ns, ifa->ifa_local, flags);
+
+	return 0;
+}
+
+/*
+ * Recomputes @ns's nodes from its current interface addresses.
+ *
+ * Nodes are updated in place rather than purged and re-added, so readers never
+ * see a still assigned address vanish temporarily.
+ *
+ * Assumes RTNL is held.
+ */
+static void ifa4_rebuild(struct net *ns)
+{
+	struct ifa4_node *node;
+	struct hlist_node *tmp;
+	unsigned int bkt;
+
+	hash_for_each(ifa4_table, bkt, node, hook)
+		if (node->ns == ns)
+			node->pending = 0;
+
+	foreach_ifa(ns, mark_ifa, NULL);
+
+	hash_for_each_safe(ifa4_table, bkt, tmp, node, hook) {
+		if (node->ns != ns)
+			continue;
+		if (node->pending)
+			WRITE_ONCE(node->flags, node->pending);
+		else
+			ifa4_node_rm(node);
+	}
+}
+
+/* Assumes RTNL is held. */
+static void ifa4_purge(struct net *ns)
+{
+	struct ifa4_node *node;
+	struct hlist_node *tmp;
+	unsigned int bkt;
+
+	hash_for_each_safe(ifa4_table, bkt, tmp, node, hook)
+		if (node->ns == ns)
+			ifa4_node_rm(node);
+}
+
+static int ifa4_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+	struct in_ifaddr *ifa = ptr;
+
+	switch (event) {
+	case NETDEV_UP:
+	case NETDEV_DOWN:
+		/*
+		 * By now, the address has already been linked to (UP) or
+		 * unlinked from (DOWN) its in_device.
+		 */
+		ifa4_rebuild(dev_net(ifa->ifa_dev->dev));
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ifa4_notifier = {
+	.notifier_call = ifa4_event,
+};
+
+/*
+ * Called for every namespace that already exists during registration, and for
+ * every namespace created afterwards.
+ *
+ * The notifier is registered before this, so events might have already been
+ * indexed for @ns. That's fine; the rebuild doesn't care.
+ */
+static int __net_init ifa4_net_init(struct net *ns)
+{
+	rtnl_lock();
+	ifa4_rebuild(ns);
+	rtnl_unlock();
+	return 0;
+}
+
+static void __net_exit ifa4_net_exit(struct net *ns)
+{
+	rtnl_lock();
+	ifa4_purge(ns);
+	rtnl_unlock();
+}
+
+static struct pernet_operations ifa4_ops = {
+	.init = ifa4_net_init,
+	.exit = ifa4_net_exit,
+};
+
+int jdev_setup(void)
+{
+	int error;
+
+	error = register_inetaddr_notifier(&ifa4_notifier);
+	if (error)
+		return error;
+	error = register_pernet_subsys(&ifa4_ops);
+	if (error)
+		unregister_inetaddr_notifier(&ifa4_notifier);
+
+	return error;
+}
+
+void jdev_teardown(void)
+{
+	unregister_inetaddr_notifier(&ifa4_notifier);
+	unregister_pernet_subsys(&ifa4_ops); /* Purges every namespace */
+	rcu_barrier(); /* Wait for the pending ifa4_node_free()s */
+}
+
+/**
+ * Returns the IFA4_* flags of @addr in namespace @ns. (0 if no interface
+ * address is related to @addr.)
+ */
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr)
+{
+	struct ifa4_node *node;
+	unsigned int flags = 0;
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu(ifa4_table, node, hook,
+			ifa4_hash(ns, addr->s_addr)) {
+		if (node->ns == ns && node->addr == addr->s_addr) {
+			flags = READ_ONCE(node->flags);
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return flags;
+}
@@ -6,4 +6,25 @@
 int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
 		void const *args);
 
+/*
+ * Index of the IPv4 addresses assigned to the interfaces of every namespace.
+ *
+ * The packet path used to walk every device and every address (foreach_ifa())
+ * for every translated packet, which does not scale to boxes with hundreds of
+ * interfaces. This index is kept up to date by the inetaddr notifier instead,
+ * so lookups are a single hash probe.
+ */
+
+/* @addr is the local address of a non-/32 interface. */
+#define IFA4_LOCAL		(1u << 0)
+/* @addr is the local address of a global-scope interface (any length). */
+#define IFA4_UNIVERSE		(1u << 1)
+/* @addr is the directed broadcast address of some (< /31) interface. */
+#define IFA4_BROADCAST		(1u << 2)
+
+int jdev_setup(void);
+void jdev_teardown(void);
+
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr);
+
 #endif /* SRC_MOD_COMMON_DEV_H_ */
@@ -0,0 +1,118 @@
+#include "mod/common/histogram.h"
+
+#include <linux/kref.h>
+#include <linux/percpu.h>
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+
+struct jool_hist {
+	struct jhist_counts __percpu *cpus;
+	struct kref refcounter;
+};
+
+#ifndef UNIT_TESTING
+DEFINE_STATIC_KEY_FALSE(jhist_key);
+#endif
+
+struct jool_hist *jhist_alloc(void)
+{
+	struct jool_hist *result;
+
+	result = wkmalloc(struct jool_hist, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	result->cpus = alloc_percpu(struct jhist_counts);
+	if (!result->cpus) {
+		wkfree(struct jool_hist, result);
+		return NULL;
+	}
+	kref_init(&result->refcounter);
+
+	return result;
+}
+
+void jhist_get(struct jool_hist *hist)
+{
+	kref_get(&hist->refcounter);
+}
+
+static void jhist_release(struct kref *refcounter)
+{
+	struct jool_hist *hist;
+	hist = container_of(refcounter, struct jool_hist, refcounter);
+
+	free_percpu(hist->cpus);
+	wkfree(struct jool_hist, hist);
+}
+
+void jhist_put(struct jool_hist *hist)
+{
+	kref_put(&hist->refcounter, jhist_release);
+}
+
+#ifndef UNIT_TESTING
+
+void jhist_key_get(struct xlator const *jool)
+{
+	if (jool->globals.latency_histograms)
+		static_branch_inc(&jhist_key);
+}
+
+void jhist_key_put(struct xlator const *jool)
+{
+	if (jool->globals.latency_histograms)
+		static_branch_dec(&jhist_key);
+}
+
+static unsigned int ns_to_bucket(u64 ns)
+{
+	unsigned int bucket;
+
+	bucket = fls64(ns);
+	return (bucket < JHIST_BUCKETS) ? bucket : (JHIST_BUCKETS - 1);
+}
+
+void __jhist_record(struct xlation *state, enum jool_hist_stage stage,
+		u64 start)
+{
+	struct packet *in = &state->in;
+
+	/* The key was enabled after jhist_start(). */
+	if (!start)
+		return;
+	/* Another instance enabled the key. */
+	if (!state->jool.globals.latency_histograms)
+		return;
+
+	this_cpu_inc(state->jool.hist->cpus->counts[stage][pkt_l3_proto(in)]
+			[pkt_l4_proto(in)][ns_to_bucket(ktime_get_ns() - start)]);
+}
+
+#endif
+
+/**
+ * Returns the sum of every CPU's histograms. You will have to kfree() it.
+ */
+struct jhist_counts *jhist_query(struct jool_hist *hist)
+{
+	struct jhist_counts *result;
+	struct jhist_counts *cpu_counts;
+	__u64 *dst, *src;
+	unsigned int i;
+	int cpu;
+
+	result = kzalloc(sizeof(*result), GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	dst = &result->counts[0][0][0][0];
+	for_each_possible_cpu(cpu) {
+		cpu_counts = per_cpu_ptr(hist->cpus, cpu);
+		src = &cpu_counts->counts[0][0][0][0];
+		for (i = 0; i < sizeof(*result) / sizeof(__u64); i++)
+			dst[i] += src[i];
+	}
+
+	return result;
+}
@@ -0,0 +1,72 @@
+#ifndef SRC_MOD_COMMON_HISTOGRAM_H_
+#define SRC_MOD_COMMON_HISTOGRAM_H_
+
+/**
+ * @file
+ * Per-CPU latency histograms of the translation stages. (See
+ * common/histogram.h.)
+ *
+ * Recording is gated by a static key, which is only enabled while at least one
+ * instance has latency-histograms enabled. Otherwise, jhist_start() and
+ * jhist_end() cost a NOP each.
+ */
+
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include "common/histogram.h"
+#include "mod/common/translation_state.h"
+
+struct jool_hist;
+
+/* The sum of every CPU's counters. */
+struct jhist_counts {
+	__u64 counts[JHIST_STAGE_COUNT][L3_PROTO_COUNT][L4_PROTO_COUNT]
+			[JHIST_BUCKETS];
+};
+
+struct jool_hist *jhist_alloc(void);
+void jhist_get(struct jool_hist *hist);
+void jhist_put(struct jool_hist *hist);
+
+struct jhist_counts *jhist_query(struct jool_hist *hist);
+
+#ifdef UNIT_TESTING
+
+static inline void jhist_key_get(struct xlator const *jool) {}
+static inline void jhist_key_put(struct xlator const *jool) {}
+static inline u64 jhist_start(void) { return 0; }
+static inline void jhist_end(struct xlation *state,
+		enum jool_hist_stage stage, u64 start) {}
+
+#else
+
+DECLARE_STATIC_KEY_FALSE(jhist_key);
+#define jhist_active() static_branch_unlikely(&jhist_key)
+
+/*
+ * To be called whenever @jool is attached to (get) or detached from (put) the
+ * instance database. Process context only.
+ */
+void jhist_key_get(struct xlator const *jool);
+void jhist_key_put(struct xlator const *jool);
+
+void __jhist_record(struct xlation *state, enum jool_hist_stage stage,
+		u64 start);
+
+/* Returns the timestamp jhist_end() needs. */
+static inline u64 jhist_start(void)
+{
+	return jhist_active() ? ktime_get_ns() : 0;
+}
+
+/* Records the time elapsed since @start in @state's @stage histogram. */
+static inline void jhist_end(struct xlation *state,
+		enum jool_hist_stage stage, u64 start)
+{
+	if (jhist_active())
+		__jhist_record(state, stage, start);
+}
+
+#endif
+
+#endif /* SRC_MOD_COMMON_HISTOGRAM_H_ */
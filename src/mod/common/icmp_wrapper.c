@@ -5,7 +5,7 @@
 #include "common/types.h"
 #include "mod/common/log.h"
 
-static int route4_input(struct xlator *jool, struct sk_buff *skb)
+static int route4_input(struct xlator *jool, struct sk_buff *skb, bool debug)
 {
 	struct iphdr *hdr;
 	int error;
@@ -18,7 +18,7 @@ static int route4_input(struct xlator *jool, struct sk_buff *skb)
 	hdr = ip_hdr(skb);
 	error = ip_route_input(skb, hdr->daddr, hdr->saddr, hdr->tos, skb->dev);
 	if (error)
-		__log_debug(jool, "ip_route_input failed: %d", error);
+		__log_debug_if(jool, debug, "ip_route_input failed: %d", error);
 
 	return error;
 }
@@ -50,7 +50,7 @@ static char *icmp_error_to_string(icmp_error_code error)
 }
 
 bool icmp64_send4(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info)
+		icmp_error_code error, __u32 info, bool debug)
 {
 	int type, code;
 
@@ -61,7 +61,7 @@ bool icmp64_send4(struct xlator *jool, struct sk_buff *skb,
 	 * I don't know why the kernel needs this nonsense,
 	 * but it's not my fault.
 	 */
-	if (route4_input(jool, skb))
+	if (route4_input(jool, skb, debug))
 		return false;
 
 	switch (error) {
@@ -97,14 +97,14 @@ bool icmp64_send4(struct xlator *jool, struct sk_buff *skb,
 		return false; /* Not supported or needed. */
 	}
 
-	__log_debug(jool, "Sending ICMPv4 error: %s, type: %d, code: %d, rest: %u.",
+	__log_debug_if(jool, debug, "Sending ICMPv4 error: %s, type: %d, code: %d, rest: %u.",
 			icmp_error_to_string(error), type, code, info);
 	icmp_send(skb, type, code, cpu_to_be32(info));
 	return true;
 }
 
 bool icmp64_send6(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info)
+		icmp_error_code error, __u32 info, bool debug)
 {
 	int type, code;
 
@@ -142,7 +142,7 @@ bool icmp64_send6(struct xlator *jool, struct sk_buff *skb,
 		return false; /* Not supported or needed. */
 	}
 
-	__log_debug(jool, "Sending ICMPv6 error: %s, type: %d, code: %d, rest: %u",
+	__log_debug_if(jool, debug, "Sending ICMPv6 error: %s, type: %d, code: %d, rest: %u",
 			icmp_error_to_string(error), type, code, info);
 	icmpv6_send(skb, type, code, info);
 	return true;
@@ -156,9 +156,11 @@ bool icmp64_send(struct xlator *jool, struct sk_buff *skb,
 
 	switch (ntohs(skb->protocol)) {
 	case ETH_P_IP:
-		return icmp64_send4(jool, skb, error, info);
+		return icmp64_send4(jool, skb, error, info,
+				xlator_debug(jool));
 	case ETH_P_IPV6:
-		return icmp64_send6(jool, skb, error, info);
+		return icmp64_send6(jool, skb, error, info,
+				xlator_debug(jool));
 	}
 
 	return false;
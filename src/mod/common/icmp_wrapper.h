@@ -35,11 +35,12 @@ typedef enum icmp_errcode {
 
 /**
  * Wrappers for icmp_send() and icmpv6_send().
+ * @debug is the debug decision of the packet that caused the error.
  */
 bool icmp64_send6(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info);
+		icmp_error_code error, __u32 info, bool debug);
 bool icmp64_send4(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info);
+		icmp_error_code error, __u32 info, bool debug);
 bool icmp64_send(struct xlator *jool, struct sk_buff *skb,
 		icmp_error_code error, __u32 info);
 
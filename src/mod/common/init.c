@@ -3,8 +3,10 @@
 #include <linux/module.h>
 
 #include "mod/common/atomic_config.h"
+#include "mod/common/dev.h"
 #include "mod/common/joold.h"
 #include "mod/common/log.h"
+#include "mod/common/route.h"
 #include "mod/common/timer.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
@@ -38,6 +40,12 @@ static int setup_common_modules(void)
 		goto jtimer_fail;
 
 	/* Common */
+	error = jdev_setup();
+	if (error)
+		goto jdev_fail;
+	error = route_setup();
+	if (error)
+		goto route_fail;
 	error = xlation_setup();
 	if (error)
 		goto xlation_fail;
@@ -59,6 +67,10 @@ nlhandler_fail:
 xlator_fail:
 	xlation_teardown();
 xlation_fail:
+	route_teardown();
+route_fail:
+	jdev_teardown();
+jdev_fail:
 	jtimer_teardown();
 jtimer_fail:
 	rfc6056_teardown();
@@ -77,6 +89,8 @@ static void teardown_common_modules(void)
 	nlhandler_teardown(); /* Userspace requests no longer handled now */
 	xlator_teardown(); /* Packets no longer handled by Netfilter now */
 	xlation_teardown();
+	route_teardown();
+	jdev_teardown();
 	atomconfig_teardown();
 
 	/* NAT64 */
@@ -1,8 +1,15 @@
 #include "mod/common/joold.h"
 
+#include <linux/hashtable.h>
 #include <linux/inet.h>
+#include <linux/jhash.h>
+#include <linux/lz4.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
 
 #include "common/constants.h"
+#include "common/joold_compact.h"
+#include "mod/common/joold_udp.h"
 #include "mod/common/log.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
@@ -14,23 +21,92 @@
 
 #define GLOBALS(xlator) (xlator->globals.nat64.joold)
 
+#if IS_ENABLED(CONFIG_LZ4_COMPRESS) && IS_ENABLED(CONFIG_LZ4_DECOMPRESS)
+#define JOOLD_LZ4
+/* Compression workspace, followed by a copy of the records being compressed */
+#define LZ4_SCRATCH_SIZE (LZ4_MEM_COMPRESS + JOOLD_MAX_PAYLOAD)
+#endif
+
 struct counted_list {
 	struct list_head list;
 	unsigned int count;
 };
 
-/**
- * Can we send our packet yet?
- * (We need to wait for ACKs because the kernel can't handle too many
- * Netlink messages at once.)
- */
-#define JQF_ACK_RECEIVED (1 << 0)
 #define JQF_AD_ONGOING (1 << 1) /** Advertisement requested by user? */
+#define JQF_AD_FETCHING (1 << 2) /** Someone is running ad_fetch()? */
+
+/*
+ * Maximum number of batches a single send_to_userspace_prepare() can dequeue.
+ * (The rest wait for the next one.)
+ */
+#define JOOLD_MAX_BATCHES 16
+
+/*
+ * An advertisement fetch stops after visiting this many times as many
+ * sessions as it wants, even if the replication policy rejected most of them.
+ * (So the BIB's lock is not held for too long.)
+ */
+#define AD_VISIT_FACTOR 8
+
+/* Position of an ongoing advertisement in the BIB. */
+struct ad_cursor {
+	l4_protocol proto;
+	/* Last session visited from @proto's table. Only valid if @started. */
+	struct session_foreach_offset offset;
+	bool started;
+	/* Have all the tables been visited? */
+	bool done;
+};
+
+#define JOOLD_INDEX_BITS 8
+
+/*
+ * Sessions queued by joold_add() in one CPU, which haven't been merged into the
+ * queue yet. This is what spares the translation path the queue's lock; the
+ * lists are only merged when the queue is about to be flushed.
+ */
+struct joold_cpu {
+	struct counted_list sessions;
+	/* Only ever contended by merge_cpus(). */
+	spinlock_t lock;
+};
 
 struct joold_queue {
 	unsigned int flags; /** JQF */
 
-	struct counted_list deferred; /** Queued sessions */
+	struct joold_cpu __percpu *cpus;
+	struct counted_list deferred; /** Queued sessions (merged) */
+	/*
+	 * Sessions of the ongoing advertisement which have already been
+	 * fetched from the BIB, but not sent yet. Advertisements are fetched
+	 * (from @cursor) about one batch at a time, and only when there's room
+	 * to send them, so this never grows much.
+	 */
+	struct counted_list ad;
+	struct ad_cursor cursor;
+	/* Should the next batch come from @ad, rather than @deferred? */
+	bool ad_turn;
+	/*
+	 * The sessions of @deferred that were queued by joold_add(), indexed
+	 * by session. If a session is updated again before it's sent, the
+	 * update replaces the queued copy instead of being queued as well.
+	 * (Advertised sessions are not indexed.)
+	 */
+	DECLARE_HASHTABLE(index, JOOLD_INDEX_BITS);
+	u32 seed;
+
+	/*
+	 * Every batch (Netlink packet) of sessions is numbered, and the daemon
+	 * echoes the number in its ACK. Up to ss-window batches can be waiting
+	 * for their ACK at any given time. (We need to limit them because the
+	 * kernel can't handle too many Netlink messages at once.)
+	 * If there's an in-kernel transport, it ACKs each batch once it has
+	 * handed it to its socket instead.
+	 *
+	 * The batches in flight are [@acked_seq, @next_seq). Both wrap around.
+	 */
+	__u32 next_seq; /** Number of the next batch to be sent */
+	__u32 acked_seq; /** Number of the oldest unacknowledged batch */
 
 	/**
 	 * Jiffy at which the last batch of sessions was sent.
@@ -39,13 +115,49 @@ struct joold_queue {
 	 */
 	unsigned long last_flush_time;
 
+	/*
+	 * If not NULL, the kernel sends the sessions to the network itself,
+	 * instead of handing them to the daemon. (See joold_udp.h.)
+	 */
+	struct joold_udp *udp;
+
+#ifdef JOOLD_LZ4
+	/* ss-lz4's scratch memory. Protected by @lz4_lock, not @lock. */
+	void *lz4_scratch;
+	spinlock_t lz4_lock;
+#endif
+
 	spinlock_t lock;
+	struct jlock_stats lstats;
 	struct kref refs;
 };
 
+/* ad_fetch()'s bib_foreach_session() argument. */
 struct ad_arg {
-	struct joold_queue *queue;
-	struct list_head *ready;
+	struct counted_list *sessions;
+	/* Only sessions allowed by this policy are advertised. */
+	struct joold_config const *cfg;
+	/* Stop once @sessions has this many sessions. */
+	unsigned int max;
+	/* Sessions visited so far (including the ones the policy rejected) */
+	unsigned int visited;
+	/* The last of them */
+	struct taddr4_tuple last;
+};
+
+/* Sessions dequeued during a send_to_userspace_prepare(). */
+struct joold_prepared {
+	struct list_head sessions;
+	/* Length of each of the batches in @sessions */
+	unsigned int lens[JOOLD_MAX_BATCHES];
+	/* Number of batches in @sessions */
+	unsigned int count;
+	/* Number of the first batch. The rest are numbered incrementally. */
+	__u32 seq;
+	/* The queue's transport, if the batches go straight to the network */
+	struct joold_udp *udp;
+	/* Does the advertisement need the next batch fetched? */
+	bool refill;
 };
 
 /**
@@ -56,6 +168,8 @@ struct deferred_session {
 	struct session_entry session;
 	/** List hook to joold_queue.deferred.  */
 	struct list_head lh;
+	/** Hook to joold_queue.index. (Unhashed if not indexed.) */
+	struct hlist_node hh;
 };
 
 static struct kmem_cache *deferred_cache;
@@ -74,11 +188,21 @@ static int joold_setup(void)
 {
 	deferred_cache = kmem_cache_create("joold_sessions",
 			sizeof(struct deferred_session), 0, 0, NULL);
-	return deferred_cache ? 0 : -EINVAL;
+	if (!deferred_cache)
+		return -EINVAL;
+
+	if (joold_udp_setup()) {
+		kmem_cache_destroy(deferred_cache);
+		deferred_cache = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
 }
 
 void joold_teardown(void)
 {
+	joold_udp_teardown();
 	if (deferred_cache) {
 		kmem_cache_destroy(deferred_cache);
 		deferred_cache = NULL;
@@ -96,46 +220,122 @@ static void delete_sessions(struct list_head *sessions)
 }
 
 /* "advertise session," not "add session." Although we're adding it too. */
-static int ad_session(struct session_entry const *_session, void *arg)
+/* Returns 1 if the fetch is done. (@_session will be visited again later.) */
+static int ad_session(struct session_entry const *_session, void *_arg)
 {
+	struct ad_arg *arg;
 	struct counted_list *list;
 	struct deferred_session *session;
 
+	arg = _arg;
+	list = arg->sessions;
+	if (list->count >= arg->max)
+		return 1;
+	if (arg->visited >= AD_VISIT_FACTOR * arg->max)
+		return 1;
+
+	arg->visited++;
+	arg->last.src = _session->src4;
+	arg->last.dst = _session->dst4;
+
+	if (!joold_policy_allows(arg->cfg, _session))
+		return 0;
+
 	session = ALLOC_DEFERRED;
 	if (!session)
 		return -ENOMEM;
 	session->session = *_session;
+	INIT_HLIST_NODE(&session->hh);
 
-	list = arg;
 	list_add_tail(&session->lh, &list->list);
 	list->count++;
 	return 0;
 }
 
+static void init_prepared(struct joold_prepared *prepared)
+{
+	INIT_LIST_HEAD(&prepared->sessions);
+	prepared->count = 0;
+	prepared->seq = 0;
+	prepared->udp = NULL;
+	prepared->refill = false;
+}
+
+static __u32 in_flight(struct joold_queue *queue)
+{
+	return queue->next_seq - queue->acked_seq;
+}
+
+/*
+ * Zero ss-window and ss-max-sessions-per-packet are treated as one, since they
+ * would otherwise stall the queue.
+ */
+static bool window_full(struct xlator *jool)
+{
+	return in_flight(jool->nat64.joold) >= max(GLOBALS(jool).window, 1u);
+}
+
+static unsigned int batch_size(struct xlator *jool)
+{
+	return max(GLOBALS(jool).max_sessions_per_pkt, 1u);
+}
+
+/* Has ss-flush-deadline elapsed since the last flush? Lockless. */
+static bool deadline_passed(struct xlator *jool)
+{
+	unsigned long last;
+
+	last = READ_ONCE(jool->nat64.joold->last_flush_time);
+	return time_before(last + msecs_to_jiffies(GLOBALS(jool).flush_deadline),
+			jiffies);
+}
+
+/*
+ * Assumes the lock is held.
+ * If the deadline was reached, forgets the batches in flight and returns true.
+ */
+static bool deadline_reached(struct xlator *jool)
+{
+	struct joold_queue *queue;
+
+	queue = jool->nat64.joold;
+	if (!deadline_passed(jool))
+		return false;
+
+	/* Assume the ACKs were lost; the window is ours again. */
+	queue->acked_seq = queue->next_seq;
+	return true;
+}
+
+/*
+ * Assumes the lock is held.
+ * If the deadline was reached, also forgets the batches in flight.
+ */
 static bool should_send(struct xlator *jool)
 {
 	struct joold_queue *queue;
-	unsigned long deadline;
 
 	queue = jool->nat64.joold;
 
-	if (queue->deferred.count == 0) {
+	if (queue->deferred.count == 0 && queue->ad.count == 0) {
+		/* An advertisement waiting for the window needs it back. */
+		if (queue->flags & JQF_AD_ONGOING)
+			deadline_reached(jool);
 		jstat_inc(jool->stats, JSTAT_JOOLD_EMPTY);
 		return false;
 	}
 
-	deadline = msecs_to_jiffies(GLOBALS(jool).flush_deadline);
-	if (time_before(queue->last_flush_time + deadline, jiffies)) {
+	if (deadline_reached(jool)) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_TIMEOUT);
 		return true;
 	}
 
-	if (!(queue->flags & JQF_ACK_RECEIVED)) {
+	if (window_full(jool)) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_MISSING_ACK);
 		return false;
 	}
 
-	if (queue->flags & JQF_AD_ONGOING) {
+	if (queue->ad.count > 0) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_AD_ONGOING);
 		return true;
 	}
@@ -150,85 +350,498 @@ static bool should_send(struct xlator *jool)
 }
 
 static bool too_many_sessions(struct xlator *jool)
+{
+	return jool->nat64.joold->deferred.count >= GLOBALS(jool).capacity;
+}
+
+/*
+ * Number of sessions each CPU's list can hold: An even share of ss-capacity.
+ * A full list is merged right away, so the lists add up to at most another
+ * ss-capacity on top of the queue's.
+ */
+static unsigned int cpu_capacity(struct xlator *jool)
+{
+	return max(1u, GLOBALS(jool).capacity / num_possible_cpus());
+}
+
+/*
+ * joold_add()'s lockless approximation of should_send(). @local is the number
+ * of sessions queued in the current CPU; the other CPUs' are not counted.
+ * (If they're enough to warrant a flush, their own joold_add()s will notice.)
+ */
+static bool should_merge(struct xlator *jool, unsigned int local)
 {
 	struct joold_queue *queue = jool->nat64.joold;
 
-	if (queue->flags & JQF_AD_ONGOING)
+	if (deadline_passed(jool))
+		return true;
+	if (local >= cpu_capacity(jool))
+		return true; /* Make room, even if nothing can be sent */
+	if (READ_ONCE(queue->next_seq) - READ_ONCE(queue->acked_seq)
+			>= max(GLOBALS(jool).window, 1u))
 		return false;
+	if (READ_ONCE(queue->ad.count) > 0)
+		return true;
+	return READ_ONCE(queue->deferred.count) + local
+			>= GLOBALS(jool).max_sessions_per_pkt;
+}
 
-	return queue->deferred.count >= GLOBALS(jool).capacity;
+/*
+ * Should another batch follow the ones that were just dequeued?
+ * Only full batches are sent back-to-back, unless an advertisement is ongoing.
+ */
+static bool should_send_more(struct xlator *jool,
+		struct joold_prepared *prepared)
+{
+	struct joold_queue *queue = jool->nat64.joold;
+
+	if (queue->deferred.count == 0 && queue->ad.count == 0)
+		return false;
+	if (window_full(jool) || prepared->count >= JOOLD_MAX_BATCHES)
+		return false;
+	if (queue->ad.count > 0)
+		return true;
+	return queue->deferred.count >= batch_size(jool);
 }
 
-/**
- * Always swallows @session, can be NULL.
+/*
  * Assumes the lock is held.
- * You have to send_to_userspace(@jool, @prepared) after releasing the spinlock.
+ * Picks the list the next batch should be taken from. While an advertisement
+ * is ongoing, it takes turns with the queue, so neither starves the other.
  */
-static void send_to_userspace_prepare(struct xlator *jool,
-		struct deferred_session *session,
-		struct list_head *prepared)
+static struct counted_list *next_source(struct joold_queue *queue)
+{
+	bool ad;
+
+	if (queue->ad.count == 0)
+		ad = false;
+	else if (queue->deferred.count == 0)
+		ad = true;
+	else
+		ad = queue->ad_turn;
+
+	queue->ad_turn = !ad;
+	return ad ? &queue->ad : &queue->deferred;
+}
+
+/* Assumes the lock is held. */
+static bool needs_fetch(struct xlator *jool)
+{
+	struct joold_queue *queue = jool->nat64.joold;
+
+	return (queue->flags & JQF_AD_ONGOING)
+			&& !(queue->flags & JQF_AD_FETCHING)
+			&& !queue->cursor.done
+			&& queue->ad.count == 0
+			&& !window_full(jool);
+}
+
+/* Assumes the lock is held. */
+static void ad_update_flags(struct joold_queue *queue)
+{
+	if (queue->cursor.done && queue->ad.count == 0)
+		queue->flags &= ~JQF_AD_ONGOING;
+}
+
+/*
+ * src4, dst4 and proto identify the session. (ICMP sessions have equal ports,
+ * which is fine.)
+ */
+static u32 hash_session(struct joold_queue *queue,
+		struct session_entry const *session)
+{
+	return jhash_3words(session->src4.l3.s_addr, session->dst4.l3.s_addr,
+			(session->src4.l4 << 16) | session->dst4.l4,
+			queue->seed ^ session->proto);
+}
+
+/*
+ * Assumes the lock is held.
+ * If @session is already queued, updates the queued copy and returns true.
+ *
+ * The two directions of a connection can be translated by different CPUs, and
+ * the CPUs are merged in no particular order, so @session might be older than
+ * the queued copy. In that case, it's simply dropped.
+ */
+static bool coalesce(struct joold_queue *queue,
+		struct deferred_session *session, u32 hash)
+{
+	struct deferred_session *queued;
+
+	hash_for_each_possible(queue->index, queued, hh, hash) {
+		if (session_equals(&queued->session, &session->session)) {
+			if (!time_before(session->session.update_time,
+					queued->session.update_time))
+				queued->session = session->session;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Compact mode: Returns the number of sessions (from the beginning of
+ * @sessions, and no more than @max) that fit in a single batch of
+ * ss-max-payload bytes. Always at least one.
+ * Also returns the length of their records in @len.
+ */
+static unsigned int compact_fit(struct xlator *jool, struct list_head *sessions,
+		unsigned int max, size_t *len)
+{
+	struct deferred_session *session;
+	struct joold_record records[2];
+	struct joold_record *prev;
+	struct joold_record *cur;
+	size_t payload;
+	size_t total;
+	size_t rlen;
+	unsigned int c;
+
+	payload = min_t(size_t, GLOBALS(jool).max_payload, JOOLD_MAX_PAYLOAD);
+	if (jool->nat64.joold->udp)
+		payload -= min_t(size_t, payload, JOOLD_UDP_OVERHEAD);
+	total = 0;
+	c = 0;
+
+	list_for_each_entry(session, sessions, lh) {
+		if (c >= max)
+			break;
+
+		prev = c ? &records[!(c & 1)] : NULL;
+		cur = &records[c & 1];
+		joold_record_from_session(cur, &session->session);
+		rlen = joold_record_len(prev, cur);
+
+		if (c > 0 && nla_total_size(sizeof(struct joold_compact_hdr)
+				+ total + rlen) > payload)
+			break;
+
+		total += rlen;
+		c++;
+	}
+
+	*len = total;
+	return c;
+}
+
+/*
+ * Moves the next batch from @source (@jool's queue, or its advertisement) to
+ * the end of @prepared.
+ */
+static void dequeue_batch(struct xlator *jool, struct counted_list *source,
+		struct joold_prepared *prepared)
 {
 	struct joold_queue *queue;
+	struct deferred_session *session;
+	struct list_head batch;
 	struct list_head *cut;
+	unsigned int limit;
 	unsigned int d;
+	size_t len;
 
 	queue = jool->nat64.joold;
 
-	if (session) {
-		if (too_many_sessions(jool)) {
-			log_warn_once("joold: Too many sessions deferred! I need to drop some; sorry.");
-			jstat_inc(jool->stats, JSTAT_JOOLD_SSS_ENOSPC);
-			FREE_DEFERRED(session);
-		} else {
-			list_add_tail(&session->lh, &queue->deferred.list);
-			queue->deferred.count++;
+	/*
+	 * In compact mode, ss-max-sessions-per-packet only decides when the
+	 * queue is flushed; the batches are as long as ss-max-payload allows.
+	 */
+	limit = GLOBALS(jool).compact
+			? compact_fit(jool, &source->list, source->count, &len)
+			: batch_size(jool);
+
+	if (source->count <= limit) {
+		cut = source->list.prev;
+		d = source->count;
+	} else {
+		cut = &source->list;
+		for (d = 0; d < limit; d++)
+			cut = cut->next;
+	}
+
+	list_cut_position(&batch, &source->list, cut);
+	/* They're on their way; later updates need to be queued anew. */
+	list_for_each_entry(session, &batch, lh)
+		hash_del(&session->hh);
+	list_splice_tail(&batch, &prepared->sessions);
+	source->count -= d;
+	prepared->lens[prepared->count++] = d;
+
+	queue->next_seq++;
+	ad_update_flags(queue);
+}
+
+/*
+ * Assumes the lock is held.
+ * Always swallows @session.
+ */
+static void enqueue(struct xlator *jool, struct deferred_session *session)
+{
+	struct joold_queue *queue;
+	u32 hash;
+
+	queue = jool->nat64.joold;
+	hash = hash_session(queue, &session->session);
+
+	if (coalesce(queue, session, hash)) {
+		jstat_inc(jool->stats, JSTAT_JOOLD_SSS_COALESCED);
+		FREE_DEFERRED(session);
+	} else if (too_many_sessions(jool)) {
+		log_warn_once("joold: Too many sessions deferred! I need to drop some; sorry.");
+		jstat_inc(jool->stats, JSTAT_JOOLD_SSS_ENOSPC);
+		FREE_DEFERRED(session);
+	} else {
+		list_add_tail(&session->lh, &queue->deferred.list);
+		hash_add(queue->index, &session->hh, hash);
+		queue->deferred.count++;
+	}
+}
+
+/*
+ * Assumes the lock is held.
+ * Moves the sessions queued by every CPU to the queue, in order.
+ */
+static void merge_cpus(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct joold_cpu *local;
+	struct deferred_session *session, *tmp;
+	struct list_head sessions;
+	int cpu;
+
+	queue = jool->nat64.joold;
+
+	for_each_possible_cpu(cpu) {
+		local = per_cpu_ptr(queue->cpus, cpu);
+		INIT_LIST_HEAD(&sessions);
+
+		spin_lock(&local->lock);
+		list_splice_init(&local->sessions.list, &sessions);
+		local->sessions.count = 0;
+		spin_unlock(&local->lock);
+
+		list_for_each_entry_safe(session, tmp, &sessions, lh) {
+			list_del(&session->lh);
+			enqueue(jool, session);
 		}
 	}
+}
+
+/**
+ * Assumes the lock is held.
+ * You have to send_to_userspace(@jool, @prepared) after releasing the spinlock.
+ */
+static void send_to_userspace_prepare(struct xlator *jool,
+		struct joold_prepared *prepared)
+{
+	struct joold_queue *queue;
+
+	queue = jool->nat64.joold;
+	merge_cpus(jool);
 
 	if (!should_send(jool))
+		goto end;
+
+	prepared->seq = queue->next_seq;
+	do {
+		dequeue_batch(jool, next_source(queue), prepared);
+	} while (should_send_more(jool, prepared));
+
+	if (queue->udp) {
+		joold_udp_get(queue->udp);
+		prepared->udp = queue->udp;
+	}
+
+	/*
+	 * BTW: This sucks.
+	 * We're assuming that the nlcore_send_multicast_message() during
+	 * send_to_userspace() is going to succeed.
+	 * But the alternative is to do the nlcore_send_multicast_message()
+	 * with the lock held, and I don't have the stomach for that.
+	 * (If it fails, the deadline will eventually reclaim the window.)
+	 */
+	WRITE_ONCE(queue->last_flush_time, jiffies);
+
+end:
+	prepared->refill = needs_fetch(jool);
+}
+
+#ifdef JOOLD_LZ4
+
+/*
+ * Replaces the records of @attr (which is @skb's last attribute) with their LZ4
+ * compression, unless it's not any shorter.
+ */
+static void compress_records(struct xlator *jool, struct sk_buff *skb,
+		struct nlattr *attr)
+{
+	struct joold_queue *queue;
+	struct joold_compact_hdr *hdr;
+	char *records;
+	char *copy;
+	int old_size;
+	int len;
+	int clen;
+
+	queue = jool->nat64.joold;
+	hdr = nla_data(attr);
+	records = (char *)(hdr + 1);
+	len = be16_to_cpu(hdr->len);
+	old_size = nla_total_size(sizeof(*hdr) + len);
+
+	spin_lock_bh(&queue->lz4_lock);
+
+	copy = ((char *)queue->lz4_scratch) + LZ4_MEM_COMPRESS;
+	memcpy(copy, records, len);
+	clen = LZ4_compress_default(copy, records, len, len - 1,
+			queue->lz4_scratch);
+	if (clen <= 0) {
+		/* Incompressible; LZ4 might have trashed the records, though. */
+		memcpy(records, copy, len);
+		spin_unlock_bh(&queue->lz4_lock);
 		return;
+	}
 
-	if (queue->deferred.count <= GLOBALS(jool).max_sessions_per_pkt) {
-		cut = queue->deferred.list.prev;
-		d = queue->deferred.count;
-	} else {
-		cut = &queue->deferred.list;
-		for (d = 0; d < GLOBALS(jool).max_sessions_per_pkt; d++)
-			cut = cut->next;
+	spin_unlock_bh(&queue->lz4_lock);
+
+	hdr->flags |= JOOLD_COMPACT_LZ4;
+	attr->nla_len = nla_attr_size(sizeof(*hdr) + clen);
+	memset(records + clen, 0, nla_padlen(sizeof(*hdr) + clen));
+	skb_trim(skb, skb->len - old_size + nla_total_size(sizeof(*hdr) + clen));
+}
+
+#else
+
+static void compress_records(struct xlator *jool, struct sk_buff *skb,
+		struct nlattr *attr)
+{
+	log_warn_once("joold: ss-lz4 is enabled, but the kernel lacks LZ4 support. Sending the sessions uncompressed.");
+}
+
+#endif
+
+/*
+ * Moves the first @max sessions from @sessions to a single compact batch
+ * attribute in @skb. (Or less, if they don't fit.)
+ * Returns the number of sessions moved, or a negative error code.
+ */
+static int put_compact(struct xlator *jool, struct sk_buff *skb,
+		struct list_head *sessions, unsigned int max)
+{
+	struct deferred_session *session;
+	struct joold_compact_hdr *hdr;
+	struct joold_record records[2];
+	struct nlattr *attr;
+	unsigned int count;
+	unsigned int c;
+	size_t len;
+	__u8 *dst;
+
+	count = compact_fit(jool, sessions, max, &len);
+
+	attr = nla_reserve(skb, JNLAJ_BATCH, sizeof(*hdr) + len);
+	if (WARN(!attr, "nla_reserve() returned NULL"))
+		return -EMSGSIZE;
+
+	hdr = nla_data(attr);
+	hdr->version = JOOLD_COMPACT_VERSION;
+	hdr->flags = 0;
+	hdr->count = cpu_to_be16(count);
+	hdr->len = cpu_to_be16(len);
+
+	dst = (__u8 *)(hdr + 1);
+	for (c = 0; c < count; c++) {
+		session = first_deferred(sessions);
+		joold_record_from_session(&records[c & 1], &session->session);
+		dst += joold_record_write(dst,
+				c ? &records[!(c & 1)] : NULL,
+				&records[c & 1]);
+		list_del(&session->lh);
+		FREE_DEFERRED(session);
 	}
 
-	list_cut_position(prepared, &queue->deferred.list, cut);
-	queue->deferred.count -= d;
+	if (GLOBALS(jool).lz4)
+		compress_records(jool, skb, attr);
+
+	return count;
+}
+
+/*
+ * Moves the first @len sessions (the batch dequeue_batch() cut) from @sessions
+ * to @skb.
+ * Returns the number of sessions moved, or a negative error code.
+ */
+static int put_sessions(struct xlator *jool, struct sk_buff *skb,
+		struct list_head *sessions, unsigned int len)
+{
+	struct deferred_session *session;
+	unsigned int count;
+	int error;
+
+	if (GLOBALS(jool).compact) {
+		error = put_compact(jool, skb, sessions, len);
+		if (error < 0)
+			return error;
+		count = error;
+		goto end;
+	}
+
+	count = 0;
+	while (!list_empty(sessions) && count < len) {
+		session = first_deferred(sessions);
+		error = jnla_put_session_joold(skb, JNLAJ_SESSION, &session->session);
+		if (WARN(error, "jnla_put_session() returned %d", error))
+			return error;
+		list_del(&session->lh);
+		FREE_DEFERRED(session);
+		count++;
+	}
+
+end:
+	jstat_add(jool->stats, JSTAT_JOOLD_SSS_SENT, count);
+	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_SENT);
+	return count;
+}
+
+/*
+ * Sends the first @len sessions from @sessions straight to the network, as
+ * batch number @seq. The payload is the daemon's: the entries, and nothing
+ * else.
+ * On failure, drops all of @sessions.
+ */
+static void send_batch_udp(struct xlator *jool, struct joold_udp *udp,
+		struct list_head *sessions, unsigned int len, __u32 seq)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb(JOOLD_MAX_PAYLOAD, GFP_ATOMIC);
+	if (!skb)
+		goto revert_list;
+	if (put_sessions(jool, skb, sessions, len) < 0)
+		goto revert_skb;
+
+	joold_udp_send(udp, jool, skb, seq);
+	return;
 
-	/*
-	 * BTW: This sucks.
-	 * We're assuming that the nlcore_send_multicast_message() during
-	 * send_to_userspace() is going to succeed.
-	 * But the alternative is to do the nlcore_send_multicast_message()
-	 * with the lock held, and I don't have the stomach for that.
-	 */
-	queue->flags &= ~JQF_ACK_RECEIVED;
-	if (queue->deferred.count == 0)
-		queue->flags &= ~JQF_AD_ONGOING;
-	queue->last_flush_time = jiffies;
+revert_skb:
+	kfree_skb(skb);
+revert_list:
+	delete_sessions(sessions);
 }
 
 /*
- * Swallows ownership of the sessions.
+ * Sends the first @len sessions from @sessions to the daemon as batch number
+ * @seq. On failure, drops all of @sessions.
  */
-static void send_to_userspace(struct xlator *jool, struct list_head *sessions)
+static void send_batch(struct xlator *jool, struct list_head *sessions,
+		unsigned int len, __u32 seq)
 {
 	struct sk_buff *skb;
 	struct joolnlhdr *jhdr;
 	struct nlattr *root;
-	struct deferred_session *session;
-	int count;
 	int error;
 
-	if (list_empty(sessions))
-		return;
-
-	skb = genlmsg_new(1500, GFP_ATOMIC);
+	skb = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
 	if (!skb)
 		goto revert_list;
 
@@ -246,21 +859,16 @@ static void send_to_userspace(struct xlator *jool, struct list_head *sessions)
 	if (WARN(!root, "nla_nest_start() returned NULL"))
 		goto revert_skb;
 
-	count = 0;
-	while (!list_empty(sessions)) {
-		session = first_deferred(sessions);
-		error = jnla_put_session_joold(skb, JNLAL_ENTRY, &session->session);
-		if (WARN(error, "jnla_put_session() returned %d", error))
-			goto revert_skb;
-		list_del(&session->lh);
-		FREE_DEFERRED(session);
-		count++;
-	}
-
-	jstat_add(jool->stats, JSTAT_JOOLD_SSS_SENT, count);
-	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_SENT);
+	if (put_sessions(jool, skb, sessions, len) < 0)
+		goto revert_skb;
 
 	nla_nest_end(skb, root);
+
+	/* After the sessions, because the daemon expects them first. */
+	error = nla_put_u32(skb, JNLAR_JOOLD_SEQ, seq);
+	if (WARN(error, "nla_put_u32() returned %d", error))
+		goto revert_skb;
+
 	genlmsg_end(skb, jhdr);
 	sendpkt_multicast(jool, skb);
 	return;
@@ -271,13 +879,41 @@ revert_list:
 	delete_sessions(sessions);
 }
 
+/*
+ * Swallows ownership of the sessions.
+ */
+static void send_to_userspace(struct xlator *jool,
+		struct joold_prepared *prepared)
+{
+	unsigned int b;
+
+	for (b = 0; b < prepared->count; b++) {
+		/* A failed batch drops the rest. */
+		if (list_empty(&prepared->sessions))
+			break;
+
+		if (prepared->udp)
+			send_batch_udp(jool, prepared->udp,
+					&prepared->sessions, prepared->lens[b],
+					prepared->seq + b);
+		else
+			send_batch(jool, &prepared->sessions,
+					prepared->lens[b], prepared->seq + b);
+	}
+
+	if (prepared->udp)
+		joold_udp_put(prepared->udp);
+}
+
 /**
  * joold_create - Constructor for joold_queue structs.
  */
 struct joold_queue *joold_alloc(void)
 {
 	struct joold_queue *queue;
+	struct joold_cpu *local;
 	bool cache_created;
+	int cpu;
 
 	cache_created = false;
 	if (!deferred_cache) {
@@ -287,20 +923,56 @@ struct joold_queue *joold_alloc(void)
 	}
 
 	queue = wkmalloc(struct joold_queue, GFP_KERNEL);
-	if (!queue) {
-		if (cache_created)
-			joold_teardown();
-		return NULL;
+	if (!queue)
+		goto revert_cache;
+
+	queue->cpus = alloc_percpu(struct joold_cpu);
+	if (!queue->cpus)
+		goto revert_queue;
+	for_each_possible_cpu(cpu) {
+		local = per_cpu_ptr(queue->cpus, cpu);
+		INIT_LIST_HEAD(&local->sessions.list);
+		local->sessions.count = 0;
+		spin_lock_init(&local->lock);
 	}
 
-	queue->flags = JQF_ACK_RECEIVED;
+#ifdef JOOLD_LZ4
+	queue->lz4_scratch = __wkmalloc("joold LZ4 scratch", LZ4_SCRATCH_SIZE,
+			GFP_KERNEL);
+	if (!queue->lz4_scratch)
+		goto revert_cpus;
+	spin_lock_init(&queue->lz4_lock);
+#endif
+
+	queue->flags = 0;
 	INIT_LIST_HEAD(&queue->deferred.list);
 	queue->deferred.count = 0;
+	INIT_LIST_HEAD(&queue->ad.list);
+	queue->ad.count = 0;
+	queue->cursor.done = true;
+	queue->ad_turn = false;
+	hash_init(queue->index);
+	queue->seed = get_random_u32();
+	queue->next_seq = 0;
+	queue->acked_seq = 0;
 	queue->last_flush_time = jiffies;
+	queue->udp = NULL;
 	spin_lock_init(&queue->lock);
+	jlock_stats_init(&queue->lstats);
 	kref_init(&queue->refs);
 
 	return queue;
+
+#ifdef JOOLD_LZ4
+revert_cpus:
+	free_percpu(queue->cpus);
+#endif
+revert_queue:
+	wkfree(struct joold_queue, queue);
+revert_cache:
+	if (cache_created)
+		joold_teardown();
+	return NULL;
 }
 
 void joold_get(struct joold_queue *queue)
@@ -311,8 +983,19 @@ void joold_get(struct joold_queue *queue)
 static void joold_release(struct kref *refs)
 {
 	struct joold_queue *queue;
+	int cpu;
+
 	queue = container_of(refs, struct joold_queue, refs);
+	if (queue->udp)
+		joold_udp_put(queue->udp);
+	for_each_possible_cpu(cpu)
+		delete_sessions(&per_cpu_ptr(queue->cpus, cpu)->sessions.list);
+	free_percpu(queue->cpus);
 	delete_sessions(&queue->deferred.list);
+	delete_sessions(&queue->ad.list);
+#ifdef JOOLD_LZ4
+	__wkfree("joold LZ4 scratch", queue->lz4_scratch);
+#endif
 	wkfree(struct joold_queue, queue);
 }
 
@@ -321,18 +1004,142 @@ void joold_put(struct joold_queue *queue)
 	kref_put(&queue->refs, joold_release);
 }
 
+struct jlock_stats *joold_lock_stats(struct joold_queue *queue)
+{
+	return &queue->lstats;
+}
+
+/* Number of sessions each advertisement fetch should collect; about a batch. */
+static unsigned int ad_fetch_size(struct xlator *jool)
+{
+	size_t payload;
+
+	if (!GLOBALS(jool).compact)
+		return batch_size(jool);
+
+	payload = min_t(size_t, GLOBALS(jool).max_payload, JOOLD_MAX_PAYLOAD);
+	return max_t(size_t, payload / JOOLD_RECORD_MIN_LEN, 1);
+}
+
+/*
+ * Collects the next (up to) @max sessions of the advertisement into @list,
+ * starting from @cursor, and moves @cursor past them.
+ * Takes the BIB's locks; assumes the queue's is not held.
+ */
+static int ad_fetch(struct xlator *jool, struct ad_cursor *cursor,
+		struct counted_list *list, unsigned int max)
+{
+	struct ad_arg arg;
+	unsigned int visited;
+	int error;
+
+	arg.sessions = list;
+	arg.cfg = &GLOBALS(jool);
+	arg.max = max;
+	arg.visited = 0;
+
+	while (!cursor->done) {
+		visited = arg.visited;
+		error = bib_foreach_session(jool, cursor->proto, ad_session,
+				&arg, cursor->started ? &cursor->offset : NULL);
+		if (arg.visited != visited) {
+			cursor->offset.offset = arg.last;
+			cursor->offset.include_offset = false;
+			cursor->started = true;
+		}
+		if (error < 0)
+			return error;
+		if (error > 0)
+			return 0; /* Done for now; the rest come later. */
+
+		/* Table exhausted; next one. */
+		if (cursor->proto == L4PROTO_ICMP) {
+			cursor->done = true;
+		} else {
+			cursor->proto++;
+			cursor->started = false;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Fetches the next piece of the ongoing advertisement, and sends whatever can
+ * be sent.
+ * Returns true if another fetch is already warranted.
+ */
+static bool ad_refill(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct ad_cursor cursor;
+	struct counted_list fetched;
+	struct joold_prepared prepared;
+	int error;
+
+	queue = jool->nat64.joold;
+	INIT_LIST_HEAD(&fetched.list);
+	fetched.count = 0;
+	init_prepared(&prepared);
+
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+	if (!needs_fetch(jool)) {
+		junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+		return false;
+	}
+	/* Walk the BIB without the lock; live sessions keep flowing. */
+	queue->flags |= JQF_AD_FETCHING;
+	cursor = queue->cursor;
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+
+	error = ad_fetch(jool, &cursor, &fetched, ad_fetch_size(jool));
+	if (error) {
+		log_err("joold advertisement interrupted.");
+		delete_sessions(&fetched.list);
+		fetched.count = 0;
+		cursor.done = true;
+	}
+
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+	queue->flags &= ~JQF_AD_FETCHING;
+	queue->cursor = cursor;
+	list_splice_tail(&fetched.list, &queue->ad.list);
+	queue->ad.count += fetched.count;
+	ad_update_flags(queue);
+	send_to_userspace_prepare(jool, &prepared);
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+
+	send_to_userspace(jool, &prepared);
+	return prepared.refill;
+}
+
+/*
+ * Pushes the ongoing advertisement until the window fills up (or the
+ * advertisement ends). Process context only.
+ */
+static void ad_stream(struct xlator *jool)
+{
+	while (ad_refill(jool))
+		cond_resched();
+}
+
 /**
  * joold_add - Add @session to @jool->nat64.joold.
  *
  * This is the function that gets called whenever a packet translation
  * successfully triggers the creation of a session entry. @session will be sent
  * to the joold daemon.
+ *
+ * @session is only appended to the current CPU's list. The queue's lock is
+ * taken only if the queue looks like it's ready to be flushed.
  */
 void joold_add(struct xlator *jool, struct session_entry *_session)
 {
 	struct joold_queue *queue;
+	struct joold_cpu *local;
 	struct deferred_session *session;
-	struct list_head prepared;
+	struct joold_prepared prepared;
+	unsigned int count;
 
 	if (!GLOBALS(jool).enabled)
 		return;
@@ -341,68 +1148,117 @@ void joold_add(struct xlator *jool, struct session_entry *_session)
 	if (!session)
 		return;
 	session->session = *_session;
+	INIT_HLIST_NODE(&session->hh);
 	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
 
-	spin_lock_bh(&queue->lock);
-	send_to_userspace_prepare(jool, session, &prepared);
-	spin_unlock_bh(&queue->lock);
+	local = get_cpu_ptr(queue->cpus);
+	spin_lock_bh(&local->lock);
+	count = local->sessions.count;
+	if (count < cpu_capacity(jool)) {
+		list_add_tail(&session->lh, &local->sessions.list);
+		local->sessions.count = ++count;
+		session = NULL;
+	}
+	spin_unlock_bh(&local->lock);
+	put_cpu_ptr(queue->cpus);
+
+	if (session) {
+		/* This CPU's share is full, and has not been merged yet. */
+		log_warn_once("joold: Too many sessions deferred! I need to drop some; sorry.");
+		jstat_inc(jool->stats, JSTAT_JOOLD_SSS_ENOSPC);
+		FREE_DEFERRED(session);
+		return;
+	}
 
-	send_to_userspace(jool, &prepared);
 	jstat_inc(jool->stats, JSTAT_JOOLD_SSS_QUEUED);
+	if (!should_merge(jool, count))
+		return;
+
+	init_prepared(&prepared);
+
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADD);
+	send_to_userspace_prepare(jool, &prepared);
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADD);
+
+	send_to_userspace(jool, &prepared);
+
+	/* Packet context; fetch one piece at most. */
+	if (prepared.refill)
+		ad_refill(jool);
 }
 
-struct add_params {
-	struct session_entry new;
+/* Sessions bib_add_sessions() gets at a time. */
+#define JOOLD_APPLY_CHUNK 64
+
+/* Received sessions, waiting to be added to the database in bulk. */
+struct apply_buffer {
+	struct xlator *jool;
+	struct bib_add_request reqs[JOOLD_APPLY_CHUNK];
+	unsigned int count;
+	/* Were all the sessions received so far added successfully? */
 	bool success;
 };
 
 static enum session_fate collision_cb(struct session_entry *old, void *arg)
 {
-	struct add_params *params = arg;
-	struct session_entry *new = &params->new;
+	struct bib_add_request *req = arg;
+	struct session_entry *new = &req->session;
 
 	if (session_equals(old, new)) { /* It's the same session; update it. */
+		/* Unless the update is older than what we already have. */
+		if (time_before(new->update_time, old->update_time))
+			return FATE_PRESERVE;
 		old->state = new->state;
 		old->timer_type = new->timer_type;
 		old->update_time = new->update_time;
-		params->success = true;
 		return FATE_TIMER_SLOW;
 	}
 
 	log_warn_once("We're out of sync: Incoming session entry " SEPP
 			" collides with DB entry " SEPP ".",
 			SEPA(new), SEPA(old));
-	params->success = false;
+	req->error = -EINVAL;
 	return FATE_PRESERVE;
 }
 
-static bool add_new_session(struct xlator *jool, struct nlattr *attr)
+/* Adds the sessions of @apply to the database, and empties it. */
+static void apply_flush(struct apply_buffer *apply)
 {
-	struct add_params params;
-	struct collision_cb cb;
+	unsigned int i;
 	int error;
 
-	__log_debug(jool, "Adding session!");
-
-	error = jnla_get_session_joold(attr, "joold session",
-			&jool->globals, &params.new);
-	if (error)
-		return false;
-
-	params.success = true;
-	cb.cb = collision_cb;
-	cb.arg = &params;
+	if (apply->count == 0)
+		return;
 
-	error = bib_add_session(jool, &params.new, &cb);
-	if (error == -EEXIST)
-		return params.success;
-	if (error) {
-		log_err("sessiondb_add() threw unknown error code %d.", error);
-		return false;
+	__log_debug(apply->jool, "Adding %u sessions!", apply->count);
+	bib_add_sessions(apply->jool, apply->reqs, apply->count,
+			collision_cb);
+
+	for (i = 0; i < apply->count; i++) {
+		error = apply->reqs[i].error;
+		switch (error) {
+		case 0:
+		case -EEXIST:
+			break;
+		case -EINVAL: /* Out of sync; collision_cb() already warned. */
+			apply->success = false;
+			break;
+		default:
+			log_err("bib_add_sessions() threw unknown error code %d.",
+					error);
+			apply->success = false;
+		}
 	}
 
-	return true;
+	apply->count = 0;
+}
+
+/* Returns the slot the next received session should be parsed into. */
+static struct session_entry *apply_next(struct apply_buffer *apply)
+{
+	if (apply->count >= JOOLD_APPLY_CHUNK)
+		apply_flush(apply);
+	return &apply->reqs[apply->count].session;
 }
 
 static bool joold_disabled(struct xlator *jool)
@@ -415,30 +1271,175 @@ static bool joold_disabled(struct xlator *jool)
 	return false;
 }
 
-/**
- * joold_sync - Parses a bunch of sessions out of @data and adds them to @jool's
- * session database.
- *
- * This is the function that gets called whenever the jool daemon sends data to
- * the @jool Jool instance.
+static void add_legacy_session(struct apply_buffer *apply,
+		struct nlattr *attr)
+{
+	struct xlator *jool = apply->jool;
+
+	if (jnla_get_session_joold(attr, "joold session", &jool->globals,
+			apply_next(apply))) {
+		apply->success = false;
+		return;
+	}
+
+	apply->count++;
+}
+
+#ifdef JOOLD_LZ4
+
+/* Returns the decompressed records of @hdr. (Needs to be freed.) */
+static void *decompress_records(struct joold_compact_hdr const *hdr, int clen)
+{
+	char *result;
+	int len;
+
+	len = be16_to_cpu(hdr->len);
+	if (len > JOOLD_MAX_PAYLOAD) {
+		log_warn_once("joold: Dropping LZ4 batch; its records are too long (%d bytes).",
+				len);
+		return NULL;
+	}
+
+	result = __wkmalloc("joold LZ4 records", len, GFP_ATOMIC);
+	if (!result)
+		return NULL;
+
+	if (LZ4_decompress_safe((char const *)(hdr + 1), result, clen, len)
+			!= len) {
+		log_warn_once("joold: Dropping malformed LZ4 batch.");
+		__wkfree("joold LZ4 records", result);
+		return NULL;
+	}
+
+	return result;
+}
+
+#else
+
+static void *decompress_records(struct joold_compact_hdr const *hdr, int clen)
+{
+	log_warn_once("joold: Dropping LZ4 batch; the kernel lacks LZ4 support.");
+	return NULL;
+}
+
+#endif
+
+/*
+ * Queues the sessions of compact batch @attr into @apply.
+ * Returns the number of sessions received.
  */
-int joold_sync(struct xlator *jool, struct nlattr *root)
+static unsigned int add_batch(struct apply_buffer *apply, struct nlattr *attr)
+{
+	struct joold_compact_hdr const *hdr;
+	struct joold_record records[2];
+	__u8 const *src;
+	void *buffer;
+	unsigned int count;
+	unsigned int c;
+	int len;
+	int consumed;
+
+	if (nla_len(attr) < sizeof(*hdr))
+		goto malformed;
+	hdr = nla_data(attr);
+	if (hdr->version != JOOLD_COMPACT_VERSION) {
+		log_warn_once("joold: Dropping batch; unknown compact format version: %u",
+				hdr->version);
+		goto fail;
+	}
+	if (hdr->flags & ~JOOLD_COMPACT_LZ4)
+		goto malformed;
+
+	count = be16_to_cpu(hdr->count);
+	len = be16_to_cpu(hdr->len);
+	buffer = NULL;
+
+	if (hdr->flags & JOOLD_COMPACT_LZ4) {
+		buffer = decompress_records(hdr, nla_len(attr) - sizeof(*hdr));
+		if (!buffer)
+			goto fail;
+		src = buffer;
+	} else {
+		if (len > nla_len(attr) - sizeof(*hdr))
+			goto malformed;
+		src = (__u8 const *)(hdr + 1);
+	}
+
+	for (c = 0; c < count; c++) {
+		consumed = joold_record_read(src, len,
+				c ? &records[!(c & 1)] : NULL,
+				&records[c & 1]);
+		if (consumed < 0) {
+			log_warn_once("joold: Received a truncated compact batch.");
+			apply->success = false;
+			break;
+		}
+		src += consumed;
+		len -= consumed;
+
+		if (joold_record_to_session(&apply->jool->globals,
+				&records[c & 1], apply_next(apply)))
+			apply->success = false;
+		else
+			apply->count++;
+	}
+
+	if (buffer)
+		__wkfree("joold LZ4 records", buffer);
+	return c;
+
+malformed:
+	log_warn_once("joold: Dropping malformed compact batch.");
+fail:
+	apply->success = false;
+	return 0;
+}
+
+/*
+ * @head and @len delimit a sequence of session attributes. (Legacy sessions,
+ * compact batches, or both.)
+ */
+static int sync_sessions(struct xlator *jool, struct nlattr *head, int len)
 {
+	struct apply_buffer *apply;
 	struct nlattr *attr;
 	int rem;
 	int rcvd;
 	bool success;
 
-	if (joold_disabled(jool))
-		return -EINVAL;
+	apply = __wkmalloc("joold apply buffer", sizeof(*apply), GFP_ATOMIC);
+	if (!apply)
+		return -ENOMEM;
+	apply->jool = jool;
+	apply->count = 0;
+	apply->success = true;
 
-	success = true;
 	rcvd = 0;
-	nla_for_each_nested(attr, root, rem) {
-		success &= add_new_session(jool, attr);
-		rcvd++;
+	nla_for_each_attr(attr, head, len, rem) {
+		switch (nla_type(attr)) {
+		case JNLAJ_SESSION:
+			add_legacy_session(apply, attr);
+			rcvd++;
+			break;
+		case JNLAJ_BATCH:
+			rcvd += add_batch(apply, attr);
+			break;
+		case JNLAJ_SEQ:
+		case JNLAJ_NACK:
+		case JNLAJ_RESYNC:
+			/* A daemon forwarded some transport's datagram. */
+			break;
+		default:
+			log_warn_once("joold: Skipping unknown attribute type: %u",
+					nla_type(attr));
+			apply->success = false;
+		}
 	}
 
+	apply_flush(apply);
+	success = apply->success;
+	__wkfree("joold apply buffer", apply);
+
 	jstat_add(jool->stats, JSTAT_JOOLD_SSS_RCVD, rcvd);
 	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_RCVD);
 
@@ -446,76 +1447,169 @@ int joold_sync(struct xlator *jool, struct nlattr *root)
 	return success ? 0 : -EINVAL;
 }
 
-int joold_advertise(struct xlator *jool)
+/**
+ * joold_sync - Parses a bunch of sessions out of @data and adds them to @jool's
+ * session database.
+ *
+ * This is the function that gets called whenever the jool daemon sends data to
+ * the @jool Jool instance.
+ */
+int joold_sync(struct xlator *jool, struct nlattr *root)
 {
-	l4_protocol proto;
-	struct joold_queue *queue;
-	struct counted_list sessions;
-	struct list_head prepared;
-	int error;
-
 	if (joold_disabled(jool))
 		return -EINVAL;
+	return sync_sessions(jool, nla_data(root), nla_len(root));
+}
 
-	/* Collect the current sessions */
-	INIT_LIST_HEAD(&sessions.list);
-	sessions.count = 0;
-	for (proto = L4PROTO_TCP; proto <= L4PROTO_ICMP; proto++) {
-		error = bib_foreach_session(jool, proto, ad_session, &sessions,
-				NULL);
-		if (error) {
-			log_err("joold advertisement interrupted.");
-			delete_sessions(&sessions.list);
-			return error;
-		}
-	}
+/**
+ * joold_sync_datagram - Same as joold_sync(), except the sessions were
+ * received by @jool's own transport. @payload is the datagram's payload.
+ */
+void joold_sync_datagram(struct xlator *jool, void *payload, int len)
+{
+	/* Not the user's fault; don't complain. */
+	if (!GLOBALS(jool).enabled)
+		return;
+	sync_sessions(jool, payload, len);
+}
 
-	if (sessions.count == 0)
-		return 0;
+/**
+ * joold_set_transport - Makes @udp @jool's transport. (Swallows the reference.)
+ *
+ * If @udp is NULL, the sessions go back to the daemon.
+ */
+void joold_set_transport(struct xlator *jool, struct joold_udp *udp)
+{
+	struct joold_queue *queue;
+	struct joold_udp *old;
 
 	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
 
-	spin_lock_bh(&queue->lock);
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_TRANSPORT);
+	old = queue->udp;
+	queue->udp = udp;
+	/* Whatever was in flight, its ACKs are not coming anymore. */
+	queue->acked_seq = queue->next_seq;
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_TRANSPORT);
 
-	if (queue->flags & JQF_AD_ONGOING) {
-		spin_unlock_bh(&queue->lock);
-		delete_sessions(&sessions.list);
-		log_err("joold advertisement already in progress.");
-		return -EINVAL;
+	if (old)
+		joold_udp_put(old);
+}
+
+/**
+ * joold_advertise - Starts sending every session in the database to the peers.
+ *
+ * The sessions are not collected all at once. The advertisement is a cursor
+ * over the BIB; every time there's room in the window, about one more batch is
+ * fetched from it. Its batches take turns with the ones from the queue.
+ */
+/* Returns false if an advertisement was already in progress. */
+static bool ad_start(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	bool started;
+
+	queue = jool->nat64.joold;
+
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+
+	started = !(queue->flags & JQF_AD_ONGOING);
+	if (started) {
+		queue->flags |= JQF_AD_ONGOING;
+		queue->cursor.proto = L4PROTO_TCP;
+		queue->cursor.started = false;
+		queue->cursor.done = false;
+		queue->ad_turn = false;
 	}
-	queue->flags |= JQF_AD_ONGOING;
 
-	list_move_all(&sessions.list, &queue->deferred.list);
-	queue->deferred.count += sessions.count;
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ADVERTISE);
+	return started;
+}
 
-	send_to_userspace_prepare(jool, NULL, &prepared);
+int joold_advertise(struct xlator *jool)
+{
+	if (joold_disabled(jool))
+		return -EINVAL;
 
-	spin_unlock_bh(&queue->lock);
+	if (!ad_start(jool)) {
+		log_err("joold advertisement already in progress.");
+		return -EINVAL;
+	}
 
-	send_to_userspace(jool, &prepared);
+	ad_stream(jool);
 	jstat_inc(jool->stats, JSTAT_JOOLD_ADS);
 	return 0;
 }
 
-void joold_ack(struct xlator *jool)
+/**
+ * joold_resync - Same as joold_advertise(), except it's requested by a peer
+ * (through @jool's transport), so it's quiet, and a no-op if an advertisement
+ * is already in progress. (That one will do.) Process context only.
+ */
+void joold_resync(struct xlator *jool)
+{
+	if (!GLOBALS(jool).enabled)
+		return;
+	if (!ad_start(jool))
+		return;
+
+	ad_stream(jool);
+	jstat_inc(jool->stats, JSTAT_JOOLD_ADS);
+	jstat_inc(jool->stats, JSTAT_JOOLD_RESYNCS);
+}
+
+/*
+ * Assumes the lock is held.
+ * ACKs are cumulative; @seq acknowledges every batch up to itself.
+ */
+static void handle_ack(struct xlator *jool, __u32 const *seq)
+{
+	struct joold_queue *queue = jool->nat64.joold;
+
+	if (!seq) {
+		/* Old daemon; it ACKs every batch, in order. */
+		if (in_flight(queue) > 0)
+			queue->acked_seq++;
+		return;
+	}
+
+	if (*seq - queue->acked_seq >= in_flight(queue)) {
+		/* Duplicate, or from before the deadline reclaimed the window */
+		jstat_inc(jool->stats, JSTAT_JOOLD_STALE_ACKS);
+		return;
+	}
+
+	queue->acked_seq = *seq + 1;
+}
+
+/**
+ * joold_ack - The daemon (or the in-kernel transport) is done with batch number
+ * @seq.
+ *
+ * @seq can be NULL, in which case the ACK is assumed to be for the oldest
+ * batch in flight.
+ */
+void joold_ack(struct xlator *jool, __u32 const *seq)
 {
 	struct joold_queue *queue;
-	struct list_head prepared;
+	struct joold_prepared prepared;
 
 	if (joold_disabled(jool))
 		return;
 
 	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
+	init_prepared(&prepared);
 
-	spin_lock_bh(&queue->lock);
-	queue->flags |= JQF_ACK_RECEIVED;
-	send_to_userspace_prepare(jool, NULL, &prepared);
-	spin_unlock_bh(&queue->lock);
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_ACK);
+	handle_ack(jool, seq);
+	send_to_userspace_prepare(jool, &prepared);
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_ACK);
 
 	send_to_userspace(jool, &prepared);
 	jstat_inc(jool->stats, JSTAT_JOOLD_ACKS);
+
+	if (prepared.refill)
+		ad_stream(jool);
 }
 
 /**
@@ -526,18 +1620,22 @@ void joold_ack(struct xlator *jool)
  */
 void joold_clean(struct xlator *jool)
 {
-	spinlock_t *lock;
-	struct list_head prepared;
+	struct joold_queue *queue;
+	struct joold_prepared prepared;
 
 	if (!GLOBALS(jool).enabled)
 		return;
 
-	lock = &jool->nat64.joold->lock;
-	INIT_LIST_HEAD(&prepared);
+	queue = jool->nat64.joold;
+	init_prepared(&prepared);
 
-	spin_lock_bh(lock);
-	send_to_userspace_prepare(jool, NULL, &prepared);
-	spin_unlock_bh(lock);
+	jlock(&queue->lock, &queue->lstats, JLS_JOOLD_CLEAN);
+	send_to_userspace_prepare(jool, &prepared);
+	junlock(&queue->lock, &queue->lstats, JLS_JOOLD_CLEAN);
 
 	send_to_userspace(jool, &prepared);
+
+	/* Timer context; fetch one piece at most. */
+	if (prepared.refill)
+		ad_refill(jool);
 }
@@ -2,6 +2,8 @@
 #define SRC_MOD_NAT64_JOOLD_H_
 
 #include "common/config.h"
+#include "mod/common/lock_stats.h"
+#include "mod/common/joold_udp.h"
 #include "mod/common/xlator.h"
 #include "mod/common/db/bib/entry.h"
 
@@ -19,12 +21,50 @@ struct joold_queue *joold_alloc(void);
 void joold_get(struct joold_queue *queue);
 void joold_put(struct joold_queue *queue);
 
+struct jlock_stats *joold_lock_stats(struct joold_queue *queue);
+
 int joold_sync(struct xlator *jool, struct nlattr *root);
+void joold_sync_datagram(struct xlator *jool, void *payload, int len);
 void joold_add(struct xlator *jool, struct session_entry *entry);
 
 int joold_advertise(struct xlator *jool);
-void joold_ack(struct xlator *jool);
+void joold_resync(struct xlator *jool);
+void joold_ack(struct xlator *jool, __u32 const *seq);
 
 void joold_clean(struct xlator *jool);
 
+/* @udp can be NULL. */
+void joold_set_transport(struct xlator *jool, struct joold_udp *udp);
+
+/*
+ * Does the replication policy (ss-tcp, ss-udp, ss-icmp, ss-include-ports and
+ * ss-exclude-ports) want @session synchronized?
+ * (Ignores ss-min-age and ss-min-packets; the BIB handles those.)
+ */
+static inline bool joold_policy_allows(struct joold_config const *cfg,
+		struct session_entry const *session)
+{
+	switch (session->proto) {
+	case L4PROTO_TCP:
+		if (!cfg->tcp)
+			return false;
+		break;
+	case L4PROTO_UDP:
+		if (!cfg->udp)
+			return false;
+		break;
+	case L4PROTO_ICMP:
+		/* ICMP "ports" are identifiers, so the ranges don't apply. */
+		return cfg->icmp;
+	case L4PROTO_OTHER:
+		return false;
+	}
+
+	if (!port_range_contains(&cfg->include_ports, session->src6.l4)
+			&& !port_range_contains(&cfg->include_ports, session->dst4.l4))
+		return false;
+	return !port_range_contains(&cfg->exclude_ports, session->src6.l4)
+			&& !port_range_contains(&cfg->exclude_ports, session->dst4.l4);
+}
+
 #endif /* SRC_MOD_NAT64_JOOLD_H_ */
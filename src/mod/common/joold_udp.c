@@ -0,0 +1,879 @@
+#include "mod/common/joold_udp.h"
+
+#include <linux/igmp.h>
+#include <linux/kref.h>
+#include <linux/net.h>
+#include <linux/random.h>
+#include <linux/rtnetlink.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <net/addrconf.h>
+#include <net/inet_sock.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+#include <net/sock.h>
+
+#include "common/config.h"
+#include "mod/common/joold.h"
+#include "mod/common/linux_version.h"
+#include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+
+/*
+ * Maximum number of datagrams waiting for the workqueue. They're not ACKed
+ * until they're sent, so ss-window normally keeps the queue shorter than this.
+ * (It can only grow past it if ss-window is larger, or ss-flush-deadline gave
+ * up on the ACKs.) If it does, the rest are dropped, but their numbers are
+ * still spent, so the peers notice.
+ */
+#define TX_QUEUE_MAX 256
+
+/*
+ * Number of datagrams each transport remembers, so it can resend them if a peer
+ * reports them missing. Also the width of the window in which a receiver tracks
+ * a peer's datagrams. Needs to be a power of two.
+ */
+#define RTX_RING_SIZE 64
+/* Maximum number of peers whose datagram sequences are tracked at once */
+#define MAX_PEERS 16
+
+/*
+ * Reliability
+ * ===========
+ *
+ * Every datagram that carries sessions starts with a JNLAJ_SEQ attribute,
+ * which contains the sender transport's random ID and the datagram's number.
+ * The receivers track each peer's numbers; when they notice a gap, they
+ * multicast a JNLAJ_NACK, and the peer resends the missing datagrams from its
+ * retransmission ring. Only if the ring no longer has them (because the gap is
+ * too large, or the resends got lost too), the receiver multicasts a
+ * JNLAJ_RESYNC, and the peer starts an advertisement.
+ *
+ * The NACKs and resends also travel through the multicast group, so the other
+ * receivers drop the datagrams they already have.
+ *
+ * The daemon does not number its datagrams, and is not meant to; it would need
+ * its own ring and NACK handling in userspace. Unnumbered datagrams are simply
+ * applied as they arrive.
+ */
+
+/* JNLAJ_SEQ's payload */
+struct joold_udp_seq {
+	/* joold_udp.id of the sender */
+	__be32 sender;
+	__be32 seq;
+};
+
+/* JNLAJ_NACK's payload: "@sender, resend datagrams [@first, @first + @count)" */
+struct joold_udp_nack {
+	__be32 sender;
+	__be32 first;
+	__be32 count;
+};
+
+/* JNLAJ_RESYNC's payload: "@sender, advertise your sessions" */
+struct joold_udp_resync {
+	__be32 sender;
+};
+
+struct seq_attr {
+	struct nlattr hdr;
+	struct joold_udp_seq seq;
+};
+
+/* What the transport stores in the control buffer of the skbs it queues. */
+struct joold_udp_cb {
+	/* The instance's number for the batch. (See joold_udp_send().) */
+	__u32 batch;
+};
+
+#define JOOLD_UDP_CB(skb) ((struct joold_udp_cb *)(skb)->cb)
+
+/* Another transport, as seen by our receiver. */
+struct joold_udp_peer {
+	/* The peer's joold_udp.id */
+	__u32 id;
+	/* Number of the next datagram expected from the peer */
+	__u32 next;
+	/*
+	 * Datagrams received from the window [@next - 64, @next).
+	 * Bit i stands for datagram @next - 1 - i.
+	 */
+	__u64 rcvd;
+	/* Bits of @rcvd that stand for datagrams sent after we met the peer */
+	__u64 known;
+	/* Jiffy of the last datagram. (Oldest peer gets evicted first.) */
+	unsigned long last_seen;
+	bool used;
+};
+
+struct joold_udp {
+	struct socket *sock;
+	/*
+	 * Not a reference; the socket would keep the namespace alive forever.
+	 * joold_udp_flush_net() ensures we die first instead.
+	 */
+	struct net *ns;
+	/* Instance the received sessions are delivered to */
+	char iname[INAME_MAX_SIZE];
+	union {
+		struct sockaddr_in v4;
+		struct sockaddr_in6 v6;
+	} group;
+
+	/* Random; tells our datagrams apart from the other transports' */
+	__u32 id;
+
+	void (*saved_data_ready)(struct sock *sk);
+	struct work_struct rx_work;
+	/* Only touched by rx_work */
+	char rx_buffer[JOOLD_MAX_PAYLOAD];
+	/* Only touched by rx_work */
+	struct joold_udp_peer peers[MAX_PEERS];
+
+	struct sk_buff_head tx_queue;
+	struct work_struct tx_work;
+
+	/*
+	 * The last RTX_RING_SIZE datagrams sent. Datagram number n lives in
+	 * slot n % RTX_RING_SIZE. (NULL if the slot hasn't been used yet.)
+	 */
+	struct sk_buff *rtx[RTX_RING_SIZE];
+	/* Number of the next datagram */
+	__u32 next_seq;
+	/*
+	 * Newest batch that was sent (or dropped), if @tx_ack. The instance
+	 * hasn't been told yet.
+	 */
+	__u32 tx_batch;
+	bool tx_ack;
+	/* Protects @rtx, @next_seq, @tx_batch and @tx_ack. */
+	spinlock_t rtx_lock;
+
+	/* Advertisement requested by a peer */
+	struct work_struct resync_work;
+
+	struct work_struct release_work;
+	/* List hook to @transports */
+	struct list_head list_hook;
+	struct kref refs;
+};
+
+static struct workqueue_struct *wq;
+
+/* Every transport that hasn't been released yet. */
+static LIST_HEAD(transports);
+static DEFINE_SPINLOCK(transports_lock);
+static DECLARE_WAIT_QUEUE_HEAD(transports_released);
+
+int joold_udp_setup(void)
+{
+	BUILD_BUG_ON(sizeof(struct seq_attr) != JOOLD_UDP_OVERHEAD);
+	BUILD_BUG_ON(RTX_RING_SIZE & (RTX_RING_SIZE - 1));
+	BUILD_BUG_ON(RTX_RING_SIZE > 64); /* joold_udp_peer.rcvd's width */
+
+	wq = alloc_workqueue("jool_joold", 0, 0);
+	return wq ? 0 : -ENOMEM;
+}
+
+void joold_udp_teardown(void)
+{
+	if (wq) {
+		destroy_workqueue(wq);
+		wq = NULL;
+	}
+}
+
+static int send_iov(struct joold_udp *udp, struct kvec *iov, size_t n,
+		size_t len)
+{
+	struct msghdr msg;
+	int error;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &udp->group;
+	msg.msg_namelen = (udp->group.v4.sin_family == AF_INET)
+			? sizeof(udp->group.v4)
+			: sizeof(udp->group.v6);
+
+	error = kernel_sendmsg(udp->sock, &msg, iov, n, len);
+	if (error < 0)
+		log_warn_once("joold: Could not send a session packet (errcode %d).",
+				error);
+	return error;
+}
+
+/* Sends @skb (whose payload is a bunch of sessions) as datagram number @seq. */
+static void send_numbered(struct joold_udp *udp, struct sk_buff *skb, __u32 seq)
+{
+	struct seq_attr attr;
+	struct kvec iov[2];
+
+	attr.hdr.nla_type = JNLAJ_SEQ;
+	attr.hdr.nla_len = nla_attr_size(sizeof(attr.seq));
+	attr.seq.sender = cpu_to_be32(udp->id);
+	attr.seq.seq = cpu_to_be32(seq);
+
+	iov[0].iov_base = &attr;
+	iov[0].iov_len = sizeof(attr);
+	iov[1].iov_base = skb->data;
+	iov[1].iov_len = skb->len;
+	send_iov(udp, iov, 2, sizeof(attr) + skb->len);
+}
+
+/* @len needs to be a multiple of 4. */
+static void send_control(struct joold_udp *udp, int type, void *payload,
+		size_t len)
+{
+	struct nlattr hdr;
+	struct kvec iov[2];
+
+	hdr.nla_type = type;
+	hdr.nla_len = nla_attr_size(len);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = len;
+	send_iov(udp, iov, 2, sizeof(hdr) + len);
+}
+
+static void request_resend(struct joold_udp *udp, __u32 peer, __u32 first,
+		__u32 count)
+{
+	struct joold_udp_nack nack;
+
+	nack.sender = cpu_to_be32(peer);
+	nack.first = cpu_to_be32(first);
+	nack.count = cpu_to_be32(count);
+	send_control(udp, JNLAJ_NACK, &nack, sizeof(nack));
+}
+
+static void request_resync(struct joold_udp *udp, __u32 peer)
+{
+	struct joold_udp_resync resync;
+
+	resync.sender = cpu_to_be32(peer);
+	send_control(udp, JNLAJ_RESYNC, &resync, sizeof(resync));
+}
+
+static struct joold_udp_peer *get_peer(struct joold_udp *udp, __u32 id,
+		bool *is_new)
+{
+	struct joold_udp_peer *peer;
+	struct joold_udp_peer *victim;
+	unsigned int i;
+
+	/* Unused slot if there's one, least recently seen peer otherwise */
+	victim = &udp->peers[0];
+	for (i = 0; i < MAX_PEERS; i++) {
+		peer = &udp->peers[i];
+		if (peer->used && peer->id == id) {
+			*is_new = false;
+			return peer;
+		}
+
+		if (!peer->used) {
+			if (victim->used)
+				victim = peer;
+		} else if (victim->used && time_before(peer->last_seen,
+				victim->last_seen)) {
+			victim = peer;
+		}
+	}
+
+	*is_new = true;
+	victim->id = id;
+	victim->used = true;
+	return victim;
+}
+
+/*
+ * Updates our records of peer @id's datagrams, now that its datagram number
+ * @seq arrived. Asks the peer for the datagrams that seem to be missing.
+ * Returns false if @seq should be dropped. (Because it's a duplicate, or too
+ * old to tell.)
+ */
+static bool track_seq(struct joold_udp *udp, struct xlator *jool, __u32 id,
+		__u32 seq)
+{
+	struct joold_udp_peer *peer;
+	__u64 missing;
+	__u32 gap;
+	__u32 age;
+	bool is_new;
+
+	peer = get_peer(udp, id, &is_new);
+	peer->last_seen = jiffies;
+
+	if (is_new) {
+		/* Whatever it sent before we met, the advertisements cover. */
+		peer->next = seq + 1;
+		peer->rcvd = 1;
+		peer->known = 1;
+		return true;
+	}
+
+	gap = seq - peer->next;
+	if (gap < (1u << 31)) {
+		/* @seq is new; datagrams [next, seq) are missing. */
+		if (gap >= RTX_RING_SIZE) {
+			/* The peer doesn't have them anymore. */
+			jstat_add(jool->stats, JSTAT_JOOLD_GAPS, gap);
+			request_resync(udp, id);
+			peer->rcvd = 1;
+			peer->known = 1;
+			peer->next = seq + 1;
+			return true;
+		}
+
+		/*
+		 * Holes that fall off the window are not going to be filled.
+		 * The advertisement covers the other holes too, so forget them.
+		 */
+		missing = peer->known & ~peer->rcvd;
+		if (missing >> (RTX_RING_SIZE - 1 - gap)) {
+			request_resync(udp, id);
+			peer->rcvd |= missing;
+		}
+
+		if (gap > 0) {
+			jstat_add(jool->stats, JSTAT_JOOLD_GAPS, gap);
+			request_resend(udp, id, peer->next, gap);
+		}
+
+		if (gap + 1 == 64) {
+			peer->rcvd = 1;
+			peer->known = ~0ull;
+		} else {
+			peer->rcvd = (peer->rcvd << (gap + 1)) | 1;
+			peer->known = (peer->known << (gap + 1))
+					| ((1ull << (gap + 1)) - 1);
+		}
+		peer->next = seq + 1;
+		return true;
+	}
+
+	/* @seq is old; probably a resend. */
+	age = peer->next - 1 - seq;
+	if (age >= RTX_RING_SIZE || (peer->rcvd & (1ull << age))) {
+		jstat_inc(jool->stats, JSTAT_JOOLD_DUPLICATES);
+		return false;
+	}
+
+	peer->rcvd |= 1ull << age;
+	return true;
+}
+
+static void handle_nack(struct joold_udp *udp, struct xlator *jool,
+		struct joold_udp_nack const *nack)
+{
+	struct sk_buff *skbs[RTX_RING_SIZE];
+	struct sk_buff *skb;
+	__u32 first;
+	__u32 count;
+	__u32 seq;
+	unsigned int n;
+	bool overrun;
+
+	if (be32_to_cpu(nack->sender) != udp->id)
+		return; /* Somebody else's */
+
+	first = be32_to_cpu(nack->first);
+	count = min_t(__u32, be32_to_cpu(nack->count), RTX_RING_SIZE);
+	overrun = false;
+
+	spin_lock_bh(&udp->rtx_lock);
+	for (n = 0; n < count; n++) {
+		seq = first + n;
+		skb = udp->rtx[seq % RTX_RING_SIZE];
+		if (udp->next_seq - 1 - seq >= RTX_RING_SIZE || !skb) {
+			overrun = true;
+			break;
+		}
+		skbs[n] = skb_get(skb);
+	}
+	spin_unlock_bh(&udp->rtx_lock);
+
+	count = n;
+	for (n = 0; n < count; n++) {
+		send_numbered(udp, skbs[n], first + n);
+		consume_skb(skbs[n]);
+	}
+	jstat_add(jool->stats, JSTAT_JOOLD_RETRANSMITS, count);
+
+	/* The peer will likely ask for this anyway. */
+	if (overrun)
+		queue_work(wq, &udp->resync_work);
+}
+
+static void handle_resync(struct joold_udp *udp,
+		struct joold_udp_resync const *resync)
+{
+	if (be32_to_cpu(resync->sender) == udp->id)
+		queue_work(wq, &udp->resync_work);
+}
+
+/* Handles the @len-byte datagram that was just received into @udp->rx_buffer. */
+static void handle_datagram(struct joold_udp *udp, struct xlator *jool, int len)
+{
+	struct nlattr *attr;
+	struct joold_udp_seq *seq;
+
+	attr = (struct nlattr *)udp->rx_buffer;
+	if (!nla_ok(attr, len))
+		goto sessions; /* joold can complain about it */
+
+	switch (nla_type(attr)) {
+	case JNLAJ_SEQ:
+		if (nla_len(attr) < sizeof(*seq))
+			goto malformed;
+		seq = nla_data(attr);
+		if (!track_seq(udp, jool, be32_to_cpu(seq->sender),
+				be32_to_cpu(seq->seq)))
+			return;
+		attr = nla_next(attr, &len);
+		joold_sync_datagram(jool, attr, max(len, 0));
+		return;
+
+	case JNLAJ_NACK:
+		if (nla_len(attr) < sizeof(struct joold_udp_nack))
+			goto malformed;
+		handle_nack(udp, jool, nla_data(attr));
+		return;
+
+	case JNLAJ_RESYNC:
+		if (nla_len(attr) < sizeof(struct joold_udp_resync))
+			goto malformed;
+		handle_resync(udp, nla_data(attr));
+		return;
+	}
+
+sessions:
+	/* Sent by a daemon; no sequence. */
+	joold_sync_datagram(jool, udp->rx_buffer, len);
+	return;
+
+malformed:
+	log_warn_once("joold: Dropping malformed transport datagram.");
+}
+
+static void rx_work_fn(struct work_struct *work)
+{
+	struct joold_udp *udp;
+	struct xlator jool;
+	struct msghdr msg;
+	struct kvec iov;
+	bool found;
+	int len;
+
+	udp = container_of(work, struct joold_udp, rx_work);
+	found = !xlator_find(udp->ns, XF_ANY | XT_NAT64, udp->iname, &jool);
+
+	do {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = udp->rx_buffer;
+		iov.iov_len = sizeof(udp->rx_buffer);
+
+		len = kernel_recvmsg(udp->sock, &msg, &iov, 1, iov.iov_len,
+				MSG_DONTWAIT);
+		if (len < 0)
+			break;
+		if (msg.msg_flags & MSG_TRUNC) {
+			log_warn_once("joold: Dropping oversized datagram.");
+			continue;
+		}
+		/* If the instance doesn't exist, just empty the socket. */
+		if (found)
+			handle_datagram(udp, &jool, len);
+	} while (true);
+
+	if (found)
+		xlator_put(&jool);
+}
+
+/*
+ * Assumes the rtx lock is held.
+ * Spends the next datagram number on @skb (NULL if the datagram is being
+ * dropped), and records batch @batch as done.
+ * Returns the number; the caller has to consume_skb() whatever @old points to.
+ */
+static __u32 number_datagram(struct joold_udp *udp, struct sk_buff *skb,
+		__u32 batch, struct sk_buff **old)
+{
+	__u32 seq;
+
+	seq = udp->next_seq++;
+	*old = udp->rtx[seq % RTX_RING_SIZE];
+	udp->rtx[seq % RTX_RING_SIZE] = skb;
+	udp->tx_batch = batch;
+	udp->tx_ack = true;
+
+	return seq;
+}
+
+/*
+ * ACKs the batches that were sent, which might let the instance send more (or
+ * resume its advertisement).
+ */
+static void ack_batches(struct joold_udp *udp)
+{
+	struct xlator jool;
+	__u32 batch;
+	bool ack;
+
+	spin_lock_bh(&udp->rtx_lock);
+	ack = udp->tx_ack;
+	batch = udp->tx_batch;
+	udp->tx_ack = false;
+	spin_unlock_bh(&udp->rtx_lock);
+
+	if (!ack)
+		return;
+	if (xlator_find(udp->ns, XF_ANY | XT_NAT64, udp->iname, &jool))
+		return;
+
+	joold_ack(&jool, &batch);
+	xlator_put(&jool);
+}
+
+static void tx_work_fn(struct work_struct *work)
+{
+	struct joold_udp *udp;
+	struct sk_buff *skb;
+	struct sk_buff *old;
+	__u32 seq;
+
+	udp = container_of(work, struct joold_udp, tx_work);
+
+	while ((skb = skb_dequeue(&udp->tx_queue)) != NULL) {
+		/* The ring keeps @skb, in case somebody NACKs it. */
+		spin_lock_bh(&udp->rtx_lock);
+		seq = number_datagram(udp, skb_get(skb),
+				JOOLD_UDP_CB(skb)->batch, &old);
+		spin_unlock_bh(&udp->rtx_lock);
+
+		if (old)
+			consume_skb(old);
+		send_numbered(udp, skb, seq);
+		consume_skb(skb);
+	}
+
+	ack_batches(udp);
+}
+
+static void resync_work_fn(struct work_struct *work)
+{
+	struct joold_udp *udp;
+	struct xlator jool;
+
+	udp = container_of(work, struct joold_udp, resync_work);
+	if (xlator_find(udp->ns, XF_ANY | XT_NAT64, udp->iname, &jool))
+		return;
+
+	joold_resync(&jool);
+	xlator_put(&jool);
+}
+
+static void data_ready(struct sock *sk)
+{
+	struct joold_udp *udp;
+
+	read_lock_bh(&sk->sk_callback_lock);
+	udp = sk->sk_user_data;
+	if (udp)
+		queue_work(wq, &udp->rx_work);
+	read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void release_work_fn(struct work_struct *work)
+{
+	struct joold_udp *udp;
+	struct sock *sk;
+	unsigned int i;
+
+	udp = container_of(work, struct joold_udp, release_work);
+	sk = udp->sock->sk;
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = NULL;
+	sk->sk_data_ready = udp->saved_data_ready;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	cancel_work_sync(&udp->rx_work);
+	cancel_work_sync(&udp->tx_work);
+	cancel_work_sync(&udp->resync_work);
+	sock_release(udp->sock); /* Also leaves the group */
+	skb_queue_purge(&udp->tx_queue);
+	for (i = 0; i < RTX_RING_SIZE; i++)
+		if (udp->rtx[i])
+			consume_skb(udp->rtx[i]);
+
+	spin_lock(&transports_lock);
+	list_del(&udp->list_hook);
+	spin_unlock(&transports_lock);
+	wake_up_all(&transports_released);
+
+	wkfree(struct joold_udp, udp);
+}
+
+static int join_group(struct joold_udp *udp, struct joold_udp_cfg const *cfg)
+{
+	struct ip_mreqn mreq;
+	struct sock *sk;
+	int error;
+
+	sk = udp->sock->sk;
+
+	rtnl_lock();
+	lock_sock(sk);
+
+	switch (cfg->family) {
+	case AF_INET:
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr = cfg->addr.v4;
+		mreq.imr_ifindex = cfg->ifindex;
+		error = ip_mc_join_group(sk, &mreq);
+		break;
+	case AF_INET6:
+		error = ipv6_sock_mc_join(sk, cfg->ifindex, &cfg->addr.v6);
+		break;
+	default:
+		error = -EAFNOSUPPORT;
+	}
+
+	release_sock(sk);
+	rtnl_unlock();
+
+	if (error)
+		log_err("Could not join the multicast group (errcode %d).",
+				error);
+	return error;
+}
+
+/* TTL, and do not deliver our own datagrams back to ourselves. */
+static void set_mcast_opts(struct joold_udp *udp,
+		struct joold_udp_cfg const *cfg)
+{
+	struct sock *sk;
+
+	sk = udp->sock->sk;
+	lock_sock(sk);
+
+	if (cfg->family == AF_INET) {
+		inet_sk(sk)->mc_ttl = cfg->ttl;
+#if LINUX_VERSION_AT_LEAST(6, 6, 0, 9999, 0)
+		inet_clear_bit(MC_LOOP, sk);
+#else
+		inet_sk(sk)->mc_loop = 0;
+#endif
+	} else {
+		inet6_sk(sk)->mcast_hops = cfg->ttl;
+#if LINUX_VERSION_AT_LEAST(6, 7, 0, 9999, 0)
+		inet6_clear_bit(MC6_LOOP, sk);
+#else
+		inet6_sk(sk)->mc_loop = 0;
+#endif
+	}
+
+	release_sock(sk);
+}
+
+static void init_group(struct joold_udp *udp, struct joold_udp_cfg const *cfg)
+{
+	memset(&udp->group, 0, sizeof(udp->group));
+
+	if (cfg->family == AF_INET) {
+		udp->group.v4.sin_family = AF_INET;
+		udp->group.v4.sin_addr = cfg->addr.v4;
+		udp->group.v4.sin_port = cpu_to_be16(cfg->port);
+	} else {
+		udp->group.v6.sin6_family = AF_INET6;
+		udp->group.v6.sin6_addr = cfg->addr.v6;
+		udp->group.v6.sin6_port = cpu_to_be16(cfg->port);
+		udp->group.v6.sin6_scope_id = cfg->ifindex;
+	}
+}
+
+static int validate_cfg(struct joold_udp_cfg const *cfg)
+{
+	switch (cfg->family) {
+	case AF_INET:
+		if (!ipv4_is_multicast(cfg->addr.v4.s_addr))
+			goto not_multicast;
+		break;
+	case AF_INET6:
+		if (!ipv6_addr_is_multicast(&cfg->addr.v6))
+			goto not_multicast;
+		break;
+	default:
+		log_err("Unknown address family: %u", cfg->family);
+		return -EINVAL;
+	}
+
+	if (cfg->port == 0) {
+		log_err("The joold transport needs a port.");
+		return -EINVAL;
+	}
+
+	return 0;
+
+not_multicast:
+	log_err("The joold transport's address needs to be a multicast group.");
+	return -EINVAL;
+}
+
+int joold_udp_open(struct net *ns, char const *iname,
+		struct joold_udp_cfg const *cfg, struct joold_udp **result)
+{
+	struct joold_udp *udp;
+	struct sock *sk;
+	int error;
+
+	error = validate_cfg(cfg);
+	if (error)
+		return error;
+
+	udp = wkmalloc(struct joold_udp, GFP_KERNEL);
+	if (!udp)
+		return -ENOMEM;
+
+	error = sock_create_kern(ns, cfg->family, SOCK_DGRAM, IPPROTO_UDP,
+			&udp->sock);
+	if (error) {
+		log_err("Could not create the joold socket (errcode %d).",
+				error);
+		goto free_udp;
+	}
+
+	udp->ns = ns;
+	strcpy(udp->iname, iname);
+	init_group(udp, cfg);
+	udp->id = get_random_u32();
+	INIT_WORK(&udp->rx_work, rx_work_fn);
+	memset(udp->peers, 0, sizeof(udp->peers));
+	skb_queue_head_init(&udp->tx_queue);
+	INIT_WORK(&udp->tx_work, tx_work_fn);
+	memset(udp->rtx, 0, sizeof(udp->rtx));
+	udp->next_seq = 0;
+	udp->tx_batch = 0;
+	udp->tx_ack = false;
+	spin_lock_init(&udp->rtx_lock);
+	INIT_WORK(&udp->resync_work, resync_work_fn);
+	INIT_WORK(&udp->release_work, release_work_fn);
+	kref_init(&udp->refs);
+
+	sk = udp->sock->sk;
+	/* Same as the daemon's SO_REUSEADDR */
+	sk->sk_reuse = SK_CAN_REUSE;
+	sk->sk_bound_dev_if = cfg->ifindex;
+
+	error = kernel_bind(udp->sock, (struct sockaddr *)&udp->group,
+			(cfg->family == AF_INET)
+					? sizeof(udp->group.v4)
+					: sizeof(udp->group.v6));
+	if (error) {
+		log_err("Could not bind the joold socket (errcode %d).", error);
+		goto release_sock;
+	}
+
+	error = join_group(udp, cfg);
+	if (error)
+		goto release_sock;
+	set_mcast_opts(udp, cfg);
+
+	write_lock_bh(&sk->sk_callback_lock);
+	udp->saved_data_ready = sk->sk_data_ready;
+	sk->sk_user_data = udp;
+	sk->sk_data_ready = data_ready;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	spin_lock(&transports_lock);
+	list_add(&udp->list_hook, &transports);
+	spin_unlock(&transports_lock);
+
+	/* In case something arrived before the callback was set. */
+	queue_work(wq, &udp->rx_work);
+
+	*result = udp;
+	return 0;
+
+release_sock:
+	sock_release(udp->sock);
+free_udp:
+	wkfree(struct joold_udp, udp);
+	return error;
+}
+
+void joold_udp_get(struct joold_udp *udp)
+{
+	kref_get(&udp->refs);
+}
+
+/*
+ * Might be called from the packet path, or from the rx worker itself (if its
+ * instance died in the meantime), so the actual cleanup is deferred.
+ */
+static void joold_udp_release(struct kref *refs)
+{
+	struct joold_udp *udp;
+	udp = container_of(refs, struct joold_udp, refs);
+	queue_work(wq, &udp->release_work);
+}
+
+void joold_udp_put(struct joold_udp *udp)
+{
+	kref_put(&udp->refs, joold_udp_release);
+}
+
+void joold_udp_send(struct joold_udp *udp, struct xlator *jool,
+		struct sk_buff *skb, __u32 batch)
+{
+	struct sk_buff *old;
+
+	if (skb_queue_len(&udp->tx_queue) >= TX_QUEUE_MAX) {
+		log_warn_once("joold: The transport can't keep up; dropping sessions.");
+		jstat_inc(jool->stats, JSTAT_JOOLD_TX_OVERFLOW);
+
+		/*
+		 * The empty slot makes the peers' NACK fail, so they end up
+		 * with an advertisement instead.
+		 */
+		spin_lock_bh(&udp->rtx_lock);
+		number_datagram(udp, NULL, batch, &old);
+		spin_unlock_bh(&udp->rtx_lock);
+
+		if (old)
+			consume_skb(old);
+		kfree_skb(skb);
+	} else {
+		JOOLD_UDP_CB(skb)->batch = batch;
+		skb_queue_tail(&udp->tx_queue, skb);
+	}
+
+	queue_work(wq, &udp->tx_work);
+}
+
+static bool ns_released(struct net *ns)
+{
+	struct joold_udp *udp;
+	bool result = true;
+
+	spin_lock(&transports_lock);
+	list_for_each_entry(udp, &transports, list_hook) {
+		if (udp->ns == ns) {
+			result = false;
+			break;
+		}
+	}
+	spin_unlock(&transports_lock);
+
+	return result;
+}
+
+void joold_udp_flush_net(struct net *ns)
+{
+	wait_event(transports_released, ns_released(ns));
+}
@@ -0,0 +1,106 @@
+#ifndef SRC_MOD_COMMON_JOOLD_UDP_H_
+#define SRC_MOD_COMMON_JOOLD_UDP_H_
+
+/**
+ * @file
+ * In-kernel joold transport.
+ *
+ * Normally, the sessions travel kernel -> Netlink -> joold -> UDP -> joold ->
+ * Netlink -> kernel. If the instance owns a joold_udp, the daemons are skipped:
+ * the kernel sends the session batches to the multicast group itself, and
+ * adds the sessions it receives from the group to its own database.
+ *
+ * The payload of each datagram is the same as the one the daemon would send
+ * (a sequence of JNLAJ_SESSION or JNLAJ_BATCH attributes), so kernel
+ * transports and daemons can coexist in the same group.
+ *
+ * Sockets cannot be used in atomic context, so sending and receiving are
+ * deferred to a workqueue.
+ *
+ * Unlike the daemon, the transport numbers its datagrams, and its peers ask it
+ * to resend the ones they miss. (See joold_udp.c.)
+ */
+
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
+
+struct joold_udp;
+struct xlator;
+
+/*
+ * Bytes the transport prepends to each datagram of sessions. (Its JNLAJ_SEQ
+ * attribute.)
+ */
+#define JOOLD_UDP_OVERHEAD 12
+
+struct joold_udp_cfg {
+	/* AF_INET or AF_INET6 */
+	sa_family_t family;
+	/* Multicast group */
+	union {
+		struct in_addr v4;
+		struct in6_addr v6;
+	} addr;
+	__u16 port;
+	/* Interface the group is joined on, and packets are sent through. */
+	int ifindex;
+	__u8 ttl;
+};
+
+/* (The transport's own unit test defines UNIT_TESTING_JOOLD_UDP.) */
+#if defined(UNIT_TESTING) && !defined(UNIT_TESTING_JOOLD_UDP)
+
+static inline int joold_udp_setup(void) { return 0; }
+static inline void joold_udp_teardown(void) {}
+
+static inline int joold_udp_open(struct net *ns, char const *iname,
+		struct joold_udp_cfg const *cfg, struct joold_udp **result)
+{
+	return -EINVAL;
+}
+
+static inline void joold_udp_get(struct joold_udp *udp) {}
+static inline void joold_udp_put(struct joold_udp *udp) {}
+
+static inline void joold_udp_send(struct joold_udp *udp, struct xlator *jool,
+		struct sk_buff *skb, __u32 batch)
+{
+	kfree_skb(skb);
+}
+
+static inline void joold_udp_flush_net(struct net *ns) {}
+
+#else
+
+int joold_udp_setup(void);
+void joold_udp_teardown(void);
+
+/*
+ * Process context only. The transport will deliver the sessions it receives
+ * to instance @iname of namespace @ns, whenever it exists.
+ */
+int joold_udp_open(struct net *ns, char const *iname,
+		struct joold_udp_cfg const *cfg, struct joold_udp **result);
+void joold_udp_get(struct joold_udp *udp);
+void joold_udp_put(struct joold_udp *udp);
+
+/*
+ * Swallows @skb, whose (linear) data is the datagram's payload. @batch is
+ * @jool's number for it; the transport ACKs it (joold_ack()) once the datagram
+ * has been handed to the socket, so the ones still waiting count against
+ * ss-window.
+ */
+void joold_udp_send(struct joold_udp *udp, struct xlator *jool,
+		struct sk_buff *skb, __u32 batch);
+
+/*
+ * Waits until the transports of namespace @ns have been released. (Sockets
+ * need to die before their namespace.) Process context only.
+ */
+void joold_udp_flush_net(struct net *ns);
+
+#endif
+
+#endif /* SRC_MOD_COMMON_JOOLD_UDP_H_ */
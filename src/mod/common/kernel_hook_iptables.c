@@ -106,9 +106,10 @@ unsigned int target_ipv6(struct sk_buff *skb,
 			&state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
 
 	result = core_6to4(skb, state);
+	/* The debug decision is made by core, once the packet is parsed. */
+	enable_debug = state_debug(state);
 
 	xlator_put(&state->jool);
 end:	xlation_destroy(state);
@@ -135,9 +136,10 @@ unsigned int target_ipv4(struct sk_buff *skb,
 			&state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
 
 	result = core_4to6(skb, state);
+	/* The debug decision is made by core, once the packet is parsed. */
+	enable_debug = state_debug(state);
 
 	xlator_put(&state->jool);
 end:	xlation_destroy(state);
@@ -69,9 +69,10 @@ unsigned int hook_ipv6(void *priv, struct sk_buff *skb,
 	result = find_instance(skb, &state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
 
 	result = core_6to4(skb, state);
+	/* The debug decision is made by core, once the packet is parsed. */
+	enable_debug = state_debug(state);
 
 	xlator_put(&state->jool);
 end:	xlation_destroy(state);
@@ -97,9 +98,10 @@ unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 	result = find_instance(skb, &state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
 
 	result = core_4to6(skb, state);
+	/* The debug decision is made by core, once the packet is parsed. */
+	enable_debug = state_debug(state);
 
 	xlator_put(&state->jool);
 end:	xlation_destroy(state);
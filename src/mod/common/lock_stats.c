@@ -0,0 +1,80 @@
+#include "mod/common/lock_stats.h"
+
+#include <linux/ktime.h>
+#include "mod/common/joold.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
+
+DEFINE_STATIC_KEY_FALSE(jlock_key);
+
+static bool lock_stats_enabled(struct xlator const *jool)
+{
+	return xlator_is_nat64(jool) && jool->globals.nat64.lock_stats;
+}
+
+void jlock_key_get(struct xlator *jool)
+{
+	bool enabled;
+	l4_protocol proto;
+
+	if (!xlator_is_nat64(jool))
+		return;
+
+	enabled = lock_stats_enabled(jool);
+	for (proto = L4PROTO_TCP; proto <= L4PROTO_ICMP; proto++)
+		WRITE_ONCE(bib_lock_stats(jool->nat64.bib, proto)->enabled,
+				enabled);
+	WRITE_ONCE(pool4db_lock_stats(jool->nat64.pool4)->enabled, enabled);
+	WRITE_ONCE(joold_lock_stats(jool->nat64.joold)->enabled, enabled);
+
+	if (enabled)
+		static_branch_inc(&jlock_key);
+}
+
+void jlock_key_put(struct xlator const *jool)
+{
+	if (lock_stats_enabled(jool))
+		static_branch_dec(&jlock_key);
+}
+
+void __jlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	struct jlock_site_stats *counters;
+	bool contended;
+
+	if (!READ_ONCE(stats->enabled)) {
+		spin_lock_bh(lock);
+		return;
+	}
+
+	contended = !spin_trylock_bh(lock);
+	if (contended)
+		spin_lock_bh(lock);
+
+	counters = &stats->sites[site];
+	counters->acquisitions++;
+	if (contended)
+		counters->contended++;
+	stats->acquired = ktime_get_ns();
+}
+
+void __junlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	struct jlock_site_stats *counters;
+	u64 hold;
+
+	/* Zero if the lock was taken before the instance started recording */
+	if (stats->acquired) {
+		hold = ktime_get_ns() - stats->acquired;
+		counters = &stats->sites[site];
+		counters->hold_total += hold;
+		if (hold > counters->hold_max)
+			counters->hold_max = hold;
+		stats->acquired = 0;
+	}
+
+	spin_unlock_bh(lock);
+}
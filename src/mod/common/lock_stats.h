@@ -0,0 +1,100 @@
+#ifndef SRC_MOD_COMMON_LOCK_STATS_H_
+#define SRC_MOD_COMMON_LOCK_STATS_H_
+
+/**
+ * @file
+ * Instrumented spinlocks. (See common/lock_stats.h.)
+ *
+ * jlock() and junlock() are spin_lock_bh() and spin_unlock_bh(), plus a static
+ * key branch. The key is only enabled while at least one instance has
+ * lock-stats enabled. Each lock's counters are protected by the lock itself.
+ */
+
+#include <linux/jump_label.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include "common/lock_stats.h"
+
+struct xlator;
+
+struct jlock_site_stats {
+	__u64 acquisitions;
+	/* Acquisitions that had to wait for another holder */
+	__u64 contended;
+	/* Sum of the hold times, in nanoseconds */
+	__u64 hold_total;
+	/* Longest hold time, in nanoseconds */
+	__u64 hold_max;
+};
+
+struct jlock_stats {
+	/* Is the owner instance recording? (Its lock-stats global.) */
+	bool enabled;
+	/* When the current holder acquired the lock. (0 = unknown.) */
+	u64 acquired;
+	struct jlock_site_stats sites[JLS_COUNT];
+};
+
+static inline void jlock_stats_init(struct jlock_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+#ifdef UNIT_TESTING
+
+static inline void jlock_key_get(struct xlator *jool) {}
+static inline void jlock_key_put(struct xlator const *jool) {}
+
+static inline void jlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	spin_lock_bh(lock);
+}
+
+static inline void junlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	spin_unlock_bh(lock);
+}
+
+#else
+
+DECLARE_STATIC_KEY_FALSE(jlock_key);
+#define jlock_active() static_branch_unlikely(&jlock_key)
+
+/*
+ * To be called whenever @jool is attached to (get) or detached from (put) the
+ * instance database. Process context only.
+ *
+ * jlock_key_get() also updates the enabled flag of @jool's locks, since they
+ * can outlive the instance that created them.
+ */
+void jlock_key_get(struct xlator *jool);
+void jlock_key_put(struct xlator const *jool);
+
+void __jlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site);
+void __junlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site);
+
+static inline void jlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	if (jlock_active())
+		__jlock(lock, stats, site);
+	else
+		spin_lock_bh(lock);
+}
+
+static inline void junlock(spinlock_t *lock, struct jlock_stats *stats,
+		enum jool_lock_site site)
+{
+	if (jlock_active())
+		__junlock(lock, stats, site);
+	else
+		spin_unlock_bh(lock);
+}
+
+#endif
+
+#endif /* SRC_MOD_COMMON_LOCK_STATS_H_ */
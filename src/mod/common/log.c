@@ -22,6 +22,20 @@
  *    the error message cannot be sent to userspace.
  */
 
+DEFINE_STATIC_KEY_FALSE(jool_debug_key);
+
+void jool_debug_get(struct xlator const *jool)
+{
+	if (jool->globals.debug)
+		static_branch_inc(&jool_debug_key);
+}
+
+void jool_debug_put(struct xlator const *jool)
+{
+	if (jool->globals.debug)
+		static_branch_dec(&jool_debug_key);
+}
+
 static bool is_packet_context(void)
 {
 	return in_softirq();
@@ -1,17 +1,54 @@
 #ifndef SRC_MOD_COMMON_LOG_H_
 #define SRC_MOD_COMMON_LOG_H_
 
+#include <linux/jump_label.h>
 #include <linux/printk.h>
+#include "mod/common/debug_filter.h"
 #include "mod/common/translation_state.h"
 
+/*
+ * Is at least one instance's debug global enabled?
+ *
+ * This is a static key, so while nobody is debugging, the debug messages of the
+ * packet path are skipped by a NOP instead of a branch per message.
+ */
+#ifdef UNIT_TESTING
+
+#define jool_debug_active() true
+static inline void jool_debug_get(struct xlator const *jool) {}
+static inline void jool_debug_put(struct xlator const *jool) {}
+
+#else
+
+DECLARE_STATIC_KEY_FALSE(jool_debug_key);
+#define jool_debug_active() static_branch_unlikely(&jool_debug_key)
+
+/*
+ * To be called whenever @jool is attached to (get) or detached from (put) the
+ * instance database. Process context only.
+ */
+void jool_debug_get(struct xlator const *jool);
+void jool_debug_put(struct xlator const *jool);
+
+#endif
+
 static inline bool state_debug(struct xlation const *state)
 {
-	return state && state->jool.globals.debug;
+	return jool_debug_active() && state && state->debug;
 }
 
+/*
+ * Debug messages that are not tied to a packet can only be printed if the
+ * instance debugs every packet. Otherwise, the logging-debug-* filters would
+ * not keep them from flooding the log.
+ */
 static inline bool xlator_debug(struct xlator const *instance)
 {
-	return instance && instance->globals.debug;
+	return jool_debug_active()
+			&& instance
+			&& instance->globals.debug
+			&& !debug_filter_set(&instance->globals.debug_filter)
+			&& !instance->globals.debug_filter.rate;
 }
 
 /**
@@ -23,6 +60,7 @@ static inline bool xlator_debug(struct xlator const *instance)
 
 #define log_debug(trash, f, ...) pr_debug(f, ##__VA_ARGS__)
 #define __log_debug log_debug
+#define __log_debug_if(jool, trash, f, ...) pr_debug(f, ##__VA_ARGS__)
 #define ____log_debug log_debug
 
 #else
@@ -44,9 +82,18 @@ static inline bool xlator_debug(struct xlator const *instance)
 		if (xlator_debug(jool))					\
 			JOOL_DEBUG(jool, text, ##__VA_ARGS__);		\
 	} while (0)
+/*
+ * For code that runs on behalf of a packet, but only has its instance.
+ * @debug is the packet's debug decision. (state_debug().)
+ */
+#define __log_debug_if(jool, debug, text, ...)				\
+	do {								\
+		if (jool_debug_active() && (debug))			\
+			JOOL_DEBUG(jool, text, ##__VA_ARGS__);		\
+	} while (0)
 #define ____log_debug(cond, text, ...)					\
 	do {								\
-		if (cond)						\
+		if (jool_debug_active() && (cond))			\
 			pr_info("Jool: " text "\n", ##__VA_ARGS__);	\
 	} while (0)
 
@@ -405,6 +405,65 @@ static int get_timeout(struct bib_config *config, struct session_entry *entry)
 	return 0;
 }
 
+void joold_record_from_session(struct joold_record *record,
+		struct session_entry const *session)
+{
+	unsigned long dying_time;
+
+	record->src6 = session->src6.l3;
+	record->src4 = session->src4.l3;
+	record->dst4 = session->dst4.l3;
+	/* dst6 can be inferred from dst4. */
+	record->src6_port = session->src6.l4;
+	record->src4_port = session->src4.l4;
+	record->dst4_port = session->dst4.l4;
+	record->proto = session->proto;
+	record->state = session->state;
+	record->timer_type = session->timer_type;
+
+	dying_time = session->update_time + session->timeout;
+	dying_time = (dying_time > jiffies)
+			? jiffies_to_msecs(dying_time - jiffies)
+			: 0;
+	if (dying_time > MAX_U32)
+		dying_time = MAX_U32;
+	record->expiration = dying_time;
+}
+
+int joold_record_to_session(struct jool_globals *cfg,
+		struct joold_record const *record, struct session_entry *se)
+{
+	unsigned long expiration;
+	int error;
+
+	memset(se, 0, sizeof(*se));
+
+	se->src6.l3 = record->src6;
+	se->src6.l4 = record->src6_port;
+	se->src4.l3 = record->src4;
+	se->src4.l4 = record->src4_port;
+	se->dst4.l3 = record->dst4;
+	se->dst4.l4 = record->dst4_port;
+	se->proto = record->proto;
+	se->state = record->state;
+	se->timer_type = record->timer_type;
+
+	error = __rfc6052_4to6(&cfg->pool6.prefix, &se->dst4.l3, &se->dst6.l3);
+	if (error)
+		return error;
+	se->dst6.l4 = (se->proto == L4PROTO_ICMP) ? se->src6.l4 : se->dst4.l4;
+
+	error = get_timeout(&cfg->nat64.bib, se);
+	if (error)
+		return error;
+
+	expiration = msecs_to_jiffies(record->expiration);
+	se->update_time = jiffies + expiration - se->timeout;
+	se->has_stored = false;
+
+	return 0;
+}
+
 #define READ_RAW(serialized, field)					\
 	memcpy(&field, serialized, sizeof(field));			\
 	serialized += sizeof(field);
@@ -412,11 +471,11 @@ static int get_timeout(struct bib_config *config, struct session_entry *entry)
 int jnla_get_session_joold(struct nlattr *attr, char const *name,
 		struct jool_globals *cfg, struct session_entry *se)
 {
+	struct joold_record record;
 	__u8 *serialized;
 	__be32 tmp32;
 	__be16 tmp16;
 	__u16 __tmp16;
-	unsigned long expiration;
 	int error;
 
 	error = validate_null(attr, name);
@@ -429,41 +488,28 @@ int jnla_get_session_joold(struct nlattr *attr, char const *name,
 		return -EINVAL;
 	}
 
-	memset(se, 0, sizeof(*se));
 	serialized = nla_data(attr);
 
-	READ_RAW(serialized, se->src6.l3);
-	READ_RAW(serialized, se->src4.l3);
-	READ_RAW(serialized, se->dst4.l3);
+	READ_RAW(serialized, record.src6);
+	READ_RAW(serialized, record.src4);
+	READ_RAW(serialized, record.dst4);
 	READ_RAW(serialized, tmp32);
+	record.expiration = ntohl(tmp32);
 
 	READ_RAW(serialized, tmp16);
-	se->src6.l4 = ntohs(tmp16);
+	record.src6_port = ntohs(tmp16);
 	READ_RAW(serialized, tmp16);
-	se->src4.l4 = ntohs(tmp16);
+	record.src4_port = ntohs(tmp16);
 	READ_RAW(serialized, tmp16);
-	se->dst4.l4 = ntohs(tmp16);
+	record.dst4_port = ntohs(tmp16);
 
 	READ_RAW(serialized, tmp16);
 	__tmp16 = ntohs(tmp16);
-	se->proto = (__tmp16 >> 5) & 3;
-	se->state = (__tmp16 >> 2) & 7;
-	se->timer_type = __tmp16 & 3;
-
-	error = __rfc6052_4to6(&cfg->pool6.prefix, &se->dst4.l3, &se->dst6.l3);
-	if (error)
-		return error;
-	se->dst6.l4 = (se->proto == L4PROTO_ICMP) ? se->src6.l4 : se->dst4.l4;
-
-	error = get_timeout(&cfg->nat64.bib, se);
-	if (error)
-		return error;
-
-	expiration = msecs_to_jiffies(ntohl(tmp32));
-	se->update_time = jiffies + expiration - se->timeout;
-	se->has_stored = false;
+	record.proto = (__tmp16 >> 5) & 3;
+	record.state = (__tmp16 >> 2) & 7;
+	record.timer_type = __tmp16 & 3;
 
-	return 0;
+	return joold_record_to_session(cfg, &record, se);
 }
 
 static int u16_compare(const void *a, const void *b)
@@ -774,9 +820,9 @@ int jnla_put_session(struct sk_buff *skb, int attrtype,
 int jnla_put_session_joold(struct sk_buff *skb, int attrtype,
 		struct session_entry const *entry)
 {
+	struct joold_record record;
 	__u8 buffer[SERIALIZED_SESSION_SIZE];
 	size_t offset;
-	unsigned long dying_time;
 	__be32 tmp32;
 	__be16 tmp16;
 
@@ -785,41 +831,34 @@ int jnla_put_session_joold(struct sk_buff *skb, int attrtype,
 	 * as possible in one single packet.
 	 * Therefore, instead of adding each field as a Netlink attribute,
 	 * we'll do some low level byte hacking.
+	 * (See also common/joold_compact.h.)
 	 */
 
+	joold_record_from_session(&record, entry);
 	offset = 0;
 
 	/* 128 bit fields */
-	ADD_RAW(buffer, offset, entry->src6.l3);
-	/* Skip dst6; it can be inferred from dst4. */
+	ADD_RAW(buffer, offset, record.src6);
 
 	/* 32 bit fields */
-	ADD_RAW(buffer, offset, entry->src4.l3);
-	ADD_RAW(buffer, offset, entry->dst4.l3);
-
-	dying_time = entry->update_time + entry->timeout;
-	dying_time = (dying_time > jiffies)
-			? jiffies_to_msecs(dying_time - jiffies)
-			: 0;
-	if (dying_time > MAX_U32)
-		dying_time = MAX_U32;
-
-	tmp32 = htonl(dying_time);
+	ADD_RAW(buffer, offset, record.src4);
+	ADD_RAW(buffer, offset, record.dst4);
+	tmp32 = htonl(record.expiration);
 	ADD_RAW(buffer, offset, tmp32);
 
 	/* 16 bit fields */
-	tmp16 = htons(entry->src6.l4);
+	tmp16 = htons(record.src6_port);
 	ADD_RAW(buffer, offset, tmp16);
-	tmp16 = htons(entry->src4.l4);
+	tmp16 = htons(record.src4_port);
 	ADD_RAW(buffer, offset, tmp16);
-	tmp16 = htons(entry->dst4.l4);
+	tmp16 = htons(record.dst4_port);
 	ADD_RAW(buffer, offset, tmp16);
 
 	/* Well, this fits in a byte, but use 2 to avoid slop */
 	tmp16 = htons(
-		(entry->proto << 5) /* 2 bits */
-		| (entry->state << 2) /* 3 bits */
-		| entry->timer_type /* 2 bits */
+		(record.proto << 5) /* 2 bits */
+		| (record.state << 2) /* 3 bits */
+		| record.timer_type /* 2 bits */
 	);
 	ADD_RAW(buffer, offset, tmp16);
 
@@ -3,6 +3,7 @@
 
 #include <linux/netlink.h>
 #include "common/config.h"
+#include "common/joold_compact.h"
 #include "mod/common/db/bib/entry.h"
 
 int jnla_get_u8(struct nlattr *attr, char const *name, __u8 *out);
@@ -42,4 +43,10 @@ int jnla_parse_nested(struct nlattr *tb[], int maxtype,
 		char const *name);
 void report_put_failure(void);
 
+/* Conversions between sessions and joold's wire records. */
+void joold_record_from_session(struct joold_record *record,
+		struct session_entry const *session);
+int joold_record_to_session(struct jool_globals *cfg,
+		struct joold_record const *record, struct session_entry *session);
+
 #endif /* SRC_MOD_COMMON_NL_ATTRIBUTE_H_ */
@@ -76,7 +76,7 @@ int handle_denylist4_add(struct sk_buff *skb, struct genl_info *info)
 		goto revert_start;
 
 	error = denylist4_add(jool.siit.denylist4, &operand,
-			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE);
+			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE, true);
 	/* Fall through */
 
 revert_start:
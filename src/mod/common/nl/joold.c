@@ -1,6 +1,7 @@
 #include "mod/common/nl/joold.h"
 
 #include "mod/common/log.h"
+#include "mod/common/nl/attribute.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/joold.h"
@@ -54,6 +55,7 @@ int handle_joold_advertise(struct sk_buff *skb, struct genl_info *info)
 int handle_joold_ack(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
+	__u32 seq;
 	int error;
 
 	error = request_handle_start(info, XT_NAT64, &jool, true);
@@ -62,8 +64,86 @@ int handle_joold_ack(struct sk_buff *skb, struct genl_info *info)
 
 	__log_debug(&jool, "Handling joold ack.");
 
-	joold_ack(&jool);
+	if (info->attrs[JNLAR_JOOLD_SEQ]) {
+		seq = nla_get_u32(info->attrs[JNLAR_JOOLD_SEQ]);
+		joold_ack(&jool, &seq);
+	} else {
+		joold_ack(&jool, NULL);
+	}
 
 	request_handle_end(&jool);
 	return 0; /* Do not ack the ack. */
 }
+
+static int parse_transport(struct nlattr *root, struct joold_udp_cfg *cfg)
+{
+	struct nlattr *attrs[JNLAJT_COUNT];
+	int error;
+
+	error = jnla_parse_nested(attrs, JNLAJT_MAX, root,
+			joolnl_joold_transport_policy, "joold transport");
+	if (error)
+		return error;
+
+	memset(cfg, 0, sizeof(*cfg));
+
+	if (attrs[JNLAJT_ADDR6]) {
+		cfg->family = AF_INET6;
+		error = jnla_get_addr6(attrs[JNLAJT_ADDR6],
+				"joold transport address", &cfg->addr.v6);
+	} else if (attrs[JNLAJT_ADDR4]) {
+		cfg->family = AF_INET;
+		error = jnla_get_addr4(attrs[JNLAJT_ADDR4],
+				"joold transport address", &cfg->addr.v4);
+	} else {
+		log_err("The joold transport request lacks an address.");
+		return -EINVAL;
+	}
+	if (error)
+		return error;
+
+	if (!attrs[JNLAJT_PORT]) {
+		log_err("The joold transport request lacks a port.");
+		return -EINVAL;
+	}
+	cfg->port = nla_get_u16(attrs[JNLAJT_PORT]);
+
+	cfg->ifindex = attrs[JNLAJT_IFINDEX]
+			? nla_get_u32(attrs[JNLAJT_IFINDEX])
+			: 0;
+	cfg->ttl = attrs[JNLAJT_TTL] ? nla_get_u8(attrs[JNLAJT_TTL]) : 1;
+
+	return 0;
+}
+
+int handle_joold_transport(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct joold_udp_cfg cfg;
+	struct joold_udp *udp;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Handling joold transport.");
+
+	/* No transport attribute means "give the sessions back to joold." */
+	udp = NULL;
+	if (info->attrs[JNLAR_JOOLD_TRANSPORT]) {
+		error = parse_transport(info->attrs[JNLAR_JOOLD_TRANSPORT],
+				&cfg);
+		if (error)
+			goto end;
+		error = joold_udp_open(jool.ns, jool.iname, &cfg, &udp);
+		if (error)
+			goto end;
+	}
+
+	joold_set_transport(&jool, udp);
+
+end:	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
@@ -55,6 +55,8 @@ static struct nla_policy const jool_policy[JNLAR_COUNT] = {
 	[JNLAR_PROTO] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_INIT] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_END] = { .type = NLA_BINARY, .len = 0 },
+	[JNLAR_JOOLD_SEQ] = { .type = NLA_U32 },
+	[JNLAR_JOOLD_TRANSPORT] = { .type = NLA_NESTED },
 };
 
 #if LINUX_VERSION_AT_LEAST(5, 2, 0, 8, 0)
@@ -184,6 +186,18 @@ static const struct genl_ops ops[] = {
 		.cmd = JNLOP_JOOLD_ACK,
 		.doit = handle_joold_ack,
 		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_HISTOGRAM,
+		.doit = handle_stats_histogram,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_LOCKS,
+		.doit = handle_stats_locks,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_JOOLD_TRANSPORT,
+		.doit = handle_joold_transport,
+		JOOL_POLICY
 	}
 };
 
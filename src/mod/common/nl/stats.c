@@ -1,10 +1,16 @@
 #include "mod/common/nl/stats.h"
 
+#include "mod/common/histogram.h"
+#include "mod/common/joold.h"
+#include "mod/common/lock_stats.h"
 #include "mod/common/log.h"
 #include "mod/common/stats.h"
+#include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
 
 int handle_stats_foreach(struct sk_buff *skb, struct genl_info *info)
 {
@@ -67,3 +73,221 @@ revert_start:
 	request_handle_end(&jool);
 	return error;
 }
+
+#define HISTOGRAM_COUNT (JHIST_STAGE_COUNT * L3_PROTO_COUNT * L4_PROTO_COUNT)
+
+static int jnla_put_histogram(struct sk_buff *skb, unsigned int stage,
+		unsigned int l3_proto, unsigned int l4_proto,
+		__u64 const *buckets)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, JNLAL_ENTRY);
+	if (!root)
+		return -EMSGSIZE;
+
+	error = nla_put_u8(skb, JNLAH_STAGE, stage)
+		|| nla_put_u8(skb, JNLAH_L3_PROTO, l3_proto)
+		|| nla_put_u8(skb, JNLAH_L4_PROTO, l4_proto)
+		|| nla_put(skb, JNLAH_BUCKETS, JHIST_BUCKETS * sizeof(__u64),
+				buckets);
+	if (error) {
+		nla_nest_cancel(skb, root);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+static bool is_empty(__u64 const *buckets)
+{
+	unsigned int i;
+
+	for (i = 0; i < JHIST_BUCKETS; i++)
+		if (buckets[i])
+			return false;
+	return true;
+}
+
+/*
+ * Writes the nonempty histograms, starting from the @offset'th one.
+ * Returns 1 if they did not fit in the response.
+ */
+static int serialize_histograms(struct jhist_counts *counts,
+		unsigned int offset, struct sk_buff *skb)
+{
+	unsigned int stage, l3, l4;
+	unsigned int i;
+	__u64 *buckets;
+
+	for (i = offset; i < HISTOGRAM_COUNT; i++) {
+		stage = i / (L3_PROTO_COUNT * L4_PROTO_COUNT);
+		l3 = (i / L4_PROTO_COUNT) % L3_PROTO_COUNT;
+		l4 = i % L4_PROTO_COUNT;
+
+		buckets = counts->counts[stage][l3][l4];
+		if (is_empty(buckets))
+			continue;
+		if (jnla_put_histogram(skb, stage, l3, l4, buckets))
+			return 1;
+	}
+
+	return 0;
+}
+
+int handle_stats_histogram(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jhist_counts *counts;
+	struct jool_response response;
+	unsigned int offset;
+	int error;
+
+	error = request_handle_start(info, XT_ANY, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning latency histograms.");
+
+	offset = 0;
+	if (info->attrs[JNLAR_OFFSET_U8]) {
+		offset = nla_get_u8(info->attrs[JNLAR_OFFSET_U8]);
+		__log_debug(&jool, "Offset: [%u]", offset);
+	}
+
+	counts = jhist_query(jool.hist);
+	if (!counts) {
+		error = -ENOMEM;
+		goto revert_start;
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_query;
+
+	error = serialize_histograms(counts, offset, response.skb);
+	error = jresponse_send_array(&jool, &response, error);
+	if (error)
+		goto revert_query;
+
+	kfree(counts);
+	request_handle_end(&jool);
+	return 0;
+
+revert_query:
+	kfree(counts);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+static int jnla_put_lock_stats(struct sk_buff *skb, unsigned int lock,
+		unsigned int site, struct jlock_site_stats const *counters)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, JNLAL_ENTRY);
+	if (!root)
+		return -EMSGSIZE;
+
+	error = nla_put_u8(skb, JNLALS_LOCK, lock)
+		|| nla_put_u8(skb, JNLALS_SITE, site)
+		|| nla_put_u64_64bit(skb, JNLALS_ACQUISITIONS,
+				counters->acquisitions, JNLALS_PAD)
+		|| nla_put_u64_64bit(skb, JNLALS_CONTENDED,
+				counters->contended, JNLALS_PAD)
+		|| nla_put_u64_64bit(skb, JNLALS_HOLD_TOTAL,
+				counters->hold_total, JNLALS_PAD)
+		|| nla_put_u64_64bit(skb, JNLALS_HOLD_MAX,
+				counters->hold_max, JNLALS_PAD);
+	if (error) {
+		nla_nest_cancel(skb, root);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+/*
+ * Writes the counters of the (lock, site) pairs that have been used, starting
+ * from the @offset'th pair. Returns 1 if they did not fit in the response.
+ *
+ * The counters are read without taking the locks, because the query would
+ * otherwise show up in its own results. They might be slightly out of sync
+ * with each other.
+ */
+static int serialize_lock_stats(struct xlator *jool, unsigned int offset,
+		struct sk_buff *skb)
+{
+	struct jlock_stats *locks[JLOCK_COUNT];
+	struct jlock_site_stats *src, counters;
+	unsigned int lock, site;
+	unsigned int i;
+
+	locks[JLOCK_BIB_TCP] = bib_lock_stats(jool->nat64.bib, L4PROTO_TCP);
+	locks[JLOCK_BIB_UDP] = bib_lock_stats(jool->nat64.bib, L4PROTO_UDP);
+	locks[JLOCK_BIB_ICMP] = bib_lock_stats(jool->nat64.bib, L4PROTO_ICMP);
+	locks[JLOCK_POOL4] = pool4db_lock_stats(jool->nat64.pool4);
+	locks[JLOCK_JOOLD] = joold_lock_stats(jool->nat64.joold);
+
+	for (i = offset; i < JLOCK_COUNT * JLS_COUNT; i++) {
+		lock = i / JLS_COUNT;
+		site = i % JLS_COUNT;
+
+		src = &locks[lock]->sites[site];
+
+		counters.acquisitions = READ_ONCE(src->acquisitions);
+		if (!counters.acquisitions)
+			continue;
+		counters.contended = READ_ONCE(src->contended);
+		counters.hold_total = READ_ONCE(src->hold_total);
+		counters.hold_max = READ_ONCE(src->hold_max);
+
+		if (jnla_put_lock_stats(skb, lock, site, &counters))
+			return 1;
+	}
+
+	return 0;
+}
+
+int handle_stats_locks(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	unsigned int offset;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning lock stats.");
+
+	offset = 0;
+	if (info->attrs[JNLAR_OFFSET_U8]) {
+		offset = nla_get_u8(info->attrs[JNLAR_OFFSET_U8]);
+		__log_debug(&jool, "Offset: [%u]", offset);
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	error = serialize_lock_stats(&jool, offset, response.skb);
+	error = jresponse_send_array(&jool, &response, error);
+	if (error)
+		goto revert_start;
+
+	request_handle_end(&jool);
+	return 0;
+
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
@@ -4,5 +4,7 @@
 #include <net/genetlink.h>
 
 int handle_stats_foreach(struct sk_buff *jool, struct genl_info *info);
+int handle_stats_histogram(struct sk_buff *jool, struct genl_info *info);
+int handle_stats_locks(struct sk_buff *jool, struct genl_info *info);
 
 #endif /* SRC_MOD_COMMON_NL_STATS_H_ */
@@ -310,6 +310,29 @@ static inline struct frag_hdr *pkt_frag_hdr(const struct packet *pkt)
 	return (struct frag_hdr *)(pkt->skb->data + pkt->frag_offset);
 }
 
+/**
+ * @{
+ * Is @pkt a fragment? (Unlike the is_fragmented_*() functions, these are
+ * compatible with both protocols.)
+ */
+static inline bool pkt_is_fragment(const struct packet *pkt)
+{
+	return (pkt_l3_proto(pkt) == L3PROTO_IPV6)
+			? is_fragmented_ipv6(pkt_frag_hdr(pkt))
+			: is_fragmented_ipv4(pkt_ip4_hdr(pkt));
+}
+
+/* Is @pkt a fragment, and does its layer 4 header live in some other one? */
+static inline bool pkt_is_subsequent_frag(const struct packet *pkt)
+{
+	return (pkt_l3_proto(pkt) == L3PROTO_IPV6)
+			? !is_first_frag6(pkt_frag_hdr(pkt))
+			: !is_first_frag4(pkt_ip4_hdr(pkt));
+}
+/**
+ * @}
+ */
+
 static inline void *pkt_payload(const struct packet *pkt)
 {
 	return pkt->skb->data + pkt->payload_offset;
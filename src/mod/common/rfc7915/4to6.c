@@ -4,6 +4,7 @@
 #include <net/ip6_checksum.h>
 
 #include "common/constants.h"
+#include "mod/common/histogram.h"
 #include "mod/common/log.h"
 #include "mod/common/rfc6052.h"
 #include "mod/common/route.h"
@@ -256,7 +257,8 @@ static verdict predict_route46(struct xlation *state)
 
 	flow6 = &state->flowx.v6.flowi;
 	log_debug(state, "Routing: %pI6c->%pI6c", &flow6->saddr, &flow6->daddr);
-	state->dst = route6(&state->jool, flow6);
+	state->dst = route6(&state->jool, flow6, &state->dst_noref,
+			state_debug(state));
 	if (!state->dst)
 		return untranslatable(state, JSTAT_FAILED_ROUTES);
 
@@ -272,7 +274,7 @@ static verdict predict_route46(struct xlation *state)
 				       IPV6_PREFER_SRC_PUBLIC, &flow6->saddr)) {
 			log_warn_once("Can't find a sufficiently scoped primary source address to reach %pI6.",
 					&flow6->daddr);
-			dst_release(state->dst);
+			route_put(state->dst, state->dst_noref);
 			state->dst = NULL;
 			return drop(state, JSTAT46_6791_ENOENT);
 		}
@@ -281,7 +283,7 @@ static verdict predict_route46(struct xlation *state)
 	return VERDICT_CONTINUE;
 
 panic:
-	dst_release(state->dst);
+	route_put(state->dst, state->dst_noref);
 	state->dst = NULL;
 	return drop(state, JSTAT_UNKNOWN);
 }
@@ -332,11 +334,29 @@ static int get_delta(struct packet *in)
 	return delta;
 }
 
+/*
+ * Returns the length of the largest fragment @in was reassembled from (IPv4
+ * header included), as best as it can be inferred from its frag_list. Fallback
+ * for when IPCB(skb)->frag_max_size is unavailable.
+ */
+static unsigned int frag_list_max_len(struct packet *in)
+{
+	struct sk_buff *iter;
+	unsigned int result;
+
+	result = skb_headlen(in->skb);
+	skb_walk_frags(in->skb, iter)
+		result = max(result, pkt_l3hdr_len(in) + iter->len);
+
+	return result;
+}
+
 static bool fragment_exceeds_mtu46(struct packet *in, unsigned int mtu)
 {
 	struct skb_shared_info *shinfo;
 	unsigned int out_hdrs_len;
 	unsigned int out_payload_len;
+	unsigned int frag_max_size;
 
 	out_hdrs_len = sizeof(struct ipv6hdr);
 	if (will_need_frag_hdr(pkt_ip4_hdr(in)))
@@ -370,13 +390,45 @@ static bool fragment_exceeds_mtu46(struct packet *in, unsigned int mtu)
 		 * nf_defrag_ipv4 only enables DF when the biggest DF fragment
 		 * is also the biggest fragment.
 		 */
-		return IPCB(in->skb)->frag_max_size > mtu;
+		frag_max_size = IPCB(in->skb)->frag_max_size;
+		if (!frag_max_size) /* Reassembled by somebody else? */
+			frag_max_size = frag_list_max_len(in);
+		/*
+		 * That's an IPv4 length. The fragments will leave with an IPv6
+		 * header and a Fragment header instead.
+		 */
+		return (frag_max_size - pkt_l3hdr_len(in)
+				+ sizeof(struct ipv6hdr)
+				+ sizeof(struct frag_hdr)) > mtu;
 	}
 
 	out_payload_len = in->skb->len - pkt_hdrs_len(in);
 	return (out_hdrs_len + out_payload_len) > mtu;
 }
 
+/*
+ * Returns true if @state->in (a GSO packet) has to be segmented in software,
+ * because its segments are not allowed to shrink, yet they would exceed LIM
+ * once translated.
+ */
+bool ttp46_needs_segmentation(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	unsigned int seg_len;
+
+	if (pkt_l4_proto(in) == L4PROTO_TCP)
+		return false; /* Will shrink */
+	if (is_df_set(pkt_ip4_hdr(in)))
+		return false; /* Will PTB if too big */
+
+	seg_len = sizeof(struct ipv6hdr) + pkt_l4hdr_len(in)
+			+ skb_shinfo(in->skb)->gso_size;
+	return seg_len > state->jool.globals.lowest_ipv6_mtu;
+}
+
+static bool ttp46_xlat_in_place(struct xlation *state, bool ignore_df,
+		unsigned short gso_size);
+
 static verdict allocate_fast(struct xlation *state, bool ignore_df,
 		unsigned short gso_size)
 {
@@ -384,8 +436,11 @@ static verdict allocate_fast(struct xlation *state, bool ignore_df,
 	struct sk_buff *out;
 	struct iphdr *hdr4_inner;
 	struct frag_hdr *hdr_frag;
-	struct skb_shared_info *shinfo;
 	int delta;
+	u64 start;
+
+	if (ttp46_xlat_in_place(state, ignore_df, gso_size))
+		return VERDICT_CONTINUE;
 
 	/* Dunno what happens when headroom is negative, so don't risk it. */
 	delta = get_delta(in);
@@ -393,7 +448,9 @@ static verdict allocate_fast(struct xlation *state, bool ignore_df,
 		delta = 0;
 
 	/* Allocate the outgoing packet as a copy of @in with shared pages. */
+	start = jhist_start();
 	out = __pskb_copy(in->skb, delta + skb_headroom(in->skb), GFP_ATOMIC);
+	jhist_end(state, JHIST_SKB_ALLOC, start);
 	if (!out) {
 		log_debug(state, "__pskb_copy() returned NULL.");
 		return drop(state, JSTAT46_PSKB_COPY);
@@ -446,13 +503,7 @@ static verdict allocate_fast(struct xlation *state, bool ignore_df,
 	out->mark = in->skb->mark;
 	out->protocol = htons(ETH_P_IPV6);
 
-	shinfo = skb_shinfo(out);
-	if (shinfo->gso_size && gso_size)
-		shinfo->gso_size = gso_size;
-	if (shinfo->gso_type & SKB_GSO_TCPV4) {
-		shinfo->gso_type &= ~SKB_GSO_TCPV4;
-		shinfo->gso_type |= SKB_GSO_TCPV6;
-	}
+	xlat_gso(&state->out, gso_size);
 
 	return VERDICT_CONTINUE;
 }
@@ -470,6 +521,7 @@ static verdict allocate_slow(struct xlation *state, unsigned int mpl)
 	unsigned int bytes_consumed;
 	struct frag_hdr *frag;
 	unsigned char *l3_payload;
+	u64 start;
 
 	in = &state->in;
 	previous = &state->out.skb;
@@ -486,8 +538,10 @@ static verdict allocate_slow(struct xlation *state, unsigned int mpl)
 			payload_left = 0;
 		}
 
+		start = jhist_start();
 		out = alloc_skb(skb_headroom(in->skb) + HDRS_LEN
 				+ fragment_payload_len, GFP_ATOMIC);
+		jhist_end(state, JHIST_SKB_ALLOC, start);
 		if (!out)
 			goto fail;
 
@@ -533,10 +587,14 @@ static void autofill_dst(struct xlation *state)
 	struct sk_buff *skb;
 
 	skb = state->out.skb;
-	skb_dst_set(skb, state->dst);
+	route_skb_set(skb, state->dst, state->dst_noref);
 
-	for (skb = skb->next; skb != NULL; skb = skb->next)
-		skb_dst_set(skb, dst_clone(state->dst));
+	for (skb = skb->next; skb != NULL; skb = skb->next) {
+		if (state->dst_noref)
+			skb_dst_set_noref(skb, state->dst);
+		else
+			skb_dst_set(skb, dst_clone(state->dst));
+	}
 
 	state->dst = NULL;
 }
@@ -649,14 +707,20 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 	 *
 	 * 2. If fragmentation is allowed, GSO might lead us to translate a
 	 * large DF-disabled IPv4 packet into a large IPv6 packet, so we need to
-	 * impose LIM. If the packet is already fragmented, we need to preserve
-	 * the Fragmentation ID, which AFAIK, is impossible through the kernel
-	 * API. Therefore, Slow Path.
+	 * impose LIM. GSO packets are never fragments (GRO does not merge
+	 * them), so there is no Fragmentation ID to preserve, and Slow Path
+	 * (which would turn the whole train into the fragments of a single
+	 * datagram) is not needed either:
 	 *
-	 * (Note: GRO enabled on !DF suggests there might exist some potential
-	 * optimization I could be missing somewhere.)
+	 * - TCP segments can simply shrink. (ie. gso_size is reduced by however
+	 *   much is needed to make room for the bigger header.)
+	 * - UDP segments are datagrams, so their size is untouchable. If they
+	 *   exceed LIM, core.c segments the packet in software before we ever
+	 *   get here, so each datagram can be fragmented on its own. (See
+	 *   ttp46_needs_segmentation().)
 	 *
-	 * Therefore: If users want performance, they need to enable DF or GTFO.
+	 * Same happens to GRO frag_list trains, for a different reason: Every
+	 * skb in the frag_list has its own untranslated headers.
 	 *
 	 * # LRO
 	 *
@@ -676,12 +740,15 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 	unsigned int nexthop_mtu;
 	unsigned int lim;
 	unsigned int mpl;
+	u64 start;
 	verdict result;
 
 	result = compute_flowix46(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
+	start = jhist_start();
 	result = predict_route46(state);
+	jhist_end(state, JHIST_ROUTE, start);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -719,13 +786,28 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 					skb_shinfo(in->skb)->gso_size);
 		}
 
-	} else if (fragment_exceeds_mtu46(in, mpl)) {
+	} else if (!skb_is_gso(in->skb) && fragment_exceeds_mtu46(in, mpl)) {
 		/*
 		 * Force LIM and Fragmentation ID preservation through manual
 		 * fragmentation.
 		 */
 		result = allocate_slow(state, mpl);
 
+	} else if (fragment_exceeds_mtu46(in, mpl)) {
+		if (pkt_l4_proto(in) == L4PROTO_TCP) {
+			/* Resegment the stream into smaller segments instead. */
+			result = allocate_fast(state, false, mpl
+					- sizeof(struct ipv6hdr)
+					- pkt_l4hdr_len(in));
+		} else {
+			/*
+			 * Segments fit LIM (see ttp46_needs_segmentation())
+			 * but not the nexthop MTU. Unfragmented, so the kernel
+			 * can fragment them after segmentation.
+			 */
+			result = allocate_fast(state, true, 0);
+		}
+
 	} else {
 		/*
 		 * Dodged a bullet; no need to fragment further, we'll just
@@ -741,7 +823,7 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 	return VERDICT_CONTINUE;
 
 fail:
-	dst_release(state->dst);
+	route_put(state->dst, state->dst_noref);
 	state->dst = NULL;
 	return result;
 }
@@ -834,6 +916,19 @@ static void autofill_hdr6(struct packet *out)
 	}
 }
 
+/* Also zeroizes the Flow Label's upper bits, as a side effect. */
+static void xlat_tclass(struct xlation const *state, struct iphdr const *hdr4,
+		struct ipv6hdr *hdr6)
+{
+	if (state->jool.globals.reset_traffic_class) {
+		hdr6->priority = 0;
+		hdr6->flow_lbl[0] = 0;
+	} else {
+		hdr6->priority = hdr4->tos >> 4;
+		hdr6->flow_lbl[0] = hdr4->tos << 4;
+	}
+}
+
 static verdict ttcp46_ipv6_common(struct xlation *state)
 {
 	struct packet *in = &state->in;
@@ -843,13 +938,7 @@ static verdict ttcp46_ipv6_common(struct xlation *state)
 	struct frag_hdr *frag_header;
 
 	hdr6->version = 6;
-	if (state->jool.globals.reset_traffic_class) {
-		hdr6->priority = 0;
-		hdr6->flow_lbl[0] = 0;
-	} else {
-		hdr6->priority = hdr4->tos >> 4;
-		hdr6->flow_lbl[0] = hdr4->tos << 4;
-	}
+	xlat_tclass(state, hdr4, hdr6);
 	hdr6->flow_lbl[1] = 0;
 	hdr6->flow_lbl[2] = 0;
 	/* hdr6->payload_len */
@@ -1422,29 +1511,29 @@ static bool can_compute_csum(struct xlation *state)
 	return true;
 }
 
-static verdict ttp46_tcp(struct xlation *state)
+/*
+ * Translates the ports and checksum of @tcp_out, which is assumed to already
+ * contain a copy of @tcp_in. @hdr4 is @tcp_in's IPv4 header.
+ */
+static void xlat46_tcp_hdr(struct xlation *state, struct iphdr *hdr4,
+		struct tcphdr const *tcp_in, struct tcphdr *tcp_out)
 {
-	struct packet *in = &state->in;
 	struct packet *out = &state->out;
-	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
-	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		tcp_out->source = get_src_port46(state);
 		tcp_out->dest = get_dst_port46(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_4to6(tcp_in->check,
-				pkt_ip4_hdr(in), &tcp_copy,
+				hdr4, &tcp_copy,
 				pkt_ip6_hdr(out), tcp_out,
 				sizeof(*tcp_out));
 
@@ -1458,20 +1547,29 @@ static verdict ttp46_tcp(struct xlation *state)
 				&pkt_ip6_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
+}
+
+static verdict ttp46_tcp(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
+	struct tcphdr *tcp_out = pkt_tcp_hdr(&state->out);
 
+	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
+	xlat46_tcp_hdr(state, pkt_ip4_hdr(in), tcp_in, tcp_out);
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp46_udp(struct xlation *state)
+/*
+ * Same as xlat46_tcp_hdr(), but UDP.
+ * If @udp_in's checksum is zero, can_compute_csum() has to be validated first.
+ */
+static void xlat46_udp_hdr(struct xlation *state, struct iphdr *hdr4,
+		struct udphdr const *udp_in, struct udphdr *udp_out)
 {
-	struct packet *in = &state->in;
 	struct packet *out = &state->out;
-	struct udphdr *udp_in = pkt_udp_hdr(in);
-	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		udp_out->source = get_src_port46(state);
 		udp_out->dest = get_dst_port46(state);
@@ -1479,19 +1577,15 @@ static verdict ttp46_udp(struct xlation *state)
 
 	/* Header.checksum */
 	if (udp_in->check == 0) {
-		if (can_compute_csum(state))
-			goto partial;
-
-		return drop_icmp(state, JSTAT46_FRAGMENTED_ZERO_CSUM,
-				ICMPERR_FILTER, 0);
+		goto partial;
 
-	} else if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	} else if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
 		udp_copy.check = 0;
 
 		udp_out->check = 0;
 		udp_out->check = update_csum_4to6(udp_in->check,
-				pkt_ip4_hdr(in), &udp_copy,
+				hdr4, &udp_copy,
 				pkt_ip6_hdr(out), udp_out,
 				sizeof(*udp_out));
 
@@ -1503,16 +1597,147 @@ static verdict ttp46_udp(struct xlation *state)
 		goto partial;
 	}
 
-	return VERDICT_CONTINUE;
+	return;
 
 partial:
 	udp_out->check = ~udp_v6_check(pkt_datagram_len(out),
 			&pkt_ip6_hdr(out)->saddr,
 			&pkt_ip6_hdr(out)->daddr, 0);
 	partialize_skb(out->skb, offsetof(struct udphdr, check));
+}
+
+static verdict ttp46_udp(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct udphdr *udp_in = pkt_udp_hdr(in);
+	struct udphdr *udp_out = pkt_udp_hdr(&state->out);
+
+	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
+	if (udp_in->check == 0 && !can_compute_csum(state))
+		return drop_icmp(state, JSTAT46_FRAGMENTED_ZERO_CSUM,
+				ICMPERR_FILTER, 0);
+
+	xlat46_udp_hdr(state, pkt_ip4_hdr(in), udp_in, udp_out);
 	return VERDICT_CONTINUE;
 }
 
+static bool xlat46_in_place_viable(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct iphdr *hdr4;
+	int delta;
+
+	if (!state->jool.globals.xlat_in_place)
+		return false;
+	/* Hairpin: The U-turned packet is still needed by the caller. */
+	if (pkt_original_pkt(in) != in)
+		return false;
+	/* Somebody else (eg. a packet socket) shares the headers. */
+	if (skb_cloned(in->skb))
+		return false;
+
+	hdr4 = pkt_ip4_hdr(in);
+	if (will_need_frag_hdr(hdr4))
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		break;
+	case L4PROTO_UDP:
+		/* Might need to be dropped; leave it to the copy path. */
+		if (pkt_udp_hdr(in)->check == 0)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	/* Leave the ICMP errors to the copy path; it can still send them. */
+	if (!state->is_hairpin && hdr4->ttl <= 1)
+		return false;
+	if (has_unexpired_src_route(hdr4))
+		return false;
+
+	/* The IPv6 header is longer, so it needs to grow into the headroom. */
+	delta = iphdr_delta(hdr4);
+	if (delta > 0 && skb_headroom(in->skb) < (unsigned int)delta)
+		return false;
+
+	return true;
+}
+
+/*
+ * Translates @state->in by rewriting its headers, instead of building a new
+ * packet. Meant to be called by allocate_fast(), and has the same contract as
+ * ttp64_xlat_in_place().
+ */
+static bool ttp46_xlat_in_place(struct xlation *state, bool ignore_df,
+		unsigned short gso_size)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
+	struct sk_buff *skb = in->skb;
+	struct iphdr hdr4;
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+	} l4;
+	struct ipv6hdr *hdr6;
+	unsigned int l4hdr_len;
+	int delta;
+
+	if (!xlat46_in_place_viable(state))
+		return false;
+
+	/* Back up whatever is about to be overridden. (Options are dropped.) */
+	memcpy(&hdr4, pkt_ip4_hdr(in), sizeof(hdr4));
+	if (pkt_l4_proto(in) == L4PROTO_TCP)
+		memcpy(&l4.tcp, pkt_tcp_hdr(in), sizeof(l4.tcp));
+	else
+		memcpy(&l4.udp, pkt_udp_hdr(in), sizeof(l4.udp));
+	l4hdr_len = pkt_l4hdr_len(in);
+
+	/* The L4 header stays where it is; the L3 header grows backwards. */
+	delta = sizeof(struct ipv6hdr) - pkt_l3hdr_len(in);
+	if (delta > 0)
+		__skb_push(skb, delta);
+	else
+		__skb_pull(skb, -delta);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct ipv6hdr));
+
+	pkt_fill(out, skb, L3PROTO_IPV6, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+
+	skb_cleanup_copy(skb);
+	skb_dst_drop(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	skb->ignore_df = ignore_df;
+	skb->protocol = htons(ETH_P_IPV6);
+
+	xlat_gso(out, gso_size);
+
+	hdr6 = pkt_ip6_hdr(out);
+	hdr6->version = 6;
+	xlat_tclass(state, &hdr4, hdr6);
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->payload_len = cpu_to_be16(skb->len - sizeof(struct ipv6hdr));
+	hdr6->nexthdr = state->flowx.v6.flowi.flowi6_proto;
+	hdr6->hop_limit = state->is_hairpin ? hdr4.ttl : (hdr4.ttl - 1);
+	hdr6->saddr = state->flowx.v6.flowi.saddr;
+	hdr6->daddr = state->flowx.v6.flowi.daddr;
+
+	if (pkt_l4_proto(out) == L4PROTO_TCP)
+		xlat46_tcp_hdr(state, &hdr4, &l4.tcp, pkt_tcp_hdr(out));
+	else
+		xlat46_udp_hdr(state, &hdr4, &l4.udp, pkt_udp_hdr(out));
+
+	return true;
+}
+
 const struct translation_steps ttp46_steps = {
 	.skb_alloc = ttp46_alloc_skb,
 	.xlat_outer_l3 = ttp46_ipv6_external,
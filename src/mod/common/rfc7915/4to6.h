@@ -12,4 +12,6 @@
 
 extern const struct translation_steps ttp46_steps;
 
+bool ttp46_needs_segmentation(struct xlation *state);
+
 #endif /* SRC_MOD_COMMON_RFC7915_4TO6_H_ */
@@ -5,13 +5,15 @@
 #include <net/udp.h>
 #include <net/tcp.h>
 
+#include "mod/common/histogram.h"
 #include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/route.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 
-static __u8 xlat_tos(struct jool_globals const *config, struct ipv6hdr const *hdr)
+__u8 ttp64_xlat_tos(struct jool_globals const *config,
+		struct ipv6hdr const *hdr)
 {
 	return config->reset_tos ? config->new_tos : get_traffic_class(hdr);
 }
@@ -204,9 +206,9 @@ static verdict compute_flowix64(struct xlation *state)
 
 	flow4->flowi4_mark = state->in.skb->mark;
 #if LINUX_VERSION_AT_LEAST(6, 18, 0, 0, 0)
-	flow4->flowi4_dscp = xlat_tos(&state->jool.globals, hdr6);
+	flow4->flowi4_dscp = ttp64_xlat_tos(&state->jool.globals, hdr6);
 #else
-	flow4->flowi4_tos = xlat_tos(&state->jool.globals, hdr6);
+	flow4->flowi4_tos = ttp64_xlat_tos(&state->jool.globals, hdr6);
 #endif
 	flow4->flowi4_scope = RT_SCOPE_UNIVERSE;
 	flow4->flowi4_proto = xlat_proto(hdr6);
@@ -311,7 +313,8 @@ static verdict __predict_route64(struct xlation *state)
 		log_debug(state, "Packet is hairpinning; skipping routing.");
 	} else {
 		log_debug(state, "Routing: %pI4->%pI4", &flow4->saddr, &flow4->daddr);
-		state->dst = route4(&state->jool, flow4);
+		state->dst = route4(&state->jool, flow4,
+				&state->dst_noref, state_debug(state));
 		if (!state->dst)
 			return untranslatable(state, JSTAT_FAILED_ROUTES);
 	}
@@ -320,7 +323,7 @@ static verdict __predict_route64(struct xlation *state)
 		if (state->dst) {
 			result = select_good_saddr(state);
 			if (result != VERDICT_CONTINUE) {
-				dst_release(state->dst);
+				route_put(state->dst, state->dst_noref);
 				state->dst = NULL;
 				return result;
 			}
@@ -336,6 +339,7 @@ static verdict __predict_route64(struct xlation *state)
 
 verdict predict_route64(struct xlation *state)
 {
+	u64 start;
 	verdict result;
 
 	if (!state->flowx_set) {
@@ -346,7 +350,9 @@ verdict predict_route64(struct xlation *state)
 	}
 
 	if (!state->dst) {
+		start = jhist_start();
 		result = __predict_route64(state);
+		jhist_end(state, JHIST_ROUTE, start);
 		if (result != VERDICT_CONTINUE)
 			return result;
 	}
@@ -364,6 +370,7 @@ static int fragment_exceeds_mtu64(struct packet const *in, unsigned int mtu)
 {
 	struct sk_buff *iter;
 	unsigned short gso_size;
+	unsigned int frag_max_size;
 	int delta;
 
 	/*
@@ -395,9 +402,23 @@ static int fragment_exceeds_mtu64(struct packet const *in, unsigned int mtu)
 		goto generic_too_big;
 
 	/*
-	 * TODO (performance) This loop could probably be optimized away by
-	 * querying IP6CB(skb)->frag_max_size. You'll have to test it.
+	 * The head was the first fragment, so the rest only need to be checked
+	 * if the packet was reassembled.
+	 *
+	 * nf_defrag_ipv6 records the length of the largest fragment (IPv6
+	 * header and Fragment header included) in frag_max_size, which spares
+	 * us the frag_list walk. (It also covers fragments that were coalesced
+	 * into the head's frags, which the walk cannot see.)
 	 */
+	frag_max_size = IP6CB(in->skb)->frag_max_size;
+	if (frag_max_size) {
+		if (frag_max_size > mtu + pkt_l3hdr_len(in)
+				+ sizeof(struct frag_hdr) - sizeof(struct iphdr))
+			return 2;
+		return 0;
+	}
+
+	/* Reassembled by somebody else? */
 	mtu -= sizeof(struct iphdr);
 	skb_walk_frags(in->skb, iter)
 		if (iter->len > mtu)
@@ -431,11 +452,13 @@ static verdict validate_size(struct xlation *state)
 	return drop(state, JSTAT_UNKNOWN);
 }
 
+static bool ttp64_xlat_in_place(struct xlation *state);
+
 static verdict ttp64_alloc_skb(struct xlation *state)
 {
 	struct packet const *in = &state->in;
 	struct sk_buff *out;
-	struct skb_shared_info *shinfo;
+	u64 start;
 	verdict result;
 
 	result = predict_route64(state);
@@ -445,6 +468,9 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto revert;
 
+	if (ttp64_xlat_in_place(state))
+		return VERDICT_CONTINUE;
+
 	/*
 	 * pskb_copy() is more efficient than allocating a new packet, because
 	 * it shares (not copies) the original's paged data with the copy. This
@@ -463,7 +489,9 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 	 * We will therefore *not* attempt to allocate less.
 	 */
 
+	start = jhist_start();
 	out = pskb_copy(in->skb, GFP_ATOMIC);
+	jhist_end(state, JHIST_SKB_ALLOC, start);
 	if (!out) {
 		log_debug(state, "pskb_copy() returned NULL.");
 		result = drop(state, JSTAT64_PSKB_COPY);
@@ -505,21 +533,17 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 	out->mark = state->flowx.v4.flowi.flowi4_mark;
 	out->protocol = htons(ETH_P_IP);
 
-	shinfo = skb_shinfo(out);
-	if (shinfo->gso_type & SKB_GSO_TCPV6) {
-		shinfo->gso_type &= ~SKB_GSO_TCPV6;
-		shinfo->gso_type |= SKB_GSO_TCPV4;
-	}
+	xlat_gso(&state->out, 0);
 
 	if (state->dst) {
-		skb_dst_set(out, state->dst);
+		route_skb_set(out, state->dst, state->dst_noref);
 		state->dst = NULL;
 	}
 	return VERDICT_CONTINUE;
 
 revert:
 	if (state->dst) {
-		dst_release(state->dst);
+		route_put(state->dst, state->dst_noref);
 		state->dst = NULL;
 	}
 	return result;
@@ -555,17 +579,25 @@ static bool generate_df_flag(struct xlation const *state)
 		/* Unimportant. Guess: RFC logic. Meh. */
 		return ntohs(pkt_ip4_hdr(out)->tot_len) > 1260;
 	}
-	if (skb_has_frag_list(in->skb)) {
-		/* Clearly fragmented */
-		return false;
-	}
 	if (skb_is_gso(in->skb)) {
-		if (pkt_l4_proto(in) != L4PROTO_TCP) {
-			/* UDP fragmented, ICMP & OTHER undefined */
+		/*
+		 * GSO segments are whole packets (even if GRO chained them
+		 * through frag_list), so each of them gets the RFC logic.
+		 * (UDP GSO is SKB_GSO_UDP_L4; each segment is a datagram.)
+		 */
+		switch (pkt_l4_proto(in)) {
+		case L4PROTO_TCP:
+		case L4PROTO_UDP:
+			return pkt_hdrs_len(out) + skb_shinfo(in->skb)->gso_size
+					> 1260;
+		default:
+			/* ICMP & OTHER undefined */
 			return false;
 		}
-		/* TCP not fragmented */
-		return pkt_hdrs_len(out) + skb_shinfo(in->skb)->gso_size > 1260;
+	}
+	if (skb_has_frag_list(in->skb)) {
+		/* Clearly fragmented (defrag) */
+		return false;
 	}
 
 	/* Not fragmented */
@@ -618,6 +650,34 @@ static bool has_nonzero_segments_left(struct ipv6hdr const *hdr6,
 	return true;
 }
 
+/*
+ * Writes @hdr4 (@state->out's external IPv4 header) out of @hdr6 and @hdr_frag.
+ * Assumes @state->out's length is already final.
+ */
+static void xlat64_external_hdr(struct xlation *state,
+		struct ipv6hdr const *hdr6, struct frag_hdr const *hdr_frag,
+		struct iphdr *hdr4)
+{
+	struct flowi4 *flow4 = &state->flowx.v4.flowi;
+
+	hdr4->version = 4;
+	hdr4->ihl = 5;
+#if LINUX_VERSION_AT_LEAST(6, 18, 0, 0, 0)
+	hdr4->tos = flow4->flowi4_dscp;
+#else
+	hdr4->tos = flow4->flowi4_tos;
+#endif
+	hdr4->tot_len = cpu_to_be16(state->out.skb->len);
+	generate_ipv4_id(state, hdr4, hdr_frag);
+	hdr4->frag_off = xlat_frag_off(hdr_frag, state);
+	hdr4->ttl = hdr6->hop_limit - 1;
+	hdr4->protocol = flow4->flowi4_proto;
+	hdr4->saddr = flow4->saddr;
+	hdr4->daddr = flow4->daddr;
+	hdr4->check = 0;
+	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+}
+
 /**
  * Translates @state->in's IPv6 header into @state->out's IPv4 header.
  * Only used for external IPv6 headers. (ie. not enclosed in ICMP errors.)
@@ -626,9 +686,6 @@ static bool has_nonzero_segments_left(struct ipv6hdr const *hdr6,
 static verdict ttp64_ipv4_external(struct xlation *state)
 {
 	struct ipv6hdr const *hdr6;
-	struct iphdr *hdr4;
-	struct frag_hdr const *hdr_frag;
-	struct flowi4 *flow4;
 	__u32 nonzero_location;
 
 	hdr6 = pkt_ip6_hdr(&state->in);
@@ -643,28 +700,8 @@ static verdict ttp64_ipv4_external(struct xlation *state)
 				ICMPERR_HDR_FIELD, nonzero_location);
 	}
 
-	hdr4 = pkt_ip4_hdr(&state->out);
-	hdr_frag = pkt_frag_hdr(&state->in);
-	flow4 = &state->flowx.v4.flowi;
-
-	hdr4->version = 4;
-	hdr4->ihl = 5;
-#if LINUX_VERSION_AT_LEAST(6, 18, 0, 0, 0)
-	hdr4->tos = flow4->flowi4_dscp;
-#else
-	hdr4->tos = flow4->flowi4_tos;
-#endif
-	hdr4->tot_len = cpu_to_be16(state->out.skb->len);
-	generate_ipv4_id(state, hdr4, hdr_frag);
-	hdr4->frag_off = xlat_frag_off(hdr_frag, state);
-	hdr4->ttl = hdr6->hop_limit - 1;
-	hdr4->protocol = flow4->flowi4_proto;
-	/* ip4_hdr->check is set later; please scroll down. */
-	hdr4->saddr = flow4->saddr;
-	hdr4->daddr = flow4->daddr;
-	hdr4->check = 0;
-	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
-
+	xlat64_external_hdr(state, hdr6, pkt_frag_hdr(&state->in),
+			pkt_ip4_hdr(&state->out));
 	return VERDICT_CONTINUE;
 }
 
@@ -681,7 +718,7 @@ static verdict ttp64_ipv4_internal(struct xlation *state)
 
 	hdr4->version = 4;
 	hdr4->ihl = 5;
-	hdr4->tos = xlat_tos(&state->jool.globals, hdr6);
+	hdr4->tos = ttp64_xlat_tos(&state->jool.globals, hdr6);
 	hdr4->tot_len = cpu_to_be16(get_tot_len_ipv6(in->skb) - pkt_hdrs_len(in)
 			+ pkt_hdrs_len(out));
 	generate_ipv4_id(state, hdr4, hdr_frag);
@@ -1103,29 +1140,29 @@ static __sum16 update_csum_6to4(__sum16 csum16,
 	return csum_fold(csum);
 }
 
-static verdict ttp64_tcp(struct xlation *state)
+/*
+ * Translates the ports and checksum of @tcp_out, which is assumed to already
+ * contain a copy of @tcp_in. @hdr6 is @tcp_in's IPv6 header.
+ */
+static void xlat64_tcp_hdr(struct xlation *state, struct ipv6hdr const *hdr6,
+		struct tcphdr const *tcp_in, struct tcphdr *tcp_out)
 {
-	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
-	struct tcphdr const *tcp_in = pkt_tcp_hdr(in);
-	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		tcp_out->source = get_src_port64(state);
 		tcp_out->dest = get_dst_port64(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_6to4(tcp_in->check,
-				pkt_ip6_hdr(in), &tcp_copy, sizeof(tcp_copy),
+				hdr6, &tcp_copy, sizeof(tcp_copy),
 				pkt_ip4_hdr(out), tcp_out, sizeof(*tcp_out));
 		out->skb->ip_summed = CHECKSUM_NONE;
 
@@ -1135,33 +1172,39 @@ static verdict ttp64_tcp(struct xlation *state)
 				pkt_ip4_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
+}
+
+static verdict ttp64_tcp(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct tcphdr const *tcp_in = pkt_tcp_hdr(in);
+	struct tcphdr *tcp_out = pkt_tcp_hdr(&state->out);
 
+	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
+	xlat64_tcp_hdr(state, pkt_ip6_hdr(in), tcp_in, tcp_out);
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp64_udp(struct xlation *state)
+/* Same as xlat64_tcp_hdr(), but UDP. */
+static void xlat64_udp_hdr(struct xlation *state, struct ipv6hdr const *hdr6,
+		struct udphdr const *udp_in, struct udphdr *udp_out)
 {
-	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
-	struct udphdr const *udp_in = pkt_udp_hdr(in);
-	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
 	if (xlation_is_nat64(state)) {
 		udp_out->source = get_src_port64(state);
 		udp_out->dest = get_dst_port64(state);
 	}
 
 	/* Header.checksum */
-	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+	if (state->in.skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
 		udp_copy.check = 0;
 
 		udp_out->check = 0;
 		udp_out->check = update_csum_6to4(udp_in->check,
-				pkt_ip6_hdr(in), &udp_copy, sizeof(udp_copy),
+				hdr6, &udp_copy, sizeof(udp_copy),
 				pkt_ip4_hdr(out), udp_out, sizeof(*udp_out));
 		if (udp_out->check == 0)
 			udp_out->check = CSUM_MANGLED_0;
@@ -1173,10 +1216,125 @@ static verdict ttp64_udp(struct xlation *state)
 				pkt_ip4_hdr(out)->daddr, 0);
 		partialize_skb(out->skb, offsetof(struct udphdr, check));
 	}
+}
+
+static verdict ttp64_udp(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct udphdr const *udp_in = pkt_udp_hdr(in);
+	struct udphdr *udp_out = pkt_udp_hdr(&state->out);
 
+	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
+	xlat64_udp_hdr(state, pkt_ip6_hdr(in), udp_in, udp_out);
 	return VERDICT_CONTINUE;
 }
 
+static bool xlat64_in_place_viable(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct ipv6hdr const *hdr6;
+	__u32 nonzero_location;
+
+	if (!state->jool.globals.xlat_in_place)
+		return false;
+	/* Hairpin: The U-turned packet is still needed by the caller. */
+	if (pkt_original_pkt(in) != in)
+		return false;
+	/*
+	 * First leg of a hairpin: The second leg might store the original skb
+	 * (eg. a TCP SYN in the simultaneous open queue), and core frees the
+	 * first leg's output afterwards.
+	 */
+	if (state->jool.is_hairpin(state))
+		return false;
+	/* Somebody else (eg. a packet socket) shares the headers. */
+	if (skb_cloned(in->skb))
+		return false;
+	if (pkt_frag_hdr(in))
+		return false;
+	if (pkt_l4_proto(in) != L4PROTO_TCP && pkt_l4_proto(in) != L4PROTO_UDP)
+		return false;
+
+	/* Leave the ICMP errors to the copy path; it can still send them. */
+	hdr6 = pkt_ip6_hdr(in);
+	if (hdr6->hop_limit <= 1)
+		return false;
+	if (has_nonzero_segments_left(hdr6, &nonzero_location))
+		return false;
+
+	return true;
+}
+
+/*
+ * Translates @state->in by rewriting its headers, instead of building a new
+ * packet. Meant to be called by ttp64_alloc_skb(), once the packet has been
+ * routed.
+ *
+ * Returns false if the packet does not qualify (and nothing was touched).
+ * Otherwise the translation is complete, and @state->out.skb is
+ * @state->in.skb.
+ *
+ * Because the original headers are lost, this is only attempted on packets
+ * whose translation cannot fail anymore.
+ */
+static bool ttp64_xlat_in_place(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
+	struct sk_buff *skb = in->skb;
+	struct ipv6hdr hdr6;
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+	} l4;
+	unsigned int l4hdr_len;
+
+	if (!xlat64_in_place_viable(state))
+		return false;
+
+	/* Back up whatever is about to be overridden. */
+	memcpy(&hdr6, pkt_ip6_hdr(in), sizeof(hdr6));
+	if (pkt_l4_proto(in) == L4PROTO_TCP)
+		memcpy(&l4.tcp, pkt_tcp_hdr(in), sizeof(l4.tcp));
+	else
+		memcpy(&l4.udp, pkt_udp_hdr(in), sizeof(l4.udp));
+	l4hdr_len = pkt_l4hdr_len(in);
+
+	/*
+	 * The IPv4 header is shorter, so it's written over the tail of the
+	 * IPv6 header. The L4 header stays where it is.
+	 */
+	__skb_pull(skb, pkt_l3hdr_len(in) - sizeof(struct iphdr));
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct iphdr));
+
+	pkt_fill(out, skb, L3PROTO_IPV4, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+
+	skb_cleanup_copy(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	skb->mark = state->flowx.v4.flowi.flowi4_mark;
+	skb->protocol = htons(ETH_P_IP);
+
+	xlat_gso(out, 0);
+
+	skb_dst_drop(skb);
+	if (state->dst) {
+		route_skb_set(skb, state->dst, state->dst_noref);
+		state->dst = NULL;
+	}
+
+	xlat64_external_hdr(state, &hdr6, NULL, pkt_ip4_hdr(out));
+	if (pkt_l4_proto(out) == L4PROTO_TCP)
+		xlat64_tcp_hdr(state, &hdr6, &l4.tcp, pkt_tcp_hdr(out));
+	else
+		xlat64_udp_hdr(state, &hdr6, &l4.udp, pkt_udp_hdr(out));
+
+	return true;
+}
+
 const struct translation_steps ttp64_steps = {
 	.skb_alloc = ttp64_alloc_skb,
 	.xlat_outer_l3 = ttp64_ipv4_external,
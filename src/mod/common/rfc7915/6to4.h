@@ -14,5 +14,8 @@
 extern const struct translation_steps ttp64_steps;
 
 verdict predict_route64(struct xlation *state);
+/* The IPv4 TOS @hdr will be translated into. */
+__u8 ttp64_xlat_tos(struct jool_globals const *config,
+		struct ipv6hdr const *hdr);
 
 #endif /* SRC_MOD_COMMON_RFC7915_6TO4_H_ */
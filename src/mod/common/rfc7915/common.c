@@ -420,3 +420,49 @@ void skb_cleanup_copy(struct sk_buff *skb)
 	skb->tstamp = 0;
 #endif
 }
+
+/*
+ * Adjusts @out's GSO metadata to its (new) L3 protocol. A nonzero @gso_size
+ * replaces the length of the segments' payload.
+ *
+ * Only the family-specific bits need attention; the rest of gso_type describes
+ * things translation does not change.
+ */
+void xlat_gso(struct packet *out, unsigned short gso_size)
+{
+	struct skb_shared_info *shinfo;
+
+	shinfo = skb_shinfo(out->skb);
+	if (!shinfo->gso_size)
+		return;
+
+	switch (pkt_l3_proto(out)) {
+	case L3PROTO_IPV6:
+		if (shinfo->gso_type & SKB_GSO_TCPV4) {
+			/* IPv6 has no Identification to keep fixed. */
+			shinfo->gso_type &= ~(SKB_GSO_TCPV4 | SKB_GSO_TCP_FIXEDID);
+			shinfo->gso_type |= SKB_GSO_TCPV6;
+		}
+		if (shinfo->gso_type & SKB_GSO_IPXIP4) {
+			shinfo->gso_type &= ~SKB_GSO_IPXIP4;
+			shinfo->gso_type |= SKB_GSO_IPXIP6;
+		}
+		break;
+	case L3PROTO_IPV4:
+		if (shinfo->gso_type & SKB_GSO_TCPV6) {
+			shinfo->gso_type &= ~SKB_GSO_TCPV6;
+			shinfo->gso_type |= SKB_GSO_TCPV4;
+		}
+		if (shinfo->gso_type & SKB_GSO_IPXIP6) {
+			shinfo->gso_type &= ~SKB_GSO_IPXIP6;
+			shinfo->gso_type |= SKB_GSO_IPXIP4;
+		}
+		break;
+	}
+
+	if (gso_size && gso_size != shinfo->gso_size) {
+		shinfo->gso_size = gso_size;
+		shinfo->gso_segs = DIV_ROUND_UP(out->skb->len - pkt_hdrs_len(out),
+				gso_size);
+	}
+}
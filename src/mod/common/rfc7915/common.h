@@ -32,6 +32,12 @@ struct translation_steps {
 	 *
 	 * There's also the issue that the incoming packet might not have enough
 	 * room for the header length expansion from v4 to v6.
+	 *
+	 * (Exception: If xlat-in-place is enabled, and the packet is simple
+	 * enough that nothing can go wrong anymore once it has been routed,
+	 * this function translates the whole thing by rewriting the incoming
+	 * packet's headers. In this case, @state->out.skb will equal
+	 * @state->in.skb, and the rest of the steps are skipped.)
 	 */
 	skb_alloc_fn skb_alloc;
 	/** The function that will translate the external IP header. */
@@ -98,5 +104,6 @@ verdict handle_icmp_extension(struct xlation *state,
 		struct icmpext_args *args);
 
 void skb_cleanup_copy(struct sk_buff *skb);
+void xlat_gso(struct packet *out, unsigned short gso_size);
 
 #endif /* SRC_MOD_COMMON_RFC7915_COMMON_H_ */
@@ -1,5 +1,7 @@
 #include "mod/common/rfc7915/core.h"
 
+#include "mod/common/histogram.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/skbuff.h"
 #include "mod/common/rfc7915/4to6.h"
@@ -55,6 +57,7 @@ static void __kfree_skb_list(struct xlation *state)
 verdict translating_the_packet(struct xlation *state)
 {
 	struct translation_steps const *steps;
+	u64 start;
 	verdict result;
 
 	switch (xlator_get_type(&state->jool)) {
@@ -81,15 +84,24 @@ verdict translating_the_packet(struct xlation *state)
 	result = steps->skb_alloc(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
+	if (xlation_in_place(state)) {
+		jstat_inc(state->jool.stats, JSTAT_XLAT_IN_PLACE);
+		goto success;
+	}
+
 	result = steps->xlat_outer_l3(state);
 	if (result != VERDICT_CONTINUE)
 		goto revert;
 	if (has_l4_hdr(state)) {
+		start = jhist_start();
 		result = xlat_l4_function(state, steps);
+		jhist_end(state, JHIST_CSUM, start);
 		if (result != VERDICT_CONTINUE)
 			goto revert;
 	}
+	jstat_inc(state->jool.stats, JSTAT_XLAT_COPY);
 
+success:
 	if (xlation_is_nat64(state))
 		log_debug(state, "Done step 4.");
 	return VERDICT_CONTINUE;
@@ -98,3 +110,38 @@ revert:
 	__kfree_skb_list(state);
 	return result;
 }
+
+/**
+ * Returns true if @state->in is a GSO packet whose segments cannot be
+ * translated as a unit. Such packets need to be segmented in software, and
+ * each segment translated separately.
+ *
+ * (The rest of the GSO packets are translated whole, and the kernel segments
+ * the result.)
+ */
+bool xlat_needs_segmentation(struct xlation *state)
+{
+	struct sk_buff *skb = state->in.skb;
+
+	if (!skb_is_gso(skb))
+		return false;
+
+#if LINUX_VERSION_AT_LEAST(5, 6, 0, 9, 0)
+	/*
+	 * The frag_list skbs of a fraglist GRO train keep their own L3 and L4
+	 * headers, and the segmentation code trusts them.
+	 */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST)
+		return true;
+#endif
+
+	switch (pkt_l3_proto(&state->in)) {
+	case L3PROTO_IPV6:
+		return false;
+	case L3PROTO_IPV4:
+		return ttp46_needs_segmentation(state);
+	}
+
+	WARN(1, "Unknown l3 proto: %u", pkt_l3_proto(&state->in));
+	return false;
+}
@@ -15,5 +15,6 @@
 #include "mod/common/translation_state.h"
 
 verdict translating_the_packet(struct xlation *state);
+bool xlat_needs_segmentation(struct xlation *state);
 
 #endif /* SRC_MOD_COMMON_RFC7915_CORE_H_ */
@@ -2,11 +2,66 @@
 #define SRC_MOD_COMMON_ROUTE_H_
 
 #include <linux/bug.h> /* Needed by flow.h in some old kernels (~4.9) */
+#include <net/dst.h>
 #include <net/flow.h>
+#include <net/net_namespace.h>
 #include "mod/common/xlator.h"
 
-/* Wrappers for the kernel's routing functions. */
-struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow);
-struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow);
+int route_setup(void);
+void route_teardown(void);
+
+/*
+ * Wrappers for the kernel's routing functions. (Cached; see route_out.c.)
+ * Have to be called in an RCU read-side critical section.
+ * @noref: Out parameter. If true, the result is borrowed from the cache, and
+ *	only lives until the end of the critical section. (Use route_put() and
+ *	route_skb_set() instead of dst_release() and skb_dst_set().)
+ * @debug: Print debug messages? (Usually state_debug().)
+ */
+struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow,
+		bool *noref, bool debug);
+struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow,
+		bool *noref, bool debug);
+
+/*
+ * Does the FIB need the layer 4 fields (ie. are there policy routing rules
+ * that match protocols or ports) in @ns?
+ * Caches of routing results that don't key by those fields should bypass
+ * themselves when this is true.
+ */
+static inline bool fib4_needs_l4(struct net *ns)
+{
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+	return ns->ipv4.fib_rules_require_fldissect;
+#else
+	return false;
+#endif
+}
+
+static inline bool fib6_needs_l4(struct net *ns)
+{
+#ifdef CONFIG_IPV6_MULTIPLE_TABLES
+	return ns->ipv6.fib6_rules_require_fldissect;
+#else
+	return false;
+#endif
+}
+
+/* Releases @dst, as returned by route4() or route6(). */
+static inline void route_put(struct dst_entry *dst, bool noref)
+{
+	if (dst && !noref)
+		dst_release(dst);
+}
+
+/* Hands @dst (as returned by route4() or route6()) over to @skb. */
+static inline void route_skb_set(struct sk_buff *skb, struct dst_entry *dst,
+		bool noref)
+{
+	if (dst && noref)
+		skb_dst_set_noref(skb, dst);
+	else
+		skb_dst_set(skb, dst);
+}
 
 #endif /* SRC_MOD_COMMON_ROUTE_H_ */
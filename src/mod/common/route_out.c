@@ -1,10 +1,14 @@
 #include "mod/common/route.h"
 
+#include <linux/netdevice.h>
+#include <net/ip6_fib.h>
 #include <net/ip6_route.h>
 #include <net/route.h>
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 
-struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow)
+static struct dst_entry *__route4(struct xlator *jool, struct flowi4 *flow,
+		bool debug)
 {
 	struct rtable *table;
 	struct dst_entry *dst;
@@ -15,24 +19,24 @@ struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow)
 	 */
 	table = __ip_route_output_key(jool->ns, flow);
 	if (!table || IS_ERR(table)) {
-		__log_debug(jool, "__ip_route_output_key() returned %ld. Cannot route packet.",
+		__log_debug_if(jool, debug, "__ip_route_output_key() returned %ld. Cannot route packet.",
 				PTR_ERR(table));
 		return NULL;
 	}
 
 	dst = &table->dst;
 	if (dst->error) {
-		__log_debug(jool, "__ip_route_output_key() returned error %d. Cannot route packet.",
+		__log_debug_if(jool, debug, "__ip_route_output_key() returned error %d. Cannot route packet.",
 				dst->error);
 		goto revert;
 	}
 
 	if (!dst->dev) {
-		__log_debug(jool, "I found a dst entry with no dev; I don't know what to do.");
+		__log_debug_if(jool, debug, "I found a dst entry with no dev; I don't know what to do.");
 		goto revert;
 	}
 
-	__log_debug(jool, "Packet routed via device '%s'.", dst->dev->name);
+	__log_debug_if(jool, debug, "Packet routed via device '%s'.", dst->dev->name);
 	return dst;
 
 revert:
@@ -40,22 +44,353 @@ revert:
 	return NULL;
 }
 
-struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow)
+static struct dst_entry *__route6(struct xlator *jool, struct flowi6 *flow,
+		bool debug)
 {
 	struct dst_entry *dst;
 
 	dst = ip6_route_output(jool->ns, NULL, flow);
 	if (!dst) {
-		__log_debug(jool, "ip6_route_output() returned NULL. Cannot route packet.");
+		__log_debug_if(jool, debug, "ip6_route_output() returned NULL. Cannot route packet.");
 		return NULL;
 	}
 	if (dst->error) {
-		__log_debug(jool, "ip6_route_output() returned error %d. Cannot route packet.",
+		__log_debug_if(jool, debug, "ip6_route_output() returned error %d. Cannot route packet.",
 				dst->error);
 		dst_release(dst);
 		return NULL;
 	}
 
-	__log_debug(jool, "Packet routed via device '%s'.", dst->dev->name);
+	__log_debug_if(jool, debug, "Packet routed via device '%s'.", dst->dev->name);
 	return dst;
 }
+
+/*
+ * Route cache.
+ *
+ * For long flows, the routing arguments are the same packet after packet, so
+ * route4() and route6() remember the last dst_entry they got for each set of
+ * FIB lookup arguments, in small direct-mapped per-CPU tables.
+ *
+ * The keys include the protocol, the ports (or ICMP type and code) and the
+ * flow label, because the multipath hash (and policy routing rules) might look
+ * at them. Otherwise, a slot would pin every flow between two hosts to the
+ * nexthop the first one happened to hash to. (Each flow gets its own slot, so
+ * the cache remembers the kernel's decision, rather than overriding it.)
+ * Namespaces whose policy routing rules match layer 4 fields bypass the cache
+ * altogether, just in case.
+ *
+ * Cached entries are validated through dst_check() on every hit. This catches
+ * FIB changes (the IPv4 route generation ID and the IPv6 cookie) and PMTU
+ * updates (which obsolete the affected dsts). Because each slot holds a
+ * reference to its dst (and therefore to its device), the slots of a namespace
+ * are also flushed whenever one of its devices goes down or unregisters.
+ *
+ * The cache holds one reference per slot. route4() and route6() lend the dst to
+ * the caller instead of cloning it, so a hit never touches the dst's refcount.
+ * This is safe because the caller runs in an RCU read-side critical section,
+ * and a released dst is not freed until the grace period ends.
+ *
+ * The lock is only contended by the flush. Otherwise, every CPU only touches
+ * its own table.
+ */
+
+#define ROUTE_CACHE_BITS 6
+#define ROUTE_CACHE_SIZE (1 << ROUTE_CACHE_BITS)
+
+/* The route4() arguments the FIB lookup depends on. */
+struct route4_key {
+	struct net *ns;
+	__be32 saddr;
+	__be32 daddr;
+	__u32 mark;
+	int oif;
+	__u8 tos;
+	__u8 scope;
+	__u8 flags;
+	__u8 proto;
+	/* The ICMP type and code alias @dport. */
+	__be16 sport;
+	__be16 dport;
+};
+
+struct route4_slot {
+	struct route4_key key;
+	struct dst_entry *dst;
+	/* flowi4.saddr after routing. (The kernel fills it if it was zero.) */
+	__be32 saddr;
+};
+
+/* The route6() arguments the FIB lookup depends on. */
+struct route6_key {
+	struct net *ns;
+	struct in6_addr saddr;
+	struct in6_addr daddr;
+	__u32 mark;
+	int oif;
+	__be32 flowlabel;
+	__u8 scope;
+	__u8 flags;
+	__u8 proto;
+	/* The ICMP type and code alias @dport. */
+	__be16 sport;
+	__be16 dport;
+};
+
+struct route6_slot {
+	struct route6_key key;
+	struct dst_entry *dst;
+	u32 cookie;
+};
+
+struct route_cache {
+	spinlock_t lock;
+	struct route4_slot slots4[ROUTE_CACHE_SIZE];
+	struct route6_slot slots6[ROUTE_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct route_cache, route_caches);
+
+static void init_key4(struct route4_key *key, struct net *ns,
+		struct flowi4 *flow)
+{
+	memset(key, 0, sizeof(*key)); /* Padding; keys are memcmp()'d. */
+	key->ns = ns;
+	key->saddr = flow->saddr;
+	key->daddr = flow->daddr;
+	key->mark = flow->flowi4_mark;
+	key->oif = flow->flowi4_oif;
+#if LINUX_VERSION_AT_LEAST(6, 18, 0, 0, 0)
+	key->tos = flow->flowi4_dscp;
+#else
+	key->tos = flow->flowi4_tos;
+#endif
+	key->scope = flow->flowi4_scope;
+	key->flags = flow->flowi4_flags;
+	key->proto = flow->flowi4_proto;
+	key->sport = flow->fl4_sport;
+	key->dport = flow->fl4_dport;
+}
+
+static void init_key6(struct route6_key *key, struct net *ns,
+		struct flowi6 *flow)
+{
+	memset(key, 0, sizeof(*key)); /* Padding; keys are memcmp()'d. */
+	key->ns = ns;
+	key->saddr = flow->saddr;
+	key->daddr = flow->daddr;
+	key->mark = flow->flowi6_mark;
+	key->oif = flow->flowi6_oif;
+	key->flowlabel = flow->flowlabel;
+	key->scope = flow->flowi6_scope;
+	key->flags = flow->flowi6_flags;
+	key->proto = flow->flowi6_proto;
+	key->sport = flow->fl6_sport;
+	key->dport = flow->fl6_dport;
+}
+
+static unsigned int hash_key4(struct route4_key const *key)
+{
+	return hash_32(hash_ptr(key->ns, 32)
+			^ (__force u32)key->saddr
+			^ (__force u32)key->daddr
+			^ key->mark
+			^ key->tos
+			^ ((__force u32)key->sport << 16)
+			^ (__force u32)key->dport,
+			ROUTE_CACHE_BITS);
+}
+
+static unsigned int hash_key6(struct route6_key const *key)
+{
+	return hash_32(hash_ptr(key->ns, 32)
+			^ (__force u32)key->saddr.s6_addr32[2]
+			^ (__force u32)key->saddr.s6_addr32[3]
+			^ (__force u32)key->daddr.s6_addr32[2]
+			^ (__force u32)key->daddr.s6_addr32[3]
+			^ (__force u32)key->flowlabel
+			^ key->mark
+			^ ((__force u32)key->sport << 16)
+			^ (__force u32)key->dport,
+			ROUTE_CACHE_BITS);
+}
+
+/* Returns the slot's dst (without an additional reference) if still valid. */
+static struct dst_entry *slot_get(struct dst_entry **slot_dst, u32 cookie)
+{
+	struct dst_entry *dst = *slot_dst;
+
+	if (!dst)
+		return NULL;
+
+	if (dst_check(dst, cookie) == NULL) {
+		dst_release(dst);
+		*slot_dst = NULL;
+		return NULL;
+	}
+
+	return dst;
+}
+
+/* Hands @dst's reference over to the slot. */
+static void slot_set(struct dst_entry **slot_dst, struct dst_entry *dst)
+{
+	if (*slot_dst)
+		dst_release(*slot_dst);
+	*slot_dst = dst;
+}
+
+struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow,
+		bool *noref, bool debug)
+{
+	struct route_cache *cache;
+	struct route4_slot *slot;
+	struct route4_key key;
+	struct dst_entry *dst;
+	unsigned int index;
+
+	*noref = false;
+	if (fib4_needs_l4(jool->ns))
+		return __route4(jool, flow, debug);
+
+	init_key4(&key, jool->ns, flow);
+	index = hash_key4(&key);
+
+	local_bh_disable();
+	cache = this_cpu_ptr(&route_caches);
+	spin_lock(&cache->lock);
+	slot = &cache->slots4[index];
+	dst = (memcmp(&slot->key, &key, sizeof(key)) == 0)
+			? slot_get(&slot->dst, 0)
+			: NULL;
+	if (dst)
+		flow->saddr = slot->saddr;
+	spin_unlock(&cache->lock);
+
+	if (dst) {
+		local_bh_enable();
+		__log_debug_if(jool, debug, "Packet routed via device '%s'. (Cached)",
+				dst->dev->name);
+		*noref = true;
+		return dst;
+	}
+
+	dst = __route4(jool, flow, debug);
+	if (dst) {
+		spin_lock(&cache->lock);
+		slot->key = key;
+		slot->saddr = flow->saddr;
+		slot_set(&slot->dst, dst);
+		spin_unlock(&cache->lock);
+		*noref = true;
+	}
+
+	local_bh_enable();
+	return dst;
+}
+
+struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow,
+		bool *noref, bool debug)
+{
+	struct route_cache *cache;
+	struct route6_slot *slot;
+	struct route6_key key;
+	struct dst_entry *dst;
+	unsigned int index;
+
+	*noref = false;
+	if (fib6_needs_l4(jool->ns))
+		return __route6(jool, flow, debug);
+
+	init_key6(&key, jool->ns, flow);
+	index = hash_key6(&key);
+
+	local_bh_disable();
+	cache = this_cpu_ptr(&route_caches);
+	spin_lock(&cache->lock);
+	slot = &cache->slots6[index];
+	dst = (memcmp(&slot->key, &key, sizeof(key)) == 0)
+			? slot_get(&slot->dst, slot->cookie)
+			: NULL;
+	spin_unlock(&cache->lock);
+
+	if (dst) {
+		local_bh_enable();
+		__log_debug_if(jool, debug, "Packet routed via device '%s'. (Cached)",
+				dst->dev->name);
+		*noref = true;
+		return dst;
+	}
+
+	dst = __route6(jool, flow, debug);
+	if (dst) {
+		spin_lock(&cache->lock);
+		slot->key = key;
+		slot->cookie = rt6_get_cookie((struct rt6_info *)dst);
+		slot_set(&slot->dst, dst);
+		spin_unlock(&cache->lock);
+		*noref = true;
+	}
+
+	local_bh_enable();
+	return dst;
+}
+
+/* Empties @ns's slots. (If @ns is NULL, empties every slot.) */
+static void route_cache_flush(struct net *ns)
+{
+	struct route_cache *cache;
+	unsigned int cpu;
+	unsigned int i;
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(&route_caches, cpu);
+		spin_lock_bh(&cache->lock);
+		for (i = 0; i < ROUTE_CACHE_SIZE; i++) {
+			if (cache->slots4[i].dst
+					&& (!ns || cache->slots4[i].key.ns == ns)) {
+				dst_release(cache->slots4[i].dst);
+				cache->slots4[i].dst = NULL;
+			}
+			if (cache->slots6[i].dst
+					&& (!ns || cache->slots6[i].key.ns == ns)) {
+				dst_release(cache->slots6[i].dst);
+				cache->slots6[i].dst = NULL;
+			}
+		}
+		spin_unlock_bh(&cache->lock);
+	}
+}
+
+static int route_netdev_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+	switch (event) {
+	case NETDEV_DOWN:
+	case NETDEV_UNREGISTER:
+		route_cache_flush(dev_net(netdev_notifier_info_to_dev(ptr)));
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block route_notifier = {
+	.notifier_call = route_netdev_event,
+};
+
+int route_setup(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(&route_caches, cpu)->lock);
+
+	return register_netdevice_notifier(&route_notifier);
+}
+
+void route_teardown(void)
+{
+	unregister_netdevice_notifier(&route_notifier);
+	route_cache_flush(NULL);
+}
@@ -90,8 +90,10 @@ static verdict succeed(struct xlation *state)
 	 * - These special no-changes cases are rare.
 	 *
 	 * So let's simplify everything by just joold_add()ing here.
+	 * (The BIB module does decide whether the session changed enough to
+	 * deserve replication, though. See ss-min-readvertise-interval.)
 	 */
-	if (state->entries.session_set)
+	if (state->entries.session_set && state->entries.sync)
 		joold_add(&state->jool, &state->entries.session);
 
 	return VERDICT_CONTINUE;
@@ -1,10 +1,16 @@
 #include "mod/common/steps/handling_hairpinning_nat64.h"
 
+#include <net/checksum.h>
+#include <net/ip6_checksum.h>
+
 #include "mod/common/log.h"
+#include "mod/common/route.h"
+#include "mod/common/rfc7915/common.h"
 #include "mod/common/rfc7915/core.h"
 #include "mod/common/steps/send_packet.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 #include "mod/common/steps/filtering_and_updating.h"
+#include "mod/common/db/fragcache.h"
 #include "mod/common/db/pool4/db.h"
 
 
@@ -52,13 +58,24 @@ verdict handling_hairpinning_nat64(struct xlation *old)
 		return VERDICT_DROP;
 	new->in = old->out;
 	new->is_hairpin = true;
+	new->debug = old->debug;
+	new->batch = old->batch;
 
-	result = filtering_and_updating(new);
-	if (result != VERDICT_CONTINUE)
-		goto end;
-	result = compute_out_tuple(new);
-	if (result != VERDICT_CONTINUE)
-		goto end;
+	if (pkt_is_subsequent_frag(&new->in)) {
+		result = fragcache_find(new);
+		if (result != VERDICT_CONTINUE)
+			goto end;
+	} else {
+		result = filtering_and_updating(new);
+		if (result != VERDICT_CONTINUE)
+			goto end;
+		result = compute_out_tuple(new);
+		if (result != VERDICT_CONTINUE)
+			goto end;
+		/* Nothing can be pending; hairpinned fragments are not held. */
+		if (pkt_is_fragment(&new->in))
+			fragcache_add(new, NULL);
+	}
 	result = translating_the_packet(new);
 	if (result != VERDICT_CONTINUE)
 		goto end;
@@ -70,3 +87,218 @@ verdict handling_hairpinning_nat64(struct xlation *old)
 end:	xlation_destroy(new);
 	return result;
 }
+
+/**
+ * Can @state be U-turned by handling_hairpinning_nat64_direct()?
+ *
+ * Assumes steps 1 through 3 have already computed @state's outgoing tuple.
+ */
+bool hairpin_nat64_direct_viable(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct jool_globals const *cfg = &state->jool.globals;
+
+	if (pkt_l3_proto(in) != L3PROTO_IPV6)
+		return false;
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+		break;
+	case L4PROTO_ICMP:
+		/* Pings only; errors carry a packet that would need updating. */
+		if (pkt_is_icmp6_error(in))
+			return false;
+		break;
+	default:
+		return false;
+	}
+	/* The 6-to-4 leg would strip these; leave them to the two-step path. */
+	if (pkt_l3hdr_len(in) != sizeof(struct ipv6hdr))
+		return false;
+	/* Leave the ICMP errors to the two-step path; it can still send them. */
+	if (pkt_ip6_hdr(in)->hop_limit <= 1)
+		return false;
+	/* Both legs would have to agree on the traffic class. */
+	if (cfg->reset_traffic_class || cfg->reset_tos)
+		return false;
+	/* The frag_list skbs have their own headers. */
+	if (skb_has_frag_list(in->skb))
+		return false;
+
+	return is_hairpin_nat64(state);
+}
+
+static void update_csum6_addrs(struct sk_buff *skb, __sum16 *check,
+		struct ipv6hdr const *hdr6, struct tuple const *tuple)
+{
+	inet_proto_csum_replace16(check, skb, hdr6->saddr.s6_addr32,
+			tuple->src.addr6.l3.s6_addr32, true);
+	inet_proto_csum_replace16(check, skb, hdr6->daddr.s6_addr32,
+			tuple->dst.addr6.l3.s6_addr32, true);
+}
+
+static void update_csum6(struct sk_buff *skb, __sum16 *check,
+		struct ipv6hdr const *hdr6, struct tuple const *tuple,
+		__be16 *sport, __be16 *dport)
+{
+	__be16 new_sport = cpu_to_be16(tuple->src.addr6.l4);
+	__be16 new_dport = cpu_to_be16(tuple->dst.addr6.l4);
+
+	update_csum6_addrs(skb, check, hdr6, tuple);
+	inet_proto_csum_replace2(check, skb, *sport, new_sport, false);
+	inet_proto_csum_replace2(check, skb, *dport, new_dport, false);
+
+	*sport = new_sport;
+	*dport = new_dport;
+}
+
+/* The ICMPv6 checksum also covers the pseudoheader. */
+static void update_icmp6(struct sk_buff *skb, struct ipv6hdr const *hdr6,
+		struct tuple const *tuple)
+{
+	struct icmp6hdr *icmp6 = icmp6_hdr(skb);
+	__be16 new_id = cpu_to_be16(tuple->icmp6_id);
+
+	update_csum6_addrs(skb, &icmp6->icmp6_cksum, hdr6, tuple);
+	inet_proto_csum_replace2(&icmp6->icmp6_cksum, skb,
+			icmp6->icmp6_identifier, new_id, false);
+	icmp6->icmp6_identifier = new_id;
+}
+
+/*
+ * Translates @state->in (an IPv6 packet headed to pool4) straight into the IPv6
+ * packet the second leg of the hairpin would have produced, reusing @state and
+ * the incoming skb.
+ *
+ * The 6-to-4 and 4-to-6 translations are composed: The IPv4 version of the
+ * packet is never built, and neither is a second xlation. Only the headers
+ * are rewritten; the checksum is updated incrementally.
+ *
+ * On success, @state->out.skb is @state->in.skb, and has already been sent.
+ */
+verdict handling_hairpinning_nat64_direct(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct packet saved;
+	struct sk_buff *skb;
+	struct flowi6 *flow6;
+	struct dst_entry *dst;
+	bool noref;
+	struct ipv6hdr *hdr6;
+	struct tcphdr *tcp;
+	struct udphdr *udp;
+	unsigned int mtu;
+	verdict result;
+
+	log_debug(state, "Step 5: Handling Hairpinning (directly)...");
+
+	/*
+	 * Pretend @state->in is the IPv4 packet, and run the second leg's
+	 * steps 2 and 3. They only need the tuple and the layer 4 header, which
+	 * are the same.
+	 */
+	saved = *in;
+	in->l3_proto = L3PROTO_IPV4;
+	in->tuple = state->out.tuple;
+	memset(&state->entries, 0, sizeof(state->entries));
+	state->is_hairpin = true;
+
+	result = filtering_and_updating(state);
+	if (result == VERDICT_CONTINUE)
+		result = compute_out_tuple(state);
+
+	*in = saved;
+	state->is_hairpin = false;
+	if (result != VERDICT_CONTINUE) {
+		/* The two-step path does not report the second leg's errors. */
+		state->result.icmp = ICMPERR_NONE;
+		return result;
+	}
+
+	skb = in->skb;
+	flow6 = &state->flowx.v6.flowi;
+	memset(flow6, 0, sizeof(*flow6));
+	flow6->flowi6_mark = skb->mark;
+	flow6->flowi6_scope = RT_SCOPE_UNIVERSE;
+	flow6->flowi6_proto = pkt_ip6_hdr(in)->nexthdr;
+	flow6->flowi6_flags = FLOWI_FLAG_ANYSRC;
+	flow6->saddr = state->out.tuple.src.addr6.l3;
+	flow6->daddr = state->out.tuple.dst.addr6.l3;
+	if (pkt_l4_proto(in) == L4PROTO_ICMP) {
+		flow6->fl6_icmp_type = pkt_icmp6_hdr(in)->icmp6_type;
+		flow6->fl6_icmp_code = pkt_icmp6_hdr(in)->icmp6_code;
+	} else {
+		flow6->fl6_sport = cpu_to_be16(state->out.tuple.src.addr6.l4);
+		flow6->fl6_dport = cpu_to_be16(state->out.tuple.dst.addr6.l4);
+	}
+
+#ifndef UNIT_TESTING
+	dst = route6(&state->jool, flow6, &noref, state_debug(state));
+	if (!dst)
+		return untranslatable(state, JSTAT_FAILED_ROUTES);
+	mtu = dst_mtu(dst);
+#else
+	dst = NULL;
+	noref = false;
+	mtu = 1500;
+#endif
+
+	/*
+	 * The two-step path would drop this in the second leg, whose ICMP
+	 * errors are not reported. So don't send a PTB either.
+	 */
+	if (!skb_is_gso(skb) && skb->len > mtu) {
+		route_put(dst, noref);
+		return drop(state, JSTAT_PKT_TOO_BIG);
+	}
+
+	/* Headers might be shared (eg. with a packet socket); unshare them. */
+	if (skb_ensure_writable(skb, pkt_hdrs_len(in))) {
+		route_put(dst, noref);
+		return drop(state, JSTAT_ENOMEM);
+	}
+
+	/* Point of no return; from now on, @skb is the outgoing packet. */
+	hdr6 = ipv6_hdr(skb);
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		tcp = tcp_hdr(skb);
+		update_csum6(skb, &tcp->check, hdr6, &state->out.tuple,
+				&tcp->source, &tcp->dest);
+		break;
+	case L4PROTO_UDP:
+		udp = udp_hdr(skb);
+		update_csum6(skb, &udp->check, hdr6, &state->out.tuple,
+				&udp->source, &udp->dest);
+		if (!udp->check)
+			udp->check = CSUM_MANGLED_0;
+		break;
+	default:
+		update_icmp6(skb, hdr6, &state->out.tuple);
+	}
+
+	/* Same as the two legs: Decrement once, lose the flow label. */
+	hdr6->hop_limit--;
+	hdr6->flow_lbl[0] &= 0xF0;
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->saddr = state->out.tuple.src.addr6.l3;
+	hdr6->daddr = state->out.tuple.dst.addr6.l3;
+
+	skb_cleanup_copy(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	skb_dst_drop(skb);
+	route_skb_set(skb, dst, noref);
+
+	pkt_fill(&state->out, skb, L3PROTO_IPV6, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + pkt_l4hdr_len(in),
+			pkt_original_pkt(in));
+	jstat_inc(state->jool.stats, JSTAT_HAIRPIN_DIRECT);
+
+	result = sendpkt_send(state);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	log_debug(state, "Done step 5.");
+	return VERDICT_CONTINUE;
+}
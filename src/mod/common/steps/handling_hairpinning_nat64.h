@@ -13,4 +13,7 @@
 bool is_hairpin_nat64(struct xlation *state);
 verdict handling_hairpinning_nat64(struct xlation *state);
 
+bool hairpin_nat64_direct_viable(struct xlation *state);
+verdict handling_hairpinning_nat64_direct(struct xlation *state);
+
 #endif /* SRC_MOD_COMMON_HANDLING_HARPINNING_H_ */
@@ -22,6 +22,8 @@ verdict handling_hairpinning_siit(struct xlation *old)
 		return VERDICT_DROP;
 	new->in = old->out;
 	new->is_hairpin = true;
+	new->debug = old->debug;
+	new->batch = old->batch;
 
 	result = translating_the_packet(new);
 	if (result != VERDICT_CONTINUE)
@@ -5,22 +5,72 @@
 #include "mod/common/nl/nl_handler.h"
 /* #include "mod/common/skbuff.h" */
 
-static verdict __sendpkt_send(struct xlation *state, struct sk_buff *out)
+/*
+ * Points the devices of @skb's train to their routes' devices.
+ * Returns false if a packet has no route.
+ */
+static bool prepare_train(struct sk_buff *skb)
 {
 	struct dst_entry *dst;
+
+	for (; skb != NULL; skb = skb->next) {
+		dst = skb_dst(skb);
+		if (WARN(!dst, "dst is NULL!"))
+			return false;
+		skb->dev = dst->dev;
+	}
+
+	return true;
+}
+
+/*
+ * Hands @skb's train to dst_output(). Once a fragment fails, the rest are
+ * useless, so they're dropped.
+ * Always releases the train. Returns the first error.
+ */
+static int send_train(struct xlator *jool, struct sk_buff *skb)
+{
+	struct sk_buff *next;
+	int error;
+
+	for (; skb != NULL; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+
+		/* Implicit kfree_skb(skb) here. */
+		error = dst_output(jool->ns, NULL, skb);
+		if (error) {
+			kfree_skb_list(next);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+verdict sendpkt_send(struct xlation *state)
+{
+	struct sendpkt_batch *batch;
 	int error;
 
-	dst = skb_dst(out);
-	if (WARN(!dst, "dst is NULL!"))
+	if (!prepare_train(state->out.skb)) {
+		kfree_skb_list(state->out.skb);
 		return drop(state, JSTAT_UNKNOWN);
+	}
 
-	out->dev = dst->dev;
-	log_debug(state, "Sending packet.");
+	batch = state->batch;
+	if (batch) {
+		if (batch->count >= SENDPKT_BATCH_MAX)
+			sendpkt_flush(&state->jool, batch);
+		log_debug(state, "Queuing packet.");
+		batch->trains[batch->count++] = state->out.skb;
+		return VERDICT_CONTINUE;
+	}
 
+	log_debug(state, "Sending packet.");
 	/* skb_log(out, "Translated packet"); */
 
-	/* Implicit kfree_skb(out) here. */
-	error = dst_output(state->jool.ns, NULL, out);
+	error = send_train(&state->jool, state->out.skb);
 	if (error) {
 		log_debug(state, "dst_output() returned errcode %d.", error);
 		return drop(state, JSTAT_DST_OUTPUT);
@@ -29,24 +79,23 @@ static verdict __sendpkt_send(struct xlation *state, struct sk_buff *out)
 	return VERDICT_CONTINUE;
 }
 
-verdict sendpkt_send(struct xlation *state)
+void sendpkt_flush(struct xlator *jool, struct sendpkt_batch *batch)
 {
-	struct sk_buff *skb;
-	struct sk_buff *next;
-	verdict result;
-
-	for (skb = state->out.skb; skb != NULL; skb = next) {
-		next = skb->next;
-		skb->next = NULL;
+	unsigned int i;
+	int error;
 
-		result = __sendpkt_send(state, skb);
-		if (result != VERDICT_CONTINUE) {
-			kfree_skb_list(next);
-			return result;
+	for (i = 0; i < batch->count; i++) {
+		error = send_train(jool, batch->trains[i]);
+		if (error) {
+			__log_debug(jool, "dst_output() returned errcode %d.",
+					error);
+			jstat_inc(jool->stats, JSTAT_DST_OUTPUT);
+		} else {
+			jstat_inc(jool->stats, JSTAT_SUCCESS);
 		}
 	}
 
-	return VERDICT_CONTINUE;
+	batch->count = 0;
 }
 
 void sendpkt_multicast(struct xlator *jool, struct sk_buff *skb)
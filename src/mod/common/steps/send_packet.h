@@ -15,14 +15,49 @@
 
 #include "mod/common/translation_state.h"
 
+/* Packets a sendpkt_batch can hold. (It's flushed early if it fills up.) */
+#define SENDPKT_BATCH_MAX 16
+
+/**
+ * Translated packets waiting to be put on the network together.
+ *
+ * Some translations yield several packets (GSO packets segmented in software,
+ * fragments that were waiting for their first fragment). If they're collected
+ * here, they're handed to the devices back to back once all of them have been
+ * translated, instead of interleaving each send with the next translation.
+ */
+struct sendpkt_batch {
+	/* Each of these is a packet, or a fragment train linked by ->next. */
+	struct sk_buff *trains[SENDPKT_BATCH_MAX];
+	unsigned int count;
+};
+
+static inline void sendpkt_batch_init(struct sendpkt_batch *batch)
+{
+	batch->count = 0;
+}
+
 /**
  * Puts @state's outgoing skb on the network.
  *
  * Note that this function inherits from ip_local_out() and ip6_local_out() the
  * annoying side effect of freeing "out_skb", EVEN IF IT COULD NOT BE SENT.
+ *
+ * If @state->batch is set, the packet is only queued there. Its fate is then
+ * decided (and counted) by sendpkt_flush().
  */
 verdict sendpkt_send(struct xlation *state);
 
+/**
+ * Puts @batch's packets on the network, in the order in which they were
+ * queued, and empties it.
+ *
+ * The accounting is the same as sendpkt_send()'s: If a fragment fails, the rest
+ * of its train is dropped, and the train is counted once as JSTAT_DST_OUTPUT.
+ * Trains that make it are counted as JSTAT_SUCCESS.
+ */
+void sendpkt_flush(struct xlator *jool, struct sendpkt_batch *batch);
+
 /**
  * joold's multicast packet sender. Sends the packet to the Netlink multicast
  * group, not the network.
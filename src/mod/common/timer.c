@@ -3,6 +3,7 @@
 #include "mod/common/linux_version.h"
 #include "mod/common/xlator.h"
 #include "mod/common/joold.h"
+#include "mod/common/db/fragcache.h"
 #include "mod/common/db/bib/db.h"
 
 /*
@@ -26,6 +27,7 @@ static int clean_state(struct xlator *jool, void *args)
 {
 	bib_clean(jool);
 	joold_clean(jool);
+	fragcache_clean(jool);
 	return 0;
 }
 
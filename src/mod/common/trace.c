@@ -2,6 +2,9 @@
 
 #include "mod/common/log.h"
 
+#define CREATE_TRACE_POINTS
+#include "mod/common/tracepoints.h"
+
 void pkt_trace4(struct xlation *state)
 {
 	union {
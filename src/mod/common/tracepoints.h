@@ -0,0 +1,327 @@
+/**
+ * @file
+ * Kernel tracepoints. (As opposed to trace.h, which prints the packet on the
+ * debug log.)
+ *
+ * They cost a NOP while disabled. To list them:
+ *
+ * 	$ sudo perf list 'jool:*'
+ *
+ * Example: Per-step latency
+ *
+ * 	$ sudo bpftrace -e '
+ * 		tracepoint:jool:jool_step_begin { @t[tid, args->step] = nsecs; }
+ * 		tracepoint:jool:jool_step_end /@t[tid, args->step]/ {
+ * 			@ns[args->step] = hist(nsecs - @t[tid, args->step]);
+ * 			delete(@t[tid, args->step]);
+ * 		}'
+ *
+ * Example: Drop hot spots
+ *
+ * 	$ sudo perf record -e jool:jool_drop -g -a sleep 10
+ */
+
+#ifndef SRC_MOD_COMMON_TRACEPOINTS_STEPS_
+#define SRC_MOD_COMMON_TRACEPOINTS_STEPS_
+
+/* Arguments of jool_step_begin and jool_step_end. */
+#define JOOL_STEP_DETERMINE_IN_TUPLE	1
+#define JOOL_STEP_FILTERING		2
+#define JOOL_STEP_COMPUTE_OUT_TUPLE	3
+#define JOOL_STEP_TRANSLATE		4
+#define JOOL_STEP_HAIRPIN		5
+#define JOOL_STEP_SEND			6
+#endif
+
+#ifdef UNIT_TESTING
+
+#ifndef SRC_MOD_COMMON_TRACEPOINTS_H_
+#define SRC_MOD_COMMON_TRACEPOINTS_H_
+
+/* The unit tests don't link the tracepoints. */
+#define trace_jool_xlat_start(state, skb) do {} while (0)
+#define trace_jool_xlat_end(state, result) do {} while (0)
+#define trace_jool_step_begin(state, step) do {} while (0)
+#define trace_jool_step_end(state, step, result) do {} while (0)
+#define trace_jool_drop(state, stat, result) do {} while (0)
+#define trace_jool_bib_add(iname, src6, src4, proto) do {} while (0)
+#define trace_jool_bib_rm(iname, src6, src4, proto) do {} while (0)
+#define trace_jool_session_add(iname, src6, dst6, src4, dst4, proto) \
+	do {} while (0)
+#define trace_jool_session_rm(iname, src6, dst6, src4, dst4, proto) \
+	do {} while (0)
+
+#endif /* SRC_MOD_COMMON_TRACEPOINTS_H_ */
+
+#else /* UNIT_TESTING */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM jool
+
+#if !defined(SRC_MOD_COMMON_TRACEPOINTS_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define SRC_MOD_COMMON_TRACEPOINTS_H_
+
+#include <linux/tracepoint.h>
+#include "mod/common/translation_state.h"
+
+#define show_jool_step(step) __print_symbolic(step,			\
+		{ JOOL_STEP_DETERMINE_IN_TUPLE, "determine_in_tuple" },	\
+		{ JOOL_STEP_FILTERING, "filtering_and_updating" },	\
+		{ JOOL_STEP_COMPUTE_OUT_TUPLE, "compute_out_tuple" },	\
+		{ JOOL_STEP_TRANSLATE, "translating_the_packet" },	\
+		{ JOOL_STEP_HAIRPIN, "handling_hairpinning" },		\
+		{ JOOL_STEP_SEND, "sendpkt_send" })
+
+TRACE_DEFINE_ENUM(VERDICT_STOLEN);
+TRACE_DEFINE_ENUM(VERDICT_UNTRANSLATABLE);
+TRACE_DEFINE_ENUM(VERDICT_DROP);
+TRACE_DEFINE_ENUM(VERDICT_CONTINUE);
+
+#define show_jool_verdict(result) __print_symbolic(result,		\
+		{ VERDICT_STOLEN, "STOLEN" },				\
+		{ VERDICT_UNTRANSLATABLE, "UNTRANSLATABLE" },		\
+		{ VERDICT_DROP, "DROP" },				\
+		{ VERDICT_CONTINUE, "CONTINUE" })
+
+TRACE_DEFINE_ENUM(L4PROTO_TCP);
+TRACE_DEFINE_ENUM(L4PROTO_UDP);
+TRACE_DEFINE_ENUM(L4PROTO_ICMP);
+TRACE_DEFINE_ENUM(L4PROTO_OTHER);
+
+#define show_l4proto(proto) __print_symbolic(proto,			\
+		{ L4PROTO_TCP, "TCP" },					\
+		{ L4PROTO_UDP, "UDP" },					\
+		{ L4PROTO_ICMP, "ICMP" },				\
+		{ L4PROTO_OTHER, "unknown" })
+
+TRACE_EVENT(jool_xlat_start,
+	TP_PROTO(struct xlation const *state, struct sk_buff const *skb),
+	TP_ARGS(state, skb),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__field(const void *, skbaddr)
+		__field(__u16, protocol)
+		__field(unsigned int, len)
+		__field(__u32, mark)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, state->jool.iname, INAME_MAX_SIZE);
+		__entry->skbaddr = skb;
+		__entry->protocol = ntohs(skb->protocol);
+		__entry->len = skb->len;
+		__entry->mark = skb->mark;
+	),
+
+	TP_printk("instance=%s skbaddr=%p protocol=0x%04x len=%u mark=%u",
+		__entry->iname, __entry->skbaddr, __entry->protocol,
+		__entry->len, __entry->mark)
+);
+
+TRACE_EVENT(jool_xlat_end,
+	TP_PROTO(struct xlation const *state, verdict result),
+	TP_ARGS(state, result),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__field(const void *, skbaddr)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, state->jool.iname, INAME_MAX_SIZE);
+		__entry->skbaddr = state->in.skb;
+		__entry->result = result;
+	),
+
+	TP_printk("instance=%s skbaddr=%p result=%s",
+		__entry->iname, __entry->skbaddr,
+		show_jool_verdict(__entry->result))
+);
+
+TRACE_EVENT(jool_step_begin,
+	TP_PROTO(struct xlation const *state, int step),
+	TP_ARGS(state, step),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(int, step)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = state->in.skb;
+		__entry->step = step;
+	),
+
+	TP_printk("skbaddr=%p step=%s",
+		__entry->skbaddr, show_jool_step(__entry->step))
+);
+
+TRACE_EVENT(jool_step_end,
+	TP_PROTO(struct xlation const *state, int step, verdict result),
+	TP_ARGS(state, step, result),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(int, step)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = state->in.skb;
+		__entry->step = step;
+		__entry->result = result;
+	),
+
+	TP_printk("skbaddr=%p step=%s result=%s",
+		__entry->skbaddr, show_jool_step(__entry->step),
+		show_jool_verdict(__entry->result))
+);
+
+/* The stat is the drop reason. (See `jool stats display --explain`.) */
+TRACE_EVENT(jool_drop,
+	TP_PROTO(struct xlation const *state, enum jool_stat_id stat,
+		verdict result),
+	TP_ARGS(state, stat, result),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__field(const void *, skbaddr)
+		__field(int, stat)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, state->jool.iname, INAME_MAX_SIZE);
+		__entry->skbaddr = state->in.skb;
+		__entry->stat = stat;
+		__entry->result = result;
+	),
+
+	TP_printk("instance=%s skbaddr=%p stat=%d result=%s",
+		__entry->iname, __entry->skbaddr, __entry->stat,
+		show_jool_verdict(__entry->result))
+);
+
+DECLARE_EVENT_CLASS(jool_bib_class,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, src4, proto),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__array(__u8, src6, sizeof(struct in6_addr))
+		__field(__u16, src6_port)
+		__field(__be32, src4)
+		__field(__u16, src4_port)
+		__field(int, proto)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, iname, INAME_MAX_SIZE);
+		memcpy(__entry->src6, &src6->l3, sizeof(struct in6_addr));
+		__entry->src6_port = src6->l4;
+		__entry->src4 = src4->l3.s_addr;
+		__entry->src4_port = src4->l4;
+		__entry->proto = proto;
+	),
+
+	TP_printk("instance=%s %pI6c#%u - %pI4#%u (%s)",
+		__entry->iname,
+		__entry->src6, __entry->src6_port,
+		&__entry->src4, __entry->src4_port,
+		show_l4proto(__entry->proto))
+);
+
+DEFINE_EVENT(jool_bib_class, jool_bib_add,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, src4, proto)
+);
+
+DEFINE_EVENT(jool_bib_class, jool_bib_rm,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, src4, proto)
+);
+
+DECLARE_EVENT_CLASS(jool_session_class,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv6_transport_addr const *dst6,
+		struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, dst6, src4, dst4, proto),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__array(__u8, src6, sizeof(struct in6_addr))
+		__field(__u16, src6_port)
+		__array(__u8, dst6, sizeof(struct in6_addr))
+		__field(__u16, dst6_port)
+		__field(__be32, src4)
+		__field(__u16, src4_port)
+		__field(__be32, dst4)
+		__field(__u16, dst4_port)
+		__field(int, proto)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, iname, INAME_MAX_SIZE);
+		memcpy(__entry->src6, &src6->l3, sizeof(struct in6_addr));
+		__entry->src6_port = src6->l4;
+		memcpy(__entry->dst6, &dst6->l3, sizeof(struct in6_addr));
+		__entry->dst6_port = dst6->l4;
+		__entry->src4 = src4->l3.s_addr;
+		__entry->src4_port = src4->l4;
+		__entry->dst4 = dst4->l3.s_addr;
+		__entry->dst4_port = dst4->l4;
+		__entry->proto = proto;
+	),
+
+	TP_printk("instance=%s %pI6c#%u|%pI6c#%u|%pI4#%u|%pI4#%u|%s",
+		__entry->iname,
+		__entry->src6, __entry->src6_port,
+		__entry->dst6, __entry->dst6_port,
+		&__entry->src4, __entry->src4_port,
+		&__entry->dst4, __entry->dst4_port,
+		show_l4proto(__entry->proto))
+);
+
+DEFINE_EVENT(jool_session_class, jool_session_add,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv6_transport_addr const *dst6,
+		struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, dst6, src4, dst4, proto)
+);
+
+DEFINE_EVENT(jool_session_class, jool_session_rm,
+	TP_PROTO(char const *iname,
+		struct ipv6_transport_addr const *src6,
+		struct ipv6_transport_addr const *dst6,
+		struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4,
+		l4_protocol proto),
+	TP_ARGS(iname, src6, dst6, src4, dst4, proto)
+);
+
+#endif /* SRC_MOD_COMMON_TRACEPOINTS_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH mod/common
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tracepoints
+#include <trace/define_trace.h>
+
+#endif /* UNIT_TESTING */
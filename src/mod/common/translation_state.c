@@ -1,5 +1,7 @@
 #include "mod/common/translation_state.h"
 
+#include "mod/common/route.h"
+#include "mod/common/tracepoints.h"
 #include "mod/common/wkmalloc.h"
 
 static struct kmem_cache *xlation_cache;
@@ -37,14 +39,14 @@ void xlation_init(struct xlation *state, struct xlator *jool)
 
 void xlation_destroy(struct xlation *state)
 {
-	if (state->dst)
-		dst_release(state->dst);
+	route_put(state->dst, state->dst_noref);
 	wkmem_cache_free("xlation", xlation_cache, state);
 }
 
 verdict untranslatable(struct xlation *state, enum jool_stat_id stat)
 {
 	jstat_inc(state->jool.stats, stat);
+	trace_jool_drop(state, stat, VERDICT_UNTRANSLATABLE);
 	return VERDICT_UNTRANSLATABLE;
 }
 
@@ -54,12 +56,14 @@ verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 	jstat_inc(state->jool.stats, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
+	trace_jool_drop(state, stat, VERDICT_UNTRANSLATABLE);
 	return VERDICT_UNTRANSLATABLE;
 }
 
 verdict drop(struct xlation *state, enum jool_stat_id stat)
 {
 	jstat_inc(state->jool.stats, stat);
+	trace_jool_drop(state, stat, VERDICT_DROP);
 	return VERDICT_DROP;
 }
 
@@ -69,6 +73,7 @@ verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 	jstat_inc(state->jool.stats, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
+	trace_jool_drop(state, stat, VERDICT_DROP);
 	return VERDICT_DROP;
 }
 
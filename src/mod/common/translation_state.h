@@ -6,6 +6,8 @@
 #include "mod/common/xlator.h"
 #include "mod/common/db/bib/entry.h"
 
+struct sendpkt_batch; /* See send_packet.h. */
+
 /*
  * Fields that need to be translated prematurely because the routing functions
  * need them as input.
@@ -56,6 +58,8 @@ struct xlation {
 	bool flowx_set;
 	union flowix flowx;
 	struct dst_entry *dst;
+	/* Was @dst borrowed from the route cache? (See route4().) */
+	bool dst_noref;
 
 	/**
 	 * Convenient accesor to the BIB and session entries that correspond
@@ -70,6 +74,19 @@ struct xlation {
 	 */
 	bool is_hairpin;
 
+	/*
+	 * Print debug messages while translating this packet?
+	 * (See debug_filter.h.)
+	 */
+	bool debug;
+
+	/*
+	 * If not NULL, sendpkt_send() queues the translated packets here
+	 * instead of sending them right away. Whoever set this is responsible
+	 * for sendpkt_flush()ing it.
+	 */
+	struct sendpkt_batch *batch;
+
 	struct xlation_result result;
 };
 
@@ -91,5 +108,10 @@ verdict stolen(struct xlation *state, enum jool_stat_id stat);
 
 #define xlation_is_siit(state) xlator_is_siit(&(state)->jool)
 #define xlation_is_nat64(state) xlator_is_nat64(&(state)->jool)
+/*
+ * Was the packet translated by rewriting its headers? (See xlat-in-place.)
+ * If so, the original packet no longer exists.
+ */
+#define xlation_in_place(state) ((state)->out.skb == (state)->in.skb)
 
 #endif /* SRC_MOD_COMMON_TRANSLATION_STATE_H_ */
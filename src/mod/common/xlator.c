@@ -12,10 +12,14 @@
 #include "mod/common/log.h"
 #include "mod/common/rcu.h"
 #include "mod/common/compat_32_64.h"
+#include "mod/common/debug_filter.h"
+#include "mod/common/histogram.h"
+#include "mod/common/lock_stats.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/denylist4.h"
 #include "mod/common/db/eam.h"
 #include "mod/common/db/pool4/db.h"
+#include "mod/common/db/fragcache.h"
 #include "mod/common/db/bib/db.h"
 #include "mod/common/steps/handling_hairpinning_nat64.h"
 #include "mod/common/steps/handling_hairpinning_siit.h"
@@ -130,6 +134,8 @@ static void destroy_jool_instance(struct jool_instance *instance, bool unhook)
 static void xlator_get(struct xlator *jool)
 {
 	jstat_get(jool->stats);
+	dbgl_get(jool->debug_limit);
+	jhist_get(jool->hist);
 
 	switch (xlator_get_type(jool)) {
 	case XT_SIIT:
@@ -140,6 +146,7 @@ static void xlator_get(struct xlator *jool)
 		pool4db_get(jool->nat64.pool4);
 		bib_get(jool->nat64.bib);
 		joold_get(jool->nat64.joold);
+		fragcache_get(jool->nat64.fragcache);
 		break;
 	}
 }
@@ -178,8 +185,12 @@ static void __flush_delete(struct hlist_head *detached)
 
 	synchronize_rcu_bh();
 
-	hlist_for_each_entry_safe(instance, tmp, detached, table_hook)
+	hlist_for_each_entry_safe(instance, tmp, detached, table_hook) {
+		jool_debug_put(&instance->jool);
+		jhist_key_put(&instance->jool);
+		jlock_key_put(&instance->jool);
 		destroy_jool_instance(instance, true);
+	}
 }
 
 /**
@@ -197,6 +208,7 @@ void jool_xlator_flush_net(struct net *ns, xlator_type xt)
 	mutex_unlock(&lock);
 
 	__flush_delete(&detached);
+	joold_udp_flush_net(ns);
 }
 EXPORT_SYMBOL_GPL(jool_xlator_flush_net);
 
@@ -219,6 +231,8 @@ void jool_xlator_flush_batch(struct list_head *net_exit_list, xlator_type xt)
 	mutex_unlock(&lock);
 
 	__flush_delete(&detached);
+	list_for_each_entry(ns, net_exit_list, exit_list)
+		joold_udp_flush_net(ns);
 }
 EXPORT_SYMBOL_GPL(jool_xlator_flush_batch);
 
@@ -268,6 +282,12 @@ static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
 	jool->stats = jstat_alloc();
 	if (!jool->stats)
 		goto stats_fail;
+	jool->debug_limit = dbgl_alloc();
+	if (!jool->debug_limit)
+		goto debug_limit_fail;
+	jool->hist = jhist_alloc();
+	if (!jool->hist)
+		goto hist_fail;
 	jool->siit.eamt = eamt_alloc();
 	if (!jool->siit.eamt)
 		goto eamt_fail;
@@ -282,6 +302,10 @@ static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
 denylist4_fail:
 	eamt_put(jool->siit.eamt);
 eamt_fail:
+	jhist_put(jool->hist);
+hist_fail:
+	dbgl_put(jool->debug_limit);
+debug_limit_fail:
 	jstat_put(jool->stats);
 stats_fail:
 	return -ENOMEM;
@@ -298,6 +322,12 @@ static int init_nat64(struct xlator *jool, struct ipv6_prefix *pool6)
 	jool->stats = jstat_alloc();
 	if (!jool->stats)
 		goto stats_fail;
+	jool->debug_limit = dbgl_alloc();
+	if (!jool->debug_limit)
+		goto debug_limit_fail;
+	jool->hist = jhist_alloc();
+	if (!jool->hist)
+		goto hist_fail;
 	jool->nat64.pool4 = pool4db_alloc();
 	if (!jool->nat64.pool4)
 		goto pool4_fail;
@@ -307,16 +337,25 @@ static int init_nat64(struct xlator *jool, struct ipv6_prefix *pool6)
 	jool->nat64.joold = joold_alloc();
 	if (!jool->nat64.joold)
 		goto joold_fail;
+	jool->nat64.fragcache = fragcache_alloc();
+	if (!jool->nat64.fragcache)
+		goto fragcache_fail;
 
 	jool->is_hairpin = is_hairpin_nat64;
 	jool->handling_hairpinning = handling_hairpinning_nat64;
 	return 0;
 
+fragcache_fail:
+	joold_put(jool->nat64.joold);
 joold_fail:
 	bib_put(jool->nat64.bib);
 bib_fail:
 	pool4db_put(jool->nat64.pool4);
 pool4_fail:
+	jhist_put(jool->hist);
+hist_fail:
+	dbgl_put(jool->debug_limit);
+debug_limit_fail:
 	jstat_put(jool->stats);
 stats_fail:
 	return -ENOMEM;
@@ -459,7 +498,12 @@ static int __xlator_add(struct jool_instance *new, struct xlator *result)
 		list_add_tail_rcu(&new->list_hook, list);
 	}
 
-	if (new->jool.flags & XT_NAT64)
+	jool_debug_get(&new->jool);
+	jhist_key_get(&new->jool);
+	jlock_key_get(&new->jool);
+
+	/* NULL means the user asked for the fragment cache instead. */
+	if ((new->jool.flags & XT_NAT64) && defrag_enable)
 		defrag_enable(new->jool.ns);
 
 	if (result) {
@@ -569,6 +613,9 @@ static int __xlator_rm(struct net *ns, char *iname, xlator_type xt)
 	 * because the instance is no longer listed.
 	 * So finally return everything.
 	 */
+	jool_debug_put(&instance->jool);
+	jhist_key_put(&instance->jool);
+	jlock_key_put(&instance->jool);
 	destroy_jool_instance(instance, true);
 	return 0;
 }
@@ -695,14 +742,16 @@ int xlator_replace(struct xlator *jool)
 	new->nf_ops = old->nf_ops;
 
 	/*
-	 * The old BIB and joold must survive,
+	 * The old BIB, joold and fragment cache must survive,
 	 * because they shouldn't be reset by atomic configuration.
 	 */
 	if (xlator_is_nat64(&new->jool)) {
 		bib_put(new->jool.nat64.bib);
 		joold_put(new->jool.nat64.joold);
+		fragcache_put(new->jool.nat64.fragcache);
 		new->jool.nat64.bib = old->jool.nat64.bib;
 		new->jool.nat64.joold = old->jool.nat64.joold;
+		new->jool.nat64.fragcache = old->jool.nat64.fragcache;
 	}
 
 	hash_del(&old->table_hook);
@@ -717,11 +766,18 @@ int xlator_replace(struct xlator *jool)
 
 	synchronize_rcu_bh();
 
+	jool_debug_get(&new->jool);
+	jool_debug_put(&old->jool);
+	jhist_key_get(&new->jool);
+	jhist_key_put(&old->jool);
+	jlock_key_get(&new->jool);
+	jlock_key_put(&old->jool);
 	old->nf_ops = NULL;
 
 	if (xlator_is_nat64(&old->jool)) {
 		old->jool.nat64.bib = NULL;
 		old->jool.nat64.joold = NULL;
+		old->jool.nat64.fragcache = NULL;
 	}
 
 	destroy_jool_instance(old, false);
@@ -865,6 +921,8 @@ int xlator_find_netfilter(struct net *ns, struct xlator *result)
 void xlator_put(struct xlator *jool)
 {
 	jstat_put(jool->stats);
+	dbgl_put(jool->debug_limit);
+	jhist_put(jool->hist);
 
 	switch (xlator_get_type(jool)) {
 	case XT_SIIT:
@@ -882,6 +940,8 @@ void xlator_put(struct xlator *jool)
 			bib_put(jool->nat64.bib);
 		if (jool->nat64.joold)
 			joold_put(jool->nat64.joold);
+		if (jool->nat64.fragcache)
+			fragcache_put(jool->nat64.fragcache);
 		return;
 	}
 
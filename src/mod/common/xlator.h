@@ -32,6 +32,8 @@ struct xlator {
 	xlator_flags flags;
 
 	struct jool_stats *stats;
+	struct debug_limit *debug_limit;
+	struct jool_hist *hist;
 	struct jool_globals globals;
 	union {
 		struct {
@@ -42,6 +44,7 @@ struct xlator {
 			struct pool4 *pool4;
 			struct bib *bib;
 			struct joold_queue *joold;
+			struct fragcache *fragcache;
 		} nat64;
 	};
 
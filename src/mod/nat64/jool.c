@@ -14,6 +14,10 @@ MODULE_AUTHOR("NIC-ITESM");
 MODULE_DESCRIPTION("Stateful NAT64 (RFC 6146)");
 MODULE_VERSION(JOOL_VERSION_STR);
 
+static bool defrag = true;
+module_param(defrag, bool, 0444);
+MODULE_PARM_DESC(defrag, "Reassemble fragmented packets (through nf_defrag_ipv4 and nf_defrag_ipv6) before translating them. If disabled, fragments are translated individually.");
+
 static char const *banner = "\n"
 	"                                   ,----,                       \n"
 	"         ,--.                    ,/   .`|                 ,--,  \n"
@@ -103,7 +107,7 @@ static int __init nat64_init(void)
 #endif
 
 	/* NAT64 instances can now function properly; unlock them. */
-	error = jool_nat64_get(defrag_enable);
+	error = jool_nat64_get(defrag ? defrag_enable : NULL);
 	if (error) {
 #ifndef XTABLES_DISABLED
 		if (!iptables_error)
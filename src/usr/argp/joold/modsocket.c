@@ -3,30 +3,141 @@
 #include <errno.h>
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <string.h>
 #include <syslog.h>
 
+#include "common/joold_compact.h"
 #include "common/session.h"
 #include "usr/nl/joold.h"
 #include "usr/argp/joold/netsocket.h"
+#include "usr/argp/joold/ring.h"
 #include "usr/argp/log.h"
 #include "usr/util/str_utils.h"
 #include "usr/joold/log.h"
 
+/* Maximum number of datagrams coalesced into a single request to the kernel */
+#define COALESCE_MAX 16
+/* Datagrams the network can queue for the kernel before modsocket_send() waits */
+#define IN_SLOTS 64
+
 static char const *iname;
 
+/* Receives the kernel's sessions, sends the ACKs. */
 static struct joolnl_socket jsocket;
+/* Sends the network's sessions. (Belongs to the writer thread.) */
+static struct joolnl_socket wsocket;
+
+/* Network sessions, from modsocket_send() to the writer thread. */
+static struct ring in;
 
 atomic_int modsocket_pkts_sent;
 atomic_int modsocket_bytes_sent;
 
-/* Called by the net socket whenever joold receives data from the network. */
+/*
+ * Called by the net socket whenever joold receives data from the network.
+ * Queues @request for the writer thread. Waits if the thread is too far behind.
+ */
 void modsocket_send(void *request, size_t request_len)
+{
+	struct ring_slot *slot;
+
+	if (request_len > in.size) {
+		syslog(LOG_ERR, "Dropping a %zu-byte packet; it's longer than %zu bytes.",
+				request_len, in.size);
+		return;
+	}
+
+	ring_reserve(&in, &slot, 1);
+	memcpy(slot->data, request, request_len);
+	slot->len = request_len;
+	ring_produce(&in, 1, 1);
+}
+
+/*
+ * The kernel only answers failed requests. Since @wsocket is nonblocking, this
+ * reports those answers (if any) without waiting for them.
+ */
+static int request_error_cb(struct nl_msg *msg, void *arg)
 {
 	struct jool_result result;
-	result = joolnl_joold_add(&jsocket, iname, request, request_len);
+
+	result = joolnl_msg2result(msg);
 	pr_result_syslog(&result);
+	return 0;
+}
+
+static void send_request(void *request, size_t request_len)
+{
+	struct jool_result result;
+	int error;
+
+	SYSLOG_DBG("Sending %zu bytes to the kernel...", request_len);
+	result = joolnl_joold_add(&wsocket, iname, request, request_len);
+	pr_result_syslog(&result);
+
+	error = nl_recvmsgs_default(wsocket.sk);
+	if (error < 0 && error != -NLE_AGAIN)
+		syslog(LOG_ERR, "Error receiving the kernel's response: %s",
+				nl_geterror(error));
+}
+
+/*
+ * Can @slot be glued to other datagrams? Only if its attributes span it
+ * exactly. Otherwise, a bogus length could swallow the next datagram's
+ * sessions.
+ */
+static bool is_coalescable(struct ring_slot *slot)
+{
+	struct nlattr *attr;
+	int rem;
+
+	nla_for_each_attr(attr, slot->data, slot->len, rem)
+		;
+	return rem == 0;
+}
+
+/*
+ * Hands the network's sessions to the kernel, coalescing the datagrams that are
+ * already waiting into one request.
+ */
+static void *modsocket_writer(void *arg)
+{
+	static unsigned char request[COALESCE_MAX * JOOLD_MAX_PAYLOAD];
+	struct ring_slot *slots[COALESCE_MAX];
+	unsigned int claimed;
+	unsigned int i;
+	size_t len;
+
+	do {
+		claimed = ring_claim(&in, slots, COALESCE_MAX);
+
+		if (claimed == 1) {
+			send_request(slots[0]->data, slots[0]->len);
+			ring_consume(&in, 1);
+			continue;
+		}
+
+		len = 0;
+		for (i = 0; i < claimed; i++) {
+			if (is_coalescable(slots[i])) {
+				memcpy(request + len, slots[i]->data,
+						slots[i]->len);
+				len += slots[i]->len;
+			} else {
+				/* Let the kernel complain about it alone. */
+				send_request(slots[i]->data, slots[i]->len);
+			}
+		}
+		if (len > 0)
+			send_request(request, len);
+
+		ring_consume(&in, claimed);
+	} while (true);
+
+	return NULL;
 }
 
 #define SERIALIZED_SESSION_SIZE (		\
@@ -97,34 +208,113 @@ static int jnla_get_session_joold(struct nlattr *attr,
 	return 0;
 }
 
+static void record2session(struct joold_record const *record,
+		struct session_entry *entry)
+{
+	entry->src6.l3 = record->src6;
+	entry->src6.l4 = record->src6_port;
+	entry->src4.l3 = record->src4;
+	entry->src4.l4 = record->src4_port;
+	entry->dst4.l3 = record->dst4;
+	entry->dst4.l4 = record->dst4_port;
+	entry->proto = record->proto;
+	entry->state = record->state;
+	entry->timer_type = record->timer_type;
+	entry->expiration = record->expiration;
+}
+
+static void print_session(struct session_entry const *session)
+{
+	char buffer[INET6_ADDRSTRLEN];
+
+	printf("%s,", l4proto_to_string(session->proto));
+	inet_ntop(AF_INET6, &session->src6.l3, buffer, sizeof(buffer));
+	printf("%s,%u,", buffer, session->src6.l4);
+	inet_ntop(AF_INET, &session->src4.l3, buffer, sizeof(buffer));
+	printf("%s,%u,", buffer, session->src4.l4);
+	inet_ntop(AF_INET, &session->dst4.l3, buffer, sizeof(buffer));
+	printf("%s,%u,", buffer, session->dst4.l4);
+	timeout2str(session->expiration, buffer);
+	printf("%s\n", buffer);
+}
+
+/* Prints the sessions of a compact batch. (See common/joold_compact.h.) */
+static int print_batch(struct nlattr *attr)
+{
+	struct joold_compact_hdr const *hdr;
+	struct joold_record records[2];
+	struct session_entry session;
+	__u8 const *src;
+	unsigned int count, c;
+	int len, consumed;
+
+	if (nla_len(attr) < sizeof(*hdr)) {
+		syslog(LOG_ERR, "Invalid request: Batch is too short to contain a header.");
+		return -EINVAL;
+	}
+
+	hdr = nla_data(attr);
+	if (hdr->version != JOOLD_COMPACT_VERSION) {
+		syslog(LOG_ERR, "Unknown compact format version: %u", hdr->version);
+		return -EINVAL;
+	}
+	if (hdr->flags & JOOLD_COMPACT_LZ4) {
+		/* The kernel can decompress them; we don't bother. */
+		printf("(%u LZ4-compressed sessions)\n", ntohs(hdr->count));
+		return 0;
+	}
+
+	count = ntohs(hdr->count);
+	len = ntohs(hdr->len);
+	if (len > nla_len(attr) - sizeof(*hdr)) {
+		syslog(LOG_ERR, "Invalid request: Batch is truncated.");
+		return -EINVAL;
+	}
+	src = (__u8 const *)(hdr + 1);
+
+	memset(&session, 0, sizeof(session));
+	for (c = 0; c < count; c++) {
+		consumed = joold_record_read(src, len,
+				c ? &records[!(c & 1)] : NULL,
+				&records[c & 1]);
+		if (consumed < 0) {
+			syslog(LOG_ERR, "Invalid request: Malformed session record.");
+			return consumed;
+		}
+		src += consumed;
+		len -= consumed;
+
+		record2session(&records[c & 1], &session);
+		print_session(&session);
+	}
+
+	return 0;
+}
+
 static void print_sessions(struct nlattr *root)
 {
 	struct nlattr *attr;
 	int rem;
 	struct session_entry session;
-	char buffer[INET6_ADDRSTRLEN];
 
 	nla_for_each_nested(attr, root, rem) {
+		if (nla_type(attr) == JNLAJ_BATCH) {
+			if (print_batch(attr) != 0)
+				return;
+			continue;
+		}
+
 		if (jnla_get_session_joold(attr, &session) != 0)
 			return;
-
-		printf("%s,", l4proto_to_string(session.proto));
-		inet_ntop(AF_INET6, &session.src6.l3, buffer, sizeof(buffer));
-		printf("%s,%u,", buffer, session.src6.l4);
-		inet_ntop(AF_INET, &session.src4.l3, buffer, sizeof(buffer));
-		printf("%s,%u,", buffer, session.src4.l4);
-		inet_ntop(AF_INET, &session.dst4.l3, buffer, sizeof(buffer));
-		printf("%s,%u,", buffer, session.dst4.l4);
-		timeout2str(session.expiration, buffer);
-		printf("%s\n", buffer);
+		print_session(&session);
 	}
 }
 
-static void do_ack(void)
+static void do_ack(__u32 const *seq)
 {
 	struct jool_result result;
 
-	result = joolnl_joold_ack(&jsocket, iname);
+	result = joolnl_joold_ack(&jsocket, iname, seq);
 	if (result.error)
 		pr_result_syslog(&result);
 }
@@ -140,9 +330,13 @@ static int updated_entries_cb(struct nl_msg *msg, void *arg)
 	struct genlmsghdr *ghdr;
 	struct joolnlhdr *jhdr;
 	struct nlattr *root;
+	struct nlattr *seq_attr;
+	__u32 seq;
+	__u32 *seqp;
 	struct jool_result result;
 
 	SYSLOG_DBG("Received a packet from kernelspace.");
+	seqp = NULL;
 
 	nhdr = nlmsg_hdr(msg);
 	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
@@ -169,6 +363,14 @@ static int updated_entries_cb(struct nl_msg *msg, void *arg)
 		goto fail;
 	}
 
+	seq_attr = nla_find(genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr)),
+			genlmsg_attrlen(ghdr, sizeof(struct joolnlhdr)),
+			JNLAR_JOOLD_SEQ);
+	if (seq_attr) {
+		seq = nla_get_u32(seq_attr);
+		seqp = &seq;
+	}
+
 	root = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
 	if (nla_type(root) != JNLAR_SESSION_ENTRIES) {
 		syslog(LOG_ERR, "Kernel sent invalid data: Message lacks a session container");
@@ -188,13 +390,13 @@ static int updated_entries_cb(struct nl_msg *msg, void *arg)
 		print_sessions(root);
 	}
 
-	do_ack();
+	do_ack(seqp);
 	return 0;
 
 einval:
 	result.error = -EINVAL;
 fail:
-	do_ack(); /* Tell kernel to flush the packet queue anyway. */
+	do_ack(seqp); /* Tell kernel to flush the packet queue anyway. */
 	return (result.error < 0) ? result.error : -result.error;
 }
 
@@ -240,6 +442,45 @@ fail:
 	return result.error;
 }
 
+/*
+ * Starts the thread that sends the network's sessions to the kernel.
+ * Only needed if the netsocket is enabled; call it before netsocket_start().
+ */
+int modsocket_start(void)
+{
+	pthread_t writer_thread;
+	struct jool_result result;
+	int error;
+
+	error = ring_init(&in, IN_SLOTS, JOOLD_MAX_PAYLOAD);
+	if (error)
+		return error;
+
+	result = joolnl_setup(&wsocket, XT_NAT64);
+	if (result.error)
+		return pr_result_syslog(&result);
+
+	error = nl_socket_modify_cb(wsocket.sk, NL_CB_VALID, NL_CB_CUSTOM,
+			request_error_cb, NULL);
+	if (!error)
+		error = nl_socket_set_nonblocking(wsocket.sk);
+	if (error) {
+		syslog(LOG_ERR, "Couldn't configure the writer socket: %s",
+				nl_geterror(error));
+		joolnl_teardown(&wsocket);
+		return error;
+	}
+
+	error = pthread_create(&writer_thread, NULL, modsocket_writer, NULL);
+	if (error) {
+		pr_perror("Unable to start modsocket writer thread", error);
+		joolnl_teardown(&wsocket);
+		return error;
+	}
+
+	return 0;
+}
+
 void *modsocket_listen(void *arg)
 {
 	int error;
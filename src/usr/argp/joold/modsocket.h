@@ -6,6 +6,7 @@
 #include <stddef.h>
 
 int modsocket_setup(char const *iname);
+int modsocket_start(void);
 
 void *modsocket_listen(void *arg);
 void modsocket_send(void *buffer, size_t size);
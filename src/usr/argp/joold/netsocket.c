@@ -1,9 +1,12 @@
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
+
 #include "usr/argp/joold/netsocket.h"
 
 #include <errno.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <string.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -12,11 +15,22 @@
 
 #include "modsocket.h"
 #include "common/config.h"
+#include "usr/argp/joold/ring.h"
 #include "usr/argp/log.h"
 #include "usr/joold/json.h"
 #include "usr/joold/log.h"
 #include "usr/util/str_utils.h"
 
+/* Datagrams moved per recvmmsg() and sendmmsg() */
+#define MMSG_BATCH 16
+/* Datagrams the kernel can queue for the network before netsocket_send() waits */
+#define OUT_SLOTS 64
+/*
+ * Largest payload the kernel sends. (It allocates its Netlink messages with
+ * NLMSG_GOODSIZE, which is at most 8 KiB.)
+ */
+#define OUT_SLOT_SIZE 8192
+
 static struct netsocket_cfg netcfg;
 
 static int sk;
@@ -25,6 +39,9 @@ static struct addrinfo *addr_candidates;
 /** Candidate from @addr_candidates that we managed to bind the socket with. */
 static struct addrinfo *bound_address;
 
+/* Kernel sessions, from netsocket_send() to the sender thread. */
+static struct ring out;
+
 atomic_int netsocket_pkts_rcvd;
 atomic_int netsocket_bytes_rcvd;
 atomic_int netsocket_pkts_sent;
@@ -299,26 +316,97 @@ static int adjust_mcast_opts(void)
 	return 1;
 }
 
+/* Receives datagrams from the network, hands them to the modsocket. */
 static void *netsocket_listen(void *arg)
 {
-	char buffer[JOOLD_MAX_PAYLOAD];
-	int bytes;
+	static char buffers[MMSG_BATCH][JOOLD_MAX_PAYLOAD];
+	struct mmsghdr msgs[MMSG_BATCH];
+	struct iovec iovs[MMSG_BATCH];
+	int rcvd;
+	int i;
 
 	syslog(LOG_INFO, "Listening...");
 
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MMSG_BATCH; i++) {
+		iovs[i].iov_base = buffers[i];
+		iovs[i].iov_len = sizeof(buffers[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
 	do {
-		bytes = recv(sk, buffer, sizeof(buffer), 0);
-		if (bytes < 0) {
-			pr_perror("Error receiving packet from the network",
+		/* Wait for one, then take whatever else is already there. */
+		rcvd = recvmmsg(sk, msgs, MMSG_BATCH, MSG_WAITFORONE, NULL);
+		if (rcvd < 0) {
+			pr_perror("Error receiving packets from the network",
 					errno);
 			continue;
 		}
 
-		netsocket_pkts_rcvd++;
-		netsocket_bytes_rcvd += bytes;
+		for (i = 0; i < rcvd; i++) {
+			netsocket_pkts_rcvd++;
+			netsocket_bytes_rcvd += msgs[i].msg_len;
+
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				syslog(LOG_ERR, "Dropping a datagram; it's longer than %d bytes.",
+						JOOLD_MAX_PAYLOAD);
+				continue;
+			}
+
+			SYSLOG_DBG("Received %u bytes from the network.",
+					msgs[i].msg_len);
+			modsocket_send(buffers[i], msgs[i].msg_len);
+		}
+	} while (true);
+
+	return NULL;
+}
+
+/* Sends the kernel's sessions to the network. */
+static void *netsocket_sender(void *arg)
+{
+	struct ring_slot *slots[MMSG_BATCH];
+	struct mmsghdr msgs[MMSG_BATCH];
+	struct iovec iovs[MMSG_BATCH];
+	unsigned int claimed;
+	unsigned int i;
+	int sent;
+	int s;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MMSG_BATCH; i++) {
+		msgs[i].msg_hdr.msg_name = bound_address->ai_addr;
+		msgs[i].msg_hdr.msg_namelen = bound_address->ai_addrlen;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		claimed = ring_claim(&out, slots, MMSG_BATCH);
+		for (i = 0; i < claimed; i++) {
+			iovs[i].iov_base = slots[i]->data;
+			iovs[i].iov_len = slots[i]->len;
+		}
+
+		SYSLOG_DBG("Sending %u packets to the network...", claimed);
+		for (i = 0; i < claimed; i += sent) {
+			sent = sendmmsg(sk, &msgs[i], claimed - i, 0);
+			if (sent < 0) {
+				/* It's the first one that failed; skip it. */
+				pr_perror("Could not send a packet to the network",
+						errno);
+				sent = 1;
+				continue;
+			}
+
+			for (s = 0; s < sent; s++) {
+				netsocket_pkts_sent++;
+				netsocket_bytes_sent += msgs[i + s].msg_len;
+			}
+		}
 
-		SYSLOG_DBG("Received %d bytes from the network.", bytes);
-		modsocket_send(buffer, bytes);
+		ring_consume(&out, claimed);
 	} while (true);
 
 	return NULL;
@@ -349,11 +437,20 @@ int netsocket_start(struct netsocket_cfg *cfg)
 	if (error)
 		return error;
 
+	error = ring_init(&out, OUT_SLOTS, OUT_SLOT_SIZE);
+	if (error)
+		return error;
+
 	error = pthread_create(&net_thread, NULL, netsocket_listen, NULL);
 	if (error) {
 		pr_perror("Unable to start netsocket thread", error);
 		return error;
 	}
+	error = pthread_create(&net_thread, NULL, netsocket_sender, NULL);
+	if (error) {
+		pr_perror("Unable to start netsocket sender thread", error);
+		return error;
+	}
 
 	syslog(LOG_INFO, "Netsocket ready.");
 	return 0;
@@ -364,19 +461,22 @@ bool netsocket_enabled(void)
 	return netcfg.enabled;
 }
 
+/*
+ * Queues @buffer for the sender thread. Waits if the thread is too far behind.
+ * (Only the modsocket's listener thread is allowed to call this.)
+ */
 void netsocket_send(void *buffer, size_t size)
 {
-	int bytes;
-
-	SYSLOG_DBG("Sending %zu bytes to the network...", size);
-	bytes = sendto(sk, buffer, size, 0,
-			bound_address->ai_addr,
-			bound_address->ai_addrlen);
-	if (bytes < 0)
-		pr_perror("Could not send a packet to the network", errno);
-	else {
-		SYSLOG_DBG("Sent %d bytes to the network.\n", bytes);
-		netsocket_pkts_sent++;
-		netsocket_bytes_sent += bytes;
+	struct ring_slot *slot;
+
+	if (size > out.size) {
+		syslog(LOG_ERR, "Dropping a %zu-byte packet; it's longer than %zu bytes.",
+				size, out.size);
+		return;
 	}
+
+	ring_reserve(&out, &slot, 1);
+	memcpy(slot->data, buffer, size);
+	slot->len = size;
+	ring_produce(&out, 1, 1);
 }
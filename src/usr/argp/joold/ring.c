@@ -0,0 +1,113 @@
+#include "usr/argp/joold/ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "usr/argp/log.h"
+
+int ring_init(struct ring *ring, unsigned int count, size_t size)
+{
+	unsigned char *data;
+	unsigned int i;
+
+	ring->slots = calloc(count, sizeof(*ring->slots));
+	if (!ring->slots)
+		goto enomem;
+	data = malloc(count * size);
+	if (!data) {
+		free(ring->slots);
+		goto enomem;
+	}
+
+	for (i = 0; i < count; i++) {
+		ring->slots[i].data = data + i * size;
+		ring->slots[i].len = 0;
+	}
+	ring->count = count;
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = 0;
+
+	/* (Can't fail; the values are constant, and pshared is zero.) */
+	sem_init(&ring->used, 0, 0);
+	sem_init(&ring->unused, 0, count);
+	return 0;
+
+enomem:
+	syslog(LOG_ERR, "Out of memory.");
+	return ENOMEM;
+}
+
+/*
+ * Waits until @sem is positive, then decrements it up to @max times (without
+ * waiting anymore). Returns the number of decrements.
+ */
+static unsigned int take(sem_t *sem, unsigned int max)
+{
+	unsigned int n;
+
+	while (sem_wait(sem) != 0) {
+		if (errno != EINTR)
+			pr_perror("sem_wait() failed", errno);
+	}
+
+	for (n = 1; n < max && sem_trywait(sem) == 0; n++)
+		;
+	return n;
+}
+
+static void give(sem_t *sem, unsigned int n)
+{
+	for (; n > 0; n--)
+		sem_post(sem);
+}
+
+static unsigned int get_slots(struct ring *ring, unsigned int first,
+		struct ring_slot **slots, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		slots[i] = &ring->slots[(first + i) % ring->count];
+	return n;
+}
+
+/*
+ * Producer: Waits until there's at least one free slot, then returns up to
+ * @max of them (in @slots). Don't touch the rest.
+ */
+unsigned int ring_reserve(struct ring *ring, struct ring_slot **slots,
+		unsigned int max)
+{
+	return get_slots(ring, ring->tail, slots, take(&ring->unused, max));
+}
+
+/*
+ * Producer: Hands the first @produced of the @reserved slots to the consumer.
+ * The rest go back to the pool.
+ */
+void ring_produce(struct ring *ring, unsigned int reserved,
+		unsigned int produced)
+{
+	ring->tail = (ring->tail + produced) % ring->count;
+	give(&ring->used, produced);
+	give(&ring->unused, reserved - produced);
+}
+
+/*
+ * Consumer: Waits until at least one slot has been produced, then returns up to
+ * @max of them (in @slots), oldest first.
+ */
+unsigned int ring_claim(struct ring *ring, struct ring_slot **slots,
+		unsigned int max)
+{
+	return get_slots(ring, ring->head, slots, take(&ring->used, max));
+}
+
+/* Consumer: Returns the @claimed slots to the producer. */
+void ring_consume(struct ring *ring, unsigned int claimed)
+{
+	ring->head = (ring->head + claimed) % ring->count;
+	give(&ring->unused, claimed);
+}
@@ -0,0 +1,52 @@
+#ifndef SRC_USR_ARGP_JOOLD_RING_H_
+#define SRC_USR_ARGP_JOOLD_RING_H_
+
+/*
+ * Queue of datagrams, used to hand them over from one joold thread to another.
+ *
+ * Each ring has exactly one producer thread and one consumer thread. Neither
+ * locks anything; each of them owns one end of the ring, and the semaphores
+ * only count the slots (and put a thread to sleep while there's nothing for it
+ * to do).
+ *
+ * Both ends work in batches: Reserve (or claim) up to a bunch of slots, then
+ * produce (or consume) them all at once.
+ */
+
+#include <semaphore.h>
+#include <stddef.h>
+
+struct ring_slot {
+	void *data;
+	size_t len;
+};
+
+struct ring {
+	struct ring_slot *slots;
+	unsigned int count;
+	/* Capacity of each slot's @data */
+	size_t size;
+
+	/* Next slot the consumer will claim. Only touched by the consumer. */
+	unsigned int head;
+	/* Next slot the producer will reserve. Only touched by the producer. */
+	unsigned int tail;
+
+	/* Produced slots the consumer hasn't claimed yet */
+	sem_t used;
+	/* Slots the producer can reserve */
+	sem_t unused;
+};
+
+int ring_init(struct ring *ring, unsigned int count, size_t size);
+
+unsigned int ring_reserve(struct ring *ring, struct ring_slot **slots,
+		unsigned int max);
+void ring_produce(struct ring *ring, unsigned int reserved,
+		unsigned int produced);
+
+unsigned int ring_claim(struct ring *ring, struct ring_slot **slots,
+		unsigned int max);
+void ring_consume(struct ring *ring, unsigned int claimed);
+
+#endif /* SRC_USR_ARGP_JOOLD_RING_H_ */
@@ -72,6 +72,16 @@ static struct cmd_option stats_ops[] = {
 			.xt = XT_ANY,
 			.handler = handle_stats_display,
 			.handle_autocomplete = autocomplete_stats_display,
+		}, {
+			.label = "histogram",
+			.xt = XT_ANY,
+			.handler = handle_stats_histogram,
+			.handle_autocomplete = autocomplete_stats_histogram,
+		}, {
+			.label = "locks",
+			.xt = XT_NAT64,
+			.handler = handle_stats_locks,
+			.handle_autocomplete = autocomplete_stats_locks,
 		},
 		{ 0 },
 };
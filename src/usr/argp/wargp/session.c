@@ -1,6 +1,7 @@
 #include "usr/argp/wargp/session.h"
 
 #include <linux/types.h>
+#include <net/if.h>
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
 #include <syslog.h>
@@ -168,6 +169,8 @@ struct proxy_args {
 	__u32 net_ttl;
 	struct wargp_string stats_addr;
 	struct wargp_string stats_port;
+	struct wargp_bool kernel;
+	struct wargp_bool kernel_stop;
 };
 
 static struct wargp_option proxy_opts[] = {
@@ -214,13 +217,96 @@ static struct wargp_option proxy_opts[] = {
 		.doc = "Port to bind the stats socket to",
 		.offset = offsetof(struct proxy_args, stats_port),
 		.type = &wt_string,
+	}, {
+		.name = "kernel",
+		.key = 3012,
+		.doc = "Have the kernel module exchange the sessions by itself, then exit",
+		.offset = offsetof(struct proxy_args, kernel),
+		.type = &wt_bool,
+	}, {
+		.name = "kernel.stop",
+		.key = 3013,
+		.doc = "Give the sessions back to the daemon, then exit",
+		.offset = offsetof(struct proxy_args, kernel_stop),
+		.type = &wt_bool,
 	},
 	{ 0 },
 };
 
+/*
+ * The in-kernel transport only needs a subset of the daemon's configuration.
+ * net.dev.in is an interface name, regardless of the address family.
+ */
+static int build_transport(struct proxy_args *pargs,
+		struct joolnl_joold_transport *transport)
+{
+	char const *addr;
+	struct jool_result result;
+
+	addr = pargs->net_mcast_addr.value;
+	if (!addr) {
+		pr_err("The multicast address is mandatory.");
+		return -EINVAL;
+	}
+
+	memset(transport, 0, sizeof(*transport));
+
+	if (strchr(addr, ':')) {
+		transport->family = AF_INET6;
+		result = str_to_addr6(addr, &transport->addr.v6);
+	} else {
+		transport->family = AF_INET;
+		result = str_to_addr4(addr, &transport->addr.v4);
+	}
+	if (result.error)
+		return pr_result(&result);
+
+	transport->port = 6400;
+	if (pargs->net_mcast_port.value) {
+		result = str_to_u16(pargs->net_mcast_port.value,
+				&transport->port);
+		if (result.error)
+			return pr_result(&result);
+	}
+
+	if (pargs->net_dev_in.value) {
+		transport->ifindex = if_nametoindex(pargs->net_dev_in.value);
+		if (!transport->ifindex) {
+			pr_err("Unknown interface: %s", pargs->net_dev_in.value);
+			return -EINVAL;
+		}
+	}
+
+	if (pargs->net_ttl > 255) {
+		pr_err("net.ttl must be 255 or lower.");
+		return -EINVAL;
+	}
+	transport->ttl = pargs->net_ttl;
+
+	return 0;
+}
+
+/* @transport NULL means "stop." */
+static int set_kernel_transport(char *iname,
+		struct joolnl_joold_transport const *transport)
+{
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_joold_transport(&sk, iname, transport);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
 int handle_session_proxy(char *iname, int argc, char **argv, void const *arg)
 {
 	struct proxy_args pargs = { 0 };
+	struct joolnl_joold_transport transport;
 	struct netsocket_cfg netcfg;
 	struct statsocket_cfg statcfg;
 	int error;
@@ -231,6 +317,15 @@ int handle_session_proxy(char *iname, int argc, char **argv, void const *arg)
 	if (error)
 		return error;
 
+	if (pargs.kernel_stop.value)
+		return set_kernel_transport(iname, NULL);
+	if (pargs.kernel.value) {
+		error = build_transport(&pargs, &transport);
+		if (error)
+			return error;
+		return set_kernel_transport(iname, &transport);
+	}
+
 	netcfg.enabled = true;
 	netcfg.mcast_addr = pargs.net_mcast_addr.value;
 	netcfg.mcast_port = (pargs.net_mcast_port.value != NULL)
@@ -317,6 +412,11 @@ int joold_start(char const *iname, struct netsocket_cfg *netcfg,
 	error = modsocket_setup(iname);
 	if (error)
 		goto end;
+	if (netcfg->enabled) {
+		error = modsocket_start();
+		if (error)
+			goto end;
+	}
 	error = netsocket_start(netcfg);
 	if (error)
 		goto end;
@@ -85,3 +85,247 @@ void autocomplete_stats_display(void const *args)
 {
 	print_wargp_opts(display_opts);
 }
+
+struct histogram_args {
+	struct wargp_bool buckets;
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+};
+
+static struct wargp_option histogram_opts[] = {
+	{
+		.name = "buckets",
+		.key = 'b',
+		.doc = "Also print the nonzero buckets of each histogram",
+		.offset = offsetof(struct histogram_args, buckets),
+		.type = &wt_bool,
+	},
+	WARGP_NO_HEADERS(struct histogram_args, no_headers),
+	WARGP_CSV(struct histogram_args, csv),
+	{ 0 },
+};
+
+/* Upper limit (exclusive) of the @b'th bucket, in nanoseconds. */
+static __u64 bucket_max(unsigned int b)
+{
+	return ((__u64)1) << b;
+}
+
+/*
+ * Returns the index of the bucket that contains the @percentile'th percentile
+ * of @histogram's samples.
+ */
+static unsigned int find_percentile(struct joolnl_histogram const *histogram,
+		__u64 total, unsigned int percentile)
+{
+	__u64 rank, accumulated;
+	unsigned int b;
+
+	/* ceil(total * percentile / 100) */
+	rank = (total * percentile + 99) / 100;
+	accumulated = 0;
+	for (b = 0; b < JHIST_BUCKETS; b++) {
+		accumulated += histogram->buckets[b];
+		if (accumulated >= rank)
+			return b;
+	}
+
+	return JHIST_BUCKETS - 1;
+}
+
+static void print_duration(__u64 ns)
+{
+	if (ns < 1000)
+		printf("%lluns", (unsigned long long)ns);
+	else if (ns < 1000000)
+		printf("%.1fus", ns / 1000.0);
+	else if (ns < 1000000000)
+		printf("%.1fms", ns / 1000000.0);
+	else
+		printf("%.1fs", ns / 1000000000.0);
+}
+
+/* Prints the range of durations counted by the @b'th bucket. */
+static void print_bucket(unsigned int b)
+{
+	if (b == JHIST_BUCKETS - 1) {
+		printf(">=");
+		print_duration(bucket_max(b - 1));
+	} else {
+		printf("<");
+		print_duration(bucket_max(b));
+	}
+}
+
+static char const *direction(struct joolnl_histogram const *histogram)
+{
+	return (histogram->l3_proto == L3PROTO_IPV6) ? "6->4" : "4->6";
+}
+
+static void print_histogram_csv(struct joolnl_histogram const *histogram,
+		__u64 total, struct histogram_args *hargs)
+{
+	unsigned int b;
+
+	printf("%s,%s,%s,%llu,%llu,%llu", histogram->stage_name,
+			direction(histogram),
+			l4proto_to_string(histogram->l4_proto),
+			(unsigned long long)total,
+			(unsigned long long)bucket_max(find_percentile(histogram, total, 50)),
+			(unsigned long long)bucket_max(find_percentile(histogram, total, 99)));
+	if (hargs->buckets.value)
+		for (b = 0; b < JHIST_BUCKETS; b++)
+			printf(",%llu", (unsigned long long)histogram->buckets[b]);
+	printf("\n");
+}
+
+static void print_histogram(struct joolnl_histogram const *histogram,
+		__u64 total, struct histogram_args *hargs)
+{
+	unsigned int b;
+
+	printf("%-10s %-5s %-5s samples: %llu, p50: ",
+			histogram->stage_name, direction(histogram),
+			l4proto_to_string(histogram->l4_proto),
+			(unsigned long long)total);
+	print_bucket(find_percentile(histogram, total, 50));
+	printf(", p99: ");
+	print_bucket(find_percentile(histogram, total, 99));
+	printf("\n");
+
+	if (!hargs->buckets.value)
+		return;
+
+	for (b = 0; b < JHIST_BUCKETS; b++) {
+		if (!histogram->buckets[b])
+			continue;
+		printf("\t");
+		print_bucket(b);
+		printf(": %llu\n", (unsigned long long)histogram->buckets[b]);
+	}
+}
+
+static struct jool_result handle_histogram(
+		struct joolnl_histogram const *histogram, void *args)
+{
+	struct histogram_args *hargs = args;
+	__u64 total;
+	unsigned int b;
+
+	total = 0;
+	for (b = 0; b < JHIST_BUCKETS; b++)
+		total += histogram->buckets[b];
+	if (!total)
+		return result_success();
+
+	if (hargs->csv.value)
+		print_histogram_csv(histogram, total, hargs);
+	else
+		print_histogram(histogram, total, hargs);
+
+	return result_success();
+}
+
+int handle_stats_histogram(char *iname, int argc, char **argv,
+		void const *arg)
+{
+	struct histogram_args hargs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+	unsigned int b;
+
+	result.error = wargp_parse(histogram_opts, argc, argv, &hargs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(hargs.no_headers.value, hargs.csv.value)) {
+		printf("Stage,Direction,Protocol,Samples,p50 (ns),p99 (ns)");
+		if (hargs.buckets.value)
+			for (b = 0; b < JHIST_BUCKETS; b++)
+				printf(",<%llu ns", (unsigned long long)bucket_max(b));
+		printf("\n");
+	}
+
+	result = joolnl_stats_histogram(&sk, iname, handle_histogram, &hargs);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_stats_histogram(void const *args)
+{
+	print_wargp_opts(histogram_opts);
+}
+
+struct locks_args {
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+};
+
+static struct wargp_option locks_opts[] = {
+	WARGP_NO_HEADERS(struct locks_args, no_headers),
+	WARGP_CSV(struct locks_args, csv),
+	{ 0 },
+};
+
+static struct jool_result handle_lock_stats(
+		struct joolnl_lock_stats const *stats, void *args)
+{
+	struct locks_args *largs = args;
+	__u64 avg;
+
+	avg = stats->hold_total / stats->acquisitions;
+
+	if (largs->csv.value) {
+		printf("%s,%s,%llu,%llu,%llu,%llu\n",
+				stats->lock_name, stats->site_name,
+				(unsigned long long)stats->acquisitions,
+				(unsigned long long)stats->contended,
+				(unsigned long long)avg,
+				(unsigned long long)stats->hold_max);
+		return result_success();
+	}
+
+	printf("%-8s %-9s acquisitions: %llu, contended: %llu, avg hold: ",
+			stats->lock_name, stats->site_name,
+			(unsigned long long)stats->acquisitions,
+			(unsigned long long)stats->contended);
+	print_duration(avg);
+	printf(", max hold: ");
+	print_duration(stats->hold_max);
+	printf("\n");
+
+	return result_success();
+}
+
+int handle_stats_locks(char *iname, int argc, char **argv, void const *arg)
+{
+	struct locks_args largs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(locks_opts, argc, argv, &largs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(largs.no_headers.value, largs.csv.value))
+		printf("Lock,Site,Acquisitions,Contended,Avg hold (ns),Max hold (ns)\n");
+
+	result = joolnl_stats_locks(&sk, iname, handle_lock_stats, &largs);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_stats_locks(void const *args)
+{
+	print_wargp_opts(locks_opts);
+}
@@ -33,6 +33,14 @@ struct response_cb {
 struct jool_result joolnl_alloc_msg(struct joolnl_socket *socket,
 		char const *iname, enum joolnl_operation op, __u8 flags,
 		struct nl_msg **out)
+{
+	return joolnl_alloc_msg_size(socket, iname, op, flags, 0, out);
+}
+
+/* @size is the length of the message's buffer. Zero means "libnl's default." */
+struct jool_result joolnl_alloc_msg_size(struct joolnl_socket *socket,
+		char const *iname, enum joolnl_operation op, __u8 flags,
+		size_t size, struct nl_msg **out)
 {
 	struct nl_msg *msg;
 	struct joolnlhdr *hdr;
@@ -42,7 +50,7 @@ struct jool_result joolnl_alloc_msg(struct joolnl_socket *socket,
 	if (error)
 		return result_from_error(error, INAME_VALIDATE_ERRMSG);
 
-	msg = nlmsg_alloc();
+	msg = size ? nlmsg_alloc_size(size) : nlmsg_alloc();
 	if (!msg)
 		return result_from_enomem();
 
@@ -2,7 +2,10 @@
 
 #include <stddef.h>
 #include <netlink/msg.h>
+#include <netlink/genl/genl.h>
 #include "common/config.h"
+#include "usr/nl/attribute.h"
+#include "usr/nl/common.h"
 
 static struct jool_result send_to_kernel(struct joolnl_socket *sk,
 		struct nl_msg *msg)
@@ -28,7 +31,12 @@ struct jool_result joolnl_joold_add(struct joolnl_socket *sk, char const *iname,
 	struct nl_msg *msg;
 	struct jool_result result;
 
-	result = joolnl_alloc_msg(sk, iname, JNLOP_JOOLD_ADD, 0, &msg);
+	/* @data can be several datagrams long, so the default might not do. */
+	result = joolnl_alloc_msg_size(sk, iname, JNLOP_JOOLD_ADD, 0,
+			NLMSG_HDRLEN + GENL_HDRLEN
+			+ NLMSG_ALIGN(sizeof(struct joolnlhdr))
+			+ nla_total_size(data_len),
+			&msg);
 	if (result.error)
 		return result;
 
@@ -36,10 +44,6 @@ struct jool_result joolnl_joold_add(struct joolnl_socket *sk, char const *iname,
 			data_len, data);
 	if (result.error < 0) {
 		nlmsg_free(msg);
-		/*
-		 * This is fine as long as page size > 1500.
-		 * But admittedly, it's not the most elegant implementation.
-		 */
 		return result_from_error(
 			result.error,
 			"Can't send joold sessions to kernel: Packet too small."
@@ -62,7 +66,8 @@ struct jool_result joolnl_joold_advertise(struct joolnl_socket *sk,
 	return send_to_kernel(sk, msg);
 }
 
-struct jool_result joolnl_joold_ack(struct joolnl_socket *sk, char const *iname)
+struct jool_result joolnl_joold_ack(struct joolnl_socket *sk, char const *iname,
+		__u32 const *seq)
 {
 	struct nl_msg *msg;
 	struct jool_result result;
@@ -71,5 +76,62 @@ struct jool_result joolnl_joold_ack(struct joolnl_socket *sk, char const *iname)
 	if (result.error)
 		return result;
 
+	if (seq && (nla_put_u32(msg, JNLAR_JOOLD_SEQ, *seq) < 0)) {
+		nlmsg_free(msg);
+		return joolnl_err_msgsize();
+	}
+
 	return send_to_kernel(sk, msg);
 }
+
+static int put_transport(struct nl_msg *msg,
+		struct joolnl_joold_transport const *transport)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, JNLAR_JOOLD_TRANSPORT);
+	if (!root)
+		return -NLE_NOMEM;
+
+	if (transport->family == AF_INET6) {
+		if (nla_put(msg, JNLAJT_ADDR6, sizeof(transport->addr.v6),
+				&transport->addr.v6) < 0)
+			goto cancel;
+	} else {
+		if (nla_put(msg, JNLAJT_ADDR4, sizeof(transport->addr.v4),
+				&transport->addr.v4) < 0)
+			goto cancel;
+	}
+	if (nla_put_u16(msg, JNLAJT_PORT, transport->port) < 0)
+		goto cancel;
+	if (transport->ifindex
+			&& nla_put_u32(msg, JNLAJT_IFINDEX, transport->ifindex) < 0)
+		goto cancel;
+	if (nla_put_u8(msg, JNLAJT_TTL, transport->ttl) < 0)
+		goto cancel;
+
+	nla_nest_end(msg, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+struct jool_result joolnl_joold_transport(struct joolnl_socket *sk,
+		char const *iname, struct joolnl_joold_transport const *transport)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_JOOLD_TRANSPORT, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (transport && put_transport(msg, transport) < 0) {
+		nlmsg_free(msg);
+		return joolnl_err_msgsize();
+	}
+
+	return joolnl_request(sk, msg, NULL, NULL);
+}
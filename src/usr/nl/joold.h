@@ -1,8 +1,23 @@
 #ifndef SRC_USR_NL_JOOLD_H_
 #define SRC_USR_NL_JOOLD_H_
 
+#include <netinet/in.h>
 #include "usr/nl/core.h"
 
+/* See joold_udp_cfg (kernel). */
+struct joolnl_joold_transport {
+	/* AF_INET or AF_INET6 */
+	int family;
+	union {
+		struct in6_addr v6;
+		struct in_addr v4;
+	} addr;
+	__u16 port;
+	/* 0 = Let the kernel choose */
+	unsigned int ifindex;
+	__u8 ttl;
+};
+
 struct jool_result joolnl_joold_add(
 	struct joolnl_socket *sk,
 	char const *iname,
@@ -15,9 +30,21 @@ struct jool_result joolnl_joold_advertise(
 	char const *iname
 );
 
+/* @seq can be NULL. (ie. "the oldest packet in flight") */
 struct jool_result joolnl_joold_ack(
 	struct joolnl_socket *sk,
-	char const *iname
+	char const *iname,
+	__u32 const *seq
+);
+
+/*
+ * Has the kernel send and receive @iname's sessions by itself. If @transport is
+ * NULL, the sessions go back to the daemon.
+ */
+struct jool_result joolnl_joold_transport(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct joolnl_joold_transport const *transport
 );
 
 #endif /* SRC_USR_NL_JOOLD_H_ */
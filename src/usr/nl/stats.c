@@ -1,6 +1,7 @@
 #include "usr/nl/stats.h"
 
 #include <errno.h>
+#include <string.h>
 #include <netlink/genl/genl.h>
 #include "common/xlat.h"
 #include "usr/nl/attribute.h"
@@ -59,6 +60,10 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_TYPE2PKT, "Total number of Type 2 packets stored. (See https://github.com/NICMx/Jool/blob/584a846d09e891a0cd6342426b7a25c6478c90d6/src/mod/nat64/bib/pkt_queue.h#L77) (This counter is not decremented when a packet leaves the queue.)"),
 	DEFINE_STAT(JSTAT_SO_EXISTS, TC "Packet was a Simultaneous Open retry. (Client was trying to punch a hole, and was being unnecessarily greedy.)"),
 	DEFINE_STAT(JSTAT_SO_FULL, TC "Packet queue was full, so the Simultaneous Open attempt was denied. (Too many clients were trying to punch holes.)"),
+	DEFINE_STAT(JSTAT_FRAGCACHE_HIT, "Subsequent fragments translated using the ports of their first fragment, as remembered by the fragment cache. (Only when the module was inserted with defrag=0.)"),
+	DEFINE_STAT(JSTAT_FRAGCACHE_QUEUED, "Subsequent fragments that arrived before their first fragment, and had to be held until it arrived. (Only when the module was inserted with defrag=0.)"),
+	DEFINE_STAT(JSTAT_FRAGCACHE_FULL, TC "Held fragment was dropped because its first fragment never arrived, because the fragment cache had to make room for newer ones, or because its incoming interface disappeared."),
+	DEFINE_STAT(JSTAT_FRAGCACHE_MISS, TC "Subsequent fragment arrived before its first fragment had been translated, and could not be held. (Only when the module was inserted with defrag=0.)"),
 	DEFINE_STAT(JSTAT64_SRC, TC "IPv6 packet's source address did not match pool6 nor any EAMT entries, or the resulting address was denylist4ed."),
 	DEFINE_STAT(JSTAT64_DST, TC "IPv6 packet's destination address did not match pool6 nor any EAMT entries, or the resulting address was denylist4ed."),
 	DEFINE_STAT(JSTAT64_PSKB_COPY, TC "It was not possible to allocate the IPv4 counterpart of the IPv6 packet. (The kernel's pskb_copy() function failed.)"),
@@ -85,6 +90,11 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_FAILED_ROUTES, TC "The translated packet could not be routed; the kernel's routing function errored. Cause is unknown. (It usually happens because the packet's destination address could not be found in the routing table.)"),
 	DEFINE_STAT(JSTAT_PKT_TOO_BIG, TC "Translated IPv4 packet did not fit in the outgoing interface's MTU. A Packet Too Big or Fragmentation Needed ICMP error was returned to the client."),
 	DEFINE_STAT(JSTAT_DST_OUTPUT, TC "Translation was successful but the kernel's packet dispatch function (dst_output()) returned nonzero."),
+	DEFINE_STAT(JSTAT_XLAT_IN_PLACE, "Translations performed by rewriting the headers of the original packet. (See --xlat-in-place.)"),
+	DEFINE_STAT(JSTAT_XLAT_COPY, "Translations performed by building a new packet out of the original one."),
+	DEFINE_STAT(JSTAT_GSO_SEGMENTED, "GSO packets which had to be segmented in software because their segments could not be translated as a unit. (Each segment was then translated separately.)"),
+	DEFINE_STAT(JSTAT_GSO_SEGMENT_FAILED, TC "The packet needed software segmentation, but the kernel's skb_gso_segment() function failed."),
+	DEFINE_STAT(JSTAT_HAIRPIN_DIRECT, "Hairpinned packets that were translated from IPv6 straight into IPv6, without building the intermediate IPv4 packet."),
 	DEFINE_STAT(JSTAT_ICMP6ERR_SUCCESS, "ICMPv6 errors (created by Jool, not translated) sent successfully."),
 	DEFINE_STAT(JSTAT_ICMP6ERR_FAILURE, "ICMPv6 errors (created by Jool, not translated) that could not be sent."),
 	DEFINE_STAT(JSTAT_ICMP4ERR_SUCCESS, "ICMPv4 errors (created by Jool, not translated) sent successfully."),
@@ -93,7 +103,7 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 
 	DEFINE_STAT(JSTAT_JOOLD_EMPTY, "Joold packet not sent; no sessions queued."),
 	DEFINE_STAT(JSTAT_JOOLD_TIMEOUT, "Joold packet sent; ss-flush-deadline reached."),
-	DEFINE_STAT(JSTAT_JOOLD_MISSING_ACK, "Joold packet not sent; still waiting for ACK."),
+	DEFINE_STAT(JSTAT_JOOLD_MISSING_ACK, "Joold packet not sent; ss-window packets are still waiting for their ACKs."),
 	DEFINE_STAT(JSTAT_JOOLD_AD_ONGOING, "Joold packet sent; advertise still ongoing."),
 	DEFINE_STAT(JSTAT_JOOLD_PKT_FULL, "Joold packet sent; session packet full."),
 	DEFINE_STAT(JSTAT_JOOLD_QUEUING, "Joold packet not sent; packet still has room for more sessions."),
@@ -106,6 +116,16 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_JOOLD_PKT_RCVD, "Joold: Total session packets successfully received."),
 	DEFINE_STAT(JSTAT_JOOLD_ADS, "Joold: Total advertises queued."),
 	DEFINE_STAT(JSTAT_JOOLD_ACKS, "Joold: Total ACKs received from userspace."),
+	DEFINE_STAT(JSTAT_JOOLD_STALE_ACKS, "Joold: ACKs ignored because their packets had already been acknowledged or given up on."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_COALESCED, "Joold: Session updates merged into an older update of the same session, which was still queued."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_UNCHANGED, "Joold: Session updates not queued; the session was replicated less than ss-min-readvertise-interval ago, and its state did not change."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_EXCLUDED, "Joold: Session updates not queued because the replication policy (ss-tcp, ss-udp, ss-icmp, ss-include-ports, ss-exclude-ports) excludes the session."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_YOUNG, "Joold: Session updates not queued because the session has not reached ss-min-age or ss-min-packets yet."),
+	DEFINE_STAT(JSTAT_JOOLD_GAPS, "Joold: Datagrams the in-kernel transport found missing from a peer's sequence."),
+	DEFINE_STAT(JSTAT_JOOLD_DUPLICATES, "Joold: Datagrams dropped by the in-kernel transport because they had already been received (or were too old to tell)."),
+	DEFINE_STAT(JSTAT_JOOLD_RETRANSMITS, "Joold: Datagrams the in-kernel transport resent because a peer reported them missing."),
+	DEFINE_STAT(JSTAT_JOOLD_RESYNCS, "Joold: Advertisements started because a peer lost datagrams that could no longer be resent."),
+	DEFINE_STAT(JSTAT_JOOLD_TX_OVERFLOW, "Joold: Datagrams the in-kernel transport dropped because too many were waiting to be sent. (Its peers notice the gap, and request an advertisement.)"),
 
 	DEFINE_STAT(JSTAT_UNKNOWN, TC "Programming error found. The module recovered, but the packet was dropped."),
 	DEFINE_STAT(JSTAT_PADDING, "Dummy; ignore this one."),
@@ -227,3 +247,227 @@ struct jool_result joolnl_stats_foreach(struct joolnl_socket *sk,
 
 	return result_success();
 }
+
+static char const *const jhist_stage_names[] = {
+	[JHIST_TOTAL] = "total",
+	[JHIST_BIB_LOCK] = "bib-lock",
+	[JHIST_ROUTE] = "route",
+	[JHIST_SKB_ALLOC] = "skb-alloc",
+	[JHIST_CSUM] = "checksum",
+};
+
+struct histogram_args {
+	joolnl_histogram_foreach_cb cb;
+	void *args;
+	bool done;
+	/* Index of the next histogram the kernel should send. */
+	__u8 offset;
+};
+
+static struct jool_result nla_get_histogram(struct nlattr *root,
+		struct joolnl_histogram *out)
+{
+	struct nlattr *attrs[JNLAH_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLAH_MAX, root,
+			joolnl_histogram_entry_policy);
+	if (result.error)
+		return result;
+
+	out->stage = nla_get_u8(attrs[JNLAH_STAGE]);
+	out->l3_proto = nla_get_u8(attrs[JNLAH_L3_PROTO]);
+	out->l4_proto = nla_get_u8(attrs[JNLAH_L4_PROTO]);
+	memcpy(out->buckets, nla_data(attrs[JNLAH_BUCKETS]),
+			sizeof(out->buckets));
+
+	if (out->stage >= JHIST_STAGE_COUNT
+			|| out->l3_proto >= L3_PROTO_COUNT
+			|| out->l4_proto >= L4_PROTO_COUNT)
+		return result_from_error(-EINVAL,
+				"The kernel sent an unknown histogram. (Are the module and the client the same version?)");
+
+	out->stage_name = jhist_stage_names[out->stage];
+	return result_success();
+}
+
+static struct jool_result histogram_response(struct nl_msg *response,
+		void *arg)
+{
+	struct histogram_args *args = arg;
+	struct nlattr *attr;
+	int rem;
+	struct joolnl_histogram histogram;
+	struct jool_result result;
+
+	result = joolnl_init_foreach_list(response, "histogram", &args->done);
+	if (result.error)
+		return result;
+
+	foreach_entry(attr, genlmsg_hdr(nlmsg_hdr(response)), rem) {
+		result = nla_get_histogram(attr, &histogram);
+		if (result.error)
+			return result;
+
+		result = args->cb(&histogram, args->args);
+		if (result.error)
+			return result;
+
+		args->offset = (histogram.stage * L3_PROTO_COUNT
+				+ histogram.l3_proto) * L4_PROTO_COUNT
+				+ histogram.l4_proto + 1;
+	}
+
+	return result_success();
+}
+
+struct jool_result joolnl_stats_histogram(struct joolnl_socket *sk,
+		char const *iname, joolnl_histogram_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct histogram_args args;
+	struct jool_result result;
+
+	args.cb = cb;
+	args.args = _args;
+	args.done = true;
+	args.offset = 0;
+
+	do {
+		result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_HISTOGRAM, 0,
+				&msg);
+		if (result.error)
+			return result;
+
+		if (args.offset && (nla_put_u8(msg, JNLAR_OFFSET_U8, args.offset) < 0)) {
+			nlmsg_free(msg);
+			return joolnl_err_msgsize();
+		}
+
+		result = joolnl_request(sk, msg, histogram_response, &args);
+		if (result.error)
+			return result;
+	} while (!args.done);
+
+	return result_success();
+}
+
+static char const *const jlock_names[] = {
+	[JLOCK_BIB_TCP] = "bib-tcp",
+	[JLOCK_BIB_UDP] = "bib-udp",
+	[JLOCK_BIB_ICMP] = "bib-icmp",
+	[JLOCK_POOL4] = "pool4",
+	[JLOCK_JOOLD] = "joold",
+};
+
+static char const *const jlock_site_names[] = {
+	[JLS_BIB_ADD6] = "add6",
+	[JLS_BIB_ADD4] = "add4",
+	[JLS_BIB_SYNC] = "sync",
+	[JLS_BIB_CLEAN] = "clean",
+	[JLS_BIB_FOREACH] = "foreach",
+	[JLS_BIB_FIND] = "find",
+	[JLS_BIB_CONFIG] = "config",
+	[JLS_POOL4_MASK] = "mask",
+	[JLS_POOL4_CONTAINS] = "contains",
+	[JLS_POOL4_FOREACH] = "foreach",
+	[JLS_POOL4_CONFIG] = "config",
+	[JLS_JOOLD_ADD] = "add",
+	[JLS_JOOLD_ADVERTISE] = "advertise",
+	[JLS_JOOLD_ACK] = "ack",
+	[JLS_JOOLD_CLEAN] = "clean",
+	[JLS_JOOLD_TRANSPORT] = "transport",
+};
+
+struct lock_stats_args {
+	joolnl_lock_stats_foreach_cb cb;
+	void *args;
+	bool done;
+	/* Index of the next (lock, site) pair the kernel should send. */
+	__u8 offset;
+};
+
+static struct jool_result nla_get_lock_stats(struct nlattr *root,
+		struct joolnl_lock_stats *out)
+{
+	struct nlattr *attrs[JNLALS_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLALS_MAX, root,
+			joolnl_lock_stats_entry_policy);
+	if (result.error)
+		return result;
+
+	out->lock = nla_get_u8(attrs[JNLALS_LOCK]);
+	out->site = nla_get_u8(attrs[JNLALS_SITE]);
+	out->acquisitions = nla_get_u64(attrs[JNLALS_ACQUISITIONS]);
+	out->contended = nla_get_u64(attrs[JNLALS_CONTENDED]);
+	out->hold_total = nla_get_u64(attrs[JNLALS_HOLD_TOTAL]);
+	out->hold_max = nla_get_u64(attrs[JNLALS_HOLD_MAX]);
+
+	if (out->lock >= JLOCK_COUNT || out->site >= JLS_COUNT)
+		return result_from_error(-EINVAL,
+				"The kernel sent an unknown lock. (Are the module and the client the same version?)");
+
+	out->lock_name = jlock_names[out->lock];
+	out->site_name = jlock_site_names[out->site];
+	return result_success();
+}
+
+static struct jool_result lock_stats_response(struct nl_msg *response,
+		void *arg)
+{
+	struct lock_stats_args *args = arg;
+	struct nlattr *attr;
+	int rem;
+	struct joolnl_lock_stats stats;
+	struct jool_result result;
+
+	result = joolnl_init_foreach_list(response, "lock stats", &args->done);
+	if (result.error)
+		return result;
+
+	foreach_entry(attr, genlmsg_hdr(nlmsg_hdr(response)), rem) {
+		result = nla_get_lock_stats(attr, &stats);
+		if (result.error)
+			return result;
+
+		result = args->cb(&stats, args->args);
+		if (result.error)
+			return result;
+
+		args->offset = stats.lock * JLS_COUNT + stats.site + 1;
+	}
+
+	return result_success();
+}
+
+struct jool_result joolnl_stats_locks(struct joolnl_socket *sk,
+		char const *iname, joolnl_lock_stats_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct lock_stats_args args;
+	struct jool_result result;
+
+	args.cb = cb;
+	args.args = _args;
+	args.done = true;
+	args.offset = 0;
+
+	do {
+		result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_LOCKS, 0, &msg);
+		if (result.error)
+			return result;
+
+		if (args.offset && (nla_put_u8(msg, JNLAR_OFFSET_U8, args.offset) < 0)) {
+			nlmsg_free(msg);
+			return joolnl_err_msgsize();
+		}
+
+		result = joolnl_request(sk, msg, lock_stats_response, &args);
+		if (result.error)
+			return result;
+	} while (!args.done);
+
+	return result_success();
+}
@@ -1,6 +1,8 @@
 #ifndef SRC_USR_NL_STATS_H_
 #define SRC_USR_NL_STATS_H_
 
+#include "common/histogram.h"
+#include "common/lock_stats.h"
 #include "common/stats.h"
 #include "usr/nl/core.h"
 
@@ -25,4 +27,50 @@ struct jool_result joolnl_stats_foreach(
 	void *args
 );
 
+struct joolnl_histogram {
+	enum jool_hist_stage stage;
+	/* Printable version of @stage. */
+	char const *stage_name;
+	/* Of the incoming packet. */
+	l3_protocol l3_proto;
+	l4_protocol l4_proto;
+	/* See JHIST_BUCKETS. */
+	__u64 buckets[JHIST_BUCKETS];
+};
+
+typedef struct jool_result (*joolnl_histogram_foreach_cb)(
+	struct joolnl_histogram const *histogram, void *args
+);
+struct jool_result joolnl_stats_histogram(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_histogram_foreach_cb cb,
+	void *args
+);
+
+struct joolnl_lock_stats {
+	enum jool_lock lock;
+	enum jool_lock_site site;
+	/* Printable versions of @lock and @site. */
+	char const *lock_name;
+	char const *site_name;
+
+	__u64 acquisitions;
+	/* Acquisitions that had to wait for another holder */
+	__u64 contended;
+	/* Nanoseconds */
+	__u64 hold_total;
+	__u64 hold_max;
+};
+
+typedef struct jool_result (*joolnl_lock_stats_foreach_cb)(
+	struct joolnl_lock_stats const *stats, void *args
+);
+struct jool_result joolnl_stats_locks(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_lock_stats_foreach_cb cb,
+	void *args
+);
+
 #endif /* SRC_USR_NL_STATS_H_ */
@@ -0,0 +1 @@
+#include "common/joold_compact.c"
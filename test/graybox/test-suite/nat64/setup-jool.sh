@@ -4,6 +4,8 @@ JOOLCLIENT="$1"
 if [ -z "$JOOLCLIENT" ]; then
 	JOOLCLIENT="jool"
 fi
+# Module arguments. (Optional.)
+MODARGS="$2"
 
 modprobe -rq jool_siit
 modprobe -rq jool
@@ -18,7 +20,7 @@ ip route add 203.0.113.0/24 via 192.0.2.5
 
 sysctl -w net.ipv4.conf.all.forwarding=1     > /dev/null
 sysctl -w net.ipv6.conf.all.forwarding=1     > /dev/null
-modprobe jool
+modprobe jool $MODARGS
 "$JOOLCLIENT" instance add -6 64:ff9b::/96 --netfilter
 "$JOOLCLIENT" pool4 add 192.0.2.2 1-3000 --tcp
 "$JOOLCLIENT" pool4 add 192.0.2.2 1-3000 --udp
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+
+# Tests the fragment cache; ie. NAT64 with the module inserted with defrag=0.
+# Assumes ./setup.sh was run with "defrag=0" as second argument, in namespaces
+# where nf_defrag_ipv4 and nf_defrag_ipv6 have not been enabled yet.
+#
+# Arguments:
+# $1: Path to the NAT64 jool client binary.
+#     Optional; defaults to `jool`.
+
+
+GRAYBOX=`dirname $0`/../../usr/graybox
+JOOLCLIENT="$1"
+if [ -z "$JOOLCLIENT" ]; then
+	JOOLCLIENT="jool"
+fi
+
+# Sends two packets (usually fragments), expects two.
+# $1: Receiver namespace
+# $2: Sender namespace
+# $3: Subdirectory
+# $4: Test packet 1
+# $5: Test packet 2
+# $6: Expected packet 1
+# $7: Expected packet 2
+test_22() {
+	ip netns exec $1 $GRAYBOX expect add `dirname $0`/manual/$3/$6.pkt
+	ip netns exec $1 $GRAYBOX expect add `dirname $0`/manual/$3/$7.pkt
+	ip netns exec $2 $GRAYBOX send `dirname $0`/manual/$3/$4.pkt
+	ip netns exec $2 $GRAYBOX send `dirname $0`/manual/$3/$5.pkt
+	sleep 0.1
+	ip netns exec $1 $GRAYBOX expect flush
+}
+
+
+`dirname $0`/../wait.sh 64:ff9b::192.0.2.5
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+
+echo "Testing the fragment cache! Please wait..."
+
+# The subsequent fragment arrives first, so it has to be held until the first
+# one creates the session. (The 46 test needs the session created by the 64
+# test.)
+test_22 client4ns client6ns frag defrag64-test1 defrag64-test0 fragcache64-expected0 fragcache64-expected1
+test_22 client6ns client4ns frag defrag46-test1 defrag46-test0 fragcache46-expected0 fragcache46-expected1
+
+ip netns exec joolns "$JOOLCLIENT" stats display | grep -q JSTAT_FRAGCACHE_QUEUED
+if [ $? -ne 0 ]; then
+	echo "The fragment cache did not hold the out-of-order fragments."
+	$GRAYBOX stats flush
+	exit 1
+fi
+
+$GRAYBOX stats display
+result=$?
+$GRAYBOX stats flush
+
+exit $result
@@ -0,0 +1,120 @@
+#!/usr/bin/env bash
+
+# In-kernel joold transport convergence test.
+#
+# Runs two NAT64 instances (J and K) in their own namespaces, and has them
+# synchronize their sessions through the in-kernel transport, over a link that
+# loses some of the packets. A third namespace (C) creates UDP sessions in J.
+# Once the traffic stops, K is expected to end up with the same sessions as J.
+#
+# Needs root, the jool module installed, and tc's netem. Creates and destroys
+# its own namespaces, so it does not need ./setup.sh.
+#
+# Arguments:
+# $1: Path to the NAT64 jool client binary.
+#     Optional; defaults to `jool`.
+# $2: Sessions to create. (Default: 500)
+# $3: Packet loss in the synchronization link, in netem syntax. (Default: 20%)
+
+JOOLCLIENT="${1:-jool}"
+SESSIONS="${2:-500}"
+LOSS="${3:-20%}"
+GROUP="ff02::db8:64:64"
+RED="\\x1b[31m"
+GREEN="\\x1b[32m"
+NC="\\x1b[0m" # No Color
+
+
+function cleanup() {
+	ip netns del C 2> /dev/null
+	ip netns del J 2> /dev/null
+	ip netns del K 2> /dev/null
+	modprobe -rq jool
+}
+
+# Prints instance $1's UDP sessions, minus the timeouts.
+function sessions() {
+	ip netns exec $1 "$JOOLCLIENT" session display --udp --numeric --csv --no-headers \
+		| cut -d, -f1-9 | sort
+}
+
+# Sends one UDP packet from C to IPv4 port $1 (through J).
+function send() {
+	ip netns exec C bash -c "echo ss > /dev/udp/64:ff9b::192.0.2.5/$1"
+}
+
+
+cleanup
+trap cleanup EXIT
+set -e
+
+ip netns add C
+ip netns add J
+ip netns add K
+
+# C <-> J: The traffic that creates the sessions
+ip link add to_j netns C type veth peer name to_c netns J
+ip -n C link set to_j up
+ip -n J link set to_c up
+ip -n C addr add 2001:db8::2/64 dev to_j nodad
+ip -n J addr add 2001:db8::1/64 dev to_c nodad
+ip -n C route add 64:ff9b::/96 via 2001:db8::1
+
+# J's IPv4 side. Nobody listens; the sessions are all J needs.
+ip -n J link add v4 type dummy
+ip -n J link set v4 up
+ip -n J addr add 192.0.2.1/24 dev v4
+
+# J <-> K: Session synchronization, with loss in J's direction
+ip link add to_k netns J type veth peer name to_j netns K
+ip -n J link set to_k up
+ip -n K link set to_j up
+ip netns exec J tc qdisc add dev to_k root netem loss $LOSS
+
+modprobe jool
+for ns in J K; do
+	ip netns exec $ns sysctl -qw net.ipv6.conf.all.forwarding=1
+	ip netns exec $ns "$JOOLCLIENT" instance add --netfilter --pool6 64:ff9b::/96
+	ip netns exec $ns "$JOOLCLIENT" pool4 add 192.0.2.1 1-65535 --udp
+	ip netns exec $ns "$JOOLCLIENT" global update ss-enabled true
+	ip netns exec $ns "$JOOLCLIENT" global update ss-flush-asap true
+done
+ip netns exec J "$JOOLCLIENT" session proxy --kernel --net.dev.in to_k $GROUP
+ip netns exec K "$JOOLCLIENT" session proxy --kernel --net.dev.in to_j $GROUP
+
+# Let the interfaces join the group
+sleep 2
+
+echo "Creating $SESSIONS sessions through a link with $LOSS loss..."
+for i in $(seq 1 $SESSIONS); do
+	send $((10000 + i))
+done
+
+# Gaps are only noticed once a later datagram arrives, so the last ones need
+# to cross the link.
+ip netns exec J tc qdisc del dev to_k root
+send 9999
+
+RESULT=1
+for i in $(seq 1 10); do
+	sleep 1
+	if [ "$(sessions J)" = "$(sessions K)" ]; then
+		RESULT=0
+		break
+	fi
+done
+
+echo "J's transport:"
+ip netns exec J "$JOOLCLIENT" stats display | grep JOOLD || true
+echo "K's transport:"
+ip netns exec K "$JOOLCLIENT" stats display | grep JOOLD || true
+
+echo "J: $(sessions J | wc -l) sessions. K: $(sessions K | wc -l) sessions."
+if [ $RESULT -eq 0 ]; then
+	echo -e "${GREEN}The sessions converged.${NC}"
+else
+	echo -e "${RED}The sessions did not converge.${NC}"
+	diff <(sessions J) <(sessions K) || true
+fi
+
+exit $RESULT
@@ -71,6 +71,31 @@ test44_11() {
 	test_11 client4ns client4ns $1 $2 $3
 }
 
+# Sends two packets (usually fragments), expects one.
+# $1: Namespace that expects the packet
+# $2: Namespace that sends the packets
+# $3: Subdirectory
+# $4: Test packet 1
+# $5: Test packet 2
+# $6: Expected packet
+# $7: Exceptions (optional)
+# (test64_21 and test46_21 take $3 through $7 as their $1 through $5.)
+test_21() {
+	ip netns exec $1 $GRAYBOX expect add `dirname $0`/manual/$3/$6.pkt $7
+	ip netns exec $2 $GRAYBOX send `dirname $0`/manual/$3/$4.pkt
+	ip netns exec $2 $GRAYBOX send `dirname $0`/manual/$3/$5.pkt
+	sleep 0.1
+	ip netns exec $1 $GRAYBOX expect flush
+}
+
+test64_21() {
+	test_21 client4ns client6ns $1 $2 $3 $4 $5
+}
+
+test46_21() {
+	test_21 client6ns client4ns $1 $2 $3 $4 $5
+}
+
 test46_12() {
 	ip netns exec client6ns $GRAYBOX expect add `dirname $0`/manual/$1/$3.pkt $5
 	ip netns exec client6ns $GRAYBOX expect add `dirname $0`/manual/$1/$4.pkt $5
@@ -209,6 +234,8 @@ if [ -z "$1" -o "$1" = "frag" ]; then
 	test64_11 frag/icmp6-test frag/icmp6-expected $NOFRAG_IGNORE,$NOFRAG_IGNORE_INNER
 	test46_11 frag/icmp4-test frag/icmp4-expected
 	test46_12 frag minmtu6-big-test minmtu6-big0-expected minmtu6-big1-expected
+	test64_21 frag defrag64-test0 defrag64-test1 defrag64-expected $NOFRAG_IGNORE
+	test46_21 frag defrag46-test0 defrag46-test1 defrag46-expected
 fi
 
 $GRAYBOX stats display
@@ -27,6 +27,13 @@ siit/test.sh "" "$SIIT"
 siit_result=$?
 siit/end.sh
 
+# There's no way to turn nf_defrag off once NAT64 has enabled it in joolns, so
+# this needs to happen before the main NAT64 run.
+nat64/setup.sh "$NAT64" "defrag=0"
+nat64/test-fragcache.sh "$NAT64"
+fragcache_result=$?
+nat64/end.sh
+
 nat64/setup.sh "$NAT64"
 nat64/test.sh "" "$NAT64"
 nat64_result=$?
@@ -34,12 +41,22 @@ nat64/end.sh
 
 ./namespace-destroy.sh
 
+# Uses its own namespaces.
+nat64/test-joold.sh "$NAT64"
+joold_result=$?
+
 
 if [ $siit_result -ne 0 ]; then
 	exit $siit_result
 fi
+if [ $fragcache_result -ne 0 ]; then
+	exit $fragcache_result
+fi
 if [ $nat64_result -ne 0 ]; then
 	exit $nat64_result
 fi
+if [ $joold_result -ne 0 ]; then
+	exit $joold_result
+fi
 echo "No errors detected."
 exit 0
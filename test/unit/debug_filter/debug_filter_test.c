@@ -0,0 +1,310 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+
+#include "framework/unit_test.h"
+#include "framework/skb_generator.h"
+#include "mod/common/debug_filter.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("aleiva");
+MODULE_DESCRIPTION("Unit tests for the debug filter");
+
+static struct xlator jool; /* Too large for the stack. */
+static struct xlation state; /* Too large for the stack. */
+
+/********************** Helpers **********************/
+
+static int init(void)
+{
+	memset(&jool, 0, sizeof(jool));
+	jool.globals.debug = true;
+	jool.debug_limit = dbgl_alloc();
+	return jool.debug_limit ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	dbgl_put(jool.debug_limit);
+}
+
+static int set_prefix6(char *addr, __u8 len)
+{
+	jool.globals.debug_filter.prefix6.set = true;
+	jool.globals.debug_filter.prefix6.prefix.len = len;
+	return str_to_addr6(addr, &jool.globals.debug_filter.prefix6.prefix.addr);
+}
+
+static int set_prefix4(char *addr, __u8 len)
+{
+	jool.globals.debug_filter.prefix4.set = true;
+	jool.globals.debug_filter.prefix4.prefix.len = len;
+	return str_to_addr4(addr, &jool.globals.debug_filter.prefix4.prefix.addr);
+}
+
+/*
+ * Runs @skb through the filter the same way core does, and returns the
+ * resulting decision. Always consumes @skb.
+ */
+static bool debugged(struct sk_buff *skb, __u32 mark)
+{
+	verdict result;
+	bool debug;
+
+	skb->mark = mark;
+	xlation_init(&state, &jool);
+
+	debug_filter_start(&state);
+	result = (ntohs(skb->protocol) == ETH_P_IPV6)
+			? pkt_init_ipv6(&state, skb)
+			: pkt_init_ipv4(&state, skb);
+	if (result != VERDICT_CONTINUE) {
+		kfree_skb(skb);
+		log_err("Packet initialization failed.");
+		return false;
+	}
+	debug_filter_apply(&state);
+
+	debug = state.debug;
+	kfree_skb(skb);
+	return debug;
+}
+
+static bool udp6(char *src, __u16 sport, char *dst, __u16 dport, __u32 mark)
+{
+	struct sk_buff *skb;
+
+	if (create_skb6_udp(src, sport, dst, dport, 100, 32, &skb))
+		return false;
+	return debugged(skb, mark);
+}
+
+static bool udp4(char *src, __u16 sport, char *dst, __u16 dport, __u32 mark)
+{
+	struct sk_buff *skb;
+
+	if (create_skb4_udp(src, sport, dst, dport, 100, 32, &skb))
+		return false;
+	return debugged(skb, mark);
+}
+
+static bool tcp6(char *src, __u16 sport, char *dst, __u16 dport)
+{
+	struct sk_buff *skb;
+
+	if (create_skb6_tcp(src, sport, dst, dport, 100, 32, &skb))
+		return false;
+	return debugged(skb, 0);
+}
+
+static bool ping6(char *src, char *dst, __u16 id)
+{
+	struct sk_buff *skb;
+
+	if (create_skb6_icmp_info(src, dst, id, 100, 32, &skb))
+		return false;
+	return debugged(skb, 0);
+}
+
+static bool ping4(char *src, char *dst, __u16 id)
+{
+	struct sk_buff *skb;
+
+	if (create_skb4_icmp_info(src, dst, id, 100, 32, &skb))
+		return false;
+	return debugged(skb, 0);
+}
+
+/********************** Tests **********************/
+
+static bool no_filter_test(void)
+{
+	bool success = true;
+
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"v6");
+	success &= ASSERT_TRUE(udp4("192.0.2.1", 1000, "203.0.113.1", 2000, 0),
+			"v4");
+
+	jool.globals.debug = false;
+	success &= ASSERT_FALSE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"v6, debug disabled");
+	success &= ASSERT_FALSE(udp4("192.0.2.1", 1000, "203.0.113.1", 2000, 0),
+			"v4, debug disabled");
+
+	return success;
+}
+
+static bool prefix_test(void)
+{
+	bool success = true;
+
+	if (set_prefix6("2001:db8::", 64))
+		return false;
+
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"source matches");
+	success &= ASSERT_TRUE(udp6("64:ff9b::1", 2000, "2001:db8::1", 1000, 0),
+			"destination matches");
+	success &= ASSERT_FALSE(udp6("2001:db8:1::1", 1000, "64:ff9b::1", 2000, 0),
+			"neither matches");
+	success &= ASSERT_FALSE(udp4("192.0.2.1", 1000, "203.0.113.1", 2000, 0),
+			"IPv4 packet, no prefix4");
+
+	if (set_prefix4("192.0.2.0", 30))
+		return false;
+
+	success &= ASSERT_TRUE(udp4("192.0.2.1", 1000, "203.0.113.1", 2000, 0),
+			"v4 source matches");
+	success &= ASSERT_TRUE(udp4("203.0.113.1", 2000, "192.0.2.3", 1000, 0),
+			"v4 destination matches");
+	success &= ASSERT_FALSE(udp4("192.0.2.4", 1000, "203.0.113.1", 2000, 0),
+			"v4 neither matches");
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"v6 still matches");
+
+	return success;
+}
+
+static bool proto_test(void)
+{
+	bool success = true;
+
+	jool.globals.debug_filter.proto = IPPROTO_TCP;
+	success &= ASSERT_TRUE(tcp6("2001:db8::1", 1000, "64:ff9b::1", 2000),
+			"TCP");
+	success &= ASSERT_FALSE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"UDP");
+	success &= ASSERT_FALSE(ping6("2001:db8::1", "64:ff9b::1", 1000),
+			"ICMPv6");
+
+	/* Either ICMP number matches both ICMP versions */
+	jool.globals.debug_filter.proto = IPPROTO_ICMPV6;
+	success &= ASSERT_TRUE(ping6("2001:db8::1", "64:ff9b::1", 1000),
+			"58, ICMPv6");
+	success &= ASSERT_TRUE(ping4("192.0.2.1", "203.0.113.1", 1000),
+			"58, ICMPv4");
+	jool.globals.debug_filter.proto = IPPROTO_ICMP;
+	success &= ASSERT_TRUE(ping6("2001:db8::1", "64:ff9b::1", 1000),
+			"1, ICMPv6");
+	success &= ASSERT_FALSE(udp4("192.0.2.1", 1000, "203.0.113.1", 2000, 0),
+			"1, UDP");
+
+	return success;
+}
+
+static bool port_test(void)
+{
+	bool success = true;
+
+	jool.globals.debug_filter.port = 2000;
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 2000, "64:ff9b::1", 80, 0),
+			"source port");
+	success &= ASSERT_TRUE(tcp6("2001:db8::1", 1000, "64:ff9b::1", 2000),
+			"destination port");
+	success &= ASSERT_FALSE(udp4("192.0.2.1", 1000, "203.0.113.1", 80, 0),
+			"neither port");
+	success &= ASSERT_TRUE(ping4("192.0.2.1", "203.0.113.1", 2000),
+			"ICMP identifier");
+	success &= ASSERT_FALSE(ping6("2001:db8::1", "64:ff9b::1", 1000),
+			"other ICMP identifier");
+
+	/* The fields combine through AND */
+	jool.globals.debug_filter.proto = IPPROTO_TCP;
+	success &= ASSERT_FALSE(udp6("2001:db8::1", 2000, "64:ff9b::1", 80, 0),
+			"port matches, protocol does not");
+
+	return success;
+}
+
+static bool mark_test(void)
+{
+	bool success = true;
+
+	jool.globals.debug_filter.mark = 7;
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 7),
+			"mark matches");
+	success &= ASSERT_FALSE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 8),
+			"mark does not match");
+
+	return success;
+}
+
+static bool rate_test(void)
+{
+	unsigned int i;
+	unsigned int count;
+	bool success = true;
+
+	/* Rate limit alone */
+	jool.globals.debug_filter.rate = 3;
+	count = 0;
+	for (i = 0; i < 5; i++)
+		if (udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0))
+			count++;
+	success &= ASSERT_UINT(3, count, "first window");
+
+	/* The next second starts */
+	jool.debug_limit->window = jiffies - HZ;
+	success &= ASSERT_TRUE(udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0),
+			"second window");
+
+	/* Packets that do not match the filter do not spend the budget */
+	jool.debug_limit->window = jiffies - HZ;
+	jool.globals.debug_filter.port = 2000;
+	for (i = 0; i < 5; i++)
+		udp6("2001:db8::1", 1000, "64:ff9b::1", 80, 0);
+	count = 0;
+	for (i = 0; i < 5; i++)
+		if (udp6("2001:db8::1", 1000, "64:ff9b::1", 2000, 0))
+			count++;
+	success &= ASSERT_UINT(3, count, "filtered window");
+
+	return success;
+}
+
+static bool xlator_debug_test(void)
+{
+	bool success = true;
+
+	success &= ASSERT_TRUE(xlator_debug(&jool), "no filter");
+
+	jool.globals.debug_filter.port = 2000;
+	success &= ASSERT_FALSE(xlator_debug(&jool), "filter");
+
+	jool.globals.debug_filter.port = 0;
+	jool.globals.debug_filter.rate = 10;
+	success &= ASSERT_FALSE(xlator_debug(&jool), "rate");
+
+	return success;
+}
+
+static int debug_filter_test_init(void)
+{
+	struct test_group test = {
+		.name = "debug filter",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, no_filter_test, "no filter");
+	test_group_test(&test, prefix_test, "prefixes");
+	test_group_test(&test, proto_test, "protocol");
+	test_group_test(&test, port_test, "port");
+	test_group_test(&test, mark_test, "mark");
+	test_group_test(&test, rate_test, "rate limit");
+	test_group_test(&test, xlator_debug_test, "instance messages");
+
+	return test_group_end(&test);
+}
+
+static void debug_filter_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(debug_filter_test_init);
+module_exit(debug_filter_test_exit);
@@ -0,0 +1,244 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/timekeeping.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/db/denylist4.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("aleiva");
+MODULE_DESCRIPTION("Unit tests for the denylist4 module");
+
+static struct addr4_pool *pool;
+
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr)
+{
+	broken_unit_call(__func__);
+	return 0;
+}
+
+static int init(void)
+{
+	pool = denylist4_alloc();
+	return pool ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	denylist4_put(pool);
+}
+
+static int add(char *addr, __u8 len)
+{
+	struct ipv4_prefix prefix;
+
+	if (str_to_addr4(addr, &prefix.addr))
+		return -EINVAL;
+	prefix.len = len;
+
+	return denylist4_add(pool, &prefix, true, false);
+}
+
+static int rm(char *addr, __u8 len)
+{
+	struct ipv4_prefix prefix;
+
+	if (str_to_addr4(addr, &prefix.addr))
+		return -EINVAL;
+	prefix.len = len;
+
+	return denylist4_rm(pool, &prefix);
+}
+
+static bool contains(char *addr)
+{
+	struct in_addr tmp;
+
+	if (str_to_addr4(addr, &tmp))
+		return false;
+
+	return denylist4_contains(pool, &tmp);
+}
+
+static bool add_test(void)
+{
+	bool success = true;
+
+	success &= ASSERT_INT(0, add("192.0.2.0", 24), "add 1");
+	success &= ASSERT_INT(0, add("198.51.100.8", 29), "add 2");
+	success &= ASSERT_INT(0, add("192.0.2.128", 25), "add inner");
+	success &= ASSERT_INT(-EINVAL, add("203.0.113.1", 24), "nonzero suffix");
+
+	/* Duplicates are ignored, rather than stored twice or rejected. */
+	success &= ASSERT_INT(0, add("192.0.2.0", 24), "add duplicate");
+	success &= ASSERT_INT(0, rm("192.0.2.0", 24), "rm duplicate");
+	success &= ASSERT_INT(-ESRCH, rm("192.0.2.0", 24), "only one copy");
+
+	return success;
+}
+
+static bool contains_test(void)
+{
+	bool success = true;
+
+	success &= ASSERT_INT(0, add("192.0.2.0", 24), "add 1");
+	success &= ASSERT_INT(0, add("192.0.2.128", 25), "add 2");
+	success &= ASSERT_INT(0, add("198.51.100.8", 29), "add 3");
+	success &= ASSERT_INT(0, add("203.0.113.7", 32), "add 4");
+
+	success &= ASSERT_BOOL(false, contains("192.0.1.255"), "before 1");
+	success &= ASSERT_BOOL(true, contains("192.0.2.0"), "1 min");
+	success &= ASSERT_BOOL(true, contains("192.0.2.127"), "1 max");
+	success &= ASSERT_BOOL(true, contains("192.0.2.128"), "2 min");
+	success &= ASSERT_BOOL(true, contains("192.0.2.255"), "2 max");
+	success &= ASSERT_BOOL(false, contains("192.0.3.0"), "after 2");
+	success &= ASSERT_BOOL(false, contains("198.51.100.7"), "before 3");
+	success &= ASSERT_BOOL(true, contains("198.51.100.8"), "3 min");
+	success &= ASSERT_BOOL(true, contains("198.51.100.15"), "3 max");
+	success &= ASSERT_BOOL(false, contains("198.51.100.16"), "after 3");
+	success &= ASSERT_BOOL(false, contains("203.0.113.6"), "before 4");
+	success &= ASSERT_BOOL(true, contains("203.0.113.7"), "4");
+	success &= ASSERT_BOOL(false, contains("203.0.113.8"), "after 4");
+
+	/* The outer prefix has to keep covering the inner one's range. */
+	success &= ASSERT_INT(0, rm("192.0.2.128", 25), "rm 2");
+	success &= ASSERT_BOOL(true, contains("192.0.2.200"), "1 after rm 2");
+	success &= ASSERT_INT(0, rm("192.0.2.0", 24), "rm 1");
+	success &= ASSERT_BOOL(false, contains("192.0.2.200"), "nothing left");
+	success &= ASSERT_INT(-ESRCH, rm("192.0.2.0", 24), "rm 1 again");
+	success &= ASSERT_BOOL(true, contains("198.51.100.9"), "3 survives");
+
+	success &= ASSERT_INT(0, denylist4_flush(pool), "flush");
+	success &= ASSERT_BOOL(false, contains("198.51.100.9"), "flushed 3");
+	success &= ASSERT_BOOL(false, contains("203.0.113.7"), "flushed 4");
+	success &= ASSERT_BOOL(true, denylist4_is_empty(pool), "empty");
+
+	return success;
+}
+
+static int foreach_cb(struct ipv4_prefix *prefix, void *arg)
+{
+	struct ipv4_prefix **expected = arg;
+	bool success;
+
+	success = ASSERT_PREFIX4(*expected, prefix, "foreach order");
+	(*expected)++;
+	return success ? 0 : -EINVAL;
+}
+
+static bool foreach_test(void)
+{
+	struct ipv4_prefix expected[3];
+	struct ipv4_prefix *cursor;
+	bool success = true;
+
+	/* Insertion order, not address order. */
+	success &= ASSERT_INT(0, add("198.51.100.0", 24), "add 1");
+	success &= ASSERT_INT(0, add("192.0.2.0", 24), "add 2");
+	success &= ASSERT_INT(0, add("203.0.113.0", 24), "add 3");
+	if (!success)
+		return false;
+
+	str_to_addr4("198.51.100.0", &expected[0].addr);
+	expected[0].len = 24;
+	str_to_addr4("192.0.2.0", &expected[1].addr);
+	expected[1].len = 24;
+	str_to_addr4("203.0.113.0", &expected[2].addr);
+	expected[2].len = 24;
+
+	cursor = &expected[0];
+	success &= ASSERT_INT(0, denylist4_foreach(pool, foreach_cb, &cursor,
+			NULL), "foreach");
+	success &= ASSERT_PTR(&expected[3], cursor, "foreach count");
+
+	cursor = &expected[1];
+	success &= ASSERT_INT(0, denylist4_foreach(pool, foreach_cb, &cursor,
+			&expected[0]), "foreach with offset");
+	success &= ASSERT_PTR(&expected[3], cursor, "offset count");
+
+	return success;
+}
+
+/*
+ * Not really a test; prints the cost of denylist4_contains() as the denylist
+ * grows. (It used to be linear.)
+ */
+static bool benchmark(unsigned int entries)
+{
+	struct ipv4_prefix prefix;
+	struct in_addr addr;
+	unsigned int i;
+	u64 start, end;
+	bool found = false;
+	int error;
+
+	/* 10.0.0.0/24, 10.0.1.0/24, 10.0.2.0/24, etc. */
+	prefix.len = 24;
+	for (i = 0; i < entries; i++) {
+		prefix.addr.s_addr = cpu_to_be32(0x0A000000u + (i << 8));
+		error = denylist4_add(pool, &prefix, true, false);
+		if (error) {
+			log_err("denylist4_add() #%u returned %d.", i, error);
+			return false;
+		}
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < 1000000; i++) {
+		/* Alternate between hits and misses. */
+		addr.s_addr = cpu_to_be32((i & 1)
+				? (0x0A000000u + ((i % entries) << 8) + 1)
+				: (0xC0000201u));
+		found ^= denylist4_contains(pool, &addr);
+	}
+	end = ktime_get_ns();
+
+	pr_info("denylist4_contains() with %u entries: %llu ns per lookup (%u)\n",
+			entries, (end - start) / 1000000, found);
+	return true;
+}
+
+static bool benchmark_10(void)
+{
+	return benchmark(10);
+}
+
+static bool benchmark_1k(void)
+{
+	return benchmark(1000);
+}
+
+static bool benchmark_100k(void)
+{
+	return benchmark(100000);
+}
+
+static int denylist4_test_init(void)
+{
+	struct test_group test = {
+		.name = "denylist4",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, add_test, "add function");
+	test_group_test(&test, contains_test, "contains function");
+	test_group_test(&test, foreach_test, "foreach function");
+	test_group_test(&test, benchmark_10, "contains() benchmark, 10 entries");
+	test_group_test(&test, benchmark_1k, "contains() benchmark, 1k entries");
+	test_group_test(&test, benchmark_100k, "contains() benchmark, 100k entries");
+
+	return test_group_end(&test);
+}
+
+static void denylist4_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(denylist4_test_init);
+module_exit(denylist4_test_exit);
@@ -26,8 +26,8 @@ void joold_put(struct joold_queue *queue)
 	/* No code. */
 }
 
-int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
-		void const *args)
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr)
 {
-	return broken_unit_call(__func__);
+	broken_unit_call(__func__);
+	return 0;
 }
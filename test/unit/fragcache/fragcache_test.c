@@ -0,0 +1,298 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/db/fragcache.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("aleiva");
+MODULE_DESCRIPTION("Unit tests for the fragment cache");
+
+static struct fragcache *cache;
+static struct sk_buff_head garbage;
+
+/********************** Mocks **********************/
+
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat)
+{
+	/* No code. */
+}
+
+verdict drop(struct xlation *state, enum jool_stat_id stat)
+{
+	return VERDICT_DROP;
+}
+
+verdict stolen(struct xlation *state, enum jool_stat_id stat)
+{
+	return VERDICT_STOLEN;
+}
+
+/********************** Helpers **********************/
+
+static void init_key(struct fragcache_key *key, __u32 id)
+{
+	memset(key, 0, sizeof(*key));
+	key->addrs.v4.src.s_addr = cpu_to_be32(0xc0000205);
+	key->addrs.v4.dst.s_addr = cpu_to_be32(0xc0000202);
+	key->id = id;
+	key->l3_proto = L3PROTO_IPV4;
+	key->l4_proto = L4PROTO_UDP;
+}
+
+static void init_tuples(struct tuple *in, struct tuple *out, __u16 port)
+{
+	memset(in, 0, sizeof(*in));
+	memset(out, 0, sizeof(*out));
+	in->src.addr4.l4 = port;
+	out->src.addr6.l4 = port + 1;
+}
+
+static struct sk_buff *new_skb(void)
+{
+	return alloc_skb(0, GFP_KERNEL);
+}
+
+static int init(void)
+{
+	__skb_queue_head_init(&garbage);
+	cache = fragcache_alloc();
+	return cache ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	__skb_queue_purge(&garbage);
+	fragcache_put(cache);
+}
+
+/********************** Tests **********************/
+
+static bool store_fetch_test(void)
+{
+	struct fragcache_key key;
+	struct tuple in, out;
+	struct tuple in2, out2;
+	struct sk_buff_head pending;
+	bool success = true;
+
+	__skb_queue_head_init(&pending);
+	init_key(&key, 1234);
+	init_tuples(&in, &out, 1000);
+
+	success &= ASSERT_INT(-ENOSPC, fetch_or_hold(cache, &key, NULL,
+			&in2, &out2, &garbage), "empty cache");
+
+	store(cache, &key, &in, &out, &pending, &garbage);
+	success &= ASSERT_UINT(0, skb_queue_len(&pending), "nothing pending");
+	success &= ASSERT_INT(0, fetch_or_hold(cache, &key, NULL,
+			&in2, &out2, &garbage), "hit");
+	success &= ASSERT_UINT(1000, in2.src.addr4.l4, "in tuple");
+	success &= ASSERT_UINT(1001, out2.src.addr6.l4, "out tuple");
+
+	/* Same addresses, different ID */
+	init_key(&key, 1235);
+	success &= ASSERT_INT(-ENOSPC, fetch_or_hold(cache, &key, NULL,
+			&in2, &out2, &garbage), "different ID");
+
+	success &= ASSERT_UINT(0, skb_queue_len(&garbage), "garbage");
+	return success;
+}
+
+static bool out_of_order_test(void)
+{
+	struct fragcache_key key;
+	struct tuple in, out;
+	struct sk_buff_head pending;
+	struct sk_buff *skb1, *skb2;
+	bool success = true;
+
+	__skb_queue_head_init(&pending);
+	init_key(&key, 1234);
+	init_tuples(&in, &out, 1000);
+
+	skb1 = new_skb();
+	skb2 = new_skb();
+	if (!skb1 || !skb2) {
+		kfree_skb(skb1);
+		kfree_skb(skb2);
+		return false;
+	}
+
+	success &= ASSERT_INT(1, fetch_or_hold(cache, &key, skb1, &in, &out,
+			&garbage), "hold 1");
+	success &= ASSERT_INT(1, fetch_or_hold(cache, &key, skb2, &in, &out,
+			&garbage), "hold 2");
+	success &= ASSERT_UINT(2, cache->pending, "pending count");
+	success &= ASSERT_UINT(1, cache->count, "entry count");
+
+	/* The first fragment arrives */
+	store(cache, &key, &in, &out, &pending, &garbage);
+	success &= ASSERT_UINT(2, skb_queue_len(&pending), "released");
+	success &= ASSERT_PTR(skb1, skb_peek(&pending), "order 1");
+	success &= ASSERT_PTR(skb2, skb_peek_tail(&pending), "order 2");
+	success &= ASSERT_UINT(0, cache->pending, "pending count after");
+
+	__skb_queue_purge(&pending);
+	return success;
+}
+
+static bool expiration_test(void)
+{
+	struct fragcache_key key;
+	struct tuple in, out;
+	struct fragcache_entry *entry;
+	struct sk_buff *skb;
+	bool success = true;
+
+	init_key(&key, 1234);
+	init_tuples(&in, &out, 1000);
+
+	skb = new_skb();
+	if (!skb)
+		return false;
+	success &= ASSERT_INT(1, fetch_or_hold(cache, &key, skb, &in, &out,
+			&garbage), "hold");
+
+	/* Pretend the first fragment never arrived */
+	entry = list_first_entry(&cache->list, struct fragcache_entry,
+			list_hook);
+	entry->expires = jiffies - 1;
+
+	init_key(&key, 1235);
+	store(cache, &key, &in, &out, NULL, &garbage);
+	success &= ASSERT_UINT(1, skb_queue_len(&garbage), "expired fragment");
+	success &= ASSERT_UINT(1, cache->count, "expired entry");
+	success &= ASSERT_UINT(0, cache->pending, "pending count");
+
+	__skb_queue_purge(&garbage);
+	return success;
+}
+
+static bool device_test(void)
+{
+	struct fragcache_key key;
+	struct tuple in, out;
+	struct sk_buff_head pending;
+	struct sk_buff *skb1, *skb2;
+	struct net_device *dev;
+	bool success = true;
+
+	__skb_queue_head_init(&pending);
+	init_key(&key, 1234);
+	init_tuples(&in, &out, 1000);
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	skb1 = new_skb();
+	skb2 = new_skb();
+	if (!dev || !skb1 || !skb2) {
+		kfree(dev);
+		kfree_skb(skb1);
+		kfree_skb(skb2);
+		return false;
+	}
+
+	skb1->dev = init_net.loopback_dev;
+	skb2->dev = dev;
+	dev->ifindex = INT_MAX;
+
+	success &= ASSERT_INT(1, fetch_or_hold(cache, &key, skb1, &in, &out,
+			&garbage), "hold 1");
+	success &= ASSERT_INT(1, fetch_or_hold(cache, &key, skb2, &in, &out,
+			&garbage), "hold 2");
+	success &= ASSERT_PTR(NULL, skb1->dev, "held without device 1");
+	success &= ASSERT_PTR(NULL, skb2->dev, "held without device 2");
+
+	/* skb2's device unregisters while it waits */
+	kfree(dev);
+
+	store(cache, &key, &in, &out, &pending, &garbage);
+	rcu_read_lock();
+	restore_devs(&init_net, &pending, &garbage);
+	rcu_read_unlock();
+
+	success &= ASSERT_UINT(1, skb_queue_len(&pending), "released");
+	success &= ASSERT_PTR(skb1, skb_peek(&pending), "survivor");
+	success &= ASSERT_PTR(init_net.loopback_dev, skb1->dev, "restored");
+	success &= ASSERT_UINT(1, skb_queue_len(&garbage), "orphan dropped");
+	success &= ASSERT_PTR(skb2, skb_peek(&garbage), "orphan");
+
+	__skb_queue_purge(&pending);
+	__skb_queue_purge(&garbage);
+	return success;
+}
+
+static bool bounds_test(void)
+{
+	struct fragcache_key key;
+	struct tuple in, out;
+	struct sk_buff *skb;
+	unsigned int i;
+	bool success = true;
+
+	init_tuples(&in, &out, 1000);
+
+	for (i = 0; i < FRAGCACHE_MAX_ENTRIES + 10; i++) {
+		init_key(&key, i);
+		store(cache, &key, &in, &out, NULL, &garbage);
+	}
+	success &= ASSERT_UINT(FRAGCACHE_MAX_ENTRIES, cache->count, "entries");
+
+	/* The oldest ones were forgotten */
+	init_key(&key, 0);
+	success &= ASSERT_INT(-ENOSPC, fetch_or_hold(cache, &key, NULL,
+			&in, &out, &garbage), "oldest");
+	init_key(&key, FRAGCACHE_MAX_ENTRIES + 9);
+	success &= ASSERT_INT(0, fetch_or_hold(cache, &key, NULL,
+			&in, &out, &garbage), "newest");
+
+	for (i = 0; i < FRAGCACHE_MAX_PENDING; i++) {
+		skb = new_skb();
+		if (!skb)
+			return false;
+		init_key(&key, 100000 + i);
+		if (fetch_or_hold(cache, &key, skb, &in, &out, &garbage) != 1) {
+			kfree_skb(skb);
+			return false;
+		}
+	}
+
+	skb = new_skb();
+	if (!skb)
+		return false;
+	init_key(&key, 200000);
+	success &= ASSERT_INT(-ENOSPC, fetch_or_hold(cache, &key, skb,
+			&in, &out, &garbage), "too many pending");
+	kfree_skb(skb);
+
+	return success;
+}
+
+static int fragcache_test_init(void)
+{
+	struct test_group test = {
+		.name = "fragcache",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, store_fetch_test, "store and fetch");
+	test_group_test(&test, out_of_order_test, "out of order fragments");
+	test_group_test(&test, expiration_test, "expiration");
+	test_group_test(&test, device_test, "device unregistration");
+	test_group_test(&test, bounds_test, "bounds");
+
+	return test_group_end(&test);
+}
+
+static void fragcache_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(fragcache_test_init);
+module_exit(fragcache_test_exit);
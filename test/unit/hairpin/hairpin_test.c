@@ -0,0 +1,399 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+#include "framework/send_packet.h"
+#include "framework/skb_generator.h"
+#include "framework/unit_test.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
+#include "mod/common/db/pool4/rfc6056.h"
+#include "mod/common/rfc7915/core.h"
+#include "mod/common/steps/compute_outgoing_tuple.h"
+#include "mod/common/steps/determine_incoming_tuple.h"
+#include "mod/common/steps/filtering_and_updating.h"
+#include "mod/common/steps/handling_hairpinning_nat64.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Unit tests for the direct hairpinning shortcut");
+
+/*
+ * Node 2001:db8::1 speaks to node 2001:db8::2 through the NAT64's own pool4
+ * address. The direct hairpin is supposed to produce the exact same packet the
+ * two legs (6->4, then 4->6) would.
+ *
+ * Each leg runs on a fresh instance, so neither sees the other's sessions.
+ */
+
+static struct xlator jool;
+static struct xlation state; /* Too large for the stack. */
+
+#define POOL4_ADDR "192.0.2.128"
+#define POOL4_ADDR6 "64:ff9b::c000:280"
+/* The only port that can be assigned to 2001:db8::1. */
+#define DYNAMIC_PORT 1024
+/* 2001:db8::2's static BIB entry. */
+#define STATIC_PORT 2000
+
+static int add_pool4(l4_protocol proto, __u16 port)
+{
+	struct pool4_entry entry;
+	int error;
+
+	entry.mark = 0;
+	entry.iterations = 0;
+	entry.flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	error = str_to_addr4(POOL4_ADDR, &entry.range.prefix.addr);
+	if (error)
+		return error;
+	entry.range.prefix.len = 32;
+	entry.range.ports.min = port;
+	entry.range.ports.max = port;
+	entry.proto = proto;
+
+	return pool4db_add(jool.nat64.pool4, &entry, NULL, false);
+}
+
+static int add_bib(l4_protocol proto)
+{
+	struct bib_entry entry;
+	int error;
+
+	error = str_to_addr6("2001:db8::2", &entry.addr6.l3);
+	if (error)
+		return error;
+	entry.addr6.l4 = STATIC_PORT;
+	error = str_to_addr4(POOL4_ADDR, &entry.addr4.l3);
+	if (error)
+		return error;
+	entry.addr4.l4 = STATIC_PORT;
+	entry.l4_proto = proto;
+
+	return bib_add_static(&jool, &entry);
+}
+
+static void clean_instance(void)
+{
+	xlator_put(&jool);
+	xlator_rm(XT_NAT64, INAME_DEFAULT);
+}
+
+static int init_instance(void)
+{
+	struct ipv6_prefix pool6;
+	int error;
+
+	pool6.len = 96;
+	error = str_to_addr6("64:ff9b::", &pool6.addr);
+	if (error)
+		return error;
+
+	error = xlator_add(XF_NETFILTER | XT_NAT64, INAME_DEFAULT, &pool6,
+			&jool);
+	if (error)
+		return error;
+
+	error = add_pool4(L4PROTO_TCP, DYNAMIC_PORT);
+	if (error)
+		goto fail;
+	error = add_pool4(L4PROTO_TCP, STATIC_PORT);
+	if (error)
+		goto fail;
+	error = add_bib(L4PROTO_TCP);
+	if (error)
+		goto fail;
+	error = add_pool4(L4PROTO_UDP, DYNAMIC_PORT);
+	if (error)
+		goto fail;
+	error = add_pool4(L4PROTO_UDP, STATIC_PORT);
+	if (error)
+		goto fail;
+	error = add_bib(L4PROTO_UDP);
+	if (error)
+		goto fail;
+	error = add_pool4(L4PROTO_ICMP, DYNAMIC_PORT);
+	if (error)
+		goto fail;
+
+	return 0;
+
+fail:
+	clean_instance();
+	return error;
+}
+
+typedef int (*build_fn)(struct sk_buff **);
+
+static int tcp(struct sk_buff **skb)
+{
+	return create_skb6_tcp("2001:db8::1", 1000, POOL4_ADDR6, STATIC_PORT,
+			100, 32, skb);
+}
+
+static int udp(struct sk_buff **skb)
+{
+	return create_skb6_udp("2001:db8::1", 1000, POOL4_ADDR6, STATIC_PORT,
+			100, 32, skb);
+}
+
+/* Too big for the (fake) nexthop MTU, 1500. */
+static int big_udp(struct sk_buff **skb)
+{
+	return create_skb6_udp("2001:db8::1", 1000, POOL4_ADDR6, STATIC_PORT,
+			1500, 32, skb);
+}
+
+/* Hairpinned pings go back to their own sender. */
+static int ping(struct sk_buff **skb)
+{
+	return create_skb6_icmp_info("2001:db8::1", POOL4_ADDR6, 1000,
+			100, 32, skb);
+}
+
+/* Steps 1 through 3, as core does them. */
+static bool nat64_steps(build_fn build)
+{
+	struct sk_buff *skb;
+
+	xlation_init(&state, &jool);
+	skb_out = NULL;
+
+	if (build(&skb))
+		return false;
+	state.in.skb = skb;
+
+	return ASSERT_VERDICT(CONTINUE, pkt_init_ipv6(&state, skb), "pkt_init")
+	    && ASSERT_VERDICT(CONTINUE, determine_in_tuple(&state), "step 1")
+	    && ASSERT_VERDICT(CONTINUE, filtering_and_updating(&state), "step 2")
+	    && ASSERT_VERDICT(CONTINUE, compute_out_tuple(&state), "step 3");
+}
+
+static void clean_state(void)
+{
+	if (skb_out && skb_out != state.in.skb)
+		kfree_skb(skb_out);
+	skb_out = NULL;
+	if (state.out.skb && state.out.skb != state.in.skb)
+		kfree_skb(state.out.skb);
+	kfree_skb(state.in.skb);
+	if (state.dst)
+		dst_release(state.dst);
+	clean_instance();
+}
+
+/*
+ * Returns the bytes of the packet that would reach the wire, or NULL.
+ * The caller has to kfree() them.
+ */
+static unsigned char *hairpin(build_fn build, bool direct, unsigned int *len)
+{
+	unsigned char *result = NULL;
+	bool success;
+
+	if (init_instance())
+		return NULL;
+
+	if (!nat64_steps(build))
+		goto end;
+
+	success = ASSERT_BOOL(direct, hairpin_nat64_direct_viable(&state),
+			"Direct hairpin viable");
+	if (direct) {
+		success &= ASSERT_VERDICT(CONTINUE,
+				handling_hairpinning_nat64_direct(&state),
+				"Direct hairpin");
+		success &= ASSERT_PTR(state.in.skb, skb_out,
+				"Sent the incoming packet");
+	} else {
+		success &= ASSERT_VERDICT(CONTINUE,
+				translating_the_packet(&state), "First leg");
+		if (!success)
+			goto end;
+		success &= ASSERT_BOOL(true, is_hairpin_nat64(&state),
+				"Hairpin detected");
+		success &= ASSERT_VERDICT(CONTINUE,
+				handling_hairpinning_nat64(&state),
+				"Second leg");
+	}
+	if (!success)
+		goto end;
+	if (!skb_out) {
+		log_err("Nothing was sent.");
+		goto end;
+	}
+
+	*len = skb_out->len;
+	result = kmalloc(*len, GFP_KERNEL);
+	if (!result) {
+		log_err("Cannot allocate the comparison buffer.");
+		goto end;
+	}
+	if (skb_copy_bits(skb_out, 0, result, *len)) {
+		log_err("skb_copy_bits() failed.");
+		kfree(result);
+		result = NULL;
+	}
+	/* Fall through */
+
+end:
+	clean_state();
+	return result;
+}
+
+/*
+ * Sends a packet that doesn't fit the nexthop MTU. Whichever the path, it
+ * has to be dropped silently, because the second leg's errors are not reported.
+ */
+static bool drop_too_big(bool direct)
+{
+	verdict result;
+	bool success = true;
+
+	if (init_instance())
+		return false;
+
+	if (!nat64_steps(big_udp)) {
+		success = false;
+		goto end;
+	}
+
+	if (direct) {
+		success &= ASSERT_BOOL(true, hairpin_nat64_direct_viable(&state),
+				"Direct hairpin viable");
+		result = handling_hairpinning_nat64_direct(&state);
+	} else {
+		result = translating_the_packet(&state);
+		if (result == VERDICT_CONTINUE)
+			result = handling_hairpinning_nat64(&state);
+	}
+
+	success &= ASSERT_VERDICT(DROP, result, "%s verdict",
+			direct ? "direct" : "two legs");
+	success &= ASSERT_UINT(ICMPERR_NONE, state.result.icmp, "%s ICMP error",
+			direct ? "direct" : "two legs");
+	success &= ASSERT_PTR(NULL, skb_out, "%s sent something",
+			direct ? "direct" : "two legs");
+	/* Fall through */
+
+end:
+	clean_state();
+	return success;
+}
+
+static bool compare_legs(build_fn build)
+{
+	unsigned char *two_legs;
+	unsigned char *direct;
+	unsigned int two_legs_len;
+	unsigned int direct_len;
+	unsigned int i;
+	bool success = true;
+
+	two_legs = hairpin(build, false, &two_legs_len);
+	if (!two_legs)
+		return false;
+	direct = hairpin(build, true, &direct_len);
+	if (!direct) {
+		kfree(two_legs);
+		return false;
+	}
+
+	success &= ASSERT_UINT(two_legs_len, direct_len, "Length");
+	for (i = 0; success && i < direct_len; i++) {
+		if (two_legs[i] != direct[i]) {
+			log_err("Byte %u differs. Two legs: 0x%02x; direct: 0x%02x",
+					i, two_legs[i], direct[i]);
+			success = false;
+		}
+	}
+
+	kfree(two_legs);
+	kfree(direct);
+	return success;
+}
+
+static bool test_tcp(void)
+{
+	return compare_legs(tcp);
+}
+
+static bool test_udp(void)
+{
+	return compare_legs(udp);
+}
+
+static bool test_ping(void)
+{
+	return compare_legs(ping);
+}
+
+static bool test_too_big(void)
+{
+	return drop_too_big(false) && drop_too_big(true);
+}
+
+static void defrag_dummy(struct net *ns)
+{
+	/* No code */
+}
+
+static int setup(void)
+{
+	int error;
+
+	error = xlation_setup();
+	if (error)
+		goto xlation_fail;
+	error = rfc6056_setup();
+	if (error)
+		goto rfc6056_fail;
+	error = xlator_setup();
+	if (error)
+		goto xlator_fail;
+	xlator_set_defrag(defrag_dummy);
+
+	return 0;
+
+xlator_fail:
+	rfc6056_teardown();
+rfc6056_fail:
+	xlation_teardown();
+xlation_fail:
+	return error;
+}
+
+static void teardown(void)
+{
+	xlator_teardown();
+	rfc6056_teardown();
+	xlation_teardown();
+	bib_teardown();
+}
+
+static int hairpin_test_init(void)
+{
+	struct test_group test = {
+		.name = "Hairpinning",
+		.setup_fn = setup,
+		.teardown_fn = teardown,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, test_tcp, "TCP");
+	test_group_test(&test, test_udp, "UDP");
+	test_group_test(&test, test_ping, "ICMP echo");
+	test_group_test(&test, test_too_big, "Packet too big");
+
+	return test_group_end(&test);
+}
+
+static void hairpin_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(hairpin_test_init);
+module_exit(hairpin_test_exit);
@@ -6,13 +6,13 @@
 static int sent = 0;
 
 bool icmp64_send6(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info)
+		icmp_error_code error, __u32 info, bool debug)
 {
 	return icmp64_send(jool, skb, error, info);
 }
 
 bool icmp64_send4(struct xlator *jool, struct sk_buff *skb,
-		icmp_error_code error, __u32 info)
+		icmp_error_code error, __u32 info, bool debug)
 {
 	return icmp64_send(jool, skb, error, info);
 }
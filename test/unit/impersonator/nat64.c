@@ -1,4 +1,5 @@
 #include "mod/common/joold.h"
+#include "mod/common/db/fragcache.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/db.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
@@ -86,6 +87,33 @@ void bib_put(struct bib *db)
 	fail(__func__);
 }
 
+struct fragcache *fragcache_alloc(void)
+{
+	fail(__func__);
+	return NULL;
+}
+
+void fragcache_get(struct fragcache *cache)
+{
+	fail(__func__);
+}
+
+void fragcache_put(struct fragcache *cache)
+{
+	fail(__func__);
+}
+
+verdict fragcache_find(struct xlation *state)
+{
+	fail(__func__);
+	return VERDICT_DROP;
+}
+
+void fragcache_add(struct xlation *state, struct sk_buff_head *pending)
+{
+	fail(__func__);
+}
+
 bool is_hairpin_nat64(struct xlation *state)
 {
 	fail(__func__);
@@ -97,3 +125,15 @@ verdict handling_hairpinning_nat64(struct xlation *old)
 	fail(__func__);
 	return VERDICT_DROP;
 }
+
+bool hairpin_nat64_direct_viable(struct xlation *state)
+{
+	fail(__func__);
+	return false;
+}
+
+verdict handling_hairpinning_nat64_direct(struct xlation *state)
+{
+	fail(__func__);
+	return VERDICT_DROP;
+}
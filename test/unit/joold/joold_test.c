@@ -1,5 +1,6 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/timekeeping.h>
 
 #include "framework/bib.h"
 #include "framework/unit_test.h"
@@ -14,11 +15,11 @@ static struct session_entry ss[9];
 
 /********************** Mocks **********************/
 
-struct sk_buff *sent;
+static struct sk_buff_head sent;
 
 void sendpkt_multicast(struct xlator *jool, struct sk_buff *skb)
 {
-	sent = skb;
+	skb_queue_tail(&sent, skb);
 }
 
 static struct genl_family family_mock = {
@@ -46,7 +47,17 @@ int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 	if (proto != L4PROTO_TCP)
 		return 0;
 
-	for (s = foreach_start; s < foreach_end; s++) {
+	s = foreach_start;
+	if (offset) {
+		while (s < foreach_end && !(
+				taddr4_equals(&ss[s].src4, &offset->offset.src) &&
+				taddr4_equals(&ss[s].dst4, &offset->offset.dst)))
+			s++;
+		if (!offset->include_offset)
+			s++;
+	}
+
+	for (; s < foreach_end; s++) {
 		error = cb(&ss[s], cb_arg);
 		if (error)
 			return error;
@@ -55,11 +66,15 @@ int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 	return 0;
 }
 
-int bib_add_session(struct xlator *jool,
-		struct session_entry *session,
-		struct collision_cb *cb)
+static unsigned int applied;
+
+void bib_add_sessions(struct xlator *jool, struct bib_add_request *reqs,
+		unsigned int count, fate_cb cb)
 {
-	return -EINVAL;
+	unsigned int i;
+	for (i = 0; i < count; i++)
+		reqs[i].error = 0;
+	applied += count;
 }
 
 void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat)
@@ -107,6 +122,7 @@ static int init_sessions(void)
 	unsigned int i;
 	for (i = 0; i < ARRAY_SIZE(ss); i++)
 		init_session(i, &ss[i]);
+	skb_queue_head_init(&sent);
 	return 0;
 }
 
@@ -117,30 +133,68 @@ static struct joold_queue *init_xlator(struct xlator *jool)
 	jool->globals.nat64.joold.flush_deadline = 2000;
 	jool->globals.nat64.joold.capacity = 4;
 	jool->globals.nat64.joold.max_sessions_per_pkt = 3;
+	jool->globals.nat64.joold.window = 1;
+	jool->globals.nat64.joold.max_payload = DEFAULT_JOOLD_MAX_PAYLOAD;
+	jool->globals.nat64.joold.compact = false;
+	jool->globals.nat64.joold.lz4 = false;
+	jool->globals.nat64.joold.tcp = true;
+	jool->globals.nat64.joold.udp = true;
+	jool->globals.nat64.joold.icmp = true;
+	jool->globals.nat64.joold.include_ports.min = 0;
+	jool->globals.nat64.joold.include_ports.max = 65535;
+	jool->globals.nat64.joold.exclude_ports.min = 65535;
+	jool->globals.nat64.joold.exclude_ports.max = 0;
 	jool->nat64.joold = joold_alloc();
 	return jool->nat64.joold;
 }
 
 /********************** Asserts **********************/
 
-static bool assert_deferred(struct joold_queue *joold, ...)
+static bool assert_queue(struct joold_queue *joold, unsigned int in_flight,
+		bool ad_ongoing, char *test)
+{
+	bool success = true;
+
+	success &= ASSERT_UINT(in_flight, joold->next_seq - joold->acked_seq,
+			"%s in flight", test);
+	success &= ASSERT_BOOL(ad_ongoing, !!(joold->flags & JQF_AD_ONGOING),
+			"%s ad ongoing", test);
+
+	return success;
+}
+
+/* Checks the number of the next packet in the sent queue. */
+static bool assert_seq(__u32 expected)
+{
+	struct sk_buff *skb;
+	struct nlattr *attr;
+
+	skb = skb_peek(&sent);
+	if (!ASSERT_NOTNULL(skb, "skb was sent"))
+		return false;
+
+	attr = nlmsg_find_attr(nlmsg_hdr(skb), GENL_HDRLEN + JOOLNL_HDRLEN,
+			JNLAR_JOOLD_SEQ);
+	if (!ASSERT_NOTNULL(attr, "seq attribute"))
+		return false;
+
+	return ASSERT_UINT(expected, nla_get_u32(attr), "seq");
+}
+
+static bool assert_list(struct counted_list *list, va_list args)
 {
 	struct session_entry *expected;
 	struct deferred_session *actual;
 	unsigned int count;
-	va_list args;
 	bool success = true;
 
-	va_start(args, joold);
-
 	count = 0;
-	list_for_each_entry(actual, &joold->deferred.list, lh) {
+	list_for_each_entry(actual, &list->list, lh) {
 		expected = va_arg(args, struct session_entry *);
 		if (!expected) {
-			log_err("Unexpected deferred session: " SEPP,
+			log_err("Unexpected session: " SEPP,
 					SEPA(&actual->session));
-			success = false;
-			goto end;
+			return false;
 		}
 
 		success &= ASSERT_SESSION(expected, &actual->session, "listed");
@@ -149,22 +203,107 @@ static bool assert_deferred(struct joold_queue *joold, ...)
 
 	expected = va_arg(args, struct session_entry *);
 	if (expected != NULL) {
-		log_err("Session missing from deferred: " SEPP, SEPA(expected));
-		success = false;
-		goto end;
+		log_err("Session missing: " SEPP, SEPA(expected));
+		return false;
 	}
 
-	success &= ASSERT_UINT(count, joold->deferred.count, "count");
+	return success & ASSERT_UINT(count, list->count, "count");
+}
+
+/* Checks the queue, after merging the CPUs' sessions into it. */
+static bool assert_deferred(struct xlator *jool, ...)
+{
+	struct joold_queue *joold;
+	va_list args;
+	bool success;
+
+	joold = jool->nat64.joold;
+	spin_lock_bh(&joold->lock);
+	merge_cpus(jool);
+	spin_unlock_bh(&joold->lock);
+
+	va_start(args, jool);
+	success = assert_list(&joold->deferred, args);
+	va_end(args);
 
-end:	va_end(args);
 	return success;
 }
 
+/* Checks the advertisement's fetched sessions. */
+static bool assert_ad(struct joold_queue *joold, ...)
+{
+	va_list args;
+	bool success;
+
+	va_start(args, joold);
+	success = assert_list(&joold->ad, args);
+	va_end(args);
+
+	return success;
+}
+
+static void init_cfg(struct jool_globals *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->pool6.prefix.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9b);
+	cfg->pool6.prefix.len = 96;
+	cfg->nat64.bib.ttl.tcp_est = 1000 * TCP_EST;
+	cfg->nat64.bib.ttl.tcp_trans = 1000 * TCP_TRANS;
+	cfg->nat64.bib.ttl.udp = 1000 * UDP_DEFAULT;
+	cfg->nat64.bib.ttl.icmp = 1000 * ICMP_DEFAULT;
+}
+
+/* Decodes compact batch @attr into @result. Returns the number of sessions. */
+static int get_batch(struct nlattr *attr, struct jool_globals *cfg,
+		struct session_entry *result, unsigned int max)
+{
+	struct joold_compact_hdr *hdr;
+	struct joold_record records[2];
+	__u8 *src;
+	unsigned int count, c;
+	int len, consumed;
+	int error;
+
+	hdr = nla_data(attr);
+	if (!ASSERT_UINT(JOOLD_COMPACT_VERSION, hdr->version, "version"))
+		return -EINVAL;
+	if (!ASSERT_UINT(0, hdr->flags, "flags"))
+		return -EINVAL;
+
+	count = be16_to_cpu(hdr->count);
+	len = be16_to_cpu(hdr->len);
+	if (!ASSERT_TRUE(count <= max, "batch session count"))
+		return -EINVAL;
+	if (!ASSERT_INT(nla_len(attr), (int)sizeof(*hdr) + len, "batch length"))
+		return -EINVAL;
+
+	src = (__u8 *)(hdr + 1);
+	for (c = 0; c < count; c++) {
+		consumed = joold_record_read(src, len,
+				c ? &records[!(c & 1)] : NULL,
+				&records[c & 1]);
+		if (consumed < 0)
+			return consumed;
+		src += consumed;
+		len -= consumed;
+
+		error = joold_record_to_session(cfg, &records[c & 1],
+				&result[c]);
+		if (error)
+			return error;
+	}
+
+	return ASSERT_INT(0, len, "batch leftover") ? count : -EINVAL;
+}
+
 static bool assert_skb(int garbage, ...)
 {
-	struct session_entry *expected, actual;
+	static struct session_entry actual[ARRAY_SIZE(ss)];
+	struct sk_buff *skb;
+	struct session_entry *expected;
 	struct nlattr *root, *attr;
 	struct jool_globals cfg;
+	unsigned int a, n;
 	int rem;
 	va_list args;
 	bool success;
@@ -174,42 +313,59 @@ static bool assert_skb(int garbage, ...)
 	expected = va_arg(args, struct session_entry *);
 	va_end(args);
 
+	skb = skb_dequeue(&sent);
 	if (expected != NULL) {
-		if (!ASSERT_NOTNULL(sent, "skb was sent"))
+		if (!ASSERT_NOTNULL(skb, "skb was sent"))
 			return false;
 	} else {
-		return ASSERT_NULL(sent, "skb was not sent");
+		success = ASSERT_NULL(skb, "skb was not sent");
+		kfree_skb(skb);
+		return success;
 	}
 
-	root = nlmsg_attrdata(nlmsg_hdr(sent), GENL_HDRLEN + JOOLNL_HDRLEN);
+	root = nlmsg_attrdata(nlmsg_hdr(skb), GENL_HDRLEN + JOOLNL_HDRLEN);
 	success = ASSERT_UINT(JNLAR_SESSION_ENTRIES, nla_type(root), "root");
 
-	memset(&cfg, 0, sizeof(cfg));
-	cfg.pool6.prefix.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9b);
-	cfg.pool6.prefix.len = 96;
-	cfg.nat64.bib.ttl.tcp_est = 1000 * TCP_EST;
-	cfg.nat64.bib.ttl.tcp_trans = 1000 * TCP_TRANS;
-	cfg.nat64.bib.ttl.udp = 1000 * UDP_DEFAULT;
-	cfg.nat64.bib.ttl.icmp = 1000 * ICMP_DEFAULT;
+	init_cfg(&cfg);
 
 	va_start(args, garbage);
 
+	n = 0;
 	nla_for_each_nested(attr, root, rem) {
-		error = jnla_get_session_joold(attr, "session", &cfg, &actual);
+		if (nla_type(attr) == JNLAJ_BATCH) {
+			error = get_batch(attr, &cfg, &actual[n],
+					ARRAY_SIZE(actual) - n);
+			if (error < 0) {
+				log_err("get_batch: errcode %d", error);
+				success = false;
+				goto end;
+			}
+			n += error;
+			continue;
+		}
+
+		if (!ASSERT_TRUE(n < ARRAY_SIZE(actual), "session count")) {
+			success = false;
+			goto end;
+		}
+		error = jnla_get_session_joold(attr, "session", &cfg, &actual[n]);
 		if (error) {
 			log_err("jnla_get_session: errcode %d", error);
 			success = false;
 			goto end;
 		}
+		n++;
+	}
 
+	for (a = 0; a < n; a++) {
 		expected = va_arg(args, struct session_entry *);
 		if (!expected) {
-			log_err("Unexpected pkt session: " SEPP, SEPA(&actual));
+			log_err("Unexpected pkt session: " SEPP, SEPA(&actual[a]));
 			success = false;
 			goto end;
 		}
 
-		success &= ASSERT_SESSION(expected, &actual, "packet'd");
+		success &= ASSERT_SESSION(expected, &actual[a], "packet'd");
 	}
 
 	expected = va_arg(args, struct session_entry *);
@@ -219,8 +375,7 @@ static bool assert_skb(int garbage, ...)
 	}
 
 end:	va_end(args);
-	kfree_skb(sent);
-	sent = NULL;
+	kfree_skb(skb);
 	return success;
 }
 
@@ -233,6 +388,8 @@ static bool print_sizes(void)
 	struct joolnlhdr *jhdr;
 	struct nlattr *root;
 	struct session_entry dummy_session;
+	struct joold_record records[2];
+	unsigned int i;
 	size_t basic_size; /* NL header + GNL header + Jool header */
 	size_t root_size;
 	size_t session_size;
@@ -263,6 +420,19 @@ static bool print_sizes(void)
 	log_info("Netlink attribute header size: %zu", root_size);
 	log_info("Serialized session size: %zu", session_size);
 
+	/*
+	 * Compact format. Only the src6 prefix is shared between the test
+	 * sessions, so this is close to the worst case.
+	 */
+	session_size = 0;
+	for (i = 0; i < ARRAY_SIZE(ss); i++) {
+		joold_record_from_session(&records[i & 1], &ss[i]);
+		session_size += joold_record_len(i ? &records[!(i & 1)] : NULL,
+				&records[i & 1]);
+	}
+	log_info("Compact session size: %zu bytes per session (%zu sessions)",
+			session_size / ARRAY_SIZE(ss), ARRAY_SIZE(ss));
+
 end:	kfree_skb(skb);
 	return true;
 }
@@ -279,24 +449,24 @@ static bool test_no_flush_asap(void)
 
 	log_info("1");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags1");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	success &= assert_queue(joold, 0, false, "flags1");
+	success &= assert_deferred(&jool, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("2");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags2");
-	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
+	success &= assert_queue(joold, 0, false, "flags2");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("3");
 	joold_add(&jool, &ss[2]);
-	success &= ASSERT_UINT(0, joold->flags, "flags3");
-	success &= assert_deferred(joold, NULL);
+	success &= assert_queue(joold, 1, false, "flags3");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
@@ -305,32 +475,32 @@ static bool test_no_flush_asap(void)
 
 	log_info("4");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags1");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	success &= assert_queue(joold, 1, false, "flags1");
+	success &= assert_deferred(&jool, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("5");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(0, joold->flags, "flags2");
-	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
+	success &= assert_queue(joold, 1, false, "flags2");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("6");
 	joold_add(&jool, &ss[2]);
-	success &= ASSERT_UINT(0, joold->flags, "flags3");
-	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], NULL);
+	success &= assert_queue(joold, 1, false, "flags3");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], &ss[2], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("7");
 	joold_add(&jool, &ss[3]);
-	success &= ASSERT_UINT(0, joold->flags, "flags4");
-	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
+	success &= assert_queue(joold, 1, false, "flags4");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -338,26 +508,26 @@ static bool test_no_flush_asap(void)
 	/* Capacity exceeded; drop new session */
 	log_info("8");
 	joold_add(&jool, &ss[4]);
-	success &= ASSERT_UINT(0, joold->flags, "flags5");
-	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
+	success &= assert_queue(joold, 1, false, "flags5");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	/* ACK */
 	log_info("9");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags6");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, false, "flags6");
+	success &= assert_deferred(&jool, &ss[3], NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
 
 	/* ACK again */
 	log_info("10");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags7");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags7");
+	success &= assert_deferred(&jool, &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -365,25 +535,25 @@ static bool test_no_flush_asap(void)
 	/* Refill; make sure we're still stable after the ACK */
 	log_info("11");
 	joold_add(&jool, &ss[4]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags8");
-	success &= assert_deferred(joold, &ss[3], &ss[4], NULL);
+	success &= assert_queue(joold, 0, false, "flags8");
+	success &= assert_deferred(&jool, &ss[3], &ss[4], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("12");
 	joold_add(&jool, &ss[5]);
-	success &= ASSERT_UINT(0, joold->flags, "flags9");
-	success &= assert_deferred(joold, NULL);
+	success &= assert_queue(joold, 1, false, "flags9");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
 	if (!success)
 		goto end;
 
 	/* Try an ACK on an empty joold */
 	log_info("13");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags10");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags10");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, NULL);
 
 end:	joold_put(joold);
@@ -404,8 +574,8 @@ static bool test_advertise(void)
 	log_info("1");
 	foreach_end = 0;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags1");
-	success &= assert_deferred(joold, NULL);
+	success &= assert_queue(joold, 0, false, "flags1");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -414,8 +584,8 @@ static bool test_advertise(void)
 	log_info("2");
 	foreach_end = 1;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags2");
-	success &= assert_deferred(joold, NULL);
+	success &= assert_queue(joold, 1, false, "flags2");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
 		goto end;
@@ -423,26 +593,27 @@ static bool test_advertise(void)
 	/* Single session advertise, postponed because no ACK */
 	log_info("3");
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags3");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	success &= assert_queue(joold, 1, true, "flags3");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_ad(joold, NULL); /* Not even fetched yet */
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	/* ACK */
 	log_info("4");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags4");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, false, "flags4");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
 		goto end;
 
 	/* Enable JQF_ACK_RECEIVED */
 	log_info("5");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags5");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags5");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -451,17 +622,17 @@ static bool test_advertise(void)
 	log_info("6");
 	foreach_end = 3;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags6");
-	success &= assert_deferred(joold, NULL);
+	success &= assert_queue(joold, 1, false, "flags6");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
 
 	/* Enable JQF_ACK_RECEIVED */
 	log_info("7");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags7");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags7");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -470,8 +641,9 @@ static bool test_advertise(void)
 	log_info("8");
 	foreach_end = 4;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags8");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	success &= assert_queue(joold, 1, true, "flags8");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_ad(joold, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
@@ -479,17 +651,18 @@ static bool test_advertise(void)
 	/* Make sure advertises don't stack */
 	log_info("9");
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags9");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	success &= assert_queue(joold, 1, true, "flags9");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_ad(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	/* Send 2nd packet */
 	log_info("10");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags10");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, false, "flags10");
+	success &= assert_deferred(&jool, NULL);
 	success &= assert_skb(0, &ss[3], NULL);
 	if (!success)
 		goto end;
@@ -497,70 +670,401 @@ static bool test_advertise(void)
 	/* Large advertise, and joold isn't empty */
 	log_info("11");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags11");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	success &= assert_queue(joold, 1, false, "flags11");
+	success &= assert_deferred(&jool, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("12");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags12");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags12");
+	success &= assert_deferred(&jool, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("13");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags13");
-	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
+	success &= assert_queue(joold, 0, false, "flags13");
+	success &= assert_deferred(&jool, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
+	/* Only one batch is fetched; the queue gets the first turn. */
 	log_info("14");
 	foreach_start = 2;
 	foreach_end = 8;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags14");
-	success &= assert_deferred(joold, &ss[3], &ss[4], &ss[5], &ss[6],
-			&ss[7], NULL);
-	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	success &= assert_queue(joold, 1, true, "flags14");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_ad(joold, &ss[2], &ss[3], &ss[4], NULL);
+	success &= assert_skb(0, &ss[0], &ss[1], NULL);
 	if (!success)
 		goto end;
 
 	log_info("15");
 	joold_add(&jool, &ss[8]);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags15");
-	success &= assert_deferred(joold, &ss[3], &ss[4], &ss[5], &ss[6],
-			&ss[7], &ss[8], NULL);
+	success &= assert_queue(joold, 1, true, "flags15");
+	success &= assert_deferred(&jool, &ss[8], NULL);
+	success &= assert_ad(joold, &ss[2], &ss[3], &ss[4], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("16");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags16");
-	success &= assert_deferred(joold, &ss[6], &ss[7], &ss[8], NULL);
-	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, true, "flags16");
+	success &= assert_deferred(&jool, &ss[8], NULL);
+	success &= assert_ad(joold, NULL);
+	success &= assert_skb(0, &ss[2], &ss[3], &ss[4], NULL);
 	if (!success)
 		goto end;
 
+	/* The rest of the advertisement is fetched, but it's the queue's turn */
 	log_info("17");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags17");
-	success &= assert_deferred(joold, NULL);
-	success &= assert_skb(0, &ss[6], &ss[7], &ss[8], NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, true, "flags17");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_ad(joold, &ss[5], &ss[6], &ss[7], NULL);
+	success &= assert_skb(0, &ss[8], NULL);
 	if (!success)
 		goto end;
 
 	log_info("18");
-	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags18");
-	success &= assert_deferred(joold, NULL);
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 1, false, "flags18");
+	success &= assert_ad(joold, NULL);
+	success &= assert_skb(0, &ss[5], &ss[6], &ss[7], NULL);
+	if (!success)
+		goto end;
+
+	log_info("19");
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "flags19");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_skb(0, NULL);
+
+end:	skb_queue_purge(&sent);
+	joold_put(joold);
+	return success;
+}
+
+static bool test_window(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	__u32 seq;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+	jool.globals.nat64.joold.capacity = 16;
+	jool.globals.nat64.joold.window = 3;
+
+	/* The whole window is used at once */
+	log_info("1");
+	foreach_start = 0;
+	foreach_end = 8;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, 3, false, "1");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_seq(0);
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	success &= assert_seq(1);
+	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	success &= assert_seq(2);
+	success &= assert_skb(0, &ss[6], &ss[7], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Window full */
+	log_info("2");
+	joold_add(&jool, &ss[8]);
+	success &= assert_queue(joold, 3, false, "2");
+	success &= assert_deferred(&jool, &ss[8], NULL);
 	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Room, but the packet isn't full yet */
+	log_info("3");
+	seq = 0;
+	joold_ack(&jool, &seq);
+	success &= assert_queue(joold, 2, false, "3");
+	success &= assert_deferred(&jool, &ss[8], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	log_info("4");
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	success &= assert_queue(joold, 3, false, "4");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_seq(3);
+	success &= assert_skb(0, &ss[8], &ss[0], &ss[1], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Duplicate ACK */
+	log_info("5");
+	joold_ack(&jool, &seq);
+	success &= assert_queue(joold, 3, false, "5");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* ACKs are cumulative */
+	log_info("6");
+	seq = 3;
+	joold_ack(&jool, &seq);
+	success &= assert_queue(joold, 0, false, "6");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Old daemon; nothing in flight */
+	log_info("7");
+	joold_ack(&jool, NULL);
+	success &= assert_queue(joold, 0, false, "7");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* The deadline reclaims the window */
+	log_info("8");
+	foreach_end = 9;
+	joold_advertise(&jool);
+	joold_add(&jool, &ss[0]);
+	success &= assert_queue(joold, 3, false, "8");
+	success &= assert_deferred(&jool, &ss[0], NULL);
+	skb_queue_purge(&sent);
+	if (!success)
+		goto end;
+
+	log_info("9");
+	joold->last_flush_time = jiffies - msecs_to_jiffies(3000);
+	joold_add(&jool, &ss[1]);
+	success &= assert_queue(joold, 1, false, "9");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_seq(7);
+	success &= assert_skb(0, &ss[0], &ss[1], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Late ACK from before the deadline */
+	log_info("10");
+	seq = 5;
+	joold_ack(&jool, &seq);
+	success &= assert_queue(joold, 1, false, "10");
+	success &= assert_skb(0, NULL);
+
+end:	skb_queue_purge(&sent);
+	joold_put(joold);
+	return success;
+}
+
+static bool test_coalesce(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	struct session_entry update;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+
+	log_info("1");
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	success &= assert_deferred(&jool, &ss[0], &ss[1], NULL);
+	if (!success)
+		goto end;
+
+	/* Same session, new state; replaces the queued copy in place. */
+	log_info("2");
+	update = ss[0];
+	update.state = 2;
+	update.timer_type = SESSION_TIMER_EST;
+	joold_add(&jool, &update);
+	success &= assert_deferred(&jool, &ss[0], &ss[1], NULL);
+	success &= ASSERT_UINT(2, first_deferred(&joold->deferred.list)
+			->session.state, "coalesced state");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	log_info("3");
+	joold_add(&jool, &ss[2]);
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	if (!success)
+		goto end;
+
+	/* The old copy is gone; the session needs to be queued anew. */
+	log_info("4");
+	joold_ack(&jool, NULL);
+	joold_add(&jool, &ss[0]);
+	success &= assert_deferred(&jool, &ss[0], NULL);
+
+end:	skb_queue_purge(&sent);
+	joold_put(joold);
+	return success;
+}
+
+static bool test_policy(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	struct joold_config *cfg;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+	cfg = &jool.globals.nat64.joold;
+	foreach_start = 0;
+	foreach_end = 2;
+
+	/* Protocol disabled */
+	log_info("1");
+	cfg->tcp = false;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, 0, false, "policy1");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Remote port (80) excluded, even though the local one is not */
+	log_info("2");
+	cfg->tcp = true;
+	cfg->exclude_ports.min = 80;
+	cfg->exclude_ports.max = 80;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, 0, false, "policy2");
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Only one of the ports needs to be included */
+	log_info("3");
+	cfg->exclude_ports.min = 65535;
+	cfg->exclude_ports.max = 0;
+	cfg->include_ports.min = 3000;
+	cfg->include_ports.max = 3000;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, 1, false, "policy3");
+	success &= assert_skb(0, &ss[0], &ss[1], NULL);
+
+end:	skb_queue_purge(&sent);
+	joold_put(joold);
+	return success;
+}
+
+static bool test_compact(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+	jool.globals.nat64.joold.compact = true;
+	jool.globals.nat64.joold.capacity = 8;
+
+	log_info("1");
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	joold_add(&jool, &ss[2]);
+	success &= assert_queue(joold, 1, false, "1");
+	success &= assert_deferred(&jool, NULL);
+	success &= assert_seq(0);
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/*
+	 * Only the first record carries every address. The rest share the
+	 * src6 prefix, so they're 12 + 8 + 4 + 4 bytes long.
+	 */
+	log_info("2");
+	joold_ack(&jool, NULL);
+	jool.globals.nat64.joold.max_payload = nla_total_size(
+			sizeof(struct joold_compact_hdr) + 36 + 28);
+	joold_add(&jool, &ss[3]);
+	joold_add(&jool, &ss[4]);
+	joold_add(&jool, &ss[5]);
+	success &= assert_queue(joold, 1, false, "2");
+	success &= assert_deferred(&jool, &ss[5], NULL);
+	success &= assert_seq(1);
+	success &= assert_skb(0, &ss[3], &ss[4], NULL);
+	success &= assert_skb(0, NULL);
+
+end:	skb_queue_purge(&sent);
+	joold_put(joold);
+	return success;
+}
+
+/*
+ * Not really a test; measures how fast a peer's sessions are parsed and handed
+ * over to the BIB. (The BIB is mocked, so only joold's half is measured.)
+ */
+static bool test_apply(void)
+{
+	static const unsigned int SESSIONS = 64;
+	static const unsigned int ROUNDS = 1000;
+	struct xlator jool;
+	struct joold_queue *joold;
+	struct sk_buff *skb;
+	struct nlattr *root;
+	struct session_entry session;
+	unsigned int i;
+	u64 start, elapsed;
+	bool success = true;
+
+	init_cfg(&jool.globals);
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+
+	skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!skb) {
+		success = false;
+		goto end;
+	}
+	root = nla_nest_start(skb, JNLAR_SESSION_ENTRIES);
+	for (i = 0; i < SESSIONS; i++) {
+		init_session(i, &session);
+		if (jnla_put_session_joold(skb, JNLAJ_SESSION, &session)) {
+			log_err("The skb ran out of room at session %u.", i);
+			success = false;
+			goto free;
+		}
+	}
+	nla_nest_end(skb, root);
+
+	applied = 0;
+	start = ktime_get_ns();
+	for (i = 0; i < ROUNDS; i++)
+		success &= ASSERT_INT(0, joold_sync(&jool, root), "sync");
+	elapsed = ktime_get_ns() - start;
+
+	success &= ASSERT_UINT(SESSIONS * ROUNDS, applied, "applied");
+	pr_info("Applied %u sessions in %llu ns (%llu sessions/s).\n",
+			SESSIONS * ROUNDS, elapsed,
+			div64_u64(1000000000ull * SESSIONS * ROUNDS,
+					elapsed ? elapsed : 1));
 
+free:	kfree_skb(skb);
 end:	joold_put(joold);
 	return success;
 }
@@ -579,6 +1083,11 @@ static int joold_test_init(void)
 	test_group_test(&test, print_sizes, "print sizes");
 	test_group_test(&test, test_no_flush_asap, "ss-flush-asap disabled");
 	test_group_test(&test, test_advertise, "advertise");
+	test_group_test(&test, test_window, "window");
+	test_group_test(&test, test_coalesce, "coalesce");
+	test_group_test(&test, test_policy, "policy");
+	test_group_test(&test, test_compact, "compact");
+	test_group_test(&test, test_apply, "apply");
 	return test_group_end(&test);
 }
 
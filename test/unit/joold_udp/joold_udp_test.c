@@ -0,0 +1,497 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/net.h>
+#include <linux/workqueue.h>
+#include <net/sock.h>
+
+#include "framework/unit_test.h"
+
+/*
+ * The transport's sockets and workqueue are replaced by the recorders below,
+ * so the tests can see what would have reached the group.
+ */
+#define kernel_sendmsg fake_sendmsg
+#define queue_work(wq, work) fake_queue_work(work)
+
+struct sent_dgram {
+	int type;
+	/* SEQ: sender, seq, first word of the payload. Others: The payload. */
+	__u32 words[3];
+};
+
+static struct sent_dgram sent[512];
+static unsigned int sent_count;
+static unsigned int resyncs_queued;
+
+static int fake_sendmsg(struct socket *sock, struct msghdr *msg,
+		struct kvec *vec, size_t num, size_t len);
+static bool fake_queue_work(struct work_struct *work);
+
+#include "mod/common/joold_udp.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("joold transport test.");
+
+#define ME 0x11111111u
+#define PEER 0x22222222u
+#define OTHER 0x33333333u
+#define WRAP 0x44444444u
+
+static struct joold_udp udp; /* Too large for the stack. */
+static struct xlator jool;
+
+/********************** Mocks **********************/
+
+static int fake_sendmsg(struct socket *sock, struct msghdr *msg,
+		struct kvec *vec, size_t num, size_t len)
+{
+	struct nlattr *hdr = vec[0].iov_base;
+	struct sent_dgram *dgram;
+	__be32 *words;
+
+	if (sent_count >= ARRAY_SIZE(sent)) {
+		log_err("Too many datagrams.");
+		return -ENOSPC;
+	}
+
+	dgram = &sent[sent_count++];
+	dgram->type = hdr->nla_type;
+	if (hdr->nla_type == JNLAJ_SEQ) {
+		words = nla_data(hdr);
+		dgram->words[0] = be32_to_cpu(words[0]);
+		dgram->words[1] = be32_to_cpu(words[1]);
+		dgram->words[2] = *((__u32 *)vec[1].iov_base);
+	} else {
+		words = vec[1].iov_base;
+		dgram->words[0] = be32_to_cpu(words[0]);
+		dgram->words[1] = (vec[1].iov_len > 4) ? be32_to_cpu(words[1]) : 0;
+		dgram->words[2] = (vec[1].iov_len > 8) ? be32_to_cpu(words[2]) : 0;
+	}
+
+	return len;
+}
+
+static bool fake_queue_work(struct work_struct *work)
+{
+	if (work == &udp.resync_work)
+		resyncs_queued++;
+	return true;
+}
+
+static unsigned int gaps;
+static unsigned int duplicates;
+static unsigned int retransmits;
+static unsigned int overflows;
+static unsigned int delivered;
+static unsigned int acks;
+static __u32 last_ack;
+
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat)
+{
+	jstat_add(stats, stat, 1);
+}
+
+void jstat_add(struct jool_stats *stats, enum jool_stat_id stat, int addend)
+{
+	switch (stat) {
+	case JSTAT_JOOLD_GAPS:
+		gaps += addend;
+		break;
+	case JSTAT_JOOLD_DUPLICATES:
+		duplicates += addend;
+		break;
+	case JSTAT_JOOLD_RETRANSMITS:
+		retransmits += addend;
+		break;
+	case JSTAT_JOOLD_TX_OVERFLOW:
+		overflows += addend;
+		break;
+	default:
+		break;
+	}
+}
+
+void joold_sync_datagram(struct xlator *jool, void *payload, int len)
+{
+	delivered++;
+}
+
+void joold_resync(struct xlator *jool)
+{
+	/* Empty */
+}
+
+void joold_ack(struct xlator *jool, __u32 const *seq)
+{
+	acks++;
+	last_ack = *seq;
+}
+
+int xlator_find(struct net *ns, xlator_flags flags, const char *iname,
+		struct xlator *result)
+{
+	return 0;
+}
+
+void xlator_put(struct xlator *instance)
+{
+	/* Empty */
+}
+
+/********************** Helpers **********************/
+
+static int init(void)
+{
+	memset(&udp, 0, sizeof(udp));
+	udp.id = ME;
+	skb_queue_head_init(&udp.tx_queue);
+	spin_lock_init(&udp.rtx_lock);
+
+	sent_count = 0;
+	resyncs_queued = 0;
+	gaps = 0;
+	duplicates = 0;
+	retransmits = 0;
+	overflows = 0;
+	delivered = 0;
+	acks = 0;
+	last_ack = 0;
+	return 0;
+}
+
+static void clean(void)
+{
+	unsigned int i;
+
+	skb_queue_purge(&udp.tx_queue);
+	for (i = 0; i < RTX_RING_SIZE; i++)
+		if (udp.rtx[i])
+			consume_skb(udp.rtx[i]);
+}
+
+static bool assert_sent(unsigned int index, int type, __u32 word0,
+		__u32 word1, __u32 word2)
+{
+	struct sent_dgram *dgram;
+	bool success = true;
+
+	if (!ASSERT_BOOL(true, index < sent_count, "datagram %u exists", index))
+		return false;
+
+	dgram = &sent[index];
+	success &= ASSERT_INT(type, dgram->type, "datagram %u type", index);
+	success &= ASSERT_UINT(word0, dgram->words[0], "datagram %u word 0", index);
+	success &= ASSERT_UINT(word1, dgram->words[1], "datagram %u word 1", index);
+	success &= ASSERT_UINT(word2, dgram->words[2], "datagram %u word 2", index);
+	return success;
+}
+
+static bool track(__u32 id, __u32 seq)
+{
+	return track_seq(&udp, &jool, id, seq);
+}
+
+/*
+ * Queues @count datagrams, whose payloads (and batch numbers) are their own
+ * datagram numbers.
+ */
+static bool queue_datagrams(unsigned int count)
+{
+	struct sk_buff *skb;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		skb = alloc_skb(sizeof(__u32), GFP_KERNEL);
+		if (!skb)
+			return false;
+		*((__u32 *)skb_put(skb, sizeof(__u32))) = udp.next_seq + i;
+		joold_udp_send(&udp, &jool, skb, udp.next_seq + i);
+	}
+
+	return true;
+}
+
+static bool send_datagrams(unsigned int count)
+{
+	if (!queue_datagrams(count))
+		return false;
+	tx_work_fn(&udp.tx_work);
+	return true;
+}
+
+static void nack(__u32 sender, __u32 first, __u32 count)
+{
+	struct joold_udp_nack msg;
+
+	msg.sender = cpu_to_be32(sender);
+	msg.first = cpu_to_be32(first);
+	msg.count = cpu_to_be32(count);
+	handle_nack(&udp, &jool, &msg);
+}
+
+/********************** Tests **********************/
+
+static bool test_window(void)
+{
+	bool success = true;
+
+	/* Whatever came before the first datagram is not missing */
+	success &= ASSERT_BOOL(true, track(PEER, 10), "first");
+	success &= ASSERT_BOOL(true, track(PEER, 11), "in order");
+	success &= ASSERT_UINT(0, sent_count, "nothing to ask for");
+	success &= ASSERT_BOOL(false, track(PEER, 11), "duplicate");
+
+	/* 12, 13 and 14 are missing */
+	success &= ASSERT_BOOL(true, track(PEER, 15), "gap");
+	success &= ASSERT_UINT(3, gaps, "gap stat");
+	success &= ASSERT_UINT(1, sent_count, "NACK count");
+	success &= assert_sent(0, JNLAJ_NACK, PEER, 12, 3);
+
+	/* The resends fill the holes, in any order */
+	success &= ASSERT_BOOL(true, track(PEER, 13), "resend 13");
+	success &= ASSERT_BOOL(false, track(PEER, 13), "resend 13 again");
+	success &= ASSERT_BOOL(true, track(PEER, 12), "resend 12");
+	success &= ASSERT_BOOL(true, track(PEER, 14), "resend 14");
+	success &= ASSERT_BOOL(false, track(PEER, 15), "15 again");
+	success &= ASSERT_UINT(1, sent_count, "resends are not NACKed");
+
+	/* Too old to tell */
+	success &= ASSERT_BOOL(false, track(PEER, 15 - RTX_RING_SIZE),
+			"off the window");
+	success &= ASSERT_UINT(4, duplicates, "duplicate stat");
+
+	/* Other peers are tracked separately */
+	success &= ASSERT_BOOL(true, track(OTHER, 13), "other peer");
+	success &= ASSERT_BOOL(true, track(OTHER, 14), "other peer, in order");
+	success &= ASSERT_UINT(1, sent_count, "other peer in order");
+
+	/* The counter wraps around */
+	sent_count = 0;
+	success &= ASSERT_BOOL(true, track(WRAP, 0xFFFFFFFFu), "before wrap");
+	success &= ASSERT_BOOL(true, track(WRAP, 1), "after wrap");
+	success &= assert_sent(0, JNLAJ_NACK, WRAP, 0, 1);
+	success &= ASSERT_BOOL(true, track(WRAP, 0), "wrapped resend");
+	success &= ASSERT_BOOL(false, track(WRAP, 0xFFFFFFFFu), "wrapped dup");
+
+	return success;
+}
+
+static bool test_resync(void)
+{
+	bool success = true;
+
+	/* The peer's ring no longer has the missing datagrams */
+	track(PEER, 0);
+	success &= ASSERT_BOOL(true, track(PEER, 1 + RTX_RING_SIZE),
+			"huge gap");
+	success &= ASSERT_UINT(RTX_RING_SIZE, gaps, "huge gap stat");
+	success &= ASSERT_UINT(1, sent_count, "huge gap datagrams");
+	success &= assert_sent(0, JNLAJ_RESYNC, PEER, 0, 0);
+	/* The advertisement is on its way, but late arrivals are still welcome */
+	success &= ASSERT_BOOL(true, track(PEER, RTX_RING_SIZE), "late arrival");
+	success &= ASSERT_BOOL(false, track(PEER, RTX_RING_SIZE), "late dup");
+	success &= ASSERT_BOOL(true, track(PEER, 2 + RTX_RING_SIZE),
+			"back in order");
+	success &= ASSERT_UINT(1, sent_count, "back in order datagrams");
+
+	/* A hole is about to fall off the window: Last call for resends */
+	sent_count = 0;
+	track(OTHER, 100);
+	track(OTHER, 102);
+	success &= assert_sent(0, JNLAJ_NACK, OTHER, 101, 1);
+	/* 101 is now the oldest datagram in the window */
+	success &= ASSERT_BOOL(true, track(OTHER, 103 + RTX_RING_SIZE - 3),
+			"gap; 101 still in the window");
+	success &= ASSERT_UINT(2, sent_count, "no resync yet");
+	success &= assert_sent(1, JNLAJ_NACK, OTHER, 103, RTX_RING_SIZE - 3);
+
+	/* 101 falls off; only an advertisement can fill it now */
+	success &= ASSERT_BOOL(true, track(OTHER, 103 + RTX_RING_SIZE - 2),
+			"101 falls off");
+	success &= ASSERT_UINT(3, sent_count, "resync");
+	success &= assert_sent(2, JNLAJ_RESYNC, OTHER, 0, 0);
+
+	/* The advertisement covers the other holes too */
+	success &= ASSERT_BOOL(false, track(OTHER, 103), "late resend");
+	success &= ASSERT_UINT(3, sent_count, "single resync");
+
+	return success;
+}
+
+static bool test_ring(void)
+{
+	unsigned int i;
+	bool success = true;
+
+	if (!send_datagrams(RTX_RING_SIZE + 6))
+		return false;
+	success &= ASSERT_UINT(RTX_RING_SIZE + 6, sent_count, "sent");
+	for (i = 0; i < sent_count; i++)
+		success &= assert_sent(i, JNLAJ_SEQ, ME, i, i);
+	success &= ASSERT_UINT(RTX_RING_SIZE + 6, udp.next_seq, "next seq");
+
+	/* Resends keep their numbers */
+	sent_count = 0;
+	nack(ME, 60, 5);
+	success &= ASSERT_UINT(5, sent_count, "resends");
+	for (i = 0; i < 5; i++)
+		success &= assert_sent(i, JNLAJ_SEQ, ME, 60 + i, 60 + i);
+	success &= ASSERT_UINT(5, retransmits, "retransmit stat");
+	success &= ASSERT_UINT(0, resyncs_queued, "resends, resyncs");
+
+	/* Not ours */
+	sent_count = 0;
+	nack(OTHER, 60, 5);
+	success &= ASSERT_UINT(0, sent_count, "someone else's NACK");
+
+	/* Overwritten by datagrams 64 through 69 */
+	nack(ME, 4, 4);
+	success &= ASSERT_UINT(0, sent_count, "overwritten");
+	success &= ASSERT_UINT(1, resyncs_queued, "overwritten, resyncs");
+
+	/* Not sent yet */
+	nack(ME, RTX_RING_SIZE + 4, 5);
+	success &= ASSERT_UINT(2, sent_count, "future");
+	success &= assert_sent(0, JNLAJ_SEQ, ME, RTX_RING_SIZE + 4,
+			RTX_RING_SIZE + 4);
+	success &= assert_sent(1, JNLAJ_SEQ, ME, RTX_RING_SIZE + 5,
+			RTX_RING_SIZE + 5);
+	success &= ASSERT_UINT(2, resyncs_queued, "future, resyncs");
+
+	/* No more than the ring */
+	sent_count = 0;
+	nack(ME, 6, 1000);
+	success &= ASSERT_UINT(RTX_RING_SIZE, sent_count, "whole ring");
+	success &= assert_sent(RTX_RING_SIZE - 1, JNLAJ_SEQ, ME,
+			RTX_RING_SIZE + 5, RTX_RING_SIZE + 5);
+	success &= ASSERT_UINT(2, resyncs_queued, "whole ring, resyncs");
+
+	return success;
+}
+
+static bool test_ring_empty(void)
+{
+	bool success = true;
+
+	if (!send_datagrams(3))
+		return false;
+
+	/* Slots that were never used */
+	sent_count = 0;
+	nack(ME, 0xFFFFFFFFu - 2, 3);
+	success &= ASSERT_UINT(0, sent_count, "before the first datagram");
+	success &= ASSERT_UINT(1, resyncs_queued, "resyncs");
+
+	return success;
+}
+
+static bool test_backpressure(void)
+{
+	struct sk_buff *skb;
+	bool success = true;
+
+	/* Queued datagrams are not ACKed until they're sent */
+	if (!queue_datagrams(3))
+		return false;
+	success &= ASSERT_UINT(0, acks, "queued, ACKs");
+	tx_work_fn(&udp.tx_work);
+	success &= ASSERT_UINT(3, sent_count, "sent");
+	success &= ASSERT_UINT(1, acks, "sent, ACKs");
+	success &= ASSERT_UINT(2, last_ack, "sent, ACKed batch");
+
+	/* Nothing new to ACK */
+	tx_work_fn(&udp.tx_work);
+	success &= ASSERT_UINT(1, acks, "idle, ACKs");
+
+	/* Full queue: the datagram is dropped, but its number is spent */
+	sent_count = 0;
+	if (!queue_datagrams(TX_QUEUE_MAX))
+		return false;
+	skb = alloc_skb(sizeof(__u32), GFP_KERNEL);
+	if (!skb)
+		return false;
+	skb_put(skb, sizeof(__u32));
+	joold_udp_send(&udp, &jool, skb, 1000);
+	success &= ASSERT_UINT(1, overflows, "overflow stat");
+	success &= ASSERT_UINT(4, udp.next_seq, "spent number");
+
+	/* The peers will notice the gap, and the NACK will end in a resync */
+	nack(ME, 3, 1);
+	success &= ASSERT_UINT(0, sent_count, "dropped datagram resends");
+	success &= ASSERT_UINT(1, resyncs_queued, "dropped datagram resyncs");
+
+	tx_work_fn(&udp.tx_work);
+	success &= ASSERT_UINT(TX_QUEUE_MAX, sent_count, "queue sent");
+	success &= assert_sent(0, JNLAJ_SEQ, ME, 4, 3);
+	success &= ASSERT_UINT(2, acks, "overflow, ACKs");
+
+	return success;
+}
+
+static bool test_datagram(void)
+{
+	struct nlattr *attr;
+	struct joold_udp_resync *resync;
+	int len;
+	bool success = true;
+
+	/* A numbered datagram from a peer, with an empty payload */
+	attr = (struct nlattr *)udp.rx_buffer;
+	attr->nla_type = JNLAJ_SEQ;
+	attr->nla_len = nla_attr_size(sizeof(struct joold_udp_seq));
+	((struct joold_udp_seq *)nla_data(attr))->sender = cpu_to_be32(PEER);
+	((struct joold_udp_seq *)nla_data(attr))->seq = cpu_to_be32(5);
+	len = nla_total_size(sizeof(struct joold_udp_seq));
+
+	handle_datagram(&udp, &jool, len);
+	success &= ASSERT_UINT(1, delivered, "first delivery");
+	handle_datagram(&udp, &jool, len);
+	success &= ASSERT_UINT(1, delivered, "duplicate delivery");
+
+	/* A resync request for somebody else */
+	attr->nla_type = JNLAJ_RESYNC;
+	attr->nla_len = nla_attr_size(sizeof(*resync));
+	resync = nla_data(attr);
+	resync->sender = cpu_to_be32(OTHER);
+	len = nla_total_size(sizeof(*resync));
+	handle_datagram(&udp, &jool, len);
+	success &= ASSERT_UINT(0, resyncs_queued, "somebody else's resync");
+
+	/* A resync request for us */
+	resync->sender = cpu_to_be32(ME);
+	handle_datagram(&udp, &jool, len);
+	success &= ASSERT_UINT(1, resyncs_queued, "our resync");
+	success &= ASSERT_UINT(1, delivered, "control delivery");
+
+	return success;
+}
+
+/********************** Hooks **********************/
+
+static int joold_udp_test_init(void)
+{
+	struct test_group test = {
+		.name = "joold transport",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+	test_group_test(&test, test_window, "sequence window");
+	test_group_test(&test, test_resync, "resync escalation");
+	test_group_test(&test, test_ring, "retransmission ring");
+	test_group_test(&test, test_ring_empty, "unused ring slots");
+	test_group_test(&test, test_backpressure, "backpressure");
+	test_group_test(&test, test_datagram, "datagram handling");
+	return test_group_end(&test);
+}
+
+static void joold_udp_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(joold_udp_test_init);
+module_exit(joold_udp_test_exit);
@@ -3,8 +3,7 @@
 #include "mod/common/db/pool4/db.h"
 #include "framework/unit_test.h"
 
-int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
-		void const *args)
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr)
 {
 	return 0;
 }
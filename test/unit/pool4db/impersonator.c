@@ -27,8 +27,15 @@ verdict predict_route64(struct xlation *state)
 	return VERDICT_DROP;
 }
 
-int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
-		void const *args)
+__u8 ttp64_xlat_tos(struct jool_globals const *config,
+		struct ipv6hdr const *hdr)
 {
-	return broken_unit_call(__func__);
+	broken_unit_call(__func__);
+	return 0;
+}
+
+unsigned int ifa4_lookup(struct net *ns, struct in_addr const *addr)
+{
+	broken_unit_call(__func__);
+	return 0;
 }
@@ -0,0 +1,331 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <net/dst.h>
+#include <net/ip6_fib.h>
+#include <net/ip6_route.h>
+#include <net/route.h>
+
+#include "framework/unit_test.h"
+
+/*
+ * The FIB and the dst_entry API are replaced by the fakes below.
+ * (The kernel headers are already in, so only route_out.c's calls are
+ * renamed.)
+ */
+#define __ip_route_output_key fake_route4_output
+#define ip6_route_output fake_route6_output
+#define dst_check fake_dst_check
+#define dst_release fake_dst_release
+#define rt6_get_cookie fake_rt6_get_cookie
+
+static struct rtable *fake_route4_output(struct net *ns, struct flowi4 *flow);
+static struct dst_entry *fake_route6_output(struct net *ns,
+		struct sock const *sk, struct flowi6 *flow);
+static struct dst_entry *fake_dst_check(struct dst_entry *dst, u32 cookie);
+static void fake_dst_release(struct dst_entry *dst);
+static u32 fake_rt6_get_cookie(struct rt6_info const *rt);
+
+#include "mod/common/route_out.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Route cache test.");
+
+#define FAKE_ROUTES 4
+#define FAKE_SADDR4 cpu_to_be32(0xc0000201)
+
+static struct xlator jool;
+static struct net_device *dev;
+
+/* The FIB hands these out in order. */
+static struct rtable routes4[FAKE_ROUTES];
+static struct dst_entry routes6[FAKE_ROUTES];
+static unsigned int lookups4;
+static unsigned int lookups6;
+
+/* References held by somebody other than the test, and dst_check() results. */
+static int refs4[FAKE_ROUTES];
+static int refs6[FAKE_ROUTES];
+static bool valid4[FAKE_ROUTES];
+static bool valid6[FAKE_ROUTES];
+
+/********************** Mocks **********************/
+
+static struct rtable *fake_route4_output(struct net *ns, struct flowi4 *flow)
+{
+	unsigned int i;
+
+	if (lookups4 >= FAKE_ROUTES)
+		return ERR_PTR(-ENETUNREACH);
+
+	i = lookups4++;
+	refs4[i]++;
+	if (!flow->saddr)
+		flow->saddr = FAKE_SADDR4;
+	return &routes4[i];
+}
+
+static struct dst_entry *fake_route6_output(struct net *ns,
+		struct sock const *sk, struct flowi6 *flow)
+{
+	unsigned int i;
+
+	if (lookups6 >= FAKE_ROUTES)
+		return NULL;
+
+	i = lookups6++;
+	refs6[i]++;
+	return &routes6[i];
+}
+
+static bool *validity(struct dst_entry *dst)
+{
+	unsigned int i;
+
+	for (i = 0; i < FAKE_ROUTES; i++) {
+		if (dst == &routes4[i].dst)
+			return &valid4[i];
+		if (dst == &routes6[i])
+			return &valid6[i];
+	}
+
+	return NULL;
+}
+
+static struct dst_entry *fake_dst_check(struct dst_entry *dst, u32 cookie)
+{
+	bool *valid = validity(dst);
+
+	return (valid && *valid) ? dst : NULL;
+}
+
+static void fake_dst_release(struct dst_entry *dst)
+{
+	unsigned int i;
+
+	for (i = 0; i < FAKE_ROUTES; i++) {
+		if (dst == &routes4[i].dst)
+			refs4[i]--;
+		if (dst == &routes6[i])
+			refs6[i]--;
+	}
+}
+
+static u32 fake_rt6_get_cookie(struct rt6_info const *rt)
+{
+	return 0;
+}
+
+/********************** Helpers **********************/
+
+static int init(void)
+{
+	unsigned int i;
+
+	memset(routes4, 0, sizeof(routes4));
+	memset(routes6, 0, sizeof(routes6));
+	for (i = 0; i < FAKE_ROUTES; i++) {
+		routes4[i].dst.dev = dev;
+		routes6[i].dev = dev;
+		refs4[i] = 0;
+		refs6[i] = 0;
+		valid4[i] = true;
+		valid6[i] = true;
+	}
+	lookups4 = 0;
+	lookups6 = 0;
+
+	return 0;
+}
+
+static void clean(void)
+{
+	route_cache_flush(NULL);
+}
+
+static void init_flow4(struct flowi4 *flow, __be16 dport)
+{
+	memset(flow, 0, sizeof(*flow));
+	flow->flowi4_scope = RT_SCOPE_UNIVERSE;
+	flow->flowi4_proto = IPPROTO_UDP;
+	flow->daddr = cpu_to_be32(0xc6336401);
+	flow->fl4_sport = cpu_to_be16(1000);
+	flow->fl4_dport = dport;
+}
+
+static void init_flow6(struct flowi6 *flow, __be32 flowlabel)
+{
+	memset(flow, 0, sizeof(*flow));
+	flow->flowi6_scope = RT_SCOPE_UNIVERSE;
+	flow->flowi6_proto = IPPROTO_UDP;
+	flow->saddr.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	flow->saddr.s6_addr32[3] = cpu_to_be32(1);
+	flow->daddr.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	flow->daddr.s6_addr32[3] = cpu_to_be32(2);
+	flow->fl6_sport = cpu_to_be16(1000);
+	flow->fl6_dport = cpu_to_be16(2000);
+	flow->flowlabel = flowlabel;
+}
+
+static bool assert_route4(struct dst_entry *expected, __be16 dport, char *name)
+{
+	struct flowi4 flow;
+	struct dst_entry *dst;
+	bool noref;
+	bool success = true;
+
+	init_flow4(&flow, dport);
+
+	rcu_read_lock();
+	dst = route4(&jool, &flow, &noref, false);
+	success &= ASSERT_PTR(expected, dst, "%s: dst", name);
+	success &= ASSERT_BOOL(true, noref, "%s: borrowed", name);
+	success &= ASSERT_BE32(FAKE_SADDR4, flow.saddr, "%s: saddr", name);
+	route_put(dst, noref);
+	rcu_read_unlock();
+
+	return success;
+}
+
+static bool assert_route6(struct dst_entry *expected, __be32 flowlabel,
+		char *name)
+{
+	struct flowi6 flow;
+	struct dst_entry *dst;
+	bool noref;
+	bool success = true;
+
+	init_flow6(&flow, flowlabel);
+
+	rcu_read_lock();
+	dst = route6(&jool, &flow, &noref, false);
+	success &= ASSERT_PTR(expected, dst, "%s: dst", name);
+	success &= ASSERT_BOOL(true, noref, "%s: borrowed", name);
+	route_put(dst, noref);
+	rcu_read_unlock();
+
+	return success;
+}
+
+/********************** Tests **********************/
+
+static bool test_hit(void)
+{
+	bool success = true;
+
+	success &= assert_route4(&routes4[0].dst, cpu_to_be16(2000), "miss 4");
+	success &= assert_route4(&routes4[0].dst, cpu_to_be16(2000), "hit 4");
+	success &= ASSERT_UINT(1, lookups4, "FIB lookups 4");
+	/* The slot's reference is the only one; hits don't take more. */
+	success &= ASSERT_INT(1, refs4[0], "references 4");
+
+	success &= assert_route6(&routes6[0], 0, "miss 6");
+	success &= assert_route6(&routes6[0], 0, "hit 6");
+	success &= ASSERT_UINT(1, lookups6, "FIB lookups 6");
+	success &= ASSERT_INT(1, refs6[0], "references 6");
+
+	return success;
+}
+
+/* The multipath hash might send other flows elsewhere. */
+static bool test_flows(void)
+{
+	bool success = true;
+
+	success &= assert_route4(&routes4[0].dst, cpu_to_be16(2000), "port 1");
+	success &= assert_route4(&routes4[1].dst, cpu_to_be16(2001), "port 2");
+	success &= ASSERT_UINT(2, lookups4, "FIB lookups 4");
+
+	success &= assert_route6(&routes6[0], 0, "label 1");
+	success &= assert_route6(&routes6[1], cpu_to_be32(1), "label 2");
+	success &= ASSERT_UINT(2, lookups6, "FIB lookups 6");
+
+	return success;
+}
+
+static bool test_dst_check(void)
+{
+	bool success = true;
+
+	success &= assert_route4(&routes4[0].dst, cpu_to_be16(2000), "cached 4");
+	valid4[0] = false;
+	success &= assert_route4(&routes4[1].dst, cpu_to_be16(2000), "stale 4");
+	success &= ASSERT_UINT(2, lookups4, "FIB lookups 4");
+	success &= ASSERT_INT(0, refs4[0], "stale dst released 4");
+	success &= ASSERT_INT(1, refs4[1], "new dst cached 4");
+
+	success &= assert_route6(&routes6[0], 0, "cached 6");
+	valid6[0] = false;
+	success &= assert_route6(&routes6[1], 0, "stale 6");
+	success &= ASSERT_UINT(2, lookups6, "FIB lookups 6");
+	success &= ASSERT_INT(0, refs6[0], "stale dst released 6");
+	success &= ASSERT_INT(1, refs6[1], "new dst cached 6");
+
+	return success;
+}
+
+static bool test_netdev_event(void)
+{
+	struct netdev_notifier_info info = { .dev = dev };
+	bool success = true;
+
+	success &= assert_route4(&routes4[0].dst, cpu_to_be16(2000), "cached 4");
+	success &= assert_route6(&routes6[0], 0, "cached 6");
+
+	route_netdev_event(NULL, NETDEV_DOWN, &info);
+	success &= ASSERT_INT(0, refs4[0], "flushed 4");
+	success &= ASSERT_INT(0, refs6[0], "flushed 6");
+
+	success &= assert_route4(&routes4[1].dst, cpu_to_be16(2000), "after 4");
+	success &= assert_route6(&routes6[1], 0, "after 6");
+	return success;
+}
+
+/********************** Hooks **********************/
+
+static int setup(void)
+{
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	strscpy(dev->name, "fake0", sizeof(dev->name));
+	dev_net_set(dev, &init_net);
+
+	memset(&jool, 0, sizeof(jool));
+	jool.ns = &init_net;
+
+	return route_setup();
+}
+
+static void teardown(void)
+{
+	route_teardown();
+	kfree(dev);
+}
+
+static int route_test_init(void)
+{
+	struct test_group test = {
+		.name = "Route cache",
+		.setup_fn = setup,
+		.teardown_fn = teardown,
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+	test_group_test(&test, test_hit, "hit");
+	test_group_test(&test, test_flows, "separate flows");
+	test_group_test(&test, test_dst_check, "stale dst");
+	test_group_test(&test, test_netdev_event, "device down");
+	return test_group_end(&test);
+}
+
+static void route_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(route_test_init);
+module_exit(route_test_exit);
@@ -0,0 +1,262 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <net/dst.h>
+
+#include "framework/unit_test.h"
+
+/*
+ * The kernel's output path is replaced by the recorder below.
+ * (<net/dst.h> is already in, so only send_packet.c's call is renamed.)
+ */
+#define dst_output fake_dst_output
+
+static int fake_dst_output(struct net *net, struct sock *sk,
+		struct sk_buff *skb);
+
+#include "mod/common/steps/send_packet.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Packet sending test.");
+
+static struct xlation state; /* Too large for the stack. */
+static struct sendpkt_batch batch;
+static struct dst_entry dst;
+
+/* Marks of the packets that reached dst_output(), in order */
+static __u32 outputs[2 * SENDPKT_BATCH_MAX];
+static unsigned int output_count;
+/* dst_output() fails on the packet that has this mark. (U32_MAX = none) */
+static __u32 fail_mark;
+
+static unsigned int successes;
+static unsigned int output_errors;
+static unsigned int unknowns;
+
+/********************** Mocks **********************/
+
+static int fake_dst_output(struct net *net, struct sock *sk,
+		struct sk_buff *skb)
+{
+	__u32 mark = skb->mark;
+
+	if (output_count < ARRAY_SIZE(outputs))
+		outputs[output_count++] = mark;
+	kfree_skb(skb);
+	return (mark == fail_mark) ? -EINVAL : 0;
+}
+
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat)
+{
+	switch (stat) {
+	case JSTAT_SUCCESS:
+		successes++;
+		break;
+	case JSTAT_DST_OUTPUT:
+		output_errors++;
+		break;
+	case JSTAT_UNKNOWN:
+		unknowns++;
+		break;
+	default:
+		break;
+	}
+}
+
+verdict drop(struct xlation *state, enum jool_stat_id stat)
+{
+	jstat_inc(state->jool.stats, stat);
+	return VERDICT_DROP;
+}
+
+struct genl_family *jnl_family(void)
+{
+	return NULL;
+}
+
+/********************** Helpers **********************/
+
+static int init(void)
+{
+	memset(&state, 0, sizeof(state));
+	memset(&dst, 0, sizeof(dst));
+	sendpkt_batch_init(&batch);
+
+	output_count = 0;
+	fail_mark = U32_MAX;
+	successes = 0;
+	output_errors = 0;
+	unknowns = 0;
+	return 0;
+}
+
+static void clean(void)
+{
+	unsigned int i;
+
+	kfree_skb_list(state.out.skb);
+	for (i = 0; i < batch.count; i++)
+		kfree_skb_list(batch.trains[i]);
+}
+
+/*
+ * Builds a train of @len packets, marked @first, @first + 1, etc., and leaves
+ * it in @state.out.skb.
+ * If @routed is false, the last one has no dst.
+ */
+static bool build_train(__u32 first, unsigned int len, bool routed)
+{
+	struct sk_buff *skb;
+	struct sk_buff **next;
+	unsigned int i;
+
+	state.out.skb = NULL;
+	next = &state.out.skb;
+
+	for (i = 0; i < len; i++) {
+		skb = alloc_skb(0, GFP_KERNEL);
+		if (!skb) {
+			log_err("Could not allocate a test packet.");
+			return false;
+		}
+		skb->mark = first + i;
+		if (routed || i < len - 1)
+			skb->_skb_refdst = (unsigned long)&dst | SKB_DST_NOREF;
+		*next = skb;
+		next = &skb->next;
+	}
+
+	return true;
+}
+
+static verdict try_send(__u32 first, unsigned int len, bool routed)
+{
+	verdict result;
+
+	if (!build_train(first, len, routed))
+		return VERDICT_UNTRANSLATABLE;
+	result = sendpkt_send(&state);
+	state.out.skb = NULL; /* sendpkt_send() swallowed it */
+	return result;
+}
+
+static bool assert_outputs(__u32 const *expected, unsigned int count)
+{
+	unsigned int i;
+	bool success = true;
+
+	success &= ASSERT_UINT(count, output_count, "output count");
+	for (i = 0; i < min(count, output_count); i++)
+		success &= ASSERT_UINT(expected[i], outputs[i], "output %u", i);
+	return success;
+}
+
+/********************** Tests **********************/
+
+static bool test_immediate(void)
+{
+	__u32 const expected1[] = { 1, 2, 3 };
+	__u32 const expected2[] = { 1, 2, 3, 4, 5 };
+	bool success = true;
+
+	success &= ASSERT_VERDICT(CONTINUE, try_send(1, 3, true), "train");
+	success &= assert_outputs(expected1, ARRAY_SIZE(expected1));
+	success &= ASSERT_UINT(0, output_errors, "train errors");
+
+	/* The rest of the train is useless; don't send it */
+	fail_mark = 5;
+	success &= ASSERT_VERDICT(DROP, try_send(4, 4, true), "failed train");
+	success &= assert_outputs(expected2, ARRAY_SIZE(expected2));
+	success &= ASSERT_UINT(1, output_errors, "failed train errors");
+
+	/* Success is core's to count */
+	success &= ASSERT_UINT(0, successes, "successes");
+	return success;
+}
+
+static bool test_unrouted(void)
+{
+	bool success = true;
+
+	success &= ASSERT_VERDICT(DROP, try_send(1, 3, false), "verdict");
+	success &= ASSERT_UINT(0, output_count, "nothing sent");
+	success &= ASSERT_UINT(1, unknowns, "stat");
+	return success;
+}
+
+static bool test_batch(void)
+{
+	__u32 const expected[] = { 1, 2, 3, 5, 6 };
+	bool success = true;
+
+	state.batch = &batch;
+
+	success &= ASSERT_VERDICT(CONTINUE, try_send(1, 2, true), "train 1");
+	success &= ASSERT_VERDICT(CONTINUE, try_send(3, 2, true), "train 2");
+	success &= ASSERT_VERDICT(CONTINUE, try_send(5, 1, true), "train 3");
+	success &= ASSERT_VERDICT(CONTINUE, try_send(6, 1, true), "train 4");
+	success &= ASSERT_UINT(0, output_count, "queued, not sent");
+	success &= ASSERT_UINT(4, batch.count, "queued");
+
+	/* Train 2 dies in its first fragment */
+	fail_mark = 3;
+	sendpkt_flush(&state.jool, &batch);
+	success &= assert_outputs(expected, ARRAY_SIZE(expected));
+	success &= ASSERT_UINT(0, batch.count, "flushed");
+	success &= ASSERT_UINT(3, successes, "successes");
+	success &= ASSERT_UINT(1, output_errors, "errors");
+
+	return success;
+}
+
+static bool test_batch_full(void)
+{
+	unsigned int i;
+	bool success = true;
+
+	state.batch = &batch;
+
+	for (i = 0; i < SENDPKT_BATCH_MAX; i++)
+		success &= ASSERT_VERDICT(CONTINUE, try_send(i, 1, true), "%u", i);
+	success &= ASSERT_UINT(0, output_count, "full, not sent");
+
+	/* No room; the queued ones have to leave first */
+	success &= ASSERT_VERDICT(CONTINUE, try_send(i, 1, true), "overflow");
+	success &= ASSERT_UINT(SENDPKT_BATCH_MAX, output_count, "early flush");
+	success &= ASSERT_UINT(1, batch.count, "queued after flush");
+
+	sendpkt_flush(&state.jool, &batch);
+	success &= ASSERT_UINT(SENDPKT_BATCH_MAX + 1, output_count, "flush");
+	for (i = 0; i < output_count; i++)
+		success &= ASSERT_UINT(i, outputs[i], "order %u", i);
+	success &= ASSERT_UINT(SENDPKT_BATCH_MAX + 1, successes, "successes");
+
+	return success;
+}
+
+/********************** Hooks **********************/
+
+static int send_packet_test_init(void)
+{
+	struct test_group test = {
+		.name = "Send packet",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+	test_group_test(&test, test_immediate, "immediate send");
+	test_group_test(&test, test_unrouted, "missing route");
+	test_group_test(&test, test_batch, "batch");
+	test_group_test(&test, test_batch_full, "full batch");
+	return test_group_end(&test);
+}
+
+static void send_packet_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(send_packet_test_init);
+module_exit(send_packet_test_exit);
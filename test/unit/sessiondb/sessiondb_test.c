@@ -14,6 +14,9 @@ static struct xlator jool;
 static const l4_protocol PROTO = L4PROTO_UDP;
 static struct session_entry session_instances[16];
 static struct session_entry *sessions[4][4][4][4];
+/* Add the sessions with bib_add_sessions(), rather than bib_add_session()? */
+static bool bulk;
+static unsigned int collisions;
 
 int __rfc6052_4to6(struct ipv6_prefix const *prefix, struct in_addr const *src,
 		struct in6_addr *dst)
@@ -126,6 +129,9 @@ static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
 	entry->timeout = UDP_DEFAULT;
 	entry->has_stored = false;
 
+	if (bulk)
+		return true; /* See add_bulk() */
+
 	error = bib_add_session(&jool, entry, NULL);
 	if (error) {
 		log_err("Errcode %d on sessiontable_add.", error);
@@ -135,6 +141,31 @@ static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
 	return true;
 }
 
+static enum session_fate count_collision(struct session_entry *old,
+		void *arg)
+{
+	collisions++;
+	return FATE_PRESERVE;
+}
+
+/* Adds @session_instances in one go, backwards (so they need sorting). */
+static bool add_bulk(void)
+{
+	static struct bib_add_request reqs[ARRAY_SIZE(session_instances)];
+	unsigned int n = ARRAY_SIZE(session_instances);
+	unsigned int i;
+	bool success = true;
+
+	for (i = 0; i < n; i++)
+		reqs[i].session = session_instances[n - i - 1];
+
+	bib_add_sessions(&jool, reqs, n, count_collision);
+
+	for (i = 0; i < n; i++)
+		success &= ASSERT_INT(0, reqs[i].error, "bulk add #%u", i);
+	return success;
+}
+
 static bool insert_test_sessions(void)
 {
 	bool success = true;
@@ -158,6 +189,8 @@ static bool insert_test_sessions(void)
 	success &= inject(13, 1, 1, 1, 2);
 	success &= inject(14, 1, 2, 2, 1);
 	success &= inject(15, 2, 2, 2, 1);
+	if (bulk)
+		success &= add_bulk();
 
 	return success ? test_db() : false;
 }
@@ -257,6 +290,27 @@ static bool simple_session(void)
 	return success;
 }
 
+static bool bulk_session(void)
+{
+	bool success;
+
+	bulk = true;
+	collisions = 0;
+
+	success = insert_test_sessions();
+	success &= ASSERT_UINT(0, collisions, "first collisions");
+
+	/* Again; they all exist now. */
+	success &= add_bulk();
+	success &= ASSERT_UINT(ARRAY_SIZE(session_instances), collisions,
+			"second collisions");
+	success &= test_db();
+
+	bulk = false;
+	success &= flush();
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -286,6 +340,7 @@ static int sessiondb_test_init(void)
 		return -EINVAL;
 
 	test_group_test(&test, simple_session, "Single Session");
+	test_group_test(&test, bulk_session, "Bulk Session");
 
 	return test_group_end(&test);
 }
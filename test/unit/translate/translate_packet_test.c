@@ -15,7 +15,8 @@ MODULE_DESCRIPTION("Translating the Packet module test.");
 
 xlator_type xlator_get_type(struct xlator const *instance)
 {
-	return XT_SIIT;
+	/* Most tests don't bother initializing the instance; those are SIIT. */
+	return xlator_is_nat64(instance) ? XT_NAT64 : XT_SIIT;
 }
 
 static bool test_function_has_unexpired_src_route(void)
@@ -347,6 +348,409 @@ static bool test_function_icmp4_minimum_mtu(void)
 	return success;
 }
 
+static bool test_function_needs_segmentation(void)
+{
+	struct xlation state;
+	struct sk_buff *skb;
+	struct skb_shared_info *shinfo;
+	bool success = true;
+
+	xlation_init(&state, NULL);
+	if (globals_init(&state.jool.globals, XT_SIIT, NULL))
+		return false;
+	state.jool.globals.lowest_ipv6_mtu = 1280;
+
+	if (create_skb4_udp("192.0.2.1", 1234, "198.51.100.1", 4321, 14000, 64,
+			&skb))
+		return false;
+	if (pkt_init_ipv4(&state, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	success &= ASSERT_BOOL(false, xlat_needs_segmentation(&state),
+			"Not GSO");
+
+	shinfo = skb_shinfo(skb);
+	shinfo->gso_type = SKB_GSO_UDP_L4;
+	shinfo->gso_size = 1400;
+	shinfo->gso_segs = 10;
+	success &= ASSERT_BOOL(false, xlat_needs_segmentation(&state),
+			"DF enabled");
+
+	pkt_ip4_hdr(&state.in)->frag_off = build_ipv4_frag_off_field(0, 0, 0);
+	success &= ASSERT_BOOL(true, xlat_needs_segmentation(&state),
+			"Datagrams exceed LIM");
+
+	shinfo->gso_size = 1280 - 48;
+	success &= ASSERT_BOOL(false, xlat_needs_segmentation(&state),
+			"Datagrams fit LIM");
+	shinfo->gso_size = 1280 - 47;
+	success &= ASSERT_BOOL(true, xlat_needs_segmentation(&state),
+			"Datagrams exceed LIM by one");
+
+	shinfo->gso_size = 0;
+	kfree_skb(skb);
+	return success;
+}
+
+static bool test_function_xlat_gso(void)
+{
+	struct xlation state;
+	struct sk_buff *skb;
+	struct skb_shared_info *shinfo;
+	bool success = true;
+
+	xlation_init(&state, NULL);
+	if (create_skb6_tcp("2001:db8::1", 1234, "2001:db8::2", 4321, 10000, 64,
+			&skb))
+		return false;
+	if (pkt_init_ipv6(&state, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	shinfo = skb_shinfo(skb);
+	shinfo->gso_type = SKB_GSO_TCPV4 | SKB_GSO_TCP_FIXEDID | SKB_GSO_DODGY;
+	shinfo->gso_size = 1000;
+	shinfo->gso_segs = 10;
+
+	xlat_gso(&state.in, 0);
+	success &= ASSERT_UINT(SKB_GSO_TCPV6 | SKB_GSO_DODGY, shinfo->gso_type,
+			"4->6 type");
+	success &= ASSERT_UINT(1000, shinfo->gso_size, "Untouched size");
+	success &= ASSERT_UINT(10, shinfo->gso_segs, "Untouched segs");
+
+	xlat_gso(&state.in, 980);
+	success &= ASSERT_UINT(980, shinfo->gso_size, "Shrunk size");
+	success &= ASSERT_UINT(11, shinfo->gso_segs, "Shrunk segs");
+
+	shinfo->gso_size = 0;
+	kfree_skb(skb);
+	return success;
+}
+
+/*
+ * The xlat-in-place tests translate every packet twice: Once through the copy
+ * path, and once with xlat-in-place enabled. Both results are supposed to be
+ * identical.
+ *
+ * They use NAT64 so the addresses and ports come from the tuple, rather than
+ * the (impersonated) SIIT databases.
+ */
+
+static struct xlator nat64; /* Too large for the stack. */
+static struct xlation copy_state;
+static struct xlation in_place_state;
+
+typedef int (*build_fn)(struct sk_buff **);
+
+static bool hairpin;
+
+static bool is_hairpin_mock(struct xlation *state)
+{
+	return hairpin;
+}
+
+static int init_nat64(void)
+{
+	struct ipv6_prefix pool6;
+	int error;
+
+	memset(&nat64, 0, sizeof(nat64));
+	nat64.ns = &init_net;
+	nat64.flags = XT_NAT64;
+	nat64.is_hairpin = is_hairpin_mock;
+	hairpin = false;
+
+	error = str_to_addr6("64:ff9b::", &pool6.addr);
+	if (error)
+		return error;
+	pool6.len = 96;
+
+	return globals_init(&nat64.globals, XT_NAT64, &pool6);
+}
+
+static int tcp64(struct sk_buff **skb)
+{
+	return create_skb6_tcp("2001:db8::1", 1234, "64:ff9b::c000:202", 80,
+			100, 32, skb);
+}
+
+static int udp64(struct sk_buff **skb)
+{
+	return create_skb6_udp("2001:db8::1", 1234, "64:ff9b::c000:202", 80,
+			100, 32, skb);
+}
+
+static int icmperr64(struct sk_buff **skb)
+{
+	return create_skb6_icmp_error("2001:db8::1", "64:ff9b::c000:202",
+			100, 32, skb);
+}
+
+static int tcp46(struct sk_buff **skb)
+{
+	return create_skb4_tcp("192.0.2.2", 80, "192.0.2.1", 5000, 100, 32,
+			skb);
+}
+
+static int udp46(struct sk_buff **skb)
+{
+	return create_skb4_udp("192.0.2.2", 80, "192.0.2.1", 5000, 100, 32,
+			skb);
+}
+
+static int icmperr46(struct sk_buff **skb)
+{
+	return create_skb4_icmp_error("192.0.2.2", "192.0.2.1", 100, 32, skb);
+}
+
+/* Same as udp46(), except the IPv6 header cannot grow into the headroom. */
+static int udp46_no_headroom(struct sk_buff **skb)
+{
+	struct sk_buff *tmp;
+	int error;
+
+	error = udp46(&tmp);
+	if (error)
+		return error;
+
+	*skb = skb_copy_expand(tmp, 0, 0, GFP_KERNEL);
+	kfree_skb(tmp);
+	if (!*skb)
+		return -ENOMEM;
+	if (skb_headroom(*skb) != 0) {
+		log_err("skb_copy_expand() left %u bytes of headroom.",
+				skb_headroom(*skb));
+		kfree_skb(*skb);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static bool xlat(struct xlation *state, build_fn build,
+		struct tuple const *tuple, bool in_place)
+{
+	struct sk_buff *skb;
+	verdict result;
+
+	nat64.globals.xlat_in_place = in_place;
+	xlation_init(state, &nat64);
+	state->out.tuple = *tuple;
+
+	if (build(&skb))
+		return false;
+	state->in.skb = skb; /* release() will free it. */
+
+	result = (ntohs(skb->protocol) == ETH_P_IPV6)
+			? pkt_init_ipv6(state, skb)
+			: pkt_init_ipv4(state, skb);
+	if (!ASSERT_VERDICT(CONTINUE, result, "pkt_init()"))
+		return false;
+
+	return ASSERT_VERDICT(CONTINUE, translating_the_packet(state),
+			"translating_the_packet()");
+}
+
+static void release(struct xlation *state)
+{
+	if (state->out.skb && !xlation_in_place(state))
+		kfree_skb_list(state->out.skb);
+	kfree_skb(state->in.skb);
+	state->in.skb = NULL;
+	state->out.skb = NULL;
+}
+
+/*
+ * Translated IPv4 headers carry random identifications, so the bytes that
+ * depend on them cannot be compared. Their checksums are validated instead.
+ */
+static bool validate_ipv4_csums(struct packet *out)
+{
+	struct iphdr *hdr4;
+	unsigned int l4_len;
+	bool success = true;
+
+	hdr4 = pkt_ip4_hdr(out);
+	success &= ASSERT_UINT(0, (__force __u16)ip_fast_csum(hdr4, hdr4->ihl),
+			"IPv4 header checksum");
+
+	if (pkt_l4_proto(out) == L4PROTO_ICMP) {
+		l4_len = out->skb->len - (hdr4->ihl << 2);
+		success &= ASSERT_UINT(0, (__force __u16)csum_fold(skb_checksum(
+				out->skb, hdr4->ihl << 2, l4_len, 0)),
+				"ICMPv4 checksum");
+	}
+
+	return success;
+}
+
+/*
+ * @expected_in_place: Whether the second translation is supposed to actually
+ * happen in place, or fall back to the copy path.
+ * @skip: Offsets of the bytes that are allowed to differ.
+ */
+static bool test_in_place(build_fn build, struct tuple const *tuple,
+		bool expected_in_place,
+		unsigned int const *skip, unsigned int skip_count)
+{
+	struct sk_buff *copy;
+	struct sk_buff *in_place;
+	unsigned char *copy_bytes = NULL;
+	unsigned char *in_place_bytes = NULL;
+	unsigned int i, s;
+	bool success = true;
+
+	if (!xlat(&copy_state, build, tuple, false)
+			|| !xlat(&in_place_state, build, tuple, true)) {
+		success = false;
+		goto end;
+	}
+
+	success &= ASSERT_BOOL(false, xlation_in_place(&copy_state),
+			"Copy path reused the packet");
+	success &= ASSERT_BOOL(expected_in_place,
+			xlation_in_place(&in_place_state),
+			"Translated in place");
+
+	copy = copy_state.out.skb;
+	in_place = in_place_state.out.skb;
+	success &= ASSERT_NULL(copy->next, "Copy path fragmented");
+	success &= ASSERT_NULL(in_place->next, "In place fragmented");
+	success &= ASSERT_UINT(copy->len, in_place->len, "Length");
+	if (!success)
+		goto end;
+
+	copy_bytes = kmalloc(copy->len, GFP_KERNEL);
+	in_place_bytes = kmalloc(in_place->len, GFP_KERNEL);
+	if (!copy_bytes || !in_place_bytes) {
+		log_err("Cannot allocate the comparison buffers.");
+		success = false;
+		goto end;
+	}
+	if (skb_copy_bits(copy, 0, copy_bytes, copy->len)
+			|| skb_copy_bits(in_place, 0, in_place_bytes,
+					in_place->len)) {
+		log_err("skb_copy_bits() failed.");
+		success = false;
+		goto end;
+	}
+
+	for (i = 0; i < copy->len; i++) {
+		for (s = 0; s < skip_count; s++)
+			if (skip[s] == i)
+				break;
+		if (s < skip_count)
+			continue;
+		if (copy_bytes[i] != in_place_bytes[i]) {
+			log_err("Byte %u differs. Copy: 0x%02x; in place: 0x%02x",
+					i, copy_bytes[i], in_place_bytes[i]);
+			success = false;
+			break;
+		}
+	}
+
+	if (pkt_l3_proto(&in_place_state.out) == L3PROTO_IPV4) {
+		success &= validate_ipv4_csums(&copy_state.out);
+		success &= validate_ipv4_csums(&in_place_state.out);
+	}
+	/* Fall through */
+
+end:
+	kfree(copy_bytes);
+	kfree(in_place_bytes);
+	release(&copy_state);
+	release(&in_place_state);
+	return success;
+}
+
+/* Identification and header checksum. */
+static const unsigned int ID_BYTES[] = { 4, 5, 10, 11 };
+/* Same, plus the ICMP checksum and the inner packet's. */
+static const unsigned int ICMP_ID_BYTES[] = { 4, 5, 10, 11, 22, 23,
+		32, 33, 38, 39 };
+
+static bool test_xlat_in_place64(void)
+{
+	struct tuple tuple;
+	bool success = true;
+
+	if (init_nat64())
+		return false;
+
+	if (init_tuple4(&tuple, "192.0.2.1", 5000, "192.0.2.2", 80,
+			L4PROTO_TCP))
+		return false;
+	success &= test_in_place(tcp64, &tuple, true,
+			ID_BYTES, ARRAY_SIZE(ID_BYTES));
+	success &= test_in_place(icmperr64, &tuple, false,
+			ICMP_ID_BYTES, ARRAY_SIZE(ICMP_ID_BYTES));
+
+	tuple.l4_proto = L4PROTO_UDP;
+	success &= test_in_place(udp64, &tuple, true,
+			ID_BYTES, ARRAY_SIZE(ID_BYTES));
+
+	return success;
+}
+
+static bool test_xlat_in_place46(void)
+{
+	struct tuple tuple;
+	bool success = true;
+
+	if (init_nat64())
+		return false;
+
+	if (init_tuple6(&tuple, "64:ff9b::c000:202", 80, "2001:db8::1", 1234,
+			L4PROTO_TCP))
+		return false;
+	success &= test_in_place(tcp46, &tuple, true, NULL, 0);
+	success &= test_in_place(icmperr46, &tuple, false, NULL, 0);
+
+	tuple.l4_proto = L4PROTO_UDP;
+	success &= test_in_place(udp46, &tuple, true, NULL, 0);
+	success &= test_in_place(udp46_no_headroom, &tuple, false, NULL, 0);
+
+	return success;
+}
+
+/*
+ * The first leg of a hairpin has to leave the original packet alone, because
+ * the second leg might store it. (eg. A TCP SYN, in the simultaneous open
+ * queue.)
+ */
+static bool test_xlat_in_place_hairpin(void)
+{
+	struct tuple tuple;
+	bool success = true;
+
+	if (init_nat64())
+		return false;
+	hairpin = true;
+
+	if (init_tuple4(&tuple, "192.0.2.1", 5000, "192.0.2.2", 80,
+			L4PROTO_TCP))
+		return false;
+	if (!xlat(&in_place_state, tcp64, &tuple, true)) {
+		release(&in_place_state);
+		return false;
+	}
+
+	success &= ASSERT_BOOL(true, pkt_tcp_hdr(&in_place_state.in)->syn,
+			"Incoming packet is a SYN");
+	success &= ASSERT_BOOL(false, xlation_in_place(&in_place_state),
+			"Translated in place");
+	success &= ASSERT_UINT(6, ipv6_hdr(in_place_state.in.skb)->version,
+			"Incoming packet is still IPv6");
+	success &= ASSERT_BE16(ETH_P_IPV6, in_place_state.in.skb->protocol,
+			"Incoming packet's protocol");
+
+	release(&in_place_state);
+	return success;
+}
+
 static int translate_packet_test_init(void)
 {
 	struct test_group test = {
@@ -365,6 +769,11 @@ static int translate_packet_test_init(void)
 	test_group_test(&test, test_function_build_protocol_field, "Build protocol function");
 	test_group_test(&test, test_function_has_nonzero_segments_left, "Segments left indicator function");
 	test_group_test(&test, test_function_icmp4_minimum_mtu, "ICMP4 Minimum MTU function");
+	test_group_test(&test, test_function_needs_segmentation, "GSO segmentation decider");
+	test_group_test(&test, test_function_xlat_gso, "GSO metadata translation");
+	test_group_test(&test, test_xlat_in_place64, "In-place translation, 6->4");
+	test_group_test(&test, test_xlat_in_place46, "In-place translation, 4->6");
+	test_group_test(&test, test_xlat_in_place_hairpin, "In-place translation, hairpin");
 
 	return test_group_end(&test);
 }